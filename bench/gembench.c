@@ -0,0 +1,500 @@
+/*
+ * Copyright (c) 2012, Novell Inc.
+ *
+ * This program is licensed under the BSD license, read LICENSE.BSD
+ * for further information
+ *
+ * gembench: times the stages of turning gems into solv data.
+ *
+ * Every gem goes through the stages one after the other, each one
+ * starting from the output of the previous one, so the time of a
+ * stage does not include the others:
+ *
+ *   tar          find metadata.gz in the archive and read it
+ *   inflate      gunzip metadata.gz (libdeflate or zlib, as built)
+ *   yaml         parse the metadata, no callbacks
+ *   callbacks    feed the parsed gem to the rubygems2solv callbacks
+ *   internalize  end of parse and repodata_internalize of the whole
+ *                repo
+ *   write        tool_write of the whole repo
+ *
+ * "end-to-end" is the plain gem_parse_add_rubygem path with the
+ * rubygems2solv callbacks, for comparison with the sum of the stages.
+ *
+ * The gems of a metadata corpus (gemdump --capture) start at the yaml
+ * stage, and their end-to-end is the replay of the parser.
+ *
+ * The heap allocations of every stage are counted by wrapping glibc's
+ * malloc, calloc and realloc, including those of zlib and libyaml.
+ * Those of the yaml stage are libyaml's for every scalar, tag and
+ * anchor; the parser itself is reused like everything else.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include <solv/pool.h>
+#include <solv/repo.h>
+#include "common_write.h"
+
+#include "rubygems_parser.h"
+#include "gem_record.h"
+#include "gem_solv.h"
+#include "gem_tar.h"
+#include "gem_inflate.h"
+#include "gem_corpus.h"
+
+enum {
+    STAGE_TAR,
+    STAGE_INFLATE,
+    STAGE_YAML,
+    STAGE_CALLBACKS,
+    STAGE_INTERNALIZE,
+    STAGE_WRITE,
+    STAGE_END_TO_END,
+    NSTAGES
+};
+
+static const char *stage_names[NSTAGES] = {
+    "tar", "inflate", "yaml", "callbacks", "internalize", "write", "end-to-end"
+};
+
+typedef struct Stage
+{
+    double *samples;    /* seconds */
+    int nsamples;
+    int alloc;
+    unsigned long long bytes;
+    unsigned long long gems;
+    unsigned long long allocs;
+} Stage;
+
+static Stage stages[NSTAGES];
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long long nallocs;
+
+void *malloc(size_t size)
+{
+    nallocs++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+    nallocs++;
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    nallocs++;
+    return __libc_realloc(ptr, size);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* allocs is the value of nallocs at the start of the stage */
+static void stage_add(int stage, double t, unsigned long long bytes, int gems, unsigned long long allocs)
+{
+    Stage *st = stages + stage;
+    st->allocs += nallocs - allocs;
+    if (st->nsamples == st->alloc) {
+        st->alloc = st->alloc * 2 + 1024;
+        st->samples = realloc(st->samples, st->alloc * sizeof(double));
+    }
+    st->samples[st->nsamples++] = t;
+    st->bytes += bytes;
+    st->gems += gems;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile(const Stage *st, double p)
+{
+    int i = (int) (p * (st->nsamples - 1) + 0.5);
+    return st->samples[i];
+}
+
+static void report(void)
+{
+    Stage *st;
+    double total;
+    int i, j;
+
+    printf("%-12s %8s %10s %12s %10s %10s %10s %10s %10s %10s\n",
+           "stage", "samples", "total ms", "gems/s", "MB/s", "p50 us", "p90 us", "p99 us", "max us", "allocs/gem");
+    for (i = 0; i < NSTAGES; i++) {
+        st = stages + i;
+        if (!st->nsamples)
+            continue;
+        qsort(st->samples, st->nsamples, sizeof(double), cmp_double);
+        for (total = 0, j = 0; j < st->nsamples; j++)
+            total += st->samples[j];
+        printf("%-12s %8d %10.1f %12.0f %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+               stage_names[i], st->nsamples, total * 1e3,
+               total > 0 ? st->gems / total : 0, total > 0 ? st->bytes / total / 1e6 : 0,
+               percentile(st, 0.5) * 1e6, percentile(st, 0.9) * 1e6,
+               percentile(st, 0.99) * 1e6, st->samples[st->nsamples - 1] * 1e6,
+               st->gems ? (double) st->allocs / st->gems : 0);
+    }
+}
+
+static void bench_error(void *user_data, const char *msg)
+{
+    fprintf(stderr, "%s\n", msg);
+}
+
+typedef struct Buf
+{
+    unsigned char *buf;
+    size_t len;
+    size_t alloc;
+} Buf;
+
+static void buf_reserve(Buf *b, size_t len)
+{
+    if (len > b->alloc) {
+        b->alloc = len * 2;
+        b->buf = realloc(b->buf, b->alloc);
+    }
+}
+
+static int stage_tar(const char *path, Buf *member)
+{
+    struct stat st;
+    off_t offset, size;
+    unsigned long long a = nallocs;
+    double t = now();
+    int fd, ret;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return -1;
+    ret = gem_tar_find(fd, "metadata.gz", &offset, &size);
+    if (ret == 1) {
+        buf_reserve(member, size);
+        member->len = size;
+        if (pread(fd, member->buf, size, offset) != size)
+            ret = -1;
+    }
+    fstat(fd, &st);
+    close(fd);
+    if (ret != 1)
+        return -1;
+    stage_add(STAGE_TAR, now() - t, st.st_size, 1, a);
+    return 0;
+}
+
+/* like the parser: one inflater for all gems, the output sized from
+   the gzip trailer */
+static int stage_inflate(GemInflater *inf, const Buf *member, Buf *yaml)
+{
+    unsigned long long a = nallocs;
+    double t = now();
+    const char *error;
+    long isize, len;
+
+    if ((isize = gem_gzip_isize(member->buf, member->len)) < 0)
+        return -1;
+    buf_reserve(yaml, isize + 1);
+    if ((len = gem_inflater_gunzip(inf, member->buf, member->len, yaml->buf, isize, &error)) < 0) {
+        fprintf(stderr, "metadata.gz: %s\n", error);
+        return -1;
+    }
+    yaml->len = len;
+    stage_add(STAGE_INFLATE, now() - t, member->len, 1, a);
+    return 0;
+}
+
+static int stage_yaml(ParseContext *ctx, const Buf *yaml)
+{
+    unsigned long long a = nallocs;
+    double t;
+    int ret;
+
+    t = now();
+    ret = gem_parse_add_metadata(ctx, (const char *) yaml->buf, yaml->len);
+    t = now() - t;
+    if (ret)
+        return -1;
+    stage_add(STAGE_YAML, t, yaml->len, 1, a);
+    return 0;
+}
+
+static int stage_callbacks(const char *path, const Buf *yaml, GemRecord *rec, ParseContext *solvctx)
+{
+    ParseContext rctx;
+    unsigned long long a;
+    double t;
+    int ret;
+
+    /* record the events untimed, replay them into the pool timed */
+    gem_record_reset(rec);
+    gem_record_context(&rctx, rec, solvctx);
+    rctx.gem_start_callback(rctx.data, path);
+    ret = gem_parse_add_metadata(&rctx, (const char *) yaml->buf, yaml->len);
+    rctx.gem_end_callback(rctx.data);
+    gem_parse_context_free(&rctx);
+    if (ret)
+        return -1;
+    a = nallocs;
+    t = now();
+    ret = gem_record_replay(rec, solvctx);
+    stage_add(STAGE_CALLBACKS, now() - t, yaml->len, 1, a);
+    return ret;
+}
+
+/* the yaml and callbacks stages of the gems of a corpus, returns
+   the number of gems that went through */
+static int corpus_stages(const char *path, ParseContext *yctx, GemRecord *rec, ParseContext *solvctx)
+{
+    GemCorpus *corpus = gem_corpus_open(path);
+    const char *location, *metadata;
+    Buf yaml;
+    int i, len, ngems = 0;
+
+    if (!corpus) {
+        perror(path);
+        return 0;
+    }
+    memset(&yaml, 0, sizeof(yaml));
+    for (i = 0; i < gem_corpus_count(corpus); i++) {
+        location = gem_corpus_entry(corpus, i, &metadata, &len);
+        yaml.buf = (unsigned char *) metadata;
+        yaml.len = len;
+        if (stage_yaml(yctx, &yaml) || stage_callbacks(location, &yaml, rec, solvctx)) {
+            fprintf(stderr, "%s: %s: skipped\n", path, location);
+            continue;
+        }
+        ngems++;
+    }
+    gem_corpus_close(corpus);
+    return ngems;
+}
+
+/* tool_write writes to stdout, send that to a temporary file */
+static void stage_write(Repo *repo, int ngems)
+{
+    struct stat st;
+    FILE *tmp = tmpfile();
+    unsigned long long a;
+    int saved;
+    double t;
+
+    fflush(stdout);
+    saved = dup(1);
+    dup2(fileno(tmp), 1);
+    a = nallocs;
+    t = now();
+    tool_write(repo, 0, 0);
+    fflush(stdout);
+    t = now() - t;
+    dup2(saved, 1);
+    close(saved);
+    fstat(fileno(tmp), &st);
+    fclose(tmp);
+    stage_add(STAGE_WRITE, t, st.st_size, ngems, a);
+}
+
+static void run_stages(char **paths, int npaths)
+{
+    Pool *pool = pool_create();
+    Repo *repo = repo_create(pool, "rubygems");
+    Repodata *data = repo_add_repodata(repo, 0);
+    ParseContext pctx, yctx;
+    SolvContext sctx;
+    GemRecord rec;
+    Buf member, yaml;
+    GemInflater *inf = gem_inflater_new();
+    unsigned long long a;
+    double t;
+    int i, ngems = 0;
+
+    memset(&member, 0, sizeof(member));
+    memset(&yaml, 0, sizeof(yaml));
+    gem_record_init(&rec);
+    gem_parse_context_initialize(&yctx);
+    yctx.gem_parse_error_callback = bench_error;
+    gem_parse_context_initialize(&pctx);
+    gem_solv_context_setup(&sctx, &pctx, repo, data);
+
+    for (i = 0; i < npaths; i++) {
+        if (gem_is_corpus(paths[i])) {
+            ngems += corpus_stages(paths[i], &yctx, &rec, &pctx);
+            continue;
+        }
+        if (stage_tar(paths[i], &member) || stage_inflate(inf, &member, &yaml) || stage_yaml(&yctx, &yaml)
+            || stage_callbacks(paths[i], &yaml, &rec, &pctx)) {
+            fprintf(stderr, "%s: skipped\n", paths[i]);
+            continue;
+        }
+        ngems++;
+    }
+
+    a = nallocs;
+    t = now();
+    pctx.gem_parse_end_callback(pctx.data);
+    repodata_internalize(data);
+    stage_add(STAGE_INTERNALIZE, now() - t, 0, ngems, a);
+    stage_write(repo, ngems);
+
+    gem_inflater_free(inf);
+    gem_record_free(&rec);
+    gem_solv_context_free(&sctx);
+    gem_parse_context_free(&pctx);
+    gem_parse_context_free(&yctx);
+    free(member.buf);
+    free(yaml.buf);
+    pool_free(pool);
+}
+
+/* what gem_parse_add_corpus does for each gem */
+static void corpus_end_to_end(const char *path, ParseContext *pctx)
+{
+    GemCorpus *corpus = gem_corpus_open(path);
+    const char *location, *metadata;
+    unsigned long long a;
+    double t;
+    int i, len;
+
+    if (!corpus)
+        return;
+    for (i = 0; i < gem_corpus_count(corpus); i++) {
+        location = gem_corpus_entry(corpus, i, &metadata, &len);
+        a = nallocs;
+        t = now();
+        pctx->gem_start_callback(pctx->data, location);
+        pctx->gem_location_callback(pctx->data, location);
+        gem_parse_add_metadata(pctx, metadata, len);
+        pctx->gem_end_callback(pctx->data);
+        stage_add(STAGE_END_TO_END, now() - t, len, 1, a);
+    }
+    gem_corpus_close(corpus);
+}
+
+static void run_end_to_end(char **paths, int npaths)
+{
+    Pool *pool = pool_create();
+    Repo *repo = repo_create(pool, "rubygems");
+    Repodata *data = repo_add_repodata(repo, 0);
+    ParseContext pctx;
+    SolvContext sctx;
+    struct stat st;
+    unsigned long long a;
+    double t;
+    int i;
+
+    gem_parse_context_initialize(&pctx);
+    gem_solv_context_setup(&sctx, &pctx, repo, data);
+    for (i = 0; i < npaths; i++) {
+        if (gem_is_corpus(paths[i])) {
+            corpus_end_to_end(paths[i], &pctx);
+            continue;
+        }
+        if (stat(paths[i], &st))
+            continue;
+        a = nallocs;
+        t = now();
+        gem_parse_add_rubygem(&pctx, paths[i]);
+        stage_add(STAGE_END_TO_END, now() - t, st.st_size, 1, a);
+    }
+    gem_solv_context_free(&sctx);
+    gem_parse_context_free(&pctx);
+    pool_free(pool);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage:\n%s [options] <dir|gem|metadata corpus> ...\n", prog);
+    fprintf(stderr, "Times the stages of converting the gems, see gemcorpus for a corpus.\n");
+    fprintf(stderr, "The gems of a metadata corpus (gemdump --capture) start at the yaml stage.\n");
+    fprintf(stderr, "options: -r N : run N times (default 3), samples of all runs are reported.\n");
+}
+
+int main(int argc, char **argv)
+{
+    glob_t g;
+    struct stat st;
+    char **paths = 0;
+    int npaths = 0;
+    int c, i, runs = 3;
+    size_t k;
+    char *pattern;
+
+    while ((c = getopt(argc, argv, "hr:")) >= 0) {
+        switch (c) {
+        case 'r':
+            runs = atoi(optarg);
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(0);
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    for (i = optind; i < argc; i++) {
+        if (stat(argv[i], &st)) {
+            perror(argv[i]);
+            exit(1);
+        }
+        if (!S_ISDIR(st.st_mode)) {
+            paths = realloc(paths, (npaths + 1) * sizeof(char *));
+            paths[npaths++] = strdup(argv[i]);
+            continue;
+        }
+        pattern = malloc(strlen(argv[i]) + 7);
+        sprintf(pattern, "%s/*.gem", argv[i]);
+        if (glob(pattern, 0, 0, &g) == 0) {
+            paths = realloc(paths, (npaths + g.gl_pathc) * sizeof(char *));
+            for (k = 0; k < g.gl_pathc; k++)
+                paths[npaths++] = strdup(g.gl_pathv[k]);
+            globfree(&g);
+        }
+        free(pattern);
+    }
+    if (!npaths) {
+        fprintf(stderr, "no gems found\n");
+        exit(1);
+    }
+
+    for (i = 0; i < runs; i++) {
+        run_stages(paths, npaths);
+        run_end_to_end(paths, npaths);
+    }
+    /* a corpus has many gems */
+    printf("%d gems, %d runs, inflate with %s\n", runs > 0 ? stages[STAGE_END_TO_END].nsamples / runs : npaths,
+           runs, gem_inflater_backend());
+    report();
+
+    for (i = 0; i < npaths; i++)
+        free(paths[i]);
+    free(paths);
+    for (i = 0; i < NSTAGES; i++)
+        free(stages[i].samples);
+    return 0;
+}
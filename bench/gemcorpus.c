@@ -0,0 +1,573 @@
+/*
+ * Copyright (c) 2012, Novell Inc.
+ *
+ * This program is licensed under the BSD license, read LICENSE.BSD
+ * for further information
+ *
+ * gemcorpus: writes a reproducible corpus of synthetic .gem files
+ * for the benchmarks.
+ *
+ * The same seed always gives the same corpus, byte for byte. The
+ * shapes follow what a rubygems.org mirror looks like: a few versions
+ * per gem, lognormal gemspec, files list and payload sizes, and
+ * dependencies that point to other gems of the corpus.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <math.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+typedef struct Buf
+{
+    unsigned char *buf;
+    size_t len;
+    size_t alloc;
+} Buf;
+
+typedef struct Params
+{
+    int ngems;
+    unsigned long long seed;
+    /* share of the requirements using ~> */
+    double tilde;
+    /* share of the gems storing data.tar.gz before metadata.gz */
+    double datafirst;
+    /* scale of the data.tar.gz payload */
+    double payload;
+    /* mean runtime and development dependencies per gem */
+    double deps;
+    double devdeps;
+    /* median length of the description and of the files list */
+    double desclen;
+    double nfiles;
+} Params;
+
+static unsigned long long rng_state;
+
+/* splitmix64, so the corpus does not depend on the libc */
+static unsigned long long rng(void)
+{
+    unsigned long long z = (rng_state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static double rng_uniform(void)
+{
+    return (rng() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int rng_int(int n)
+{
+    return (int) (rng_uniform() * n);
+}
+
+static double rng_normal(void)
+{
+    double u1 = rng_uniform(), u2 = rng_uniform();
+    if (u1 < 1e-300)
+        u1 = 1e-300;
+    return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+static double rng_lognormal(double median, double sigma)
+{
+    return median * exp(sigma * rng_normal());
+}
+
+/* number of failures before the first success, with the given mean */
+static int rng_geometric(double mean)
+{
+    double p = 1 / (mean + 1);
+    int n = 0;
+    while (rng_uniform() > p && n < 1000)
+        n++;
+    return n;
+}
+
+static void buf_add(Buf *b, const void *data, size_t len)
+{
+    if (b->len + len > b->alloc) {
+        b->alloc = (b->len + len) * 2 + 4096;
+        b->buf = realloc(b->buf, b->alloc);
+    }
+    memcpy(b->buf + b->len, data, len);
+    b->len += len;
+}
+
+static void buf_puts(Buf *b, const char *s)
+{
+    buf_add(b, s, strlen(s));
+}
+
+static void buf_printf(Buf *b, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static void buf_printf(Buf *b, const char *format, ...)
+{
+    char tmp[4096];
+    va_list args;
+    int l;
+
+    va_start(args, format);
+    l = vsnprintf(tmp, sizeof(tmp), format, args);
+    va_end(args);
+    buf_add(b, tmp, l < sizeof(tmp) ? l : sizeof(tmp) - 1);
+}
+
+static const char *syllables[] = {
+    "ra", "ko", "mi", "tel", "bun", "dar", "zen", "fo", "lis", "ru", "by", "act", "rec",
+    "gem", "net", "http", "json", "xml", "pars", "er", "ify", "log", "cache", "sql",
+    "ite", "pro", "to", "col", "auth", "ent", "rack", "spec", "mock", "kit", "io",
+};
+
+static const char *words[] = {
+    "a", "the", "library", "for", "ruby", "fast", "simple", "client", "server", "with",
+    "support", "of", "and", "to", "parser", "data", "api", "tool", "framework", "based",
+    "on", "in", "is", "that", "provides", "easy", "interface", "web", "http", "json",
+    "lightweight", "extension", "helpers", "rails", "testing", "command", "line", "files",
+};
+
+static void random_name(Buf *b, int i)
+{
+    int n = 1 + rng_int(3), k;
+    char suffix[16];
+
+    for (k = 0; k < n; k++)
+        buf_puts(b, syllables[rng_int(sizeof(syllables) / sizeof(*syllables))]);
+    if (rng_int(5) == 0)
+        buf_puts(b, rng_int(2) ? "-rails" : "_ext");
+    /* unique, still looks like a name */
+    k = 0;
+    do
+        suffix[k++] = 'a' + i % 26;
+    while ((i /= 26) > 0 && k < 15);
+    suffix[k] = 0;
+    buf_puts(b, "-");
+    buf_puts(b, suffix);
+    buf_add(b, "", 1);
+}
+
+static void random_text(Buf *b, int len, int wrap, const char *indent)
+{
+    int col = 0, l;
+    const char *w;
+
+    while (len > 0) {
+        w = words[rng_int(sizeof(words) / sizeof(*words))];
+        l = strlen(w);
+        if (col) {
+            if (wrap && col + l + 1 > wrap) {
+                buf_puts(b, "\n");
+                buf_puts(b, indent);
+                col = 0;
+            }
+            else {
+                buf_puts(b, " ");
+                col++;
+            }
+        }
+        buf_puts(b, w);
+        col += l;
+        len -= l + 1;
+    }
+}
+
+typedef struct Gem
+{
+    char *name;
+    int nversions;
+    int major, minor, patch;
+} Gem;
+
+static void version_str(char *buf, int len, int major, int minor, int patch, int parts)
+{
+    if (parts == 1)
+        snprintf(buf, len, "%d", major);
+    else if (parts == 2)
+        snprintf(buf, len, "%d.%d", major, minor);
+    else
+        snprintf(buf, len, "%d.%d.%d", major, minor, patch);
+}
+
+/* the yaml of Gem::Version, quoted like psych does for numbers */
+static void yaml_version(Buf *b, const char *indent, const char *v)
+{
+    const char *dot = strchr(v, '.');
+    if (!dot || !strchr(dot + 1, '.'))
+        buf_printf(b, "%s  - !ruby/object:Gem::Version\n%s    version: '%s'\n", indent, indent, v);
+    else
+        buf_printf(b, "%s  - !ruby/object:Gem::Version\n%s    version: %s\n", indent, indent, v);
+}
+
+static void yaml_requirement(Buf *b, const char *key, char ops[2][3], char versions[2][32], int nreq)
+{
+    int i;
+    buf_printf(b, "  %s: !ruby/object:Gem::Requirement\n    requirements:\n", key);
+    for (i = 0; i < nreq; i++) {
+        buf_printf(b, "    - - \"%s\"\n", ops[i]);
+        yaml_version(b, "    ", versions[i]);
+    }
+}
+
+static void yaml_dependency(Buf *b, const Params *p, Gem *gems, int ngems, int dev)
+{
+    char ops[2][3], versions[2][32];
+    Gem *dep = gems + rng_int(ngems);
+    int nreq = 1, parts;
+    double r = rng_uniform();
+
+    parts = 1 + rng_int(3);
+    if (r < p->tilde) {
+        strcpy(ops[0], "~>");
+        version_str(versions[0], 32, dep->major, rng_int(dep->minor + 1), rng_int(3), parts < 2 ? 2 : parts);
+    }
+    else if (r < p->tilde + (1 - p->tilde) * 0.5) {
+        strcpy(ops[0], ">=");
+        version_str(versions[0], 32, dep->major, rng_int(dep->minor + 1), 0, parts);
+        if (rng_int(4) == 0) {
+            strcpy(ops[1], "<");
+            version_str(versions[1], 32, dep->major + 1, 0, 0, 1);
+            nreq = 2;
+        }
+    }
+    else if (r < p->tilde + (1 - p->tilde) * 0.8) {
+        strcpy(ops[0], ">=");
+        strcpy(versions[0], "0");
+    }
+    else {
+        strcpy(ops[0], rng_int(4) ? "=" : "!=");
+        version_str(versions[0], 32, dep->major, dep->minor, dep->patch, 3);
+    }
+
+    buf_printf(b, "- !ruby/object:Gem::Dependency\n  name: %s\n", dep->name);
+    yaml_requirement(b, "requirement", ops, versions, nreq);
+    buf_printf(b, "  type: :%s\n  prerelease: false\n", dev ? "development" : "runtime");
+    yaml_requirement(b, "version_requirements", ops, versions, nreq);
+}
+
+static void make_metadata(Buf *b, const Params *p, Gem *gems, int ngems, Gem *g, const char *version, Buf *files, int nfiles)
+{
+    int i, n;
+
+    buf_printf(b, "--- !ruby/object:Gem::Specification\nname: %s\nversion: !ruby/object:Gem::Version\n  version: %s\n", g->name, version);
+    buf_puts(b, "platform: ruby\nauthors:\n");
+    n = 1 + rng_geometric(0.6);
+    for (i = 0; i < n; i++) {
+        buf_puts(b, "- ");
+        random_text(b, 12, 0, "");
+        buf_puts(b, "\n");
+    }
+    buf_printf(b, "autorequire: \nbindir: bin\ncert_chain: []\ndate: 20%02d-%02d-%02d 00:00:00.000000000 Z\n",
+               10 + rng_int(15), 1 + rng_int(12), 1 + rng_int(28));
+
+    n = rng_geometric(p->deps);
+    i = rng_geometric(p->devdeps);
+    if (n + i == 0)
+        buf_puts(b, "dependencies: []\n");
+    else {
+        buf_puts(b, "dependencies:\n");
+        for (; n > 0; n--)
+            yaml_dependency(b, p, gems, ngems, 0);
+        for (; i > 0; i--)
+            yaml_dependency(b, p, gems, ngems, 1);
+    }
+
+    buf_puts(b, "description: ");
+    random_text(b, (int) rng_lognormal(p->desclen, 1.0), 80, "  ");
+    buf_puts(b, "\nemail:\n- someone@example.com\nexecutables: []\nextensions: []\nextra_rdoc_files: []\n");
+    {
+        const char *f = (const char *) files->buf;
+        buf_puts(b, "files:\n");
+        for (i = 0; i < nfiles; i++, f += strlen(f) + 1)
+            buf_printf(b, "- %s\n", f);
+    }
+    buf_printf(b, "homepage: https://github.com/example/%s\nlicenses:\n- MIT\nmetadata: {}\npost_install_message: \n", g->name);
+    buf_puts(b, "rdoc_options: []\nrequire_paths:\n- lib\nrequired_ruby_version: !ruby/object:Gem::Requirement\n");
+    buf_puts(b, "  requirements:\n  - - \">=\"\n    - !ruby/object:Gem::Version\n      version: '0'\n");
+    buf_puts(b, "required_rubygems_version: !ruby/object:Gem::Requirement\n");
+    buf_puts(b, "  requirements:\n  - - \">=\"\n    - !ruby/object:Gem::Version\n      version: '0'\n");
+    buf_puts(b, "requirements: []\nrubygems_version: 3.4.10\nsigning_key: \nspecification_version: 4\nsummary: ");
+    random_text(b, 20 + rng_int(60), 0, "");
+    buf_puts(b, "\ntest_files: []\n");
+}
+
+static void tar_header(Buf *b, const char *name, size_t size, int type)
+{
+    unsigned char h[512];
+    unsigned int sum = 0;
+    int i;
+
+    memset(h, 0, sizeof(h));
+    snprintf((char *) h, 100, "%s", name);
+    memcpy(h + 100, "0000644", 8);
+    memcpy(h + 108, "0000000", 8);
+    memcpy(h + 116, "0000000", 8);
+    snprintf((char *) h + 124, 12, "%011zo", size);
+    memcpy(h + 136, "00000000000", 12);
+    h[156] = type;
+    memcpy(h + 257, "ustar", 6);
+    memcpy(h + 263, "00", 2);
+    memcpy(h + 265, "wheel", 6);
+    memcpy(h + 297, "wheel", 6);
+    memset(h + 148, ' ', 8);
+    for (i = 0; i < 512; i++)
+        sum += h[i];
+    snprintf((char *) h + 148, 8, "%06o", sum);
+    buf_add(b, h, 512);
+}
+
+static void tar_member(Buf *b, const char *name, const void *data, size_t len)
+{
+    static const unsigned char zero[512];
+
+    tar_header(b, name, len, '0');
+    buf_add(b, data, len);
+    if (len % 512)
+        buf_add(b, zero, 512 - len % 512);
+}
+
+static void tar_end(Buf *b)
+{
+    static const unsigned char zero[1024];
+    buf_add(b, zero, 1024);
+}
+
+static void gzip(Buf *out, const unsigned char *data, size_t len, int level)
+{
+    z_stream strm;
+    unsigned char tmp[65536];
+    int ret;
+
+    memset(&strm, 0, sizeof(strm));
+    /* no name and no timestamp, so the output is reproducible */
+    deflateInit2(&strm, level, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+    strm.next_in = (unsigned char *) data;
+    strm.avail_in = len;
+    do {
+        strm.next_out = tmp;
+        strm.avail_out = sizeof(tmp);
+        ret = deflate(&strm, Z_FINISH);
+        buf_add(out, tmp, sizeof(tmp) - strm.avail_out);
+    } while (ret == Z_OK);
+    deflateEnd(&strm);
+}
+
+/* file contents are slices of one block of text, generating the
+   text word by word for every file is too slow for large payloads */
+static Buf text;
+
+static void make_text(void)
+{
+    while (text.len < (1 << 22))
+        random_text(&text, 200, 72, "");
+}
+
+/* a data.tar with the files of the list, about payload bytes */
+static void make_payload(Buf *files, int nfiles, size_t payload, Buf *data)
+{
+    const char *f = (const char *) files->buf;
+    size_t size, off;
+    int i;
+
+    for (i = 0; i < nfiles; i++, f += strlen(f) + 1) {
+        size = payload / nfiles;
+        size = (size_t) (size * (0.25 + 1.5 * rng_uniform()));
+        if (size > text.len / 2)
+            size = text.len / 2;
+        off = rng_int(text.len - size);
+        tar_member(data, f, text.buf + off, size);
+    }
+    tar_end(data);
+}
+
+static void make_files(Buf *files, Gem *g, int nfiles)
+{
+    static const char *dirs[] = { "lib", "lib", "lib", "spec", "test", "bin", "ext", "doc" };
+    static const char *exts[] = { ".rb", ".rb", ".rb", ".rb", ".md", ".c", ".h", ".yml" };
+    int i;
+
+    files->len = 0;
+    for (i = 0; i < nfiles; i++) {
+        if (i == 0) {
+            buf_printf(files, "README.md");
+        }
+        else {
+            buf_printf(files, "%s/%s/", dirs[rng_int(8)], g->name);
+            random_text(files, 1 + rng_int(12), 0, "");
+            buf_printf(files, "_%d%s", i, exts[rng_int(8)]);
+            /* no spaces in paths */
+            {
+                unsigned char *p = files->buf + files->len - 1;
+                for (; p > files->buf && *p; p--)
+                    if (*p == ' ')
+                        *p = '_';
+            }
+        }
+        buf_add(files, "", 1);
+    }
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage:\n%s [options] <outdir>\n", prog);
+    fprintf(stderr, "Writes a synthetic gem corpus to <outdir>.\n");
+    fprintf(stderr, "options: -n N : number of .gem files (default 1000).\n");
+    fprintf(stderr, "         -s N : random seed (default 1).\n");
+    fprintf(stderr, "         -t F : share of ~> requirements (default 0.45).\n");
+    fprintf(stderr, "         -d F : mean runtime dependencies per gem (default 1.5).\n");
+    fprintf(stderr, "         -D F : mean development dependencies per gem (default 2).\n");
+    fprintf(stderr, "         -l N : median description length (default 250).\n");
+    fprintf(stderr, "         -f N : median files list length (default 30).\n");
+    fprintf(stderr, "         -p F : scale of the data.tar.gz payload (default 1).\n");
+    fprintf(stderr, "         -o F : share of gems with data.tar.gz first (default 0.2).\n");
+}
+
+int main(int argc, char **argv)
+{
+    Params p;
+    Gem *gems;
+    Buf name, files, yaml, meta, data, datagz, gem;
+    int c, i, v, nnames, nfiles, count = 0;
+    char version[64], path[4096];
+    unsigned long long total = 0;
+    const char *outdir;
+    FILE *fp;
+
+    memset(&p, 0, sizeof(p));
+    p.ngems = 1000;
+    p.seed = 1;
+    p.tilde = 0.45;
+    p.datafirst = 0.2;
+    p.payload = 1;
+    p.deps = 1.5;
+    p.devdeps = 2;
+    p.desclen = 250;
+    p.nfiles = 30;
+
+    while ((c = getopt(argc, argv, "hn:s:t:d:D:l:f:p:o:")) >= 0) {
+        switch (c) {
+        case 'n':
+            p.ngems = atoi(optarg);
+            break;
+        case 's':
+            p.seed = strtoull(optarg, 0, 10);
+            break;
+        case 't':
+            p.tilde = atof(optarg);
+            break;
+        case 'd':
+            p.deps = atof(optarg);
+            break;
+        case 'D':
+            p.devdeps = atof(optarg);
+            break;
+        case 'l':
+            p.desclen = atof(optarg);
+            break;
+        case 'f':
+            p.nfiles = atof(optarg);
+            break;
+        case 'p':
+            p.payload = atof(optarg);
+            break;
+        case 'o':
+            p.datafirst = atof(optarg);
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(0);
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (optind + 1 != argc || p.ngems < 1) {
+        usage(argv[0]);
+        exit(1);
+    }
+    outdir = argv[optind];
+    if (mkdir(outdir, 0755) && errno != EEXIST) {
+        perror(outdir);
+        exit(1);
+    }
+    rng_state = p.seed;
+    make_text();
+
+    /* the names first, so dependencies can point to any of them */
+    memset(&name, 0, sizeof(name));
+    gems = calloc(p.ngems, sizeof(Gem));
+    for (nnames = 0, i = 0; i < p.ngems; nnames++) {
+        name.len = 0;
+        random_name(&name, nnames);
+        gems[nnames].name = strdup((char *) name.buf);
+        gems[nnames].nversions = 1 + rng_geometric(2);
+        gems[nnames].major = rng_geometric(1.5);
+        gems[nnames].minor = rng_geometric(4);
+        gems[nnames].patch = rng_geometric(3);
+        i += gems[nnames].nversions;
+    }
+
+    memset(&files, 0, sizeof(files));
+    memset(&yaml, 0, sizeof(yaml));
+    memset(&meta, 0, sizeof(meta));
+    memset(&data, 0, sizeof(data));
+    memset(&datagz, 0, sizeof(datagz));
+    memset(&gem, 0, sizeof(gem));
+    for (i = 0; i < nnames && count < p.ngems; i++) {
+        Gem *g = gems + i;
+        for (v = 0; v < g->nversions && count < p.ngems; v++, count++) {
+            version_str(version, sizeof(version), g->major, g->minor, g->patch + v, 3);
+            nfiles = (int) rng_lognormal(p.nfiles, 1.2);
+            if (nfiles > 20000)
+                nfiles = 20000;
+            if (nfiles < 1)
+                nfiles = 1;
+            make_files(&files, g, nfiles);
+
+            yaml.len = meta.len = data.len = datagz.len = gem.len = 0;
+            make_metadata(&yaml, &p, gems, nnames, g, version, &files, nfiles);
+            gzip(&meta, yaml.buf, yaml.len, 9);
+            make_payload(&files, nfiles, (size_t) (rng_lognormal(40000, 1.5) * p.payload), &data);
+            /* only the size of the payload matters, so compress it fast */
+            gzip(&datagz, data.buf, data.len, 1);
+
+            if (rng_uniform() < p.datafirst) {
+                tar_member(&gem, "data.tar.gz", datagz.buf, datagz.len);
+                tar_member(&gem, "metadata.gz", meta.buf, meta.len);
+            }
+            else {
+                tar_member(&gem, "metadata.gz", meta.buf, meta.len);
+                tar_member(&gem, "data.tar.gz", datagz.buf, datagz.len);
+            }
+            tar_end(&gem);
+
+            snprintf(path, sizeof(path), "%s/%s-%s.gem", outdir, g->name, version);
+            if (!(fp = fopen(path, "w")) || fwrite(gem.buf, gem.len, 1, fp) != 1 || fclose(fp)) {
+                perror(path);
+                exit(1);
+            }
+            total += gem.len;
+        }
+    }
+    fprintf(stderr, "%d gems of %d names, %llu bytes\n", count, i, total);
+
+    for (i = 0; i < nnames; i++)
+        free(gems[i].name);
+    free(gems);
+    free(name.buf);
+    free(files.buf);
+    free(yaml.buf);
+    free(meta.buf);
+    free(data.buf);
+    free(datagz.buf);
+    free(gem.buf);
+    free(text.buf);
+    return 0;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2012, Novell Inc.
+ *
+ * This program is licensed under the BSD license, read LICENSE.BSD
+ * for further information
+ *
+ * gemversion: times gem_version parsing, comparing, bumping and the
+ * dependency Ids of a requirement. Its conformance with RubyGems is
+ * checked by tests/test_gem_version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <solv/pool.h>
+
+#include "gem_version.h"
+
+/* the versions parsed, compared and used in requirements */
+static const char *rs[] = {
+    "0", "1", "1.0", "1.0.0", "1.0.1", "1.1", "1.9.9", "1.10", "2", "2.0.0.rc1",
+    "1.0.0.rc1", "1.0.0-rc2", "1.0.0.a", "1.0.a", "1.1.a", "1.0.0.0.1", "01.1",
+};
+
+#define NRS ((int) (sizeof(rs) / sizeof(*rs)))
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void report(const char *what, double t, long n)
+{
+    printf("%-12s %8.1f ns\n", what, t * 1e9 / n);
+}
+
+int main(int argc, char **argv)
+{
+    static const char *ops[] = { "=", "!=", ">", "<", ">=", "<=", "~>" };
+    GemVersion parsed[NRS], v;
+    GemConstraint c[2];
+    char bump[GEM_VERSION_BUMP_SIZE];
+    Pool *pool;
+    Id name, deps[2];
+    long i, n, rounds = argc > 1 ? atol(argv[1]) : 200000;
+    volatile long sink = 0;
+    double t;
+
+    for (i = 0; i < NRS; i++)
+        gem_version_parse(parsed + i, rs[i]);
+    n = rounds * NRS;
+
+    t = now();
+    for (i = 0; i < n; i++)
+        sink += gem_version_parse(&v, rs[i % NRS]);
+    report("parse", now() - t, n);
+
+    t = now();
+    for (i = 0; i < n; i++)
+        sink += gem_version_cmp(parsed + i % NRS, parsed + (i / NRS) % NRS);
+    report("cmp", now() - t, n);
+
+    t = now();
+    for (i = 0; i < n; i++)
+        sink += gem_version_bump(parsed + i % NRS, bump, sizeof(bump));
+    report("bump", now() - t, n);
+
+    t = now();
+    for (i = 0; i < n; i++)
+        sink += gem_requirement_constraints(ops[i % 7], rs[i % NRS], c, bump, sizeof(bump));
+    report("constraints", now() - t, n);
+
+    pool = pool_create();
+    name = pool_str2id(pool, "rubygem-rails", 1);
+    t = now();
+    for (i = 0; i < n; i++)
+        sink += gem_requirement_deps(pool, name, ops[i % 7], rs[i % NRS], deps);
+    report("deps", now() - t, n);
+    pool_free(pool);
+    return 0;
+}
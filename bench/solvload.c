@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2012, Novell Inc.
+ *
+ * This program is licensed under the BSD license, read LICENSE.BSD
+ * for further information
+ *
+ * solvload: times loading solv files like a repository refresh does.
+ *
+ * Every file is loaded in a child process, so the RSS growth is that
+ * of the loaded repository alone. Split files (rubygems2solv -b) only
+ * load the main file, the language subfiles are left to on demand
+ * loading.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <solv/pool.h>
+#include <solv/repo.h>
+#include <solv/repo_solv.h>
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* VmRSS in kB */
+static long rss(void)
+{
+    FILE *fp = fopen("/proc/self/status", "r");
+    char line[256];
+    long kb = 0;
+
+    if (!fp)
+        return 0;
+    while (fgets(line, sizeof(line), fp))
+        if (!strncmp(line, "VmRSS:", 6))
+            kb = atol(line + 6);
+    fclose(fp);
+    return kb;
+}
+
+static int load(const char *file, Pool **poolp)
+{
+    Pool *pool = pool_create();
+    Repo *repo = repo_create(pool, file);
+    FILE *fp = fopen(file, "r");
+
+    if (!fp) {
+        perror(file);
+        return -1;
+    }
+    if (repo_add_solv(repo, fp, 0)) {
+        fprintf(stderr, "%s: %s\n", file, pool_errstr(pool));
+        return -1;
+    }
+    fclose(fp);
+    *poolp = pool;
+    return repo->nsolvables;
+}
+
+static void bench(const char *file, int runs)
+{
+    struct stat st;
+    Pool *pool = 0, *last = 0;
+    double t, best = 0;
+    long rss0 = rss(), rss1 = 0;
+    int i, n = 0;
+
+    for (i = 0; i < runs; i++) {
+        t = now();
+        if ((n = load(file, &pool)) < 0)
+            exit(1);
+        t = now() - t;
+        if (!i)
+            rss1 = rss();
+        if (!i || t < best)
+            best = t;
+        if (last)
+            pool_free(last);
+        last = pool;
+    }
+    stat(file, &st);
+    printf("%-40s %10lld %10d %10.2f %10ld\n", file, (long long) st.st_size, n, best * 1e3, rss1 - rss0);
+    pool_free(last);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage:\n%s [options] <file.solv> ...\n", prog);
+    fprintf(stderr, "options: -r N : load N times (default 5), the fastest load is reported.\n");
+    fprintf(stderr, "The RSS growth is that of the first load.\n");
+}
+
+int main(int argc, char **argv)
+{
+    int c, i, status, runs = 5;
+    pid_t pid;
+
+    while ((c = getopt(argc, argv, "hr:")) >= 0) {
+        switch (c) {
+        case 'r':
+            runs = atoi(optarg);
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(0);
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (optind >= argc || runs < 1) {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    printf("%-40s %10s %10s %10s %10s\n", "file", "bytes", "solvables", "load ms", "rss kB");
+    fflush(stdout);
+    for (i = optind; i < argc; i++) {
+        if ((pid = fork()) == 0) {
+            bench(argv[i], runs);
+            exit(0);
+        }
+        if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+            exit(1);
+    }
+    return 0;
+}
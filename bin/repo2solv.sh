@@ -114,6 +114,17 @@ if test -z "$repotype" ; then
   fi
 fi
 
+# repodir2solv converts these in one process, with the same result
+if test -z "$parser_options" ; then
+  case $repotype in
+    rpmmd|susetags|rubygems)
+      if which repodir2solv >/dev/null 2>&1 ; then
+        exec repodir2solv -t $repotype .
+      fi
+      ;;
+  esac
+fi
+
 if test "$repotype" = rpmmd ; then
   test -d repodata && {
     cd repodata || exit 2
@@ -243,8 +254,8 @@ elif test "$repotype" = susetags ; then
   cd "$olddir"
 elif test "$repotype" = rubygems ; then
   helper=$(which rubygems2solv)
-  if test -x $helper; then
-    rubygems2solv $dir
+  if test -n "$helper" -a -x "$helper"; then
+    rubygems2solv Marshal.4.8.Z
   else
     echo "rubygems support not installed"
     exit 1
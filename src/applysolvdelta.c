@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2012, Novell Inc.
+ *
+ * This program is licensed under the BSD license, read LICENSE.BSD
+ * for further information
+ *
+ * applysolvdelta: makes the new solv file of a rubygems repository
+ * from the old one and a delta written by rubygems2solv --delta.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include <solv/pool.h>
+#include <solv/repo.h>
+
+#include "gem_delta.h"
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "Usage:\n%s [options] <old.solv> <delta>\n", prog);
+  fprintf(stderr, "Writes the new solv file if the delta is for <old.solv> and the result\n");
+  fprintf(stderr, "matches its checksum.\n");
+  fprintf(stderr, "options: -o $file : write to $file instead of stdout.\n");
+}
+
+int main(int argc, char **argv)
+{
+    Pool *pool;
+    const char *outfile = 0;
+    unsigned char *base;
+    size_t baselen;
+    FILE *fp, *delta, *out;
+    int c, ret;
+
+    while ((c = getopt(argc, argv, "ho:")) >= 0)
+    {
+        switch (c)
+        {
+        case 'o':
+            outfile = optarg;
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(0);
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (argc - optind != 2)
+    {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    if (!(fp = fopen(argv[optind], "r")) || !(base = gem_delta_read_file(fp, &baselen)))
+    {
+        perror(argv[optind]);
+        exit(1);
+    }
+    fclose(fp);
+    if (!(delta = fopen(argv[optind + 1], "r")))
+    {
+        perror(argv[optind + 1]);
+        exit(1);
+    }
+
+    pool = pool_create();
+    if (!outfile)
+        ret = gem_delta_apply(pool, base, baselen, delta, stdout);
+    else
+    {
+        /* outfile may be the old file, keep it if the delta does not apply */
+        char *tmp = solv_dupjoin(outfile, ".XXXXXX", 0);
+        int fd = mkstemp(tmp);
+        if (fd < 0 || fchmod(fd, 0644) || !(out = fdopen(fd, "w")))
+        {
+            perror(tmp);
+            exit(1);
+        }
+        ret = gem_delta_apply(pool, base, baselen, delta, out);
+        if (fclose(out) && !ret)
+            ret = pool_error(pool, -1, "%s: %s", tmp, strerror(errno));
+        if (!ret && rename(tmp, outfile))
+            ret = pool_error(pool, -1, "%s: %s", outfile, strerror(errno));
+        if (ret)
+            unlink(tmp);
+        solv_free(tmp);
+    }
+    if (ret)
+        fprintf(stderr, "%s: %s\n", argv[optind + 1], pool_errstr(pool));
+    fclose(delta);
+    solv_free(base);
+    pool_free(pool);
+    return ret ? 1 : 0;
+}
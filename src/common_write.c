@@ -6,11 +6,13 @@
  */
 
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <limits.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "pool.h"
 #include "repo.h"
@@ -41,6 +43,14 @@ static char *languagetags[] = {
 
 static int test_separate = 0;
 
+/* ids are mapped when writing, which vertical storage can't do, so
+   pool strings of the vertical keys stay incore */
+static int
+vertical_storage(Repokey *key)
+{
+  return key->type == REPOKEY_TYPE_ID ? KEY_STORAGE_INCORE : KEY_STORAGE_VERTICAL_OFFSET;
+}
+
 struct keyfilter_data {
   char **languages;
   int nlanguages;
@@ -63,11 +73,11 @@ keyfilter_solv(Repo *data, Repokey *key, void *kfdata)
     return KEY_STORAGE_DROPPED;
   for (i = 0; verticals[i]; i++)
     if (key->name == verticals[i])
-      return KEY_STORAGE_VERTICAL_OFFSET;
+      return vertical_storage(key);
   keyname = pool_id2str(data->pool, key->name);
   for (i = 0; languagetags[i] != 0; i++)
     if (!strncmp(keyname, languagetags[i], strlen(languagetags[i])))
-      return KEY_STORAGE_VERTICAL_OFFSET;
+      return vertical_storage(key);
   return KEY_STORAGE_INCORE;
 }
 
@@ -83,11 +93,11 @@ keyfilter_attr(Repo *data, Repokey *key, void *kfdata)
     return KEY_STORAGE_DROPPED;
   for (i = 0; verticals[i]; i++)
     if (key->name == verticals[i])
-      return KEY_STORAGE_VERTICAL_OFFSET;
+      return vertical_storage(key);
   keyname = pool_id2str(data->pool, key->name);
   for (i = 0; languagetags[i] != 0; i++)
     if (!strncmp(keyname, languagetags[i], strlen(languagetags[i])))
-      return KEY_STORAGE_VERTICAL_OFFSET;
+      return vertical_storage(key);
   return KEY_STORAGE_INCORE;
 }
 
@@ -107,7 +117,7 @@ keyfilter_language(Repo *repo, Repokey *key, void *kfdata)
     {
       const char *vname = pool_id2str(pool, verticals[i]);
       if (!strncmp(name, vname, p - name) && vname[p - name] == 0)
-	return KEY_STORAGE_VERTICAL_OFFSET;
+	return vertical_storage(key);
     }
   return KEY_STORAGE_INCORE;
 }
@@ -161,22 +171,34 @@ keyfilter_other(Repo *repo, Repokey *key, void *kfdata)
     }
   for (i = 0; verticals[i]; i++)
     if (key->name == verticals[i])
-      return KEY_STORAGE_VERTICAL_OFFSET;
+      return vertical_storage(key);
   return KEY_STORAGE_INCORE;
 }
 
 /*
- * Write <repo> to stdout
+ * Write <repo> to <out>, tool_write writes to stdout
  * If <attrname> is given, write attributes to <attrname>
  * If <basename> is given, split attributes
  */
 
 #define REPODATAFILE_BLOCK 15
+#define WRITE_BUFSIZE (1024 * 1024)
 
 static void
-write_info(Repo *repo, FILE *fp, int (*keyfilter)(Repo *repo, Repokey *key, void *kfdata), void *kfdata, Repodata *info, const char *location)
+add_info(Repodata *info, Queue *keyq, const char *location)
 {
   Id h;
+
+  h = repodata_new_handle(info);
+  if (keyq->count)
+    repodata_set_idarray(info, h, REPOSITORY_KEYS, keyq);
+  repodata_set_str(info, h, REPOSITORY_LOCATION, location);
+  repodata_add_flexarray(info, SOLVID_META, REPOSITORY_EXTERNAL, h);
+}
+
+static void
+write_info(Repo *repo, FILE *fp, int (*keyfilter)(Repo *repo, Repokey *key, void *kfdata), void *kfdata, Repodata *info, const char *location)
+{
   Queue keyq;
 
   queue_init(&keyq);
@@ -185,16 +207,286 @@ write_info(Repo *repo, FILE *fp, int (*keyfilter)(Repo *repo, Repokey *key, void
       fprintf(stderr, "repo_write failed\n");
       exit(1);
     }
-  h = repodata_new_handle(info);
-  if (keyq.count)
-    repodata_set_idarray(info, h, REPOSITORY_KEYS, &keyq);
+  add_info(info, &keyq, location);
   queue_free(&keyq);
-  repodata_set_str(info, h, REPOSITORY_LOCATION, location);
-  repodata_add_flexarray(info, SOLVID_META, REPOSITORY_EXTERNAL, h);
 }
 
+struct subfile {
+  char *fn;
+  int (*keyfilter)(Repo *repo, Repokey *key, void *kfdata);
+  void *kfdata;
+  Queue keyq;
+  Queue guess;
+  pid_t pid;
+  int fd;
+};
+
+static void
+add_subfile(struct subfile *sf, const char *fn, int (*keyfilter)(Repo *repo, Repokey *key, void *kfdata), void *kfdata)
+{
+  memset(sf, 0, sizeof(*sf));
+  sf->fn = solv_strdup(fn);
+  sf->keyfilter = keyfilter;
+  sf->kfdata = kfdata;
+  queue_init(&sf->keyq);
+  queue_init(&sf->guess);
+}
+
+static int
+write_subfile(Repo *repo, struct subfile *sf)
+{
+  FILE *fp;
+
+  if (!(fp = fopen(sf->fn, "w")))
+    {
+      perror(sf->fn);
+      return -1;
+    }
+  if (repo_write_filtered(repo, fp, sf->keyfilter, sf->kfdata, &sf->keyq) != 0)
+    {
+      fprintf(stderr, "repo_write failed\n");
+      fclose(fp);
+      return -1;
+    }
+  if (fclose(fp) != 0)
+    {
+      perror(sf->fn);
+      return -1;
+    }
+  return 0;
+}
+
+static int
+xfer_all(int fd, void *buf, size_t len, int out)
+{
+  char *p = buf;
+  ssize_t r;
+
+  while (len)
+    {
+      r = out ? write(fd, p, len) : read(fd, p, len);
+      if (r <= 0)
+	return -1;
+      p += r;
+      len -= r;
+    }
+  return 0;
+}
+
+/*
+ * Writing a subfile only reads the repo, so subfiles are written by
+ * forked children while this process writes the rest. The children
+ * send back the written keys, the info about the subfiles is then
+ * added in the order of the subfiles, as if they were written one
+ * after the other.
+ */
+static void
+fork_subfiles(Repo *repo, struct subfile *subfiles, int nforks)
+{
+  struct subfile *sf;
+  int i, pfd[2];
+
+  fflush(stdout);
+  fflush(stderr);
+  for (i = 0; i < nforks; i++)
+    {
+      sf = subfiles + i;
+      if (pipe(pfd))
+	continue;
+      if ((sf->pid = fork()) == 0)
+	{
+	  close(pfd[0]);
+	  if (write_subfile(repo, sf)
+	      || xfer_all(pfd[1], &sf->keyq.count, sizeof(int), 1)
+	      || xfer_all(pfd[1], sf->keyq.elements, sf->keyq.count * sizeof(Id), 1))
+	    _exit(1);
+	  _exit(0);
+	}
+      close(pfd[1]);
+      if (sf->pid < 0)
+	{
+	  close(pfd[0]);
+	  sf->pid = 0;
+	  continue;
+	}
+      sf->fd = pfd[0];
+    }
+}
+
+static void
+finish_subfiles(Repo *repo, struct subfile *subfiles, int nsubfiles)
+{
+  struct subfile *sf;
+  Id *keys;
+  int i, j, status, count;
+
+  /* the rest and those we could not fork for */
+  for (i = 0; i < nsubfiles; i++)
+    if (!subfiles[i].pid && write_subfile(repo, subfiles + i))
+      exit(1);
+  for (i = 0; i < nsubfiles; i++)
+    {
+      sf = subfiles + i;
+      if (!sf->pid)
+	continue;
+      if (xfer_all(sf->fd, &count, sizeof(int), 0) || count < 0)
+	count = -1;
+      else
+	{
+	  keys = solv_calloc(count, sizeof(Id));
+	  if (xfer_all(sf->fd, keys, count * sizeof(Id), 0))
+	    count = -1;
+	  for (j = 0; j < count; j++)
+	    queue_push(&sf->keyq, keys[j]);
+	  solv_free(keys);
+	}
+      close(sf->fd);
+      if (waitpid(sf->pid, &status, 0) != sf->pid || !WIFEXITED(status) || WEXITSTATUS(status) || count < 0)
+	{
+	  fprintf(stderr, "%s: writing failed\n", sf->fn);
+	  exit(1);
+	}
+    }
+}
+
+/*
+ * The info of the main file has the keys of the subfiles, which
+ * repo_write only tells once a subfile is written. They are the keys
+ * of the repodatas that the filter keeps and some schema uses, after
+ * the solvables, so they are guessed from those to write the main
+ * file while the children write the subfiles. Returns -1 if the
+ * repo has data this can't tell about.
+ */
+static int
+guess_subfile_keys(Repo *repo, struct subfile *sf)
+{
+  Repodata *data;
+  Repokey *key, keyd;
+  unsigned char *used;
+  Id *sp;
+  int i, j, k;
+
+  queue_empty(&sf->guess);
+  memset(&keyd, 0, sizeof(keyd));
+  keyd.type = REPOKEY_TYPE_ID;
+  keyd.storage = KEY_STORAGE_SOLVABLE;
+  for (keyd.name = SOLVABLE_NAME; keyd.name <= RPM_RPMDBID; keyd.name++)
+    if (sf->keyfilter(repo, &keyd, sf->kfdata) != KEY_STORAGE_DROPPED)
+      return -1;
+  if (repo->nsolvables)
+    queue_push2(&sf->guess, REPOSITORY_SOLVABLES, REPOKEY_TYPE_FLEXARRAY);
+  FOR_REPODATAS(repo, i, data)
+    {
+      if (data->state != REPODATA_AVAILABLE)
+	return -1;
+      used = solv_calloc(data->nkeys, 1);
+      for (j = 1; j < data->nschemata; j++)
+	for (sp = data->schemadata + data->schemata[j]; *sp; sp++)
+	  used[*sp] = 1;
+      for (j = 1, key = data->keys + j; j < data->nkeys; j++, key++)
+	{
+	  if (!used[j] || key->name == REPOSITORY_SOLVABLES)
+	    continue;
+	  if (sf->keyfilter(repo, key, sf->kfdata) == KEY_STORAGE_DROPPED)
+	    continue;
+	  for (k = 0; k < sf->guess.count; k += 2)
+	    if (sf->guess.elements[k] == key->name && sf->guess.elements[k + 1] == key->type)
+	      break;
+	  if (k == sf->guess.count)
+	    queue_push2(&sf->guess, key->name, key->type);
+	}
+      solv_free(used);
+    }
+  /* no data at all */
+  if (sf->guess.count == 2)
+    queue_empty(&sf->guess);
+  return 0;
+}
+
+static int
+queue_equal(Queue *q1, Queue *q2)
+{
+  return q1->count == q2->count && !memcmp(q1->elements, q2->elements, q1->count * sizeof(Id));
+}
+
+static Repodata *
+new_info(Repo *repo, Queue *addedfileprovides)
+{
+  Repodata *info;
+
+  info = repo_add_repodata(repo, 0);
+  repodata_set_str(info, SOLVID_META, REPOSITORY_TOOLVERSION, LIBSOLV_TOOLVERSION);
+  if (addedfileprovides->count)
+    repodata_set_idarray(info, SOLVID_META, REPOSITORY_ADDEDFILEPROVIDES, addedfileprovides);
+  return info;
+}
+
+/* repo_write_filtered with a bigger buffer than stdio's default */
+static int
+write_buffered(Repo *repo, FILE *fp, int (*keyfilter)(Repo *repo, Repokey *key, void *kfdata), void *kfdata)
+{
+  FILE *bfp;
+  int fd, ret;
+
+  if (fflush(fp) || (fd = fileno(fp)) < 0 || (fd = dup(fd)) < 0)
+    return repo_write_filtered(repo, fp, keyfilter, kfdata, 0);
+  if (!(bfp = fdopen(fd, "w")))
+    {
+      close(fd);
+      return repo_write_filtered(repo, fp, keyfilter, kfdata, 0);
+    }
+  setvbuf(bfp, 0, _IOFBF, WRITE_BUFSIZE);
+  ret = repo_write_filtered(repo, bfp, keyfilter, kfdata, 0);
+  if (fclose(bfp) != 0)
+    ret = -1;
+  return ret;
+}
+
+static void
+write_main(Repo *repo, const char *fn, Repodata *info, struct keyfilter_data *kd)
+{
+  FILE *fp;
+
+  if (!(fp = fopen(fn, "w")))
+    {
+      perror(fn);
+      exit(1);
+    }
+  repodata_internalize(info);
+  if (write_buffered(repo, fp, keyfilter_other, kd) != 0)
+    {
+      fprintf(stderr, "repo_write failed\n");
+      exit(1);
+    }
+  if (fclose(fp) != 0)
+    {
+      perror("fclose");
+      exit(1);
+    }
+}
+
+static void write_repo(Repo *repo, const char *basename, const char *attrname, FILE *out, int jobs);
+
 void
 tool_write(Repo *repo, const char *basename, const char *attrname)
+{
+  write_repo(repo, basename, attrname, stdout, 1);
+}
+
+void
+tool_write_fp(Repo *repo, const char *basename, const char *attrname, FILE *out)
+{
+  write_repo(repo, basename, attrname, out, 1);
+}
+
+void
+tool_write_jobs(Repo *repo, const char *basename, const char *attrname, int jobs)
+{
+  write_repo(repo, basename, attrname, stdout, jobs);
+}
+
+static void
+write_repo(Repo *repo, const char *basename, const char *attrname, FILE *out, int jobs)
 {
   Repodata *data;
   Repodata *info = 0;
@@ -206,25 +498,21 @@ tool_write(Repo *repo, const char *basename, const char *attrname)
   Queue addedfileprovides;
 
   memset(&kd, 0, sizeof(kd));
-  info = repo_add_repodata(repo, 0);
-  repodata_set_str(info, SOLVID_META, REPOSITORY_TOOLVERSION, LIBSOLV_TOOLVERSION);
   queue_init(&addedfileprovides);
   pool_addfileprovides_queue(repo->pool, &addedfileprovides, 0);
   if (addedfileprovides.count)
-    {
-      kd.haveaddedfileprovides = 1;
-      repodata_set_idarray(info, SOLVID_META, REPOSITORY_ADDEDFILEPROVIDES, &addedfileprovides);
-    }
-  queue_free(&addedfileprovides);
+    kd.haveaddedfileprovides = 1;
+  info = new_info(repo, &addedfileprovides);
 
   pool_freeidhashes(repo->pool);	/* free some mem */
 
   if (basename)
     {
       char fn[4096];
-      FILE *fp;
       int has_DU = 0;
       int has_FL = 0;
+      struct subfile *subfiles;
+      int nsubfiles = 0, nforks, guessed, written = 0;
 
       /* find languages and other info */
       FOR_REPODATAS(repo, i, data)
@@ -253,70 +541,80 @@ tool_write(Repo *repo, const char *basename, const char *attrname)
 	      languages[nlanguages++] = strdup(keyname + l);
 	    }
 	}
-      /* write language subfiles */
+      /* write language, DU and filelist subfiles */
+      subfiles = solv_calloc(nlanguages + 2, sizeof(struct subfile));
       for (i = 0; i < nlanguages; i++)
         {
 	  sprintf(fn, "%s.%s.solv", basename, languages[i]);
-	  if (!(fp = fopen(fn, "w")))
-	    {
-	      perror(fn);
-	      exit(1);
-	    }
-	  write_info(repo, fp, keyfilter_language, languages[i], info, fn);
-	  fclose(fp);
-	  kd.haveexternal = 1;
+	  add_subfile(subfiles + nsubfiles++, fn, keyfilter_language, languages[i]);
         }
-      /* write DU subfile */
       if (has_DU)
 	{
 	  sprintf(fn, "%s.DU.solv", basename);
-	  if (!(fp = fopen(fn, "w")))
-	    {
-	      perror(fn);
-	      exit(1);
-	    }
-	  write_info(repo, fp, keyfilter_DU, 0, info, fn);
-	  fclose(fp);
-	  kd.haveexternal = 1;
+	  add_subfile(subfiles + nsubfiles++, fn, keyfilter_DU, 0);
 	}
-      /* write filelist */
       if (has_FL)
 	{
 	  sprintf(fn, "%s.FL.solv", basename);
-	  if (!(fp = fopen(fn, "w")))
-	    {
-	      perror(fn);
-	      exit(1);
-	    }
-	  write_info(repo, fp, keyfilter_FL, 0, info, fn);
-	  fclose(fp);
-	  kd.haveexternal = 1;
+	  add_subfile(subfiles + nsubfiles++, fn, keyfilter_FL, 0);
 	}
-      /* write everything else */
+      if (nsubfiles)
+	kd.haveexternal = 1;
+      kd.languages = languages;
+      kd.nlanguages = nlanguages;
+      /* everything else goes to the main file */
       sprintf(fn, "%s.solv", basename);
-      if (!(fp = fopen(fn, "w")))
+
+      /* with the keys of all subfiles guessed this process writes
+         the main file, otherwise one of the subfiles before it */
+      nforks = jobs - 1 < nsubfiles ? jobs - 1 : nsubfiles;
+      guessed = nforks > 0;
+      FOR_REPODATAS(repo, i, data)
+	repodata_internalize(data);
+      for (i = 0; guessed && i < nsubfiles; i++)
+	if (guess_subfile_keys(repo, subfiles + i))
+	  guessed = 0;
+      if (!guessed && nforks > nsubfiles - 1)
+	nforks = nsubfiles - 1;
+      fork_subfiles(repo, subfiles, nforks);
+      if (guessed)
 	{
-	  perror(fn);
-	  exit(1);
+	  for (i = 0; i < nsubfiles; i++)
+	    add_info(info, &subfiles[i].guess, subfiles[i].fn);
+	  write_main(repo, fn, info, &kd);
+	  written = 1;
 	}
-      kd.languages = languages;
-      kd.nlanguages = nlanguages;
-      repodata_internalize(info);
-      if (repo_write_filtered(repo, fp, keyfilter_other, &kd, 0) != 0)
+      finish_subfiles(repo, subfiles, nsubfiles);
+      for (i = 0; guessed && i < nsubfiles; i++)
+	if (!queue_equal(&subfiles[i].guess, &subfiles[i].keyq))
+	  guessed = 0;
+      if (!guessed)
 	{
-	  fprintf(stderr, "repo_write failed\n");
-	  exit(1);
+	  if (written)
+	    {
+	      /* a wrong guess, write it again with the real keys */
+	      repodata_free(info);
+	      info = new_info(repo, &addedfileprovides);
+	    }
+	  for (i = 0; i < nsubfiles; i++)
+	    add_info(info, &subfiles[i].keyq, subfiles[i].fn);
+	  write_main(repo, fn, info, &kd);
 	}
-      if (fclose(fp) != 0)
+      for (i = 0; i < nsubfiles; i++)
 	{
-	  perror("fclose");
-	  exit(1);
+	  queue_free(&subfiles[i].keyq);
+	  queue_free(&subfiles[i].guess);
+	  solv_free(subfiles[i].fn);
 	}
+      solv_free(subfiles);
+      queue_free(&addedfileprovides);
       for (i = 0; i < nlanguages; i++)
 	free(languages[i]);
       solv_free(languages);
       repodata_free(info);
+      return;
     }
+  queue_free(&addedfileprovides);
   if (attrname)
     {
       FILE *fp;
@@ -327,7 +625,7 @@ tool_write(Repo *repo, const char *basename, const char *attrname)
       kd.haveexternal = 1;
     }
   repodata_internalize(info);
-  if (repo_write_filtered(repo, stdout, keyfilter_solv, &kd, 0) != 0)
+  if (write_buffered(repo, out, keyfilter_solv, &kd) != 0)
     {
       fprintf(stderr, "repo_write failed\n");
       exit(1);
@@ -8,8 +8,13 @@
 #ifndef COMMON_WRITE_H
 #define COMMON_WRITE_H
 
+#include <stdio.h>
 #include "repo.h"
 
 void tool_write(Repo *repo, const char *basename, const char *attrname);
+void tool_write_fp(Repo *repo, const char *basename, const char *attrname, FILE *out);
+/* like tool_write, the subfiles of basename are written by up to
+   jobs processes in all */
+void tool_write_jobs(Repo *repo, const char *basename, const char *attrname, int jobs);
 
 #endif
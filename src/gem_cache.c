@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2012, Novell Inc.
+ *
+ * This program is licensed under the BSD license, read LICENSE.BSD
+ * for further information
+ *
+ * gem_cache: persistent cache of parsed gems.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <solv/hash.h>
+
+#include "gem_cache.h"
+#include "gem_sha256.h"
+
+/* 2: the records have the locations of the gems, 3: their installed
+   sizes, 4: the keys have the device and the location, 5: the sha256
+   of the content instead of its crc32 */
+#define GEM_CACHE_MAGIC "GEMCACH5"
+#define GEM_CACHE_VERIFY 1
+/* the records have the checksums of the gems */
+#define GEM_CACHE_CHECKSUMS 2
+
+typedef struct GemCacheEntryHeader
+{
+    unsigned int pathlen;
+    unsigned int locationlen;
+    unsigned int reclen;
+    GemCacheKey key;
+} GemCacheEntryHeader;
+
+typedef struct GemCacheEntry
+{
+    const char *path;
+    const char *location;
+    GemCacheKey key;
+    const char *rec;
+    int reclen;
+} GemCacheEntry;
+
+struct GemCache
+{
+    char *filename;
+    int verify;
+    unsigned int flags;
+
+    /* the cache of the previous run, read only */
+    unsigned char *map;
+    size_t mapl;
+    GemCacheEntry *entries;
+    int nentries;
+    Hashtable ht;
+    Hashval htmask;
+
+    /* the cache of this run */
+    char *newfilename;
+    FILE *out;
+};
+
+static void gem_cache_load(GemCache *cache)
+{
+    GemCacheEntryHeader eh;
+    unsigned char *p, *end;
+    struct stat st;
+    unsigned int flags;
+    int fd, n;
+    Hashval h, hh;
+
+    if ((fd = open(cache->filename, O_RDONLY)) < 0)
+        return;
+    if (fstat(fd, &st) || st.st_size < 12) {
+        close(fd);
+        return;
+    }
+    cache->map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (cache->map == MAP_FAILED) {
+        cache->map = 0;
+        return;
+    }
+    cache->mapl = st.st_size;
+    memcpy(&flags, cache->map + 8, 4);
+    if (memcmp(cache->map, GEM_CACHE_MAGIC, 8) || flags != cache->flags)
+        return;
+
+    end = cache->map + cache->mapl;
+    for (p = cache->map + 12, n = 0; p + sizeof(eh) <= end; n++) {
+        memcpy(&eh, p, sizeof(eh));
+        p += sizeof(eh);
+        if (eh.pathlen == 0 || eh.locationlen == 0 || end - p < (long long) eh.pathlen + eh.locationlen + eh.reclen
+            || p[eh.pathlen - 1] || p[eh.pathlen + eh.locationlen - 1])
+            break;
+        if ((n & 255) == 0)
+            cache->entries = realloc(cache->entries, (n + 256) * sizeof(GemCacheEntry));
+        cache->entries[n].path = (const char *) p;
+        cache->entries[n].location = (const char *) p + eh.pathlen;
+        cache->entries[n].key = eh.key;
+        cache->entries[n].rec = (const char *) p + eh.pathlen + eh.locationlen;
+        cache->entries[n].reclen = eh.reclen;
+        p += eh.pathlen + eh.locationlen + eh.reclen;
+    }
+    cache->nentries = n;
+
+    cache->htmask = mkmask(n);
+    cache->ht = calloc(cache->htmask + 1, sizeof(Id));
+    for (n = 0; n < cache->nentries; n++) {
+        h = strhash(cache->entries[n].path) & cache->htmask;
+        hh = HASHCHAIN_START;
+        while (cache->ht[h])
+            h = HASHCHAIN_NEXT(h, hh, cache->htmask);
+        cache->ht[h] = n + 1;
+    }
+}
+
+GemCache *gem_cache_open(const char *filename, int verify, int checksums)
+{
+    GemCache *cache = calloc(1, sizeof(GemCache));
+
+    cache->filename = strdup(filename);
+    cache->verify = verify;
+    cache->flags = (verify ? GEM_CACHE_VERIFY : 0) | (checksums ? GEM_CACHE_CHECKSUMS : 0);
+    gem_cache_load(cache);
+
+    cache->newfilename = malloc(strlen(filename) + 5);
+    sprintf(cache->newfilename, "%s.new", filename);
+    if (!(cache->out = fopen(cache->newfilename, "w"))) {
+        fprintf(stderr, "%s: %s\n", cache->newfilename, strerror(errno));
+        gem_cache_close(cache);
+        return 0;
+    }
+    fwrite(GEM_CACHE_MAGIC, 8, 1, cache->out);
+    fwrite(&cache->flags, 4, 1, cache->out);
+    return cache;
+}
+
+int gem_cache_close(GemCache *cache)
+{
+    int ret = 0;
+
+    if (cache->out) {
+        if (fclose(cache->out) || rename(cache->newfilename, cache->filename)) {
+            fprintf(stderr, "%s: %s\n", cache->filename, strerror(errno));
+            unlink(cache->newfilename);
+            ret = -1;
+        }
+    }
+    if (cache->map)
+        munmap(cache->map, cache->mapl);
+    free(cache->entries);
+    free(cache->ht);
+    free(cache->newfilename);
+    free(cache->filename);
+    free(cache);
+    return ret;
+}
+
+static int gem_cache_checksum(const char *path, unsigned char *sum)
+{
+    unsigned char buf[65536];
+    GemSha256 *h;
+    ssize_t l;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return -1;
+    if (!(h = gem_sha256_new()) || gem_sha256_init(h)) {
+        gem_sha256_free(h);
+        close(fd);
+        return -1;
+    }
+    while ((l = read(fd, buf, sizeof(buf))) > 0)
+        gem_sha256_update(h, buf, l);
+    gem_sha256_final(h, sum);
+    gem_sha256_free(h);
+    close(fd);
+    return l < 0 ? -1 : 0;
+}
+
+int gem_cache_key(GemCache *cache, const char *path, GemCacheKey *key)
+{
+    struct stat st;
+
+    memset(key, 0, sizeof(GemCacheKey));
+    if (stat(path, &st))
+        return -1;
+    key->dev = st.st_dev;
+    key->ino = st.st_ino;
+    key->size = st.st_size;
+    key->mtime = st.st_mtim.tv_sec;
+    key->mtime_nsec = st.st_mtim.tv_nsec;
+    if (cache->verify && gem_cache_checksum(path, key->sha256))
+        return -1;
+    return 0;
+}
+
+static int gem_cache_key_equal(const GemCacheKey *k1, const GemCacheKey *k2)
+{
+    return k1->dev == k2->dev && k1->ino == k2->ino && k1->size == k2->size && k1->mtime == k2->mtime
+        && k1->mtime_nsec == k2->mtime_nsec && !memcmp(k1->sha256, k2->sha256, GEM_SHA256_LEN);
+}
+
+int gem_cache_fetch(GemCache *cache, const char *path, const char *location, const GemCacheKey *key, GemRecord *rec)
+{
+    GemCacheEntry *e;
+    Hashval h, hh;
+    Id id;
+
+    if (!cache->ht)
+        return 0;
+    h = strhash(path) & cache->htmask;
+    hh = HASHCHAIN_START;
+    while ((id = cache->ht[h]) != 0) {
+        e = cache->entries + id - 1;
+        if (!strcmp(e->path, path)) {
+            /* the records have the location */
+            if (!gem_cache_key_equal(&e->key, key) || strcmp(e->location, location))
+                return 0;
+            gem_record_reset(rec);
+            if (e->reclen > rec->alloc) {
+                rec->alloc = e->reclen;
+                rec->buf = realloc(rec->buf, rec->alloc);
+            }
+            memcpy(rec->buf, e->rec, e->reclen);
+            rec->len = e->reclen;
+            return 1;
+        }
+        h = HASHCHAIN_NEXT(h, hh, cache->htmask);
+    }
+    return 0;
+}
+
+void gem_cache_store(GemCache *cache, const char *path, const char *location, const GemCacheKey *key, const GemRecord *rec)
+{
+    GemCacheEntryHeader eh;
+
+    memset(&eh, 0, sizeof(eh));
+    eh.pathlen = strlen(path) + 1;
+    eh.locationlen = strlen(location) + 1;
+    eh.reclen = rec->len;
+    eh.key = *key;
+    fwrite(&eh, sizeof(eh), 1, cache->out);
+    fwrite(path, eh.pathlen, 1, cache->out);
+    fwrite(location, eh.locationlen, 1, cache->out);
+    fwrite(rec->buf, rec->len, 1, cache->out);
+}
@@ -0,0 +1,43 @@
+#ifndef GEM_CACHE_H
+#define GEM_CACHE_H
+
+#include "rubygems_parser.h"
+#include "gem_record.h"
+#include "gem_sha256.h"
+
+/*
+ * On-disk cache of parsed gems. Entries are keyed by the gem path
+ * plus device, inode, size and mtime (and optionally a content
+ * checksum) and the location the records have, and hold the recorded
+ * parser callbacks, so unchanged gems are replayed without opening
+ * the archive.
+ *
+ * The cache file is rewritten on close with the entries used in
+ * this run, so gems that went away are dropped from it.
+ */
+
+typedef struct GemCacheKey
+{
+    unsigned long long dev;
+    unsigned long long ino;
+    unsigned long long size;
+    long long mtime;
+    long long mtime_nsec;
+    /* sha256 of the file content, only with verify */
+    unsigned char sha256[GEM_SHA256_LEN];
+} GemCacheKey;
+
+/* checksums tells if the records have the checksums of the gems, a
+   cache with or without them is not used for the other */
+GemCache *gem_cache_open(const char *filename, int verify, int checksums);
+int gem_cache_close(GemCache *cache);
+
+/* fills key for the gem at path, returns -1 if it can't be read */
+int gem_cache_key(GemCache *cache, const char *path, GemCacheKey *key);
+/* copies the cached record for path into rec, returns 1 on a hit.
+   location is that of the gem in this run, see gem_parse_location */
+int gem_cache_fetch(GemCache *cache, const char *path, const char *location, const GemCacheKey *key, GemRecord *rec);
+/* adds path to the cache written by gem_cache_close */
+void gem_cache_store(GemCache *cache, const char *path, const char *location, const GemCacheKey *key, const GemRecord *rec);
+
+#endif
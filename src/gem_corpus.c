@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2012, Novell Inc.
+ *
+ * This program is licensed under the BSD license, read LICENSE.BSD
+ * for further information
+ *
+ * gem_corpus: a file of gem metadata to replay into the parser.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "gem_corpus.h"
+
+#define GEM_CORPUS_MAGIC "GEMCORP1"
+
+typedef struct GemCorpusIndex
+{
+    unsigned long long offset;
+    unsigned int locationlen;
+    unsigned int len;
+} GemCorpusIndex;
+
+typedef struct GemCorpusTrailer
+{
+    unsigned long long index;
+    unsigned long long count;
+    char magic[8];
+} GemCorpusTrailer;
+
+struct GemCorpus
+{
+    unsigned char *map;
+    size_t mapl;
+    /* in the map, which is page aligned and has the index at a
+       multiple of 8 */
+    const GemCorpusIndex *index;
+    int count;
+};
+
+struct GemCorpusWriter
+{
+    FILE *fp;
+    unsigned long long offset;
+    GemCorpusIndex *index;
+    int count;
+    /* an entry could not be added, the corpus is not finished */
+    int error;
+};
+
+int gem_is_corpus(const char *filename)
+{
+    char magic[8];
+    int fd, r;
+
+    if ((fd = open(filename, O_RDONLY)) < 0)
+        return 0;
+    r = read(fd, magic, 8) == 8 && !memcmp(magic, GEM_CORPUS_MAGIC, 8);
+    close(fd);
+    return r;
+}
+
+/* every entry is inside the data and has its NULs */
+static int gem_corpus_valid(const GemCorpus *corpus, unsigned long long end)
+{
+    const GemCorpusIndex *e;
+    int i;
+
+    for (i = 0; i < corpus->count; i++) {
+        e = corpus->index + i;
+        if (e->offset < 8 || e->offset > end || end - e->offset < (unsigned long long) e->locationlen + e->len + 2)
+            return 0;
+        if (corpus->map[e->offset + e->locationlen] || corpus->map[e->offset + e->locationlen + 1 + e->len])
+            return 0;
+    }
+    return 1;
+}
+
+GemCorpus *gem_corpus_open(const char *filename)
+{
+    GemCorpus *corpus;
+    GemCorpusTrailer tr;
+    struct stat st;
+    int fd;
+
+    if ((fd = open(filename, O_RDONLY)) < 0)
+        return 0;
+    if (fstat(fd, &st)) {
+        close(fd);
+        return 0;
+    }
+    if (st.st_size < 8 + (off_t) sizeof(tr)) {
+        close(fd);
+        errno = EINVAL;
+        return 0;
+    }
+    corpus = calloc(1, sizeof(GemCorpus));
+    corpus->mapl = st.st_size;
+    corpus->map = mmap(0, corpus->mapl, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (corpus->map == MAP_FAILED) {
+        free(corpus);
+        return 0;
+    }
+    /* the replay goes through it front to back */
+    madvise(corpus->map, corpus->mapl, MADV_SEQUENTIAL);
+
+    memcpy(&tr, corpus->map + corpus->mapl - sizeof(tr), sizeof(tr));
+    if (memcmp(corpus->map, GEM_CORPUS_MAGIC, 8) || memcmp(tr.magic, GEM_CORPUS_MAGIC, 8)
+        || tr.index % 8 || tr.index > corpus->mapl - sizeof(tr) || tr.count > 0x7fffffff
+        || corpus->mapl - sizeof(tr) - tr.index != tr.count * sizeof(GemCorpusIndex)) {
+        gem_corpus_close(corpus);
+        errno = EINVAL;
+        return 0;
+    }
+    corpus->index = (const GemCorpusIndex *) (corpus->map + tr.index);
+    corpus->count = tr.count;
+    if (!gem_corpus_valid(corpus, tr.index)) {
+        gem_corpus_close(corpus);
+        errno = EINVAL;
+        return 0;
+    }
+    return corpus;
+}
+
+void gem_corpus_close(GemCorpus *corpus)
+{
+    if (!corpus)
+        return;
+    munmap(corpus->map, corpus->mapl);
+    free(corpus);
+}
+
+int gem_corpus_count(const GemCorpus *corpus)
+{
+    return corpus->count;
+}
+
+const char *gem_corpus_entry(const GemCorpus *corpus, int i, const char **metadata, int *len)
+{
+    const GemCorpusIndex *e = corpus->index + i;
+    const char *location = (const char *) corpus->map + e->offset;
+
+    *metadata = location + e->locationlen + 1;
+    *len = e->len;
+    return location;
+}
+
+GemCorpusWriter *gem_corpus_writer_new(const char *filename)
+{
+    GemCorpusWriter *w;
+    FILE *fp;
+
+    if (!(fp = fopen(filename, "w")))
+        return 0;
+    w = calloc(1, sizeof(GemCorpusWriter));
+    w->fp = fp;
+    fwrite(GEM_CORPUS_MAGIC, 1, 8, fp);
+    w->offset = 8;
+    return w;
+}
+
+int gem_corpus_writer_add(GemCorpusWriter *w, const char *location, const char *metadata, int len)
+{
+    GemCorpusIndex *e;
+    size_t l = strlen(location);
+
+    if ((w->count & 1023) == 0) {
+        if (!(e = realloc(w->index, (w->count + 1024) * sizeof(GemCorpusIndex)))) {
+            w->error = ENOMEM;
+            errno = ENOMEM;
+            return -1;
+        }
+        w->index = e;
+    }
+    e = w->index + w->count++;
+    e->offset = w->offset;
+    e->locationlen = l;
+    e->len = len;
+    fwrite(location, 1, l + 1, w->fp);
+    fwrite(metadata, 1, len, w->fp);
+    putc(0, w->fp);
+    w->offset += l + len + 2;
+    return ferror(w->fp) ? -1 : 0;
+}
+
+int gem_corpus_writer_close(GemCorpusWriter *w)
+{
+    static const char pad[8];
+    GemCorpusTrailer tr;
+    int ret = 0, error = 0;
+
+    /* without all entries it is no corpus */
+    if (w->error) {
+        fclose(w->fp);
+        free(w->index);
+        error = w->error;
+        free(w);
+        errno = error;
+        return -1;
+    }
+
+    /* the index is read in place */
+    tr.index = (w->offset + 7) & ~7ULL;
+    tr.count = w->count;
+    memcpy(tr.magic, GEM_CORPUS_MAGIC, 8);
+    fwrite(pad, 1, tr.index - w->offset, w->fp);
+    fwrite(w->index, sizeof(GemCorpusIndex), w->count, w->fp);
+    fwrite(&tr, sizeof(tr), 1, w->fp);
+    if (ferror(w->fp)) {
+        ret = -1;
+        error = errno;
+    }
+    if (fclose(w->fp) && !ret) {
+        ret = -1;
+        error = errno;
+    }
+    free(w->index);
+    free(w);
+    if (ret)
+        errno = error;
+    return ret;
+}
@@ -0,0 +1,41 @@
+#ifndef GEM_CORPUS_H
+#define GEM_CORPUS_H
+
+/*
+ * A metadata corpus: the inflated YAML metadata of many gems with
+ * their locations, in one file. gemdump --capture writes it from the
+ * gems of a mirror, and the parser replays it (gem_parse_add_corpus)
+ * straight into the YAML parser and the callbacks, so these can be
+ * profiled on real metadata without reading, untarring and inflating
+ * the gems.
+ *
+ * The file is "GEMCORP1", the entries (location and metadata, each
+ * followed by a NUL), the index (offset, location and metadata length
+ * of every entry) and a trailer with the offset of the index, the
+ * number of entries and the magic again, so it is written in one pass
+ * and read with a single mmap.
+ */
+
+typedef struct GemCorpus GemCorpus;
+typedef struct GemCorpusWriter GemCorpusWriter;
+
+/* returns 1 if filename starts with the magic of a corpus */
+int gem_is_corpus(const char *filename);
+
+/* maps a corpus, 0 with errno set if it can't be read or is broken */
+GemCorpus *gem_corpus_open(const char *filename);
+void gem_corpus_close(GemCorpus *corpus);
+int gem_corpus_count(const GemCorpus *corpus);
+/* the location of entry i and its metadata, both valid until the
+   corpus is closed */
+const char *gem_corpus_entry(const GemCorpus *corpus, int i, const char **metadata, int *len);
+
+/* 0 with errno set if filename can't be created */
+GemCorpusWriter *gem_corpus_writer_new(const char *filename);
+/* returns -1 with errno set if the entry can't be added */
+int gem_corpus_writer_add(GemCorpusWriter *w, const char *location, const char *metadata, int len);
+/* writes the index, returns -1 with errno set if writing or adding an
+   entry failed */
+int gem_corpus_writer_close(GemCorpusWriter *w);
+
+#endif
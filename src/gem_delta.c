@@ -0,0 +1,554 @@
+/*
+ * Copyright (c) 2012, Novell Inc.
+ *
+ * This program is licensed under the BSD license, read LICENSE.BSD
+ * for further information
+ *
+ * gem_delta: deltas between generations of a rubygems solv file.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include <solv/pool.h>
+#include <solv/repo.h>
+#include <solv/repo_solv.h>
+#include <solv/chksum.h>
+#include "common_write.h"
+
+#include "gem_solv.h"
+#include "gem_delta.h"
+
+#define DELTA_VERSION "1"
+#define SHA256_LEN 32
+
+unsigned char *gem_delta_read_file(FILE *fp, size_t *lenp)
+{
+    unsigned char *buf = 0;
+    size_t len = 0, alloc = 0, r;
+
+    for (;;) {
+        if (len == alloc) {
+            alloc = alloc * 2 + 65536;
+            buf = solv_realloc(buf, alloc);
+        }
+        if (!(r = fread(buf + len, 1, alloc - len, fp)))
+            break;
+        len += r;
+    }
+    if (ferror(fp)) {
+        solv_free(buf);
+        return 0;
+    }
+    *lenp = len;
+    return buf;
+}
+
+static void sha256_hex(const unsigned char *buf, size_t len, char *hex)
+{
+    Chksum *chk = solv_chksum_create(REPOKEY_TYPE_SHA256);
+    const unsigned char *sum;
+    int l;
+
+    solv_chksum_add(chk, buf, len);
+    sum = solv_chksum_get(chk, &l);
+    solv_bin2hex(sum, l, hex);
+    solv_chksum_free(chk, 0);
+}
+
+/*
+ * What a gem is: the identity "name evr arch" plus a checksum of all
+ * its data. The data is hashed value by value and the value hashes
+ * are sorted, so the order in which a repo keeps the attributes (and
+ * Id versus string storage) does not matter.
+ */
+typedef struct DeltaGem
+{
+    char *ident;
+    unsigned char fp[SHA256_LEN];
+    Id p;
+} DeltaGem;
+
+static int cmp_digest(const void *a, const void *b, void *dp)
+{
+    return memcmp(a, b, SHA256_LEN);
+}
+
+static void gem_fingerprint(Repo *repo, Id p, unsigned char *fp)
+{
+    Pool *pool = repo->pool;
+    Dataiterator di;
+    Chksum *chk;
+    const char *str;
+    unsigned char *digests = 0;
+    int n = 0, l;
+
+    dataiterator_init(&di, pool, repo, p, 0, 0, 0);
+    while (dataiterator_step(&di)) {
+        str = repodata_stringify(pool, di.data, di.key, &di.kv, SEARCH_FILES | SEARCH_CHECKSUMS);
+        chk = solv_chksum_create(REPOKEY_TYPE_SHA256);
+        solv_chksum_add(chk, pool_id2str(pool, di.key->name), strlen(pool_id2str(pool, di.key->name)) + 1);
+        if (str)
+            solv_chksum_add(chk, str, strlen(str));
+        digests = solv_extend(digests, n * SHA256_LEN, SHA256_LEN, 1, 4095);
+        memcpy(digests + n++ * SHA256_LEN, solv_chksum_get(chk, &l), SHA256_LEN);
+        solv_chksum_free(chk, 0);
+    }
+    dataiterator_free(&di);
+    solv_sort(digests, n, SHA256_LEN, cmp_digest, 0);
+    chk = solv_chksum_create(REPOKEY_TYPE_SHA256);
+    solv_chksum_add(chk, digests, n * SHA256_LEN);
+    memcpy(fp, solv_chksum_get(chk, &l), SHA256_LEN);
+    solv_chksum_free(chk, 0);
+    solv_free(digests);
+}
+
+static char *gem_ident(Solvable *s)
+{
+    Pool *pool = s->repo->pool;
+    return solv_dupjoin(pool_id2str(pool, s->name), " ", pool_tmpjoin(pool, pool_id2str(pool, s->evr), " ", pool_id2str(pool, s->arch)));
+}
+
+static int cmp_gem(const void *a, const void *b, void *dp)
+{
+    const DeltaGem *ga = a, *gb = b;
+    int r = strcmp(ga->ident, gb->ident);
+    return r ? r : memcmp(ga->fp, gb->fp, SHA256_LEN);
+}
+
+static DeltaGem *delta_gems(Repo *repo, int *np)
+{
+    DeltaGem *gems = 0;
+    Solvable *s;
+    Id p;
+    int n = 0;
+
+    FOR_REPO_SOLVABLES(repo, p, s) {
+        gems = solv_extend(gems, n, 1, sizeof(DeltaGem), 1023);
+        gems[n].ident = gem_ident(s);
+        gem_fingerprint(repo, p, gems[n].fp);
+        gems[n++].p = p;
+    }
+    solv_sort(gems, n, sizeof(DeltaGem), cmp_gem, 0);
+    *np = n;
+    return gems;
+}
+
+static void free_gems(DeltaGem *gems, int n)
+{
+    int i;
+    for (i = 0; i < n; i++)
+        solv_free(gems[i].ident);
+    solv_free(gems);
+}
+
+/* the gems of gems[i] with the same identity */
+static int ident_end(DeltaGem *gems, int n, int i)
+{
+    int j;
+    for (j = i + 1; j < n && !strcmp(gems[j].ident, gems[i].ident); j++)
+        ;
+    return j;
+}
+
+static int remove_ident(Repo *repo, const char *ident)
+{
+    Solvable *s;
+    Id p;
+    char *id;
+    int count = 0;
+
+    FOR_REPO_SOLVABLES(repo, p, s) {
+        id = gem_ident(s);
+        if (!strcmp(id, ident)) {
+            repo_free_solvable_block(repo, p, 1, 1);
+            count++;
+        }
+        solv_free(id);
+    }
+    return count;
+}
+
+/* repo_add_solv from a buffer */
+static int add_solv_buf(Repo *repo, const unsigned char *buf, size_t len)
+{
+    FILE *fp = fmemopen((void *) buf, len, "r");
+    int ret;
+
+    if (!fp)
+        return pool_error(repo->pool, -1, "%s", strerror(errno));
+    ret = repo_add_solv(repo, fp, 0);
+    fclose(fp);
+    return ret;
+}
+
+/*
+ * The result is built again the way a run over the directory makes
+ * it: in the order of the walk, which is that of the locations, and
+ * with the texts shared as gem_solv shares them. It goes to a new pool
+ * that gets the Ids in that order too, as repo_write orders the
+ * relations by Id where their counts tie. Whatever order the base and
+ * the delta had, it is then byte for byte the file of a run over the
+ * new gems. The relations of each solvable are made first, in the
+ * order gem_solv makes those of a gem.
+ */
+typedef struct DeltaOrder
+{
+    char *location;
+    Id p;
+} DeltaOrder;
+
+static int cmp_location(const void *a, const void *b, void *dp)
+{
+    const DeltaOrder *oa = a, *ob = b;
+    int r = strcmp(oa->location, ob->location);
+    return r ? r : oa->p - ob->p;
+}
+
+/* id of from as an Id of to */
+static Id copy_id(Pool *from, Id id, Pool *to)
+{
+    Reldep *rd;
+
+    /* the same in every pool */
+    if (id == STRID_NULL || id == STRID_EMPTY)
+        return id;
+    if (ISRELDEP(id)) {
+        rd = GETRELDEP(from, id);
+        return pool_rel2id(to, copy_id(from, rd->name, to), copy_id(from, rd->evr, to), rd->flags, 1);
+    }
+    return pool_str2id(to, pool_id2str(from, id), 1);
+}
+
+static GemRel *solvable_rels(Repo *from, Offset o, Pool *to, GemRel *rels, Id *idp, int *np)
+{
+    Pool *pool = from->pool;
+    Reldep *rd;
+    Id *dp;
+
+    if (o)
+        for (dp = from->idarraydata + o; *dp; dp++) {
+            if (!ISRELDEP(*dp))
+                continue;
+            rd = GETRELDEP(pool, *dp);
+            rels = solv_extend(rels, *np, 1, sizeof(GemRel), 63);
+            rels[*np].name = copy_id(pool, rd->name, to);
+            rels[*np].evr = copy_id(pool, rd->evr, to);
+            rels[*np].flags = rd->flags;
+            rels[*np].idp = idp;
+            (*np)++;
+        }
+    return rels;
+}
+
+static Offset copy_deps(Repo *from, Offset o, Repo *to)
+{
+    Offset no = 0;
+    Id *ids;
+
+    if (o)
+        for (ids = from->idarraydata + o; *ids; ids++)
+            no = repo_addid_dep(to, no, copy_id(from->pool, *ids, to->pool), 0);
+    return no;
+}
+
+static int copy_attributes(Repo *from, Id p, Repodata *data, Id handle, GemTexts *texts)
+{
+    Pool *pool = from->pool, *to = data->repo->pool;
+    Dataiterator di;
+    Id key;
+    int ret = 0;
+
+    dataiterator_init(&di, pool, from, p, 0, 0, 0);
+    while (dataiterator_step(&di)) {
+        key = di.key->name;
+        /* the solvable has these */
+        if (key >= SOLVABLE_NAME && key <= SOLVABLE_ENHANCES)
+            continue;
+        if ((key == SOLVABLE_SUMMARY || key == SOLVABLE_DESCRIPTION)
+            && (di.key->type == REPOKEY_TYPE_STR || di.key->type == REPOKEY_TYPE_ID)) {
+            gem_texts_set(texts, data, handle, key, di.key->type == REPOKEY_TYPE_ID ? pool_id2str(pool, di.kv.id) : di.kv.str);
+            continue;
+        }
+        switch (di.key->type) {
+        case REPOKEY_TYPE_ID:
+            repodata_set_id(data, handle, key, copy_id(pool, di.kv.id, to));
+            break;
+        case REPOKEY_TYPE_CONSTANTID:
+            repodata_set_constantid(data, handle, key, copy_id(pool, di.kv.id, to));
+            break;
+        case REPOKEY_TYPE_IDARRAY:
+            repodata_add_idarray(data, handle, key, copy_id(pool, di.kv.id, to));
+            break;
+        case REPOKEY_TYPE_STR:
+            repodata_set_str(data, handle, key, di.kv.str);
+            break;
+        case REPOKEY_TYPE_NUM:
+            repodata_set_num(data, handle, key, SOLV_KV_NUM64(&di.kv));
+            break;
+        case REPOKEY_TYPE_CONSTANT:
+            repodata_set_constant(data, handle, key, di.kv.num);
+            break;
+        case REPOKEY_TYPE_VOID:
+            repodata_set_void(data, handle, key);
+            break;
+        default:
+            if (solv_chksum_len(di.key->type)) {
+                repodata_set_bin_checksum(data, handle, key, di.key->type, (const unsigned char *) di.kv.str);
+                break;
+            }
+            ret = pool_error(pool, -1, "%s has a %s attribute", pool_id2str(pool, key), pool_id2str(pool, di.key->type));
+            break;
+        }
+    }
+    dataiterator_free(&di);
+    return ret;
+}
+
+/* a repo of pool named like from with its solvables in the order of a
+   run, 0 with pool_errstr of from set on error */
+static Repo *canonical_repo(Repo *from, Pool *pool)
+{
+    Repo *repo = repo_create(pool, from->name);
+    Repodata *data = repo_add_repodata(repo, 0);
+    GemTexts texts;
+    GemRel *rels = 0;
+    Id relid;
+    DeltaOrder *order = 0;
+    Solvable *s, *ns;
+    const char *location;
+    Id p, np;
+    unsigned int medianr;
+    int i, n = 0, nrels;
+
+    FOR_REPO_SOLVABLES(from, p, s) {
+        location = solvable_lookup_location(s, &medianr);
+        order = solv_extend(order, n, 1, sizeof(DeltaOrder), 1023);
+        order[n].location = solv_strdup(location ? location : "");
+        order[n++].p = p;
+    }
+    solv_sort(order, n, sizeof(DeltaOrder), cmp_location, 0);
+
+    memset(&texts, 0, sizeof(texts));
+    for (i = 0; i < n; i++) {
+        np = repo_add_solvable(repo);
+        s = from->pool->solvables + order[i].p;
+        ns = pool->solvables + np;
+        ns->name = copy_id(from->pool, s->name, pool);
+        ns->evr = copy_id(from->pool, s->evr, pool);
+        ns->arch = copy_id(from->pool, s->arch, pool);
+        ns->vendor = copy_id(from->pool, s->vendor, pool);
+        nrels = 0;
+        rels = solvable_rels(from, s->provides, pool, rels, &relid, &nrels);
+        rels = solvable_rels(from, s->obsoletes, pool, rels, &relid, &nrels);
+        rels = solvable_rels(from, s->conflicts, pool, rels, &relid, &nrels);
+        rels = solvable_rels(from, s->requires, pool, rels, &relid, &nrels);
+        rels = solvable_rels(from, s->recommends, pool, rels, &relid, &nrels);
+        rels = solvable_rels(from, s->suggests, pool, rels, &relid, &nrels);
+        rels = solvable_rels(from, s->supplements, pool, rels, &relid, &nrels);
+        rels = solvable_rels(from, s->enhances, pool, rels, &relid, &nrels);
+        gem_make_rels(pool, rels, nrels);
+        ns->provides = copy_deps(from, s->provides, repo);
+        ns->obsoletes = copy_deps(from, s->obsoletes, repo);
+        ns->conflicts = copy_deps(from, s->conflicts, repo);
+        ns->requires = copy_deps(from, s->requires, repo);
+        ns->recommends = copy_deps(from, s->recommends, repo);
+        ns->suggests = copy_deps(from, s->suggests, repo);
+        ns->supplements = copy_deps(from, s->supplements, repo);
+        ns->enhances = copy_deps(from, s->enhances, repo);
+        if (copy_attributes(from, order[i].p, data, np, &texts))
+            break;
+    }
+    for (i = 0; i < n; i++)
+        solv_free(order[i].location);
+    solv_free(order);
+    solv_free(rels);
+    gem_texts_reset(&texts);
+    if (i < n) {
+        repo_free(repo, 1);
+        return 0;
+    }
+    repodata_internalize(data);
+    return repo;
+}
+
+/* base minus removed plus the solv data, written to a buffer */
+static int delta_result(Pool *pool, const unsigned char *base, size_t baselen, char **removed, int nremoved,
+                        const unsigned char *solv, size_t solvlen, char **resultp, size_t *resultlenp)
+{
+    Pool *rpool = pool_create(), *cpool = pool_create();
+    Repo *repo = repo_create(rpool, "rubygems"), *result;
+    FILE *fp;
+    int i, ret = -1;
+
+    *resultp = 0;
+    if (add_solv_buf(repo, base, baselen)) {
+        pool_error(pool, -1, "base: %s", pool_errstr(rpool));
+        goto out;
+    }
+    for (i = 0; i < nremoved; i++)
+        if (!remove_ident(repo, removed[i])) {
+            pool_error(pool, -1, "base has no %s", removed[i]);
+            goto out;
+        }
+    if (solvlen && add_solv_buf(repo, solv, solvlen)) {
+        pool_error(pool, -1, "delta: %s", pool_errstr(rpool));
+        goto out;
+    }
+    if (!(result = canonical_repo(repo, cpool))) {
+        pool_error(pool, -1, "%s", pool_errstr(rpool));
+        goto out;
+    }
+    fp = open_memstream(resultp, resultlenp);
+    tool_write_fp(result, 0, 0, fp);
+    if (fclose(fp)) {
+        pool_error(pool, -1, "%s", strerror(errno));
+        goto out;
+    }
+    ret = 0;
+out:
+    pool_free(rpool);
+    pool_free(cpool);
+    return ret;
+}
+
+int gem_delta_write(Repo *repo, const unsigned char *base, size_t baselen, FILE *deltafp, FILE *out)
+{
+    Pool *pool = repo->pool;
+    Pool *bpool = pool_create();
+    Repo *brepo = repo_create(bpool, "base");
+    DeltaGem *old = 0, *new = 0;
+    char **removed = 0;
+    char *solv = 0, *result = 0;
+    size_t solvlen, resultlen;
+    char basesum[2 * SHA256_LEN + 1], resultsum[2 * SHA256_LEN + 1];
+    FILE *fp;
+    int nold = 0, nnew = 0, nremoved = 0, nadded = 0;
+    int i, j, ie, je, c, ret = -1;
+
+    if (add_solv_buf(brepo, base, baselen)) {
+        pool_error(pool, -1, "base: %s", pool_errstr(bpool));
+        goto out;
+    }
+
+    /* walk both sorted lists one identity at a time */
+    old = delta_gems(brepo, &nold);
+    new = delta_gems(repo, &nnew);
+    for (i = j = 0; i < nold || j < nnew; i = ie, j = je) {
+        c = i == nold ? 1 : j == nnew ? -1 : strcmp(old[i].ident, new[j].ident);
+        ie = c <= 0 ? ident_end(old, nold, i) : i;
+        je = c >= 0 ? ident_end(new, nnew, j) : j;
+        if (c == 0 && ie - i == je - j) {
+            for (c = 0; c < ie - i; c++)
+                if (memcmp(old[i + c].fp, new[j + c].fp, SHA256_LEN))
+                    break;
+            if (c == ie - i) {
+                /* unchanged, not part of the delta */
+                for (c = j; c < je; c++)
+                    repo_free_solvable_block(repo, new[c].p, 1, 0);
+                continue;
+            }
+        }
+        if (ie > i) {
+            removed = solv_extend(removed, nremoved, 1, sizeof(char *), 63);
+            removed[nremoved++] = old[i].ident;
+        }
+        nadded += je - j;
+    }
+
+    fp = open_memstream(&solv, &solvlen);
+    if (nadded)
+        tool_write_fp(repo, 0, 0, fp);
+    if (fclose(fp)) {
+        pool_error(pool, -1, "%s", strerror(errno));
+        goto out;
+    }
+    /* the new file is what a client makes of the delta */
+    if (delta_result(pool, base, baselen, removed, nremoved, (unsigned char *) solv, solvlen, &result, &resultlen))
+        goto out;
+
+    sha256_hex(base, baselen, basesum);
+    sha256_hex((unsigned char *) result, resultlen, resultsum);
+    fprintf(deltafp, "=Delta: %s\n=Base: %s\n=Result: %s\n", DELTA_VERSION, basesum, resultsum);
+    for (i = 0; i < nremoved; i++)
+        fprintf(deltafp, "=Rm: %s\n", removed[i]);
+    fprintf(deltafp, "=Solv:\n");
+    fwrite(solv, 1, solvlen, deltafp);
+    fwrite(result, 1, resultlen, out);
+    if (fflush(deltafp) || ferror(deltafp) || fflush(out) || ferror(out)) {
+        pool_error(pool, -1, "%s", strerror(errno));
+        goto out;
+    }
+    ret = 0;
+out:
+    free_gems(old, nold);
+    free_gems(new, nnew);
+    solv_free(removed);
+    free(solv);
+    free(result);
+    pool_free(bpool);
+    return ret;
+}
+
+int gem_delta_apply(Pool *pool, const unsigned char *base, size_t baselen, FILE *delta, FILE *out)
+{
+    char line[4096], sum[2 * SHA256_LEN + 1];
+    char basesum[2 * SHA256_LEN + 1] = "", resultsum[2 * SHA256_LEN + 1] = "";
+    char **removed = 0;
+    unsigned char *solv = 0;
+    char *result = 0;
+    size_t solvlen = 0, resultlen, l;
+    int i, nremoved = 0, ret = -1;
+
+    if (!fgets(line, sizeof(line), delta) || strcmp(line, "=Delta: " DELTA_VERSION "\n"))
+        return pool_error(pool, -1, "not a delta of version " DELTA_VERSION);
+    while (fgets(line, sizeof(line), delta)) {
+        l = strlen(line);
+        if (!l || line[l - 1] != '\n')
+            break;
+        line[--l] = 0;
+        if (!strcmp(line, "=Solv:")) {
+            solv = gem_delta_read_file(delta, &solvlen);
+            break;
+        }
+        if (!strncmp(line, "=Base: ", 7) && l - 7 < sizeof(basesum))
+            strcpy(basesum, line + 7);
+        else if (!strncmp(line, "=Result: ", 9) && l - 9 < sizeof(resultsum))
+            strcpy(resultsum, line + 9);
+        else if (!strncmp(line, "=Rm: ", 5)) {
+            removed = solv_extend(removed, nremoved, 1, sizeof(char *), 63);
+            removed[nremoved++] = solv_strdup(line + 5);
+        }
+    }
+    if (!solv) {
+        pool_error(pool, -1, "truncated delta");
+        goto out;
+    }
+    sha256_hex(base, baselen, sum);
+    if (strcmp(sum, basesum)) {
+        pool_error(pool, -1, "the delta is not for this base");
+        goto out;
+    }
+    if (delta_result(pool, base, baselen, removed, nremoved, solv, solvlen, &result, &resultlen))
+        goto out;
+    sha256_hex((unsigned char *) result, resultlen, sum);
+    if (strcmp(sum, resultsum)) {
+        pool_error(pool, -1, "the result does not match the checksum of the delta");
+        goto out;
+    }
+    fwrite(result, 1, resultlen, out);
+    if (fflush(out) || ferror(out)) {
+        pool_error(pool, -1, "%s", strerror(errno));
+        goto out;
+    }
+    ret = 0;
+out:
+    for (i = 0; i < nremoved; i++)
+        solv_free(removed[i]);
+    solv_free(removed);
+    solv_free(solv);
+    free(result);
+    return ret;
+}
@@ -0,0 +1,41 @@
+#ifndef GEM_DELTA_H
+#define GEM_DELTA_H
+
+#include <stdio.h>
+#include <solv/repo.h>
+
+/*
+ * Deltas between two generations of a rubygems solv file, for clients
+ * that already have the old one. A delta is a short text header and
+ * the solv data of the added gems:
+ *
+ *   =Delta: 1
+ *   =Base: <sha256 of the old solv file>
+ *   =Result: <sha256 of the new solv file>
+ *   =Rm: <name> <evr> <arch>        one line per removed gem
+ *   =Solv:
+ *   <solv data>
+ *
+ * A gem whose content changed is removed and added again. Applying a
+ * delta loads the old file, drops the removed gems, adds the new ones
+ * and rebuilds the repo in the order of the locations, with the texts
+ * shared like a run shares them. rubygems2solv makes the new file in
+ * the same way, so old file plus delta gives it byte for byte, which
+ * the result checksum confirms (it can differ with another libsolv),
+ * and both are what a run over the directory writes.
+ */
+
+/* reads all of fp, returns 0 with errno set on error */
+unsigned char *gem_delta_read_file(FILE *fp, size_t *lenp);
+
+/* repo has all gems of the new generation, internalized; base is the
+   old solv file. Writes the delta to deltafp and the new solv file to
+   out. Unchanged gems are removed from repo. Returns -1 with
+   pool_errstr set on error */
+int gem_delta_write(Repo *repo, const unsigned char *base, size_t baselen, FILE *deltafp, FILE *out);
+
+/* applies delta to base and writes the result to out if it checks
+   out. Returns -1 with pool_errstr of pool set on error */
+int gem_delta_apply(Pool *pool, const unsigned char *base, size_t baselen, FILE *delta, FILE *out);
+
+#endif
@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2012, Novell Inc.
+ *
+ * This program is licensed under the BSD license, read LICENSE.BSD
+ * for further information
+ *
+ * gem_fanout: dispatches parser callbacks to several sinks.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "gem_fanout.h"
+
+/* calls cb on every sink that has it, the result is the first error */
+#define FANOUT(fan, cb, ...) do {                                       \
+        int i_, r_;                                                     \
+        for (i_ = 0; i_ < (fan)->nsinks; i_++) {                        \
+            ParseContext *s_ = (fan)->sinks[i_];                        \
+            if (s_->cb && (r_ = s_->cb(s_->data, ##__VA_ARGS__)) && !ret) \
+                ret = r_;                                               \
+        }                                                               \
+    } while (0)
+
+void gem_fanout_init(GemFanout *fan)
+{
+    memset(fan, 0, sizeof(GemFanout));
+}
+
+void gem_fanout_free(GemFanout *fan)
+{
+    free(fan->sinks);
+    memset(fan, 0, sizeof(GemFanout));
+}
+
+void gem_fanout_add(GemFanout *fan, ParseContext *sink)
+{
+    fan->sinks = realloc(fan->sinks, (fan->nsinks + 1) * sizeof(ParseContext *));
+    fan->sinks[fan->nsinks++] = sink;
+}
+
+static int fanout_parse_start(void *user_data)
+{
+    int ret = 0;
+    FANOUT((GemFanout *) user_data, gem_parse_start_callback);
+    return ret;
+}
+
+static int fanout_start(void *user_data, const char *filename)
+{
+    int ret = 0;
+    FANOUT((GemFanout *) user_data, gem_start_callback, filename);
+    return ret;
+}
+
+static int fanout_yaml(void *user_data, const char *buff, int len)
+{
+    int ret = 0;
+    FANOUT((GemFanout *) user_data, gem_yaml_metadata_callback, buff, len);
+    return ret;
+}
+
+static int fanout_attr(void *user_data, const char *attr, const char *val)
+{
+    int ret = 0;
+    FANOUT((GemFanout *) user_data, gem_attr_callback, attr, val);
+    return ret;
+}
+
+static int fanout_deps_start(void *user_data)
+{
+    int ret = 0;
+    FANOUT((GemFanout *) user_data, gem_deps_start_callback);
+    return ret;
+}
+
+static int fanout_dep(void *user_data, const char *name, const char *op, const char *version)
+{
+    int ret = 0;
+    FANOUT((GemFanout *) user_data, gem_dep_callback, name, op, version);
+    return ret;
+}
+
+static int fanout_deps_end(void *user_data)
+{
+    int ret = 0;
+    FANOUT((GemFanout *) user_data, gem_deps_end_callback);
+    return ret;
+}
+
+static int fanout_location(void *user_data, const char *location)
+{
+    int ret = 0;
+    FANOUT((GemFanout *) user_data, gem_location_callback, location);
+    return ret;
+}
+
+static int fanout_checksum(void *user_data, const char *sha256, unsigned long long size)
+{
+    int ret = 0;
+    FANOUT((GemFanout *) user_data, gem_checksum_callback, sha256, size);
+    return ret;
+}
+
+static int fanout_installsize(void *user_data, unsigned long long size)
+{
+    int ret = 0;
+    FANOUT((GemFanout *) user_data, gem_installsize_callback, size);
+    return ret;
+}
+
+static int fanout_end(void *user_data)
+{
+    int ret = 0;
+    FANOUT((GemFanout *) user_data, gem_end_callback);
+    return ret;
+}
+
+static int fanout_parse_end(void *user_data)
+{
+    int ret = 0;
+    FANOUT((GemFanout *) user_data, gem_parse_end_callback);
+    return ret;
+}
+
+static void fanout_error(void *user_data, const char *msg)
+{
+    GemFanout *fan = (GemFanout *) user_data;
+    int i;
+
+    for (i = 0; i < fan->nsinks; i++)
+        if (fan->sinks[i]->gem_parse_error_callback)
+            fan->sinks[i]->gem_parse_error_callback(fan->sinks[i]->data, msg);
+}
+
+void gem_fanout_context(ParseContext *ctx, GemFanout *fan)
+{
+    int i;
+
+    ctx->gem_parse_start_callback = fanout_parse_start;
+    ctx->gem_start_callback = fanout_start;
+    ctx->gem_yaml_metadata_callback = 0;
+    /* the yaml is only kept for the parse if somebody wants it */
+    for (i = 0; i < fan->nsinks; i++)
+        if (fan->sinks[i]->gem_yaml_metadata_callback)
+            ctx->gem_yaml_metadata_callback = fanout_yaml;
+    ctx->gem_attr_callback = fanout_attr;
+    ctx->gem_deps_start_callback = fanout_deps_start;
+    ctx->gem_dep_callback = fanout_dep;
+    ctx->gem_deps_end_callback = fanout_deps_end;
+    ctx->gem_location_callback = fanout_location;
+    /* likewise the checksum, for which the whole gem is read */
+    ctx->gem_checksum_callback = 0;
+    for (i = 0; i < fan->nsinks; i++)
+        if (fan->sinks[i]->gem_checksum_callback)
+            ctx->gem_checksum_callback = fanout_checksum;
+    ctx->gem_installsize_callback = fanout_installsize;
+    ctx->gem_end_callback = fanout_end;
+    ctx->gem_parse_end_callback = fanout_parse_end;
+    ctx->gem_parse_error_callback = fanout_error;
+    ctx->data = fan;
+}
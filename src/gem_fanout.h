@@ -0,0 +1,27 @@
+#ifndef GEM_FANOUT_H
+#define GEM_FANOUT_H
+
+#include "rubygems_parser.h"
+
+/*
+ * A GemFanout passes every parser event to a list of sinks, so one
+ * parse of the gems can feed several outputs. A sink is a ParseContext
+ * whose callbacks and data were set up by e.g. gem_solv_context_setup.
+ */
+typedef struct GemFanout
+{
+    ParseContext **sinks;
+    int nsinks;
+} GemFanout;
+
+void gem_fanout_init(GemFanout *fan);
+void gem_fanout_free(GemFanout *fan);
+/* sinks get the events in the order they were added */
+void gem_fanout_add(GemFanout *fan, ParseContext *sink);
+
+/* setup the callbacks of ctx to dispatch to the sinks of fan. Only
+   the callbacks and data of ctx are set, jobs, cache and stats are
+   left alone */
+void gem_fanout_context(ParseContext *ctx, GemFanout *fan);
+
+#endif
@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2012, Novell Inc.
+ *
+ * This program is licensed under the BSD license, read LICENSE.BSD
+ * for further information
+ *
+ * gem_inflate: single shot gunzip with libdeflate or zlib.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <zlib.h>
+#ifdef HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+#include "gem_inflate.h"
+
+#define GZIP_FHCRC 2
+#define GZIP_FEXTRA 4
+#define GZIP_FNAME 8
+#define GZIP_FCOMMENT 16
+#define GZIP_FRESERVED 0xe0
+
+struct GemInflater
+{
+#ifdef HAVE_LIBDEFLATE
+    struct libdeflate_decompressor *d;
+#else
+    z_stream strm;
+#endif
+};
+
+static unsigned int get32(const unsigned char *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (unsigned int) p[3] << 24;
+}
+
+static unsigned int gzip_crc32(unsigned int crc, const unsigned char *buf, size_t len)
+{
+#ifdef HAVE_LIBDEFLATE
+    /* uses pclmul or the arm crc instructions where available */
+    return libdeflate_crc32(crc, buf, len);
+#else
+    return crc32(crc, buf, len);
+#endif
+}
+
+GemInflater *gem_inflater_new(void)
+{
+    GemInflater *inf = calloc(1, sizeof(GemInflater));
+
+    if (!inf)
+        return 0;
+#ifdef HAVE_LIBDEFLATE
+    inf->d = libdeflate_alloc_decompressor();
+    if (!inf->d) {
+#else
+    /* raw deflate, the header and trailer are ours */
+    if (inflateInit2(&inf->strm, -MAX_WBITS) != Z_OK) {
+#endif
+        free(inf);
+        return 0;
+    }
+    return inf;
+}
+
+void gem_inflater_free(GemInflater *inf)
+{
+    if (!inf)
+        return;
+#ifdef HAVE_LIBDEFLATE
+    libdeflate_free_decompressor(inf->d);
+#else
+    inflateEnd(&inf->strm);
+#endif
+    free(inf);
+}
+
+long gem_gzip_isize(const unsigned char *in, size_t inlen)
+{
+    if (inlen < 18 || in[0] != 0x1f || in[1] != 0x8b)
+        return -1;
+    return get32(in + inlen - 4);
+}
+
+/* the offset of the deflate data, or 0 */
+static size_t gzip_header(const unsigned char *in, size_t inlen, const char **error)
+{
+    size_t pos = 10;
+    int flags;
+
+    if (inlen < 18 || in[0] != 0x1f || in[1] != 0x8b) {
+        *error = "not in gzip format";
+        return 0;
+    }
+    flags = in[3];
+    if (in[2] != Z_DEFLATED || (flags & GZIP_FRESERVED)) {
+        *error = "unknown compression method or flags";
+        return 0;
+    }
+    if (flags & GZIP_FEXTRA) {
+        if (pos + 2 > inlen)
+            goto truncated;
+        pos += 2 + (in[pos] | in[pos + 1] << 8);
+    }
+    if (flags & GZIP_FNAME) {
+        while (pos < inlen && in[pos])
+            pos++;
+        pos++;
+    }
+    if (flags & GZIP_FCOMMENT) {
+        while (pos < inlen && in[pos])
+            pos++;
+        pos++;
+    }
+    if (flags & GZIP_FHCRC) {
+        if (pos + 2 > inlen)
+            goto truncated;
+        if ((gzip_crc32(0, in, pos) & 0xffff) != (in[pos] | in[pos + 1] << 8)) {
+            *error = "header crc mismatch";
+            return 0;
+        }
+        pos += 2;
+    }
+    if (pos + 8 > inlen)
+        goto truncated;
+    return pos;
+
+truncated:
+    *error = "unexpected end of file";
+    return 0;
+}
+
+long gem_inflater_gunzip(GemInflater *inf, const unsigned char *in, size_t inlen,
+                         unsigned char *out, size_t outlen, const char **error)
+{
+    size_t pos, used, len;
+
+    if (!(pos = gzip_header(in, inlen, error)))
+        return -1;
+#ifdef HAVE_LIBDEFLATE
+    switch (libdeflate_deflate_decompress_ex(inf->d, in + pos, inlen - pos, out, outlen, &used, &len)) {
+    case LIBDEFLATE_SUCCESS:
+        break;
+    case LIBDEFLATE_INSUFFICIENT_SPACE:
+        *error = "uncompressed data larger than the trailer says";
+        return -1;
+    default:
+        *error = "invalid compressed data";
+        return -1;
+    }
+#else
+    if (inflateReset(&inf->strm) != Z_OK) {
+        *error = "zlib error";
+        return -1;
+    }
+    inf->strm.next_in = (unsigned char *) in + pos;
+    inf->strm.avail_in = inlen - pos;
+    inf->strm.next_out = out;
+    inf->strm.avail_out = outlen;
+    switch (inflate(&inf->strm, Z_FINISH)) {
+    case Z_STREAM_END:
+        break;
+    case Z_BUF_ERROR:
+        *error = inf->strm.avail_out ? "unexpected end of file" : "uncompressed data larger than the trailer says";
+        return -1;
+    default:
+        *error = inf->strm.msg ? inf->strm.msg : "invalid compressed data";
+        return -1;
+    }
+    used = inf->strm.total_in;
+    len = inf->strm.total_out;
+#endif
+    pos += used;
+    if (pos + 8 > inlen) {
+        *error = "unexpected end of file";
+        return -1;
+    }
+    if (get32(in + pos) != gzip_crc32(0, out, len)) {
+        *error = "incorrect data check";
+        return -1;
+    }
+    if (get32(in + pos + 4) != (unsigned int) len) {
+        *error = "incorrect length check";
+        return -1;
+    }
+    return len;
+}
+
+const char *gem_inflater_backend(void)
+{
+#ifdef HAVE_LIBDEFLATE
+    return "libdeflate";
+#else
+    return "zlib";
+#endif
+}
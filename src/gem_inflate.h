@@ -0,0 +1,31 @@
+#ifndef GEM_INFLATE_H
+#define GEM_INFLATE_H
+
+#include <stddef.h>
+
+/*
+ * Single shot gunzip of a gzip member that is completely in memory,
+ * as metadata.gz is once read from the gem. The gzip header is parsed
+ * here (FEXTRA, FNAME, FCOMMENT and FHCRC included), the deflate data
+ * goes to libdeflate if built with it (HAVE_LIBDEFLATE), to zlib
+ * otherwise, and the CRC32 and ISIZE of the trailer are checked.
+ */
+
+typedef struct GemInflater GemInflater;
+
+GemInflater *gem_inflater_new(void);
+void gem_inflater_free(GemInflater *inf);
+
+/* the uncompressed size from the trailer of the member in, modulo
+   2^32, or -1 if in is no gzip member */
+long gem_gzip_isize(const unsigned char *in, size_t inlen);
+
+/* inflates the member in into out, which has room for outlen bytes.
+   Returns the uncompressed length, or -1 with *error set */
+long gem_inflater_gunzip(GemInflater *inf, const unsigned char *in, size_t inlen,
+                         unsigned char *out, size_t outlen, const char **error);
+
+/* "libdeflate" or "zlib" */
+const char *gem_inflater_backend(void);
+
+#endif
@@ -0,0 +1,984 @@
+/*
+ * Copyright (c) 2012, Novell Inc.
+ *
+ * This program is licensed under the BSD license, read LICENSE.BSD
+ * for further information
+ *
+ * gem_marshal: reads the Ruby Marshal 4.8 gem indexes
+ * (Marshal.4.8.Z, specs.4.8.gz) and reports the gems found there
+ * through the ParseContext callbacks.
+ *
+ * The index is inflated and decoded incrementally: only one element
+ * of the top level container is decoded at a time, in an arena that
+ * is reset after it. What a later element may link back to has to
+ * outlive its element, so the index is read twice: the first pass
+ * only marks the objects that are the target of a link, and the
+ * second one keeps those in mr->objs (and the strings and versions
+ * marshal_retire keeps of them in mr->spool). The rest of the index
+ * costs a bit per object.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <zlib.h>
+
+#include <solv/pool.h>
+#include <solv/strpool.h>
+#include <solv/bitmap.h>
+
+#include "rubygems_parser.h"
+#include "gem_marshal.h"
+#include "gem_stats.h"
+
+#define MARSHAL_MAJOR 4
+#define MARSHAL_MINOR 8
+
+#define MARSHAL_BUFFER_SIZE 65536
+#define MARSHAL_ARENA_BLOCK 65536
+#define MARSHAL_MAX_DEPTH 64
+
+enum {
+    M_NIL,
+    M_TRUE,
+    M_FALSE,
+    M_INT,
+    M_STRING,
+    M_SYMBOL,
+    M_ARRAY,
+    M_HASH,
+    M_OBJECT,       /* 'o' and 'S': class, items are ivar name/value pairs */
+    M_USERDEF,      /* 'u': class, raw _dump data in str */
+    M_USRMARSHAL,   /* 'U': class, marshal_dump data in items[0] */
+    M_OTHER
+};
+
+typedef struct MValue
+{
+    int type;
+    long num;
+    const char *str;    /* string data, symbol or class name */
+    int len;
+    int n;
+    struct MValue **items;
+} MValue;
+
+typedef struct MArenaBlock
+{
+    struct MArenaBlock *next;
+    size_t used;
+    size_t size;
+    /* data follows */
+} MArenaBlock;
+
+typedef struct MArena
+{
+    MArenaBlock *blocks;
+} MArena;
+
+/* what survives of an object after the element that read it is done */
+typedef struct MObject
+{
+    int idx;            /* number of the object in the stream */
+    MValue *v;
+    int gen;
+    Id str;
+    int kind;
+} MObject;
+
+#define MOBJ_NONE    0
+#define MOBJ_STRING  1
+#define MOBJ_VERSION 2
+
+typedef struct MarshalReader
+{
+    ParseContext *ctx;
+
+    /* input window */
+    const unsigned char *p;
+    const unsigned char *end;
+
+    /* streamed input */
+    FILE *fp;
+    z_stream strm;
+    int inflating;
+    unsigned char *inbuf;
+    unsigned char *outbuf;
+
+    MArena arena;
+    /* symbols live as long as the reader */
+    MArena symarena;
+    const char **syms;
+    int nsyms;
+    /* the objects links may point to, ordered by idx */
+    MObject *objs;
+    int nobjs;
+    /* number of objects in the stream so far */
+    int nregistered;
+    /* the first pass, which only fills linked */
+    int scanning;
+    /* the objects that are the target of a link, all if not set up */
+    Map linked;
+    int gen;
+    Stringpool spool;
+
+    int depth;
+    int error;
+
+    /* the gem of the current element, for ctx->stats */
+    char gem[256];
+    unsigned long long bytes;
+} MarshalReader;
+
+static void marshal_error(MarshalReader *mr, const char *format, ...)
+{
+    va_list args;
+    char buffer[4096];
+
+    if (mr->error)
+        return;
+    mr->error = 1;
+    /* the second pass reports it */
+    if (mr->scanning)
+        return;
+    if (mr->ctx->gem_parse_error_callback) {
+        va_start(args, format);
+        vsnprintf(buffer, sizeof(buffer), format, args);
+        mr->ctx->gem_parse_error_callback(mr->ctx->data, buffer);
+        va_end(args);
+    }
+}
+
+static void *arena_alloc(MArena *a, size_t size)
+{
+    MArenaBlock *b = a->blocks;
+    void *r;
+
+    size = (size + 7) & ~(size_t) 7;
+    if (!b || b->used + size > b->size) {
+        size_t bsize = size > MARSHAL_ARENA_BLOCK ? size : MARSHAL_ARENA_BLOCK;
+        b = malloc(sizeof(MArenaBlock) + bsize);
+        b->used = 0;
+        b->size = bsize;
+        b->next = a->blocks;
+        a->blocks = b;
+    }
+    r = (char *) (b + 1) + b->used;
+    b->used += size;
+    return r;
+}
+
+/* frees all but one block */
+static void arena_reset(MArena *a)
+{
+    MArenaBlock *b, *next;
+
+    if (!a->blocks)
+        return;
+    for (b = a->blocks->next; b; b = next) {
+        next = b->next;
+        free(b);
+    }
+    a->blocks->next = 0;
+    a->blocks->used = 0;
+}
+
+static void arena_free(MArena *a)
+{
+    arena_reset(a);
+    free(a->blocks);
+    a->blocks = 0;
+}
+
+static int marshal_fill(MarshalReader *mr)
+{
+    int ret;
+
+    if (!mr->inflating) {
+        size_t l = mr->fp ? fread(mr->outbuf, 1, MARSHAL_BUFFER_SIZE, mr->fp) : 0;
+        if (!l)
+            return -1;
+        mr->p = mr->outbuf;
+        mr->end = mr->outbuf + l;
+        mr->bytes += l;
+        return 0;
+    }
+    mr->strm.next_out = mr->outbuf;
+    mr->strm.avail_out = MARSHAL_BUFFER_SIZE;
+    while (mr->strm.avail_out == MARSHAL_BUFFER_SIZE) {
+        if (mr->strm.avail_in == 0) {
+            size_t l = fread(mr->inbuf, 1, MARSHAL_BUFFER_SIZE, mr->fp);
+            if (!l)
+                return -1;
+            mr->strm.next_in = mr->inbuf;
+            mr->strm.avail_in = l;
+        }
+        ret = inflate(&mr->strm, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END)
+            break;
+        if (ret != Z_OK) {
+            marshal_error(mr, "Error decompressing index: %s", mr->strm.msg ? mr->strm.msg : "corrupt data");
+            return -1;
+        }
+    }
+    if (mr->strm.avail_out == MARSHAL_BUFFER_SIZE)
+        return -1;
+    mr->p = mr->outbuf;
+    mr->end = mr->outbuf + MARSHAL_BUFFER_SIZE - mr->strm.avail_out;
+    mr->bytes += mr->end - mr->p;
+    return 0;
+}
+
+static int marshal_getc(MarshalReader *mr)
+{
+    if (mr->p == mr->end && (mr->error || marshal_fill(mr))) {
+        marshal_error(mr, "Error reading index: unexpected end of data");
+        return -1;
+    }
+    return *mr->p++;
+}
+
+static int marshal_read(MarshalReader *mr, unsigned char *buf, long len)
+{
+    long l;
+
+    while (len > 0) {
+        if (mr->p == mr->end && (mr->error || marshal_fill(mr))) {
+            marshal_error(mr, "Error reading index: unexpected end of data");
+            return -1;
+        }
+        l = mr->end - mr->p;
+        if (l > len)
+            l = len;
+        memcpy(buf, mr->p, l);
+        mr->p += l;
+        buf += l;
+        len -= l;
+    }
+    return 0;
+}
+
+/* the packed integer encoding of marshal */
+static long marshal_long(MarshalReader *mr)
+{
+    int c = marshal_getc(mr), i, b;
+    long x;
+
+    if (c < 0)
+        return 0;
+    c = (signed char) c;
+    if (c == 0)
+        return 0;
+    if (c > 0) {
+        if (c > 4)
+            return c - 5;
+        for (x = 0, i = 0; i < c; i++) {
+            if ((b = marshal_getc(mr)) < 0)
+                return 0;
+            x |= (long) b << (8 * i);
+        }
+        return x;
+    }
+    if (c < -4)
+        return c + 5;
+    for (x = -1, i = 0; i < -c; i++) {
+        if ((b = marshal_getc(mr)) < 0)
+            return 0;
+        x &= ~(0xffL << (8 * i));
+        x |= (long) b << (8 * i);
+    }
+    return x;
+}
+
+static long marshal_len(MarshalReader *mr)
+{
+    long l = marshal_long(mr);
+    if (l < 0 || l > (1L << 30)) {
+        marshal_error(mr, "Error reading index: bad length %ld", l);
+        return -1;
+    }
+    return l;
+}
+
+/* reads length + bytes into the arena, NUL terminated */
+static char *marshal_bytes(MarshalReader *mr, MArena *arena, int *lenp)
+{
+    long l = marshal_len(mr);
+    char *s;
+
+    if (l < 0 || mr->error)
+        return 0;
+    s = arena_alloc(arena, l + 1);
+    if (marshal_read(mr, (unsigned char *) s, l))
+        return 0;
+    s[l] = 0;
+    if (lenp)
+        *lenp = l;
+    return s;
+}
+
+static MValue *marshal_new(MarshalReader *mr, int type)
+{
+    MValue *v = arena_alloc(&mr->arena, sizeof(MValue));
+    memset(v, 0, sizeof(MValue));
+    v->type = type;
+    return v;
+}
+
+/* returns the entry of the object in mr->objs, -1 if it isn't kept */
+static int marshal_register(MarshalReader *mr, MValue *v)
+{
+    MObject *o;
+    int idx = mr->nregistered++;
+
+    if (mr->scanning || (mr->linked.size && (idx >= mr->linked.size * 8 || !MAPTST(&mr->linked, idx))))
+        return -1;
+    mr->objs = solv_extend(mr->objs, mr->nobjs, 1, sizeof(MObject), 4095);
+    o = mr->objs + mr->nobjs;
+    o->idx = idx;
+    o->v = v;
+    o->gen = mr->gen;
+    o->str = 0;
+    o->kind = MOBJ_NONE;
+    return mr->nobjs++;
+}
+
+static const char *marshal_symbol_body(MarshalReader *mr)
+{
+    char *s = marshal_bytes(mr, &mr->symarena, 0);
+    if (!s)
+        return 0;
+    mr->syms = solv_extend(mr->syms, mr->nsyms, 1, sizeof(char *), 255);
+    mr->syms[mr->nsyms++] = s;
+    return s;
+}
+
+static MValue *marshal_value(MarshalReader *mr);
+
+static int marshal_skip_ivars(MarshalReader *mr)
+{
+    long n = marshal_len(mr), i;
+    for (i = 0; i < n && !mr->error; i++) {
+        marshal_value(mr);   /* name */
+        marshal_value(mr);   /* value */
+    }
+    return mr->error ? -1 : 0;
+}
+
+static const char *marshal_symbol(MarshalReader *mr)
+{
+    int c = marshal_getc(mr);
+    long i;
+    const char *s;
+
+    switch (c) {
+    case ':':
+        return marshal_symbol_body(mr);
+    case ';':
+        i = marshal_long(mr);
+        if (i < 0 || i >= mr->nsyms) {
+            marshal_error(mr, "Error reading index: bad symbol link");
+            return 0;
+        }
+        return mr->syms[i];
+    case 'I':
+        /* symbol with encoding */
+        if (marshal_getc(mr) != ':') {
+            marshal_error(mr, "Error reading index: bad symbol");
+            return 0;
+        }
+        s = marshal_symbol_body(mr);
+        marshal_skip_ivars(mr);
+        return s;
+    default:
+        if (c >= 0)
+            marshal_error(mr, "Error reading index: expected symbol, got 0x%02x", c);
+        return 0;
+    }
+}
+
+static MObject *marshal_object(MarshalReader *mr, long i)
+{
+    int lo = 0, hi = mr->nobjs, m;
+
+    while (lo < hi) {
+        m = (lo + hi) / 2;
+        if (mr->objs[m].idx < i)
+            lo = m + 1;
+        else
+            hi = m;
+    }
+    return lo < mr->nobjs && mr->objs[lo].idx == i ? mr->objs + lo : 0;
+}
+
+/* turns an object of an element that is done into a value again */
+static MValue *marshal_link(MarshalReader *mr, long i)
+{
+    MObject *o;
+    MValue *v, *s;
+
+    if (i < 0 || i >= mr->nregistered) {
+        marshal_error(mr, "Error reading index: bad object link");
+        return 0;
+    }
+    if (mr->scanning) {
+        if (i >= mr->linked.size * 8)
+            map_grow(&mr->linked, mr->nregistered + 65536);
+        MAPSET(&mr->linked, i);
+        return marshal_new(mr, M_NIL);
+    }
+    if (!(o = marshal_object(mr, i)))
+        return marshal_new(mr, M_NIL);
+    if (o->gen == mr->gen && o->v)
+        return o->v;
+    if (o->kind == MOBJ_NONE)
+        return marshal_new(mr, M_NIL);
+    s = marshal_new(mr, M_STRING);
+    s->str = stringpool_id2str(&mr->spool, o->str);
+    s->len = strlen(s->str);
+    if (o->kind == MOBJ_STRING)
+        return s;
+    /* Gem::Version, dumped as [version] */
+    v = marshal_new(mr, M_USRMARSHAL);
+    v->str = "Gem::Version";
+    v->n = 1;
+    v->items = arena_alloc(&mr->arena, sizeof(MValue *));
+    v->items[0] = marshal_new(mr, M_ARRAY);
+    v->items[0]->n = 1;
+    v->items[0]->items = arena_alloc(&mr->arena, sizeof(MValue *));
+    v->items[0]->items[0] = s;
+    return v;
+}
+
+static MValue *marshal_items(MarshalReader *mr, MValue *v, long n)
+{
+    long i;
+
+    v->n = n;
+    v->items = arena_alloc(&mr->arena, (n ? n : 1) * sizeof(MValue *));
+    for (i = 0; i < n; i++)
+        if (!(v->items[i] = marshal_value(mr)))
+            return 0;
+    return v;
+}
+
+static MValue *marshal_value(MarshalReader *mr)
+{
+    MValue *v;
+    int c, idx;
+    long n;
+
+    if (mr->error)
+        return 0;
+    if (++mr->depth > MARSHAL_MAX_DEPTH) {
+        marshal_error(mr, "Error reading index: nesting too deep");
+        return 0;
+    }
+    c = marshal_getc(mr);
+    switch (c) {
+    case '0':
+        v = marshal_new(mr, M_NIL);
+        break;
+    case 'T':
+        v = marshal_new(mr, M_TRUE);
+        break;
+    case 'F':
+        v = marshal_new(mr, M_FALSE);
+        break;
+    case 'i':
+        v = marshal_new(mr, M_INT);
+        v->num = marshal_long(mr);
+        break;
+    case ':':
+    case ';':
+        mr->p--;
+        v = marshal_new(mr, M_SYMBOL);
+        v->str = marshal_symbol(mr);
+        break;
+    case '@':
+        v = marshal_link(mr, marshal_long(mr));
+        break;
+    case 'I':
+        /* object with instance variables, like the string encoding */
+        v = marshal_value(mr);
+        marshal_skip_ivars(mr);
+        break;
+    case 'e':
+    case 'C':
+        /* extended by a module, subclass of a builtin */
+        marshal_symbol(mr);
+        mr->depth--;
+        return marshal_value(mr);
+    case '"':
+    case 'f':
+    case 'c':
+    case 'm':
+    case 'M':
+        v = marshal_new(mr, c == '"' ? M_STRING : M_OTHER);
+        v->str = marshal_bytes(mr, &mr->arena, &v->len);
+        marshal_register(mr, v);
+        break;
+    case '/':
+        v = marshal_new(mr, M_OTHER);
+        v->str = marshal_bytes(mr, &mr->arena, &v->len);
+        marshal_getc(mr);   /* options */
+        marshal_register(mr, v);
+        break;
+    case 'l':
+        v = marshal_new(mr, M_OTHER);
+        marshal_getc(mr);   /* sign */
+        n = marshal_len(mr);
+        if (n >= 0) {
+            unsigned char *b = arena_alloc(&mr->arena, 2 * n + 1);
+            marshal_read(mr, b, 2 * n);
+        }
+        marshal_register(mr, v);
+        break;
+    case '[':
+        v = marshal_new(mr, M_ARRAY);
+        marshal_register(mr, v);
+        if ((n = marshal_len(mr)) >= 0)
+            marshal_items(mr, v, n);
+        break;
+    case '{':
+    case '}':
+        v = marshal_new(mr, M_HASH);
+        marshal_register(mr, v);
+        if ((n = marshal_len(mr)) >= 0)
+            marshal_items(mr, v, 2 * n);
+        if (c == '}')
+            marshal_value(mr);  /* default */
+        break;
+    case 'o':
+    case 'S':
+        v = marshal_new(mr, M_OBJECT);
+        v->str = marshal_symbol(mr);
+        marshal_register(mr, v);
+        if ((n = marshal_len(mr)) >= 0)
+            marshal_items(mr, v, 2 * n);
+        break;
+    case 'u':
+        v = marshal_new(mr, M_USERDEF);
+        v->str = marshal_symbol(mr);
+        v->items = arena_alloc(&mr->arena, sizeof(MValue *));
+        v->items[0] = marshal_new(mr, M_STRING);
+        v->items[0]->str = marshal_bytes(mr, &mr->arena, &v->items[0]->len);
+        v->n = 1;
+        marshal_register(mr, v);
+        break;
+    case 'U':
+    case 'd':
+        v = marshal_new(mr, c == 'U' ? M_USRMARSHAL : M_OTHER);
+        v->str = marshal_symbol(mr);
+        idx = marshal_register(mr, v);
+        v->items = arena_alloc(&mr->arena, sizeof(MValue *));
+        v->items[0] = marshal_value(mr);
+        v->n = 1;
+        if (idx >= 0)
+            mr->objs[idx].v = v;
+        break;
+    default:
+        if (c >= 0)
+            marshal_error(mr, "Error reading index: unknown type 0x%02x", c);
+        v = 0;
+        break;
+    }
+    mr->depth--;
+    return mr->error ? 0 : v;
+}
+
+static const char *mstr(MValue *v)
+{
+    return v && v->type == M_STRING && v->str ? v->str : 0;
+}
+
+static MValue *mitem(MValue *v, int i)
+{
+    return v && (v->type == M_ARRAY || v->type == M_USRMARSHAL || v->type == M_USERDEF) && i < v->n ? v->items[i] : 0;
+}
+
+static MValue *mivar(MValue *v, const char *name)
+{
+    int i;
+    if (!v || v->type != M_OBJECT)
+        return 0;
+    for (i = 0; i + 1 < v->n; i += 2)
+        if (v->items[i]->type == M_SYMBOL && v->items[i]->str && !strcmp(v->items[i]->str, name))
+            return v->items[i + 1];
+    return 0;
+}
+
+static int mclass(MValue *v, int type, const char *klass)
+{
+    return v && v->type == type && v->str && !strcmp(v->str, klass);
+}
+
+/* Gem::Version is dumped as [version] */
+static const char *mversion(MValue *v)
+{
+    if (mclass(v, M_USRMARSHAL, "Gem::Version"))
+        return mstr(mitem(v->items[0], 0));
+    return mstr(v);
+}
+
+/* remembers the strings and versions of the element that is done */
+static void marshal_retire(MarshalReader *mr, int first)
+{
+    MObject *o;
+    const char *s;
+    int i;
+
+    for (i = first; i < mr->nobjs; i++) {
+        o = mr->objs + i;
+        if (!o->v)
+            continue;
+        if (o->v->type == M_STRING)
+            o->kind = MOBJ_STRING;
+        else if (mclass(o->v, M_USRMARSHAL, "Gem::Version"))
+            o->kind = MOBJ_VERSION;
+        s = o->kind == MOBJ_STRING ? mstr(o->v) : mversion(o->v);
+        if (!s || strlen(s) > 64)
+            o->kind = MOBJ_NONE;
+        if (o->kind != MOBJ_NONE)
+            o->str = stringpool_str2id(&mr->spool, s, 1);
+        o->v = 0;
+    }
+    mr->gen++;
+    arena_reset(&mr->arena);
+}
+
+static void attr(MarshalReader *mr, const char *name, const char *val)
+{
+    if (val && mr->ctx->gem_attr_callback)
+        mr->ctx->gem_attr_callback(mr->ctx->data, name, val);
+}
+
+static const char *platform_str(MarshalReader *mr, MValue *v, char *buf, int bufl)
+{
+    const char *cpu, *os, *version;
+
+    if (mstr(v))
+        return mstr(v);
+    if (!mclass(v, M_OBJECT, "Gem::Platform"))
+        return 0;
+    cpu = mstr(mivar(v, "@cpu"));
+    os = mstr(mivar(v, "@os"));
+    version = mstr(mivar(v, "@version"));
+    snprintf(buf, bufl, "%s%s%s%s%s", cpu ? cpu : "", cpu && os ? "-" : "", os ? os : "",
+             version ? "-" : "", version ? version : "");
+    return buf;
+}
+
+static void emit_start(MarshalReader *mr, const char *name, const char *version, const char *platform)
+{
+    char full_name[1024];
+    char location[1100];
+
+    if (platform && *platform && strcmp(platform, "ruby"))
+        snprintf(full_name, sizeof(full_name), "%s-%s-%s", name, version, platform);
+    else
+        snprintf(full_name, sizeof(full_name), "%s-%s", name, version);
+    snprintf(location, sizeof(location), "downloads/%s.gem", full_name);
+
+    snprintf(mr->gem, sizeof(mr->gem), "%s", location + 10);
+    if (mr->ctx->gem_start_callback)
+        mr->ctx->gem_start_callback(mr->ctx->data, location + 10);
+    attr(mr, "name", name);
+    attr(mr, "version", version);
+    attr(mr, "platform", platform ? platform : "ruby");
+    if (mr->ctx->gem_location_callback)
+        mr->ctx->gem_location_callback(mr->ctx->data, location);
+}
+
+static void emit_requirements(MarshalReader *mr, const char *name, MValue *req)
+{
+    MValue *reqs, *r;
+    const char *op, *version;
+    int i;
+
+    /* Gem::Requirement is dumped as [[[op, version], ...]] */
+    if (!mclass(req, M_USRMARSHAL, "Gem::Requirement"))
+        return;
+    reqs = mitem(req->items[0], 0);
+    for (i = 0; (r = mitem(reqs, i)) != 0; i++) {
+        op = mstr(mitem(r, 0));
+        version = mversion(mitem(r, 1));
+        if (op && version && mr->ctx->gem_dep_callback)
+            mr->ctx->gem_dep_callback(mr->ctx->data, name, op, version);
+    }
+}
+
+static void emit_dependencies(MarshalReader *mr, MValue *deps)
+{
+    MValue *dep, *type, *req;
+    const char *name;
+    int i;
+
+    if (!deps || deps->type != M_ARRAY)
+        return;
+    if (mr->ctx->gem_deps_start_callback)
+        mr->ctx->gem_deps_start_callback(mr->ctx->data);
+    for (i = 0; i < deps->n; i++) {
+        dep = deps->items[i];
+        if (!mclass(dep, M_OBJECT, "Gem::Dependency") || !(name = mstr(mivar(dep, "@name"))))
+            continue;
+        /* like the index, only runtime dependencies are requirements */
+        type = mivar(dep, "@type");
+        if (type && type->type == M_SYMBOL && type->str && strcmp(type->str, "runtime"))
+            continue;
+        req = mivar(dep, "@requirement");
+        if (!req)
+            req = mivar(dep, "@version_requirements");
+        emit_requirements(mr, name, req);
+    }
+    if (mr->ctx->gem_deps_end_callback)
+        mr->ctx->gem_deps_end_callback(mr->ctx->data);
+}
+
+static void emit_licenses(MarshalReader *mr, MValue *licenses)
+{
+    char buf[1024];
+    int i, l = 0;
+    const char *s;
+
+    buf[0] = 0;
+    for (i = 0; (s = mstr(mitem(licenses, i))) != 0; i++)
+        l += snprintf(buf + l, l < sizeof(buf) ? sizeof(buf) - l : 0, "%s%s", i ? ";" : "", s);
+    if (buf[0])
+        attr(mr, "license", buf);
+}
+
+/*
+ * Gem::Specification#_dump:
+ * [rubygems_version, specification_version, name, version, date,
+ *  summary, required_ruby_version, required_rubygems_version,
+ *  original_platform, dependencies, rubyforge_project, email, authors,
+ *  description, homepage, has_rdoc, new_platform, licenses, metadata]
+ */
+static void emit_specification(MarshalReader *mr, MValue *spec)
+{
+    MarshalReader nested;
+    MValue *s;
+    const char *name, *version, *platform;
+    char platformbuf[256];
+    int c;
+
+    /* the _dump data is a marshal stream of its own */
+    memset(&nested, 0, sizeof(nested));
+    nested.ctx = mr->ctx;
+    nested.p = (const unsigned char *) spec->items[0]->str;
+    nested.end = nested.p + spec->items[0]->len;
+    stringpool_init_empty(&nested.spool);
+    if ((c = marshal_getc(&nested)) != MARSHAL_MAJOR || marshal_getc(&nested) != MARSHAL_MINOR) {
+        if (c >= 0)
+            marshal_error(&nested, "Error reading index: bad Gem::Specification");
+        s = 0;
+    }
+    else
+        s = marshal_value(&nested);
+
+    name = mstr(mitem(s, 2));
+    version = mversion(mitem(s, 3));
+    if (!name || !version) {
+        marshal_error(&nested, "Error reading index: bad Gem::Specification");
+    }
+    else {
+        platform = platform_str(mr, mitem(s, 16), platformbuf, sizeof(platformbuf));
+        if (!platform)
+            platform = platform_str(mr, mitem(s, 8), platformbuf, sizeof(platformbuf));
+        emit_start(mr, name, version, platform);
+        emit_dependencies(mr, mitem(s, 9));
+        attr(mr, "description", mstr(mitem(s, 13)));
+        attr(mr, "email", mstr(mitem(s, 11)));
+        attr(mr, "homepage", mstr(mitem(s, 14)));
+        emit_licenses(mr, mitem(s, 17));
+        attr(mr, "rubygems_version", mstr(mitem(s, 0)));
+        attr(mr, "summary", mstr(mitem(s, 5)));
+        if (mr->ctx->gem_end_callback)
+            mr->ctx->gem_end_callback(mr->ctx->data);
+    }
+
+    arena_free(&nested.arena);
+    arena_free(&nested.symarena);
+    solv_free(nested.syms);
+    solv_free(nested.objs);
+    stringpool_free(&nested.spool);
+}
+
+/* reports one element of the index */
+static void emit_element(MarshalReader *mr, MValue *v)
+{
+    const char *name, *version, *platform;
+    char platformbuf[256];
+
+    if (mclass(v, M_USERDEF, "Gem::Specification")) {
+        emit_specification(mr, v);
+        return;
+    }
+    if (!v || v->type != M_ARRAY)
+        return;
+    /* Marshal.4.8: [full_name, spec] */
+    if (v->n == 2 && mclass(v->items[1], M_USERDEF, "Gem::Specification")) {
+        emit_specification(mr, v->items[1]);
+        return;
+    }
+    /* specs.4.8: [name, version, platform] */
+    if (v->n == 3 && (name = mstr(v->items[0])) && (version = mversion(v->items[1]))) {
+        platform = platform_str(mr, v->items[2], platformbuf, sizeof(platformbuf));
+        emit_start(mr, name, version, platform);
+        if (mr->ctx->gem_end_callback)
+            mr->ctx->gem_end_callback(mr->ctx->data);
+    }
+}
+
+/* decodes the elements of the top level container one by one */
+static int marshal_index(MarshalReader *mr)
+{
+    GemStats *stats = mr->ctx->stats;
+    MValue *v;
+    const char *klass;
+    long n, i;
+    int c, first, ishash;
+    double t = 0;
+
+    c = marshal_getc(mr);
+    if (c == 'o') {
+        /* Gem::SourceIndex, the gems are in @gems */
+        klass = marshal_symbol(mr);
+        marshal_register(mr, 0);
+        n = marshal_len(mr);
+        for (i = 0; i < n && !mr->error; i++) {
+            const char *ivar = marshal_symbol(mr);
+            if (ivar && !strcmp(ivar, "@gems"))
+                return marshal_index(mr);
+            first = mr->nobjs;
+            marshal_value(mr);
+            marshal_retire(mr, first);
+        }
+        if (!mr->error)
+            marshal_error(mr, "Error reading index: no gems in %s", klass ? klass : "index");
+        return -1;
+    }
+    if (c != '[' && c != '{') {
+        if (c >= 0)
+            marshal_error(mr, "Error reading index: unexpected type 0x%02x", c);
+        return -1;
+    }
+    ishash = c == '{';
+    marshal_register(mr, 0);
+    n = marshal_len(mr);
+    for (i = 0; i < n && !mr->error; i++) {
+        if (stats && !mr->scanning)
+            t = gem_stats_now();
+        mr->gem[0] = 0;
+        first = mr->nobjs;
+        if (ishash)
+            marshal_value(mr);  /* full name */
+        v = marshal_value(mr);
+        if (v && !mr->scanning)
+            emit_element(mr, v);
+        marshal_retire(mr, first);
+        if (stats && !mr->scanning) {
+            t = gem_stats_now() - t;
+            gem_stats_add(stats, GEM_STAGE_MARSHAL, t, 0);
+            if (mr->error)
+                gem_stats_error(stats, GEM_STAGE_MARSHAL);
+            if (mr->gem[0] || mr->error)
+                gem_stats_gem_done(stats, mr->gem[0] ? mr->gem : 0, t, mr->error);
+        }
+    }
+    return mr->error ? -1 : 0;
+}
+
+/* reads up to the start of the marshal data, plain or zlib/gzip compressed */
+static int marshal_open(MarshalReader *mr, const char *filename)
+{
+    unsigned char magic[2];
+
+    rewind(mr->fp);
+    if (mr->inflating) {
+        inflateEnd(&mr->strm);
+        mr->inflating = 0;
+    }
+    mr->p = mr->end = 0;
+    mr->bytes = 0;
+    if (fread(magic, 1, 2, mr->fp) == 2 && magic[0] == MARSHAL_MAJOR && magic[1] == MARSHAL_MINOR)
+        return 0;
+    rewind(mr->fp);
+    memset(&mr->strm, 0, sizeof(mr->strm));
+    if (inflateInit2(&mr->strm, 32 + MAX_WBITS) != Z_OK) {
+        marshal_error(mr, "Error initializing zlib");
+        return -1;
+    }
+    mr->inflating = 1;
+    if (marshal_getc(mr) == MARSHAL_MAJOR && marshal_getc(mr) == MARSHAL_MINOR)
+        return 0;
+    marshal_error(mr, "%s: not a marshal 4.8 index", filename);
+    return -1;
+}
+
+int gem_parse_add_marshal_index(ParseContext *ctx, const char *filename)
+{
+    MarshalReader mr;
+    int ret = -1;
+    double t = 0;
+
+    memset(&mr, 0, sizeof(mr));
+    mr.ctx = ctx;
+    if (!(mr.fp = fopen(filename, "r"))) {
+        marshal_error(&mr, "Error opening %s", filename);
+        return -1;
+    }
+    mr.inbuf = malloc(MARSHAL_BUFFER_SIZE);
+    mr.outbuf = malloc(MARSHAL_BUFFER_SIZE);
+    stringpool_init_empty(&mr.spool);
+
+    /* find the objects that are linked to. If that fails all are
+       kept, and the second pass reports the error where it is */
+    if (ctx->stats)
+        t = gem_stats_now();
+    mr.scanning = 1;
+    map_init(&mr.linked, 0);
+    if (!marshal_open(&mr, filename))
+        marshal_index(&mr);
+    if (ctx->stats)
+        gem_stats_add(ctx->stats, GEM_STAGE_MARSHAL, gem_stats_now() - t, 0);
+    if (mr.error || !mr.linked.size)
+        map_free(&mr.linked);
+    if (!mr.error && !mr.linked.size)
+        map_init(&mr.linked, 1);    /* no links, keep nothing */
+    mr.scanning = 0;
+    mr.error = 0;
+    mr.nregistered = 0;
+    mr.syms = solv_free(mr.syms);
+    mr.nsyms = 0;
+    arena_reset(&mr.arena);
+    arena_reset(&mr.symarena);
+
+    if (!marshal_open(&mr, filename))
+        ret = marshal_index(&mr);
+    if (mr.inflating)
+        inflateEnd(&mr.strm);
+
+    if (ctx->stats)
+        ctx->stats->stages[GEM_STAGE_MARSHAL].bytes += mr.bytes;
+    fclose(mr.fp);
+    free(mr.inbuf);
+    free(mr.outbuf);
+    arena_free(&mr.arena);
+    arena_free(&mr.symarena);
+    solv_free(mr.syms);
+    solv_free(mr.objs);
+    map_free(&mr.linked);
+    stringpool_free(&mr.spool);
+    return ret;
+}
+
+int gem_is_marshal_index(const char *filename)
+{
+    const char *base = strrchr(filename, '/');
+
+    base = base ? base + 1 : filename;
+    return !strncmp(base, "Marshal.4.8", 11) || strstr(base, "specs.4.8") != 0;
+}
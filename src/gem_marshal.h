@@ -0,0 +1,18 @@
+#ifndef GEM_MARSHAL_H
+#define GEM_MARSHAL_H
+
+#include "rubygems_parser.h"
+
+/*
+ * Reader for the Ruby Marshal 4.8 indexes of a gem repository:
+ * Marshal.4.8(.Z) with the full specifications, and
+ * (latest_|prerelease_)specs.4.8(.gz) with name, version and
+ * platform only. Each gem is reported through the ParseContext
+ * callbacks, with the location of the gem in the repository.
+ */
+
+/* returns 1 if filename looks like a marshal index */
+int gem_is_marshal_index(const char *filename);
+int gem_parse_add_marshal_index(ParseContext *ctx, const char *filename);
+
+#endif
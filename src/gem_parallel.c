@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) 2012, Novell Inc.
+ *
+ * This program is licensed under the BSD license, read LICENSE.BSD
+ * for further information
+ *
+ * gem_parallel: parses gems on a pool of worker threads and
+ * replays the results in order on the calling thread.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <limits.h>
+
+#include "rubygems_parser.h"
+#include "gem_record.h"
+#include "gem_cache.h"
+#include "gem_stats.h"
+#include "gem_parallel.h"
+
+/* records in flight per worker */
+#define GEM_WINDOW_PER_JOB 4
+
+typedef struct GemSlot
+{
+    const char *path;
+    GemRecord rec;
+    GemCacheKey key;
+    int cacheable;
+    GemStats stats;
+    int done;
+} GemSlot;
+
+typedef struct GemPool
+{
+    ParseContext *ctx;
+    /* only read by the workers, written by the committer */
+    GemCache *cache;
+    GemPathSource *src;
+    /* INT_MAX until a worker ran past the last path */
+    int npaths;
+
+    GemSlot *slots;
+    int nslots;
+    int next;
+    int committed;
+
+    pthread_mutex_t lock;
+    pthread_cond_t done_cond;
+    pthread_cond_t space_cond;
+} GemPool;
+
+static void *gem_worker(void *arg)
+{
+    GemPool *gp = (GemPool *) arg;
+    ParseContext wctx;
+    GemScratch *scratch = 0;
+    GemSlot *slot;
+    int i;
+
+    for (;;) {
+        pthread_mutex_lock(&gp->lock);
+        while (gp->next < gp->npaths && gp->next - gp->committed >= gp->nslots)
+            pthread_cond_wait(&gp->space_cond, &gp->lock);
+        if (gp->next >= gp->npaths) {
+            pthread_mutex_unlock(&gp->lock);
+            break;
+        }
+        i = gp->next++;
+        pthread_mutex_unlock(&gp->lock);
+
+        /* the slot is ours until the committer has replayed it */
+        slot = gp->slots + i % gp->nslots;
+        if (!(slot->path = gp->src->path(gp->src->data, i))) {
+            pthread_mutex_lock(&gp->lock);
+            if (i < gp->npaths)
+                gp->npaths = i;
+            pthread_cond_broadcast(&gp->done_cond);
+            pthread_cond_broadcast(&gp->space_cond);
+            pthread_mutex_unlock(&gp->lock);
+            break;
+        }
+        gem_record_reset(&slot->rec);
+        gem_stats_init(&slot->stats);
+        slot->cacheable = gp->cache && !gem_cache_key(gp->cache, slot->path, &slot->key);
+        if (!slot->cacheable || !gem_cache_fetch(gp->cache, slot->path, gem_parse_location(gp->ctx, slot->path), &slot->key, &slot->rec)) {
+            gem_record_context(&wctx, &slot->rec, gp->ctx);
+            if (gp->ctx->stats)
+                wctx.stats = &slot->stats;
+            /* the buffers of the worker go from gem to gem */
+            wctx.scratch = scratch;
+            slot->rec.ret = gem_parse_rubygem(&wctx, slot->path);
+            scratch = wctx.scratch;
+            wctx.scratch = 0;
+            gem_parse_context_free(&wctx);
+        }
+        else
+            slot->stats.cache_hits = 1;
+
+        pthread_mutex_lock(&gp->lock);
+        slot->done = 1;
+        pthread_cond_broadcast(&gp->done_cond);
+        pthread_mutex_unlock(&gp->lock);
+    }
+    gem_scratch_free(scratch);
+    return 0;
+}
+
+static int gem_parse_serial(ParseContext *ctx, GemPathSource *src)
+{
+    const char *path;
+    int i, ret = 0;
+
+    for (i = 0; (path = src->path(src->data, i)) != 0; i++) {
+        if (gem_parse_add_rubygem(ctx, path) != 0)
+            ret = -1;
+        src->done(src->data, i);
+    }
+    return ret;
+}
+
+static int gem_parse_threads(ParseContext *ctx, GemPathSource *src, int nthreads)
+{
+    GemPool gp;
+    pthread_t *threads;
+    GemSlot *slot;
+    int i, r, end, ret = 0;
+    double t = 0;
+
+    memset(&gp, 0, sizeof(gp));
+    gp.ctx = ctx;
+    if (!ctx->gem_yaml_metadata_callback)
+        gp.cache = ctx->cache;
+    gp.src = src;
+    gp.npaths = INT_MAX;
+    gp.nslots = nthreads * GEM_WINDOW_PER_JOB;
+    gp.slots = calloc(gp.nslots, sizeof(GemSlot));
+    pthread_mutex_init(&gp.lock, 0);
+    pthread_cond_init(&gp.done_cond, 0);
+    pthread_cond_init(&gp.space_cond, 0);
+
+    threads = calloc(nthreads, sizeof(pthread_t));
+    for (i = 0; i < nthreads; i++)
+        pthread_create(threads + i, 0, gem_worker, &gp);
+
+    /* commit in path order, so the callbacks see the same
+       sequence as a serial run and never run concurrently */
+    for (i = 0;; i++) {
+        slot = gp.slots + i % gp.nslots;
+        pthread_mutex_lock(&gp.lock);
+        while (!slot->done && i < gp.npaths)
+            pthread_cond_wait(&gp.done_cond, &gp.lock);
+        end = !slot->done;
+        pthread_mutex_unlock(&gp.lock);
+        if (end)
+            break;
+
+        if (ctx->stats)
+            t = gem_stats_now();
+        r = gem_record_replay(&slot->rec, ctx);
+        if (ctx->stats) {
+            gem_stats_add(&slot->stats, GEM_STAGE_CALLBACKS, gem_stats_now() - t, 0);
+            gem_stats_merge(ctx->stats, &slot->stats);
+            gem_stats_gem_done(ctx->stats, slot->path, gem_stats_time(&slot->stats), r);
+        }
+        if (r != 0)
+            ret = -1;
+        else if (slot->cacheable)
+            gem_cache_store(gp.cache, slot->path, gem_parse_location(ctx, slot->path), &slot->key, &slot->rec);
+        src->done(src->data, i);
+
+        pthread_mutex_lock(&gp.lock);
+        slot->done = 0;
+        gp.committed++;
+        pthread_cond_broadcast(&gp.space_cond);
+        pthread_mutex_unlock(&gp.lock);
+    }
+
+    for (i = 0; i < nthreads; i++)
+        pthread_join(threads[i], 0);
+    free(threads);
+
+    for (i = 0; i < gp.nslots; i++)
+        gem_record_free(&gp.slots[i].rec);
+    free(gp.slots);
+    pthread_mutex_destroy(&gp.lock);
+    pthread_cond_destroy(&gp.done_cond);
+    pthread_cond_destroy(&gp.space_cond);
+    return ret;
+}
+
+int gem_parse_source(ParseContext *ctx, GemPathSource *src)
+{
+    if (ctx->jobs <= 1)
+        return gem_parse_serial(ctx, src);
+    return gem_parse_threads(ctx, src, ctx->jobs);
+}
+
+typedef struct GemPathArray
+{
+    char **paths;
+    int npaths;
+} GemPathArray;
+
+static const char *array_path(void *data, int i)
+{
+    GemPathArray *a = (GemPathArray *) data;
+    return i < a->npaths ? a->paths[i] : 0;
+}
+
+static void array_done(void *data, int i)
+{
+}
+
+int gem_parse_parallel(ParseContext *ctx, char **paths, int npaths)
+{
+    GemPathArray a;
+    GemPathSource src;
+    int nthreads = ctx->jobs;
+
+    a.paths = paths;
+    a.npaths = npaths;
+    src.path = array_path;
+    src.done = array_done;
+    src.data = &a;
+    if (nthreads > npaths)
+        nthreads = npaths;
+    if (nthreads < 1)
+        nthreads = 1;
+    return gem_parse_threads(ctx, &src, nthreads);
+}
+
+/* reads the cgroup v2 or v1 cpu quota, 0 if unlimited */
+static int cgroup_cpu_quota(void)
+{
+    FILE *fp;
+    char max[32];
+    long long quota = -1, period = 0;
+
+    if ((fp = fopen("/sys/fs/cgroup/cpu.max", "r")) != 0) {
+        if (fscanf(fp, "%31s %lld", max, &period) == 2 && strcmp(max, "max"))
+            quota = atoll(max);
+        fclose(fp);
+    }
+    else {
+        if ((fp = fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "r")) != 0) {
+            if (fscanf(fp, "%lld", &quota) != 1)
+                quota = -1;
+            fclose(fp);
+        }
+        if ((fp = fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us", "r")) != 0) {
+            if (fscanf(fp, "%lld", &period) != 1)
+                period = 0;
+            fclose(fp);
+        }
+    }
+    if (quota <= 0 || period <= 0)
+        return 0;
+    return (quota + period - 1) / period;
+}
+
+int gem_parse_default_jobs(void)
+{
+    cpu_set_t set;
+    int ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int quota = cgroup_cpu_quota();
+
+    if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0)
+        ncpus = CPU_COUNT(&set);
+    if (quota > 0 && quota < ncpus)
+        ncpus = quota;
+    return ncpus > 0 ? ncpus : 1;
+}
@@ -0,0 +1,31 @@
+#ifndef GEM_PARALLEL_H
+#define GEM_PARALLEL_H
+
+#include "rubygems_parser.h"
+
+/* a stream of gem paths: path(data, i) returns the i-th path, waiting
+   until it is known, or 0 after the last one. It is called from the
+   worker threads and must stay valid until done(data, i), which comes
+   in increasing order of i */
+typedef struct GemPathSource
+{
+    const char *(*path)(void *data, int i);
+    void (*done)(void *data, int i);
+    void *data;
+} GemPathSource;
+
+/* parses the paths of src with ctx->jobs worker threads (or on the
+   calling thread if ctx->jobs <= 1), running the callbacks of ctx on
+   the calling thread in path order */
+int gem_parse_source(ParseContext *ctx, GemPathSource *src);
+
+/* the same for an array of paths */
+int gem_parse_parallel(ParseContext *ctx, char **paths, int npaths);
+
+/* parses one gem with the callbacks of ctx, no cache and no record
+   of the stats of the gem (rubygems_parser.c) */
+int gem_parse_rubygem(ParseContext *ctx, const char *rubygem);
+/* the location the callbacks get for rubygem (rubygems_parser.c) */
+const char *gem_parse_location(ParseContext *ctx, const char *rubygem);
+
+#endif
@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2012, Novell Inc.
+ *
+ * This program is licensed under the BSD license, read LICENSE.BSD
+ * for further information
+ *
+ * gem_prefetch: reads gems ahead of the parser on I/O threads.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "gem_prefetch.h"
+
+/* I/O threads; they only block in open, the reads are asynchronous */
+#define PREFETCH_THREADS 8
+/* the tar headers and metadata.gz usually are in there */
+#define PREFETCH_HEAD 65536
+
+typedef struct PrefetchThread
+{
+    struct GemPrefetch *pf;
+    int n;
+} PrefetchThread;
+
+struct GemPrefetch
+{
+    GemPathSource *src;
+    int window;
+    /* 0 to read all of the gem, else what the parser reads of it */
+    off_t readlen;
+
+    pthread_mutex_t lock;
+    /* a thread waits for work, the parser for a read to finish */
+    pthread_cond_t work, idle;
+    pthread_t *threads;
+    PrefetchThread *pts;
+    int nthreads;
+    int stop;
+
+    /* one after the last path the parser asked for */
+    int wanted;
+    /* the next path to read ahead */
+    int next;
+    /* INT_MAX until the end of src is seen */
+    int end;
+    /* the path each thread reads, -1 if none; the parser must not be
+       done with it before */
+    int *busy;
+};
+
+/* starts reading what gem_parse_rubygem will read */
+static void prefetch_read(const char *path, off_t len)
+{
+    int fd;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        return;
+    /* the kernel reads it while we go on; metadata.gz is the first
+       member, and the head seldom is too short for it */
+    posix_fadvise(fd, 0, len, POSIX_FADV_WILLNEED);
+    close(fd);
+}
+
+static void *prefetch_worker(void *arg)
+{
+    PrefetchThread *pt = (PrefetchThread *) arg;
+    GemPrefetch *pf = pt->pf;
+    const char *path;
+    int i;
+
+    pthread_mutex_lock(&pf->lock);
+    for (;;) {
+        /* never behind the parser */
+        if (pf->next < pf->wanted)
+            pf->next = pf->wanted;
+        if (pf->stop)
+            break;
+        if (pf->next >= pf->end || pf->next >= pf->wanted + pf->window) {
+            pthread_cond_wait(&pf->work, &pf->lock);
+            continue;
+        }
+        i = pf->next++;
+        pf->busy[pt->n] = i;
+        pthread_mutex_unlock(&pf->lock);
+
+        path = pf->src->path(pf->src->data, i);
+        if (path)
+            prefetch_read(path, pf->readlen);
+
+        pthread_mutex_lock(&pf->lock);
+        if (!path && i < pf->end)
+            pf->end = i;
+        pf->busy[pt->n] = -1;
+        pthread_cond_broadcast(&pf->idle);
+    }
+    pthread_mutex_unlock(&pf->lock);
+    return 0;
+}
+
+static const char *prefetch_path(void *data, int i)
+{
+    GemPrefetch *pf = (GemPrefetch *) data;
+
+    pthread_mutex_lock(&pf->lock);
+    if (i >= pf->wanted) {
+        /* usually one more gem fits in the window */
+        if (i == pf->wanted)
+            pthread_cond_signal(&pf->work);
+        else
+            pthread_cond_broadcast(&pf->work);
+        pf->wanted = i + 1;
+    }
+    pthread_mutex_unlock(&pf->lock);
+    return pf->src->path(pf->src->data, i);
+}
+
+static int prefetch_busy(GemPrefetch *pf, int i)
+{
+    int t;
+
+    for (t = 0; t < pf->nthreads; t++)
+        if (pf->busy[t] == i)
+            return 1;
+    return 0;
+}
+
+static void prefetch_done(void *data, int i)
+{
+    GemPrefetch *pf = (GemPrefetch *) data;
+
+    pthread_mutex_lock(&pf->lock);
+    while (prefetch_busy(pf, i))
+        pthread_cond_wait(&pf->idle, &pf->lock);
+    pthread_mutex_unlock(&pf->lock);
+    pf->src->done(pf->src->data, i);
+}
+
+GemPrefetch *gem_prefetch_new(GemPathSource *src, int window, int whole, GemPathSource *out)
+{
+    GemPrefetch *pf = calloc(1, sizeof(GemPrefetch));
+    int i;
+
+    pf->src = src;
+    pf->window = window;
+    pf->readlen = whole ? 0 : PREFETCH_HEAD;
+    pf->end = INT_MAX;
+    pthread_mutex_init(&pf->lock, 0);
+    pthread_cond_init(&pf->work, 0);
+    pthread_cond_init(&pf->idle, 0);
+    pf->nthreads = window < PREFETCH_THREADS ? window : PREFETCH_THREADS;
+    pf->busy = malloc(pf->nthreads * sizeof(int));
+    pf->threads = calloc(pf->nthreads, sizeof(pthread_t));
+    pf->pts = calloc(pf->nthreads, sizeof(PrefetchThread));
+    for (i = 0; i < pf->nthreads; i++) {
+        pf->busy[i] = -1;
+        pf->pts[i].pf = pf;
+        pf->pts[i].n = i;
+    }
+    for (i = 0; i < pf->nthreads; i++)
+        pthread_create(pf->threads + i, 0, prefetch_worker, pf->pts + i);
+
+    out->path = prefetch_path;
+    out->done = prefetch_done;
+    out->data = pf;
+    return pf;
+}
+
+void gem_prefetch_free(GemPrefetch *pf)
+{
+    int i;
+
+    pthread_mutex_lock(&pf->lock);
+    pf->stop = 1;
+    pthread_cond_broadcast(&pf->work);
+    pthread_mutex_unlock(&pf->lock);
+    for (i = 0; i < pf->nthreads; i++)
+        pthread_join(pf->threads[i], 0);
+    free(pf->threads);
+    free(pf->pts);
+    free(pf->busy);
+    pthread_mutex_destroy(&pf->lock);
+    pthread_cond_destroy(&pf->work);
+    pthread_cond_destroy(&pf->idle);
+    free(pf);
+}
@@ -0,0 +1,20 @@
+#ifndef GEM_PREFETCH_H
+#define GEM_PREFETCH_H
+
+#include "gem_parallel.h"
+
+/*
+ * Reads the gems of a path source ahead of the parser. Up to window
+ * gems after the one the parser asked for last are opened on a few
+ * I/O threads, which have the kernel read their start (the tar headers
+ * and metadata.gz), or all of them, with posix_fadvise, so that on a
+ * cold cache or a slow disk the parser finds them in the page cache.
+ */
+typedef struct GemPrefetch GemPrefetch;
+
+/* points out to the paths of src, read ahead. With whole set all of
+   every gem is read, for its checksum */
+GemPrefetch *gem_prefetch_new(GemPathSource *src, int window, int whole, GemPathSource *out);
+void gem_prefetch_free(GemPrefetch *pf);
+
+#endif
@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) 2012, Novell Inc.
+ *
+ * This program is licensed under the BSD license, read LICENSE.BSD
+ * for further information
+ *
+ * gem_record: records parser callbacks for later replay.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "gem_record.h"
+
+enum {
+    GEM_EV_START = 1,
+    GEM_EV_YAML,
+    GEM_EV_ATTR,
+    GEM_EV_DEPS_START,
+    GEM_EV_DEP,
+    GEM_EV_DEPS_END,
+    GEM_EV_END,
+    GEM_EV_ERROR,
+    GEM_EV_LOCATION,
+    GEM_EV_CHECKSUM,
+    GEM_EV_INSTALLSIZE
+};
+
+void gem_record_init(GemRecord *rec)
+{
+    memset(rec, 0, sizeof(GemRecord));
+}
+
+void gem_record_reset(GemRecord *rec)
+{
+    rec->len = 0;
+    rec->ret = 0;
+}
+
+void gem_record_free(GemRecord *rec)
+{
+    free(rec->buf);
+    memset(rec, 0, sizeof(GemRecord));
+}
+
+static char *record_extend(GemRecord *rec, int l)
+{
+    char *p;
+    if (rec->len + l > rec->alloc) {
+        rec->alloc = (rec->len + l) * 2 + 256;
+        rec->buf = realloc(rec->buf, rec->alloc);
+    }
+    p = rec->buf + rec->len;
+    rec->len += l;
+    return p;
+}
+
+static void record_byte(GemRecord *rec, int c)
+{
+    *record_extend(rec, 1) = c;
+}
+
+static void record_str(GemRecord *rec, const char *s)
+{
+    int l;
+    if (!s)
+        s = "";
+    l = strlen(s) + 1;
+    memcpy(record_extend(rec, l), s, l);
+}
+
+static int record_start(void *user_data, const char *filename)
+{
+    GemRecord *rec = (GemRecord *) user_data;
+    record_byte(rec, GEM_EV_START);
+    record_str(rec, filename);
+    return 0;
+}
+
+static int record_yaml(void *user_data, const char *buff, int len)
+{
+    GemRecord *rec = (GemRecord *) user_data;
+    record_byte(rec, GEM_EV_YAML);
+    memcpy(record_extend(rec, sizeof(int)), &len, sizeof(int));
+    memcpy(record_extend(rec, len), buff, len);
+    return 0;
+}
+
+static int record_attr(void *user_data, const char *attr, const char *val)
+{
+    GemRecord *rec = (GemRecord *) user_data;
+    record_byte(rec, GEM_EV_ATTR);
+    record_str(rec, attr);
+    record_str(rec, val);
+    return 0;
+}
+
+static int record_deps_start(void *user_data)
+{
+    record_byte((GemRecord *) user_data, GEM_EV_DEPS_START);
+    return 0;
+}
+
+static int record_dep(void *user_data, const char *name, const char *op, const char *version)
+{
+    GemRecord *rec = (GemRecord *) user_data;
+    record_byte(rec, GEM_EV_DEP);
+    record_str(rec, name);
+    record_str(rec, op);
+    record_str(rec, version);
+    return 0;
+}
+
+static int record_deps_end(void *user_data)
+{
+    record_byte((GemRecord *) user_data, GEM_EV_DEPS_END);
+    return 0;
+}
+
+static int record_location(void *user_data, const char *location)
+{
+    GemRecord *rec = (GemRecord *) user_data;
+    record_byte(rec, GEM_EV_LOCATION);
+    record_str(rec, location);
+    return 0;
+}
+
+static int record_checksum(void *user_data, const char *sha256, unsigned long long size)
+{
+    GemRecord *rec = (GemRecord *) user_data;
+    record_byte(rec, GEM_EV_CHECKSUM);
+    record_str(rec, sha256);
+    memcpy(record_extend(rec, sizeof(size)), &size, sizeof(size));
+    return 0;
+}
+
+static int record_installsize(void *user_data, unsigned long long size)
+{
+    GemRecord *rec = (GemRecord *) user_data;
+    record_byte(rec, GEM_EV_INSTALLSIZE);
+    memcpy(record_extend(rec, sizeof(size)), &size, sizeof(size));
+    return 0;
+}
+
+static int record_end(void *user_data)
+{
+    record_byte((GemRecord *) user_data, GEM_EV_END);
+    return 0;
+}
+
+static void record_error(void *user_data, const char *msg)
+{
+    GemRecord *rec = (GemRecord *) user_data;
+    record_byte(rec, GEM_EV_ERROR);
+    record_str(rec, msg);
+}
+
+void gem_record_context(ParseContext *rctx, GemRecord *rec, const ParseContext *parent)
+{
+    gem_parse_context_initialize(rctx);
+    rctx->gem_start_callback = record_start;
+    if (parent && parent->gem_yaml_metadata_callback)
+        rctx->gem_yaml_metadata_callback = record_yaml;
+    rctx->gem_attr_callback = record_attr;
+    rctx->gem_deps_start_callback = record_deps_start;
+    rctx->gem_dep_callback = record_dep;
+    rctx->gem_deps_end_callback = record_deps_end;
+    rctx->gem_location_callback = record_location;
+    /* it has the parser read the whole gem */
+    if (parent && parent->gem_checksum_callback)
+        rctx->gem_checksum_callback = record_checksum;
+    rctx->gem_installsize_callback = record_installsize;
+    rctx->gem_end_callback = record_end;
+    rctx->gem_parse_error_callback = record_error;
+    rctx->data = rec;
+    /* the locations are those the parent would report */
+    if (parent)
+        rctx->location_base = parent->location_base;
+}
+
+int gem_record_replay(const GemRecord *rec, ParseContext *ctx)
+{
+    const char *p = rec->buf;
+    const char *end = rec->buf + rec->len;
+    const char *s1, *s2, *s3;
+    unsigned long long size;
+    int len;
+
+    while (p < end) {
+        switch (*p++) {
+        case GEM_EV_START:
+            s1 = p; p += strlen(p) + 1;
+            if (ctx->gem_start_callback)
+                ctx->gem_start_callback(ctx->data, s1);
+            break;
+        case GEM_EV_YAML:
+            memcpy(&len, p, sizeof(int));
+            p += sizeof(int);
+            if (ctx->gem_yaml_metadata_callback)
+                ctx->gem_yaml_metadata_callback(ctx->data, p, len);
+            p += len;
+            break;
+        case GEM_EV_ATTR:
+            s1 = p; p += strlen(p) + 1;
+            s2 = p; p += strlen(p) + 1;
+            if (ctx->gem_attr_callback)
+                ctx->gem_attr_callback(ctx->data, s1, s2);
+            break;
+        case GEM_EV_DEPS_START:
+            if (ctx->gem_deps_start_callback)
+                ctx->gem_deps_start_callback(ctx->data);
+            break;
+        case GEM_EV_DEP:
+            s1 = p; p += strlen(p) + 1;
+            s2 = p; p += strlen(p) + 1;
+            s3 = p; p += strlen(p) + 1;
+            if (ctx->gem_dep_callback)
+                ctx->gem_dep_callback(ctx->data, s1, s2, s3);
+            break;
+        case GEM_EV_DEPS_END:
+            if (ctx->gem_deps_end_callback)
+                ctx->gem_deps_end_callback(ctx->data);
+            break;
+        case GEM_EV_LOCATION:
+            s1 = p; p += strlen(p) + 1;
+            if (ctx->gem_location_callback)
+                ctx->gem_location_callback(ctx->data, s1);
+            break;
+        case GEM_EV_CHECKSUM:
+            s1 = p; p += strlen(p) + 1;
+            memcpy(&size, p, sizeof(size));
+            p += sizeof(size);
+            if (ctx->gem_checksum_callback)
+                ctx->gem_checksum_callback(ctx->data, s1, size);
+            break;
+        case GEM_EV_INSTALLSIZE:
+            memcpy(&size, p, sizeof(size));
+            p += sizeof(size);
+            if (ctx->gem_installsize_callback)
+                ctx->gem_installsize_callback(ctx->data, size);
+            break;
+        case GEM_EV_END:
+            if (ctx->gem_end_callback)
+                ctx->gem_end_callback(ctx->data);
+            break;
+        case GEM_EV_ERROR:
+            s1 = p; p += strlen(p) + 1;
+            if (ctx->gem_parse_error_callback)
+                ctx->gem_parse_error_callback(ctx->data, s1);
+            break;
+        default:
+            return -1;
+        }
+    }
+    return rec->ret;
+}
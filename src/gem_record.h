@@ -0,0 +1,30 @@
+#ifndef GEM_RECORD_H
+#define GEM_RECORD_H
+
+#include "rubygems_parser.h"
+
+/*
+ * A GemRecord holds the callback events produced while parsing one gem,
+ * so they can be produced on one thread and replayed on another.
+ */
+typedef struct GemRecord
+{
+    char *buf;
+    int len;
+    int alloc;
+    /* return value of the parse that produced the record */
+    int ret;
+} GemRecord;
+
+void gem_record_init(GemRecord *rec);
+void gem_record_reset(GemRecord *rec);
+void gem_record_free(GemRecord *rec);
+
+/* setup rctx so all per-gem callbacks append to rec. The yaml
+   metadata and the checksum are only kept if parent wants them */
+void gem_record_context(ParseContext *rctx, GemRecord *rec, const ParseContext *parent);
+
+/* feed the recorded events to the callbacks of ctx */
+int gem_record_replay(const GemRecord *rec, ParseContext *ctx);
+
+#endif
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2012, Novell Inc.
+ *
+ * This program is licensed under the BSD license, read LICENSE.BSD
+ * for further information
+ *
+ * gem_sha256: SHA-256 with OpenSSL or libsolv.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#ifdef HAVE_OPENSSL
+#include <openssl/evp.h>
+#else
+#include <solv/pool.h>
+#include <solv/chksum.h>
+#endif
+
+#include "gem_sha256.h"
+
+struct GemSha256
+{
+#ifdef HAVE_OPENSSL
+    EVP_MD_CTX *md;
+#else
+    Chksum *chk;
+#endif
+};
+
+GemSha256 *gem_sha256_new(void)
+{
+    GemSha256 *h = calloc(1, sizeof(GemSha256));
+
+    if (!h)
+        return 0;
+#ifdef HAVE_OPENSSL
+    if (!(h->md = EVP_MD_CTX_new())) {
+        free(h);
+        return 0;
+    }
+#endif
+    return h;
+}
+
+void gem_sha256_free(GemSha256 *h)
+{
+    if (!h)
+        return;
+#ifdef HAVE_OPENSSL
+    EVP_MD_CTX_free(h->md);
+#else
+    if (h->chk)
+        solv_chksum_free(h->chk, 0);
+#endif
+    free(h);
+}
+
+int gem_sha256_init(GemSha256 *h)
+{
+#ifdef HAVE_OPENSSL
+    return EVP_DigestInit_ex(h->md, EVP_sha256(), 0) == 1 ? 0 : -1;
+#else
+    if (h->chk)
+        solv_chksum_free(h->chk, 0);
+    h->chk = solv_chksum_create(REPOKEY_TYPE_SHA256);
+    return h->chk ? 0 : -1;
+#endif
+}
+
+void gem_sha256_update(GemSha256 *h, const void *buf, size_t len)
+{
+#ifdef HAVE_OPENSSL
+    EVP_DigestUpdate(h->md, buf, len);
+#else
+    solv_chksum_add(h->chk, buf, len);
+#endif
+}
+
+void gem_sha256_final(GemSha256 *h, unsigned char *sum)
+{
+#ifdef HAVE_OPENSSL
+    EVP_DigestFinal_ex(h->md, sum, 0);
+#else
+    int l;
+
+    memcpy(sum, solv_chksum_get(h->chk, &l), GEM_SHA256_LEN);
+    solv_chksum_free(h->chk, 0);
+    h->chk = 0;
+#endif
+}
+
+const char *gem_sha256_backend(void)
+{
+#ifdef HAVE_OPENSSL
+    return "openssl";
+#else
+    return "libsolv";
+#endif
+}
@@ -0,0 +1,29 @@
+#ifndef GEM_SHA256_H
+#define GEM_SHA256_H
+
+#include <stddef.h>
+
+/*
+ * SHA-256 of the .gem files, fed block by block as the parser reads
+ * them. Goes to the EVP digests of OpenSSL if built with it
+ * (HAVE_OPENSSL), which use the SHA extensions or AVX2 where the cpu
+ * has them, to the plain C implementation of libsolv otherwise.
+ */
+
+#define GEM_SHA256_LEN 32
+
+typedef struct GemSha256 GemSha256;
+
+GemSha256 *gem_sha256_new(void);
+void gem_sha256_free(GemSha256 *h);
+
+/* starts a new checksum, h can be reused after gem_sha256_final */
+int gem_sha256_init(GemSha256 *h);
+void gem_sha256_update(GemSha256 *h, const void *buf, size_t len);
+/* writes the GEM_SHA256_LEN bytes of the checksum to sum */
+void gem_sha256_final(GemSha256 *h, unsigned char *sum);
+
+/* "openssl" or "libsolv" */
+const char *gem_sha256_backend(void);
+
+#endif
@@ -0,0 +1,401 @@
+/*
+ * Copyright (c) 2012, Novell Inc.
+ *
+ * This program is licensed under the BSD license, read LICENSE.BSD
+ * for further information
+ *
+ * gem_solv: parser callbacks adding the gems to a solv repo.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <solv/pool.h>
+#include <solv/repo.h>
+#include <solv/hash.h>
+
+#include "rubygems_parser.h"
+#include "gem_solv.h"
+#include "gem_version.h"
+#include "tools_util.h"
+
+static int parse_start_callback(void *user_data)
+{
+    return 0;
+}
+
+static void parse_error_callback(void *user_data, const char *msg)
+{
+    SolvContext *ctx = (SolvContext *) user_data;
+    pool_error(ctx->repo->pool, -1, msg);
+}
+
+static void add_deps(SolvContext *ctx);
+
+static int start_callback(void *user_data, const char *file)
+{
+    SolvContext *ctx = (SolvContext *) user_data;
+    /* the requirements of a gem that did not end */
+    add_deps(ctx);
+    ctx->s = pool_id2solvable(ctx->repo->pool, repo_add_solvable(ctx->repo));
+    repodata_set_poolstr(ctx->data, ctx->s - ctx->repo->pool->solvables, SOLVABLE_GROUP, "Devel/Languages/Ruby");
+    ctx->s->arch = pool_str2id(ctx->repo->pool, "x86_64", 1);
+    return 0;
+}
+
+static int end_callback(void *user_data)
+{
+    add_deps((SolvContext *) user_data);
+    return 0;
+}
+
+static int location_callback(void *user_data, const char *location)
+{
+    SolvContext *ctx = (SolvContext *) user_data;
+    repodata_set_location(ctx->data, ctx->s - ctx->repo->pool->solvables, 0, 0, location);
+    return 0;
+}
+
+static int checksum_callback(void *user_data, const char *sha256, unsigned long long size)
+{
+    SolvContext *ctx = (SolvContext *) user_data;
+    Id handle = ctx->s - ctx->repo->pool->solvables;
+
+    repodata_set_checksum(ctx->data, handle, SOLVABLE_CHECKSUM, REPOKEY_TYPE_SHA256, sha256);
+    repodata_set_num(ctx->data, handle, SOLVABLE_DOWNLOADSIZE, size);
+    return 0;
+}
+
+static int installsize_callback(void *user_data, unsigned long long size)
+{
+    SolvContext *ctx = (SolvContext *) user_data;
+    repodata_set_num(ctx->data, ctx->s - ctx->repo->pool->solvables, SOLVABLE_INSTALLSIZE, size);
+    return 0;
+}
+
+/*
+ * The same requirements show up over and over again (rake, json,
+ * bundler, ...), so the finished dependency Ids are kept per
+ * (name, op, version), and a known requirement costs one hash lookup
+ * instead of a join, two string lookups, a rel lookup and for ~> a
+ * version bump.
+ *
+ * repo_write orders the relations that are used equally often by
+ * their Id, so the new ones of a gem are made at its end, sorted (see
+ * gem_make_rels). They then get their Ids in an order that follows
+ * from the gems alone, which gem_delta repeats when it rebuilds a
+ * repo from solv files.
+ */
+
+static Hashval dep_hash(const char *name, const char *op, const char *version)
+{
+    Hashval h = strhash(name);
+    h = strhash_cont(op, h * 7 + 1);
+    return strhash_cont(version, h * 7 + 1);
+}
+
+static GemDepCacheEntry *dep_cache_lookup(GemDepCache *dc, const char *name, const char *op, const char *version, Hashval h, Hashval *slot)
+{
+    GemDepCacheEntry *e;
+    Hashval hh = HASHCHAIN_START;
+    const char *k;
+    Id id;
+
+    if (!dc->ht)
+        return 0;
+    h &= dc->htmask;
+    while ((id = dc->ht[h]) != 0) {
+        e = dc->entries + id - 1;
+        k = dc->strs + e->key;
+        if (!strcmp(k, name)) {
+            k += strlen(k) + 1;
+            if (!strcmp(k, op) && !strcmp(k + strlen(k) + 1, version))
+                return e;
+        }
+        h = HASHCHAIN_NEXT(h, hh, dc->htmask);
+    }
+    *slot = h;
+    return 0;
+}
+
+static void dep_cache_rehash(GemDepCache *dc)
+{
+    Hashval h, hh;
+    int i;
+
+    solv_free(dc->ht);
+    dc->htmask = mkmask(dc->nentries + 256);
+    dc->ht = solv_calloc(dc->htmask + 1, sizeof(Id));
+    for (i = 0; i < dc->nentries; i++) {
+        h = dc->entries[i].hash & dc->htmask;
+        hh = HASHCHAIN_START;
+        while (dc->ht[h])
+            h = HASHCHAIN_NEXT(h, hh, dc->htmask);
+        dc->ht[h] = i + 1;
+    }
+}
+
+static GemDepCacheEntry *dep_cache_add(GemDepCache *dc, const char *name, const char *op, const char *version, Hashval h)
+{
+    GemDepCacheEntry *e;
+    int nl = strlen(name) + 1, ol = strlen(op) + 1, vl = strlen(version) + 1;
+    Hashval slot = 0;
+
+    if (dc->nentries * 2 >= dc->htmask)
+        dep_cache_rehash(dc);
+    dep_cache_lookup(dc, name, op, version, h, &slot);
+
+    dc->entries = solv_extend(dc->entries, dc->nentries, 1, sizeof(GemDepCacheEntry), 1023);
+    e = dc->entries + dc->nentries++;
+    dc->strs = solv_extend(dc->strs, dc->nstrs, nl + ol + vl, 1, 65535);
+    e->key = dc->nstrs;
+    memcpy(dc->strs + dc->nstrs, name, nl);
+    memcpy(dc->strs + dc->nstrs + nl, op, ol);
+    memcpy(dc->strs + dc->nstrs + nl + ol, version, vl);
+    dc->nstrs += nl + ol + vl;
+    e->hash = h;
+    e->dep = e->dep2 = 0;
+    dc->ht[slot] = dc->nentries;
+    return e;
+}
+
+static void dep_cache_free(GemDepCache *dc)
+{
+    solv_free(dc->strs);
+    solv_free(dc->entries);
+    solv_free(dc->ht);
+    memset(dc, 0, sizeof(GemDepCache));
+}
+
+static int rel_cmp(const void *a, const void *b, void *dp)
+{
+    Pool *pool = (Pool *) dp;
+    const GemRel *ra = a, *rb = b;
+    int r;
+
+    if (ra->name != rb->name && (r = strcmp(pool_id2str(pool, ra->name), pool_id2str(pool, rb->name))) != 0)
+        return r;
+    if (ra->evr != rb->evr && (r = strcmp(pool_id2str(pool, ra->evr), pool_id2str(pool, rb->evr))) != 0)
+        return r;
+    return ra->flags - rb->flags;
+}
+
+void gem_make_rels(Pool *pool, GemRel *rels, int n)
+{
+    int i;
+
+    solv_sort(rels, n, sizeof(GemRel), rel_cmp, pool);
+    for (i = 0; i < n; i++)
+        *rels[i].idp = pool_rel2id(pool, rels[i].name, rels[i].evr, rels[i].flags, 1);
+}
+
+/* makes the dependency Ids of the requirements of the gem that are
+   new, the second one for ~> only, and adds them all to its requires */
+static void add_deps(SolvContext *ctx)
+{
+    Pool *pool = ctx->repo->pool;
+    GemDepCacheEntry *e;
+    GemConstraint c[2];
+    char bump[GEM_VERSION_BUMP_SIZE];
+    const char *name, *op, *version;
+    Id nameid;
+    int i, j, n, nrels = 0;
+
+    if (!ctx->npending)
+        return;
+    for (i = 0; i < ctx->npending; i++) {
+        e = ctx->deps.entries + ctx->pending[i];
+        if (e->dep)
+            continue;
+        name = ctx->deps.strs + e->key;
+        op = name + strlen(name) + 1;
+        version = op + strlen(op) + 1;
+        nameid = pool_str2id(pool, join2(&ctx->pctx->jd, "rubygem", "-", name), 1);
+        /* an op RubyGems does not know leaves any version */
+        e->dep = nameid;
+        e->dep2 = 0;
+        n = gem_requirement_constraints(op, version, c, bump, sizeof(bump));
+        ctx->rels = solv_extend(ctx->rels, nrels, n, sizeof(GemRel), 63);
+        for (j = 0; j < n; j++, nrels++) {
+            ctx->rels[nrels].name = nameid;
+            ctx->rels[nrels].evr = pool_str2id(pool, c[j].version, 1);
+            ctx->rels[nrels].flags = c[j].flags;
+            ctx->rels[nrels].idp = j ? &e->dep2 : &e->dep;
+        }
+    }
+    gem_make_rels(pool, ctx->rels, nrels);
+    for (i = 0; i < ctx->npending; i++) {
+        e = ctx->deps.entries + ctx->pending[i];
+        ctx->s->requires = repo_addid_dep(ctx->s->repo, ctx->s->requires, e->dep, 0);
+        if (e->dep2)
+            ctx->s->requires = repo_addid_dep(ctx->s->repo, ctx->s->requires, e->dep2, 0);
+    }
+    ctx->npending = 0;
+}
+
+static int dep_callback(void *user_data, const char *name, const char *op, const char *version)
+{
+    SolvContext *ctx = (SolvContext *) user_data;
+    Hashval h = dep_hash(name, op, version), slot;
+    GemDepCacheEntry *e;
+
+    if (!(e = dep_cache_lookup(&ctx->deps, name, op, version, h, &slot)))
+        e = dep_cache_add(&ctx->deps, name, op, version, h);
+    ctx->pending = solv_extend(ctx->pending, ctx->npending, 1, sizeof(int), 63);
+    ctx->pending[ctx->npending++] = e - ctx->deps.entries;
+    return 0;
+}
+
+/*
+ * Most versions of a gem carry the same summary and the same, often
+ * long, description. A summary or description that more than one gem
+ * has is made a pool string, stored once in the string table instead
+ * of once per gem in the vertical data. A text stays a plain string
+ * for the first gem until a second one has it, so every text is kept
+ * once.
+ */
+
+static GemTextEntry *text_lookup(GemTexts *t, Repodata *data, const char *val, Hashval h, Hashval *slot)
+{
+    GemTextEntry *e;
+    Hashval hh = HASHCHAIN_START;
+    KeyValue kv;
+    Id id;
+
+    if (!t->ht)
+        return 0;
+    h &= t->htmask;
+    while ((id = t->ht[h]) != 0) {
+        e = t->entries + id - 1;
+        if (e->id) {
+            if (!strcmp(pool_id2str(data->repo->pool, e->id), val))
+                return e;
+        }
+        else if (repodata_lookup_kv_uninternalized(data, e->handle, e->key, &kv) && !strcmp(kv.str, val))
+            return e;
+        h = HASHCHAIN_NEXT(h, hh, t->htmask);
+    }
+    *slot = h;
+    return 0;
+}
+
+static void text_rehash(GemTexts *t)
+{
+    Hashval h, hh;
+    int i;
+
+    solv_free(t->ht);
+    t->htmask = mkmask(t->nentries + 256);
+    t->ht = solv_calloc(t->htmask + 1, sizeof(Id));
+    for (i = 0; i < t->nentries; i++) {
+        h = t->entries[i].hash & t->htmask;
+        hh = HASHCHAIN_START;
+        while (t->ht[h])
+            h = HASHCHAIN_NEXT(h, hh, t->htmask);
+        t->ht[h] = i + 1;
+    }
+}
+
+void gem_texts_set(GemTexts *t, Repodata *data, Id handle, Id key, const char *val)
+{
+    Hashval h, slot = 0;
+    GemTextEntry *e;
+
+    h = strhash(val);
+    if ((e = text_lookup(t, data, val, h, &slot)) != 0) {
+        if (!e->id) {
+            /* replaces the string, in its place */
+            e->id = pool_str2id(data->repo->pool, val, 1);
+            repodata_set_id(data, e->handle, e->key, e->id);
+        }
+        repodata_set_id(data, handle, key, e->id);
+        return;
+    }
+    if (t->nentries * 2 >= t->htmask) {
+        text_rehash(t);
+        text_lookup(t, data, val, h, &slot);
+    }
+    t->entries = solv_extend(t->entries, t->nentries, 1, sizeof(GemTextEntry), 1023);
+    e = t->entries + t->nentries++;
+    e->hash = h;
+    e->handle = handle;
+    e->key = key;
+    e->id = 0;
+    t->ht[slot] = t->nentries;
+    repodata_set_str(data, handle, key, val);
+}
+
+void gem_texts_reset(GemTexts *t)
+{
+    t->entries = solv_free(t->entries);
+    t->nentries = 0;
+    t->ht = solv_free(t->ht);
+    t->htmask = 0;
+}
+
+static int attr_callback(void *user_data, const char*attr, const char *val)
+{
+    SolvContext *ctx = (SolvContext *) user_data;
+    Id handle = ctx->s - ctx->s->repo->pool->solvables;
+    if (!strcmp(attr, "name"))
+        ctx->s->name = pool_str2id(ctx->s->repo->pool, join2(&ctx->pctx->jd, "rubygem", "-", val), 1);
+      //ctx->s->name = pool_str2id(ctx->s->repo->pool, val, 1);
+    else if (!strcmp(attr, "version"))
+        ctx->s->evr = pool_str2id(ctx->s->repo->pool, val, 1);
+    else if (!strcmp(attr, "homepage"))
+        repodata_set_str(ctx->data, handle, SOLVABLE_URL, val);
+    else if (!strcmp(attr, "summary"))
+        gem_texts_set(&ctx->texts, ctx->data, handle, ctx->summary, val);
+    else if (!strcmp(attr, "description"))
+        gem_texts_set(&ctx->texts, ctx->data, handle, ctx->description, val);
+    else if (!strcmp(attr, "license"))
+      repodata_set_poolstr(ctx->data, handle, SOLVABLE_LICENSE, val);
+    return 0;
+}
+
+static int parse_end_callback(void *user_data)
+{
+    SolvContext *ctx = (SolvContext *) user_data;
+    add_deps(ctx);
+    gem_texts_reset(&ctx->texts);
+    return 0;
+}
+
+void gem_solv_context_setup(SolvContext *ctx, ParseContext *pctx, Repo *repo, Repodata *data)
+{
+    memset(ctx, 0, sizeof(SolvContext));
+    ctx->repo = repo;
+    ctx->data = data;
+    ctx->pctx = pctx;
+    ctx->summary = SOLVABLE_SUMMARY;
+    ctx->description = SOLVABLE_DESCRIPTION;
+
+    pctx->gem_parse_start_callback = parse_start_callback;
+    pctx->gem_start_callback = start_callback;
+    pctx->gem_parse_error_callback = parse_error_callback;
+    pctx->gem_attr_callback = attr_callback;
+    pctx->gem_dep_callback = dep_callback;
+    pctx->gem_location_callback = location_callback;
+    pctx->gem_checksum_callback = checksum_callback;
+    pctx->gem_installsize_callback = installsize_callback;
+    pctx->gem_end_callback = end_callback;
+    pctx->gem_parse_end_callback = parse_end_callback;
+    pctx->data = ctx;
+}
+
+void gem_solv_context_free(SolvContext *ctx)
+{
+    dep_cache_free(&ctx->deps);
+    solv_free(ctx->pending);
+    solv_free(ctx->rels);
+    gem_texts_reset(&ctx->texts);
+}
+
+void gem_solv_context_set_language(SolvContext *ctx, const char *language)
+{
+    Pool *pool = ctx->repo->pool;
+
+    ctx->summary = language ? pool_id2langid(pool, SOLVABLE_SUMMARY, language, 1) : SOLVABLE_SUMMARY;
+    ctx->description = language ? pool_id2langid(pool, SOLVABLE_DESCRIPTION, language, 1) : SOLVABLE_DESCRIPTION;
+}
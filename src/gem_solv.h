@@ -0,0 +1,85 @@
+#ifndef GEM_SOLV_H
+#define GEM_SOLV_H
+
+#include <solv/repo.h>
+#include <solv/hash.h>
+#include "rubygems_parser.h"
+
+typedef struct GemDepCacheEntry {
+    unsigned int key;   /* name, op and version in GemDepCache.strs */
+    Hashval hash;
+    Id dep;
+    Id dep2;            /* upper bound of ~> */
+} GemDepCacheEntry;
+
+/* dependency Ids by (name, op, version) */
+typedef struct GemDepCache {
+    char *strs;
+    unsigned int nstrs;
+    GemDepCacheEntry *entries;
+    int nentries;
+    Hashtable ht;
+    Hashval htmask;
+} GemDepCache;
+
+/* a relation to make, its Id goes to *idp */
+typedef struct GemRel {
+    Id name;
+    Id evr;
+    int flags;
+    Id *idp;
+} GemRel;
+
+/* makes rels in the order of their name, evr and flags strings, so
+   that they get Ids in an order that does not depend on how they
+   were found (see gem_solv.c). Sorts rels */
+void gem_make_rels(Pool *pool, GemRel *rels, int n);
+
+typedef struct GemTextEntry {
+    Hashval hash;
+    Id handle;          /* the first solvable with the text */
+    Id key;
+    Id id;              /* the pool string, once shared */
+} GemTextEntry;
+
+/* the summaries and descriptions of the parse */
+typedef struct GemTexts {
+    GemTextEntry *entries;
+    int nentries;
+    Hashtable ht;
+    Hashval htmask;
+} GemTexts;
+
+/* sets a summary or description of handle, a pool string once another
+   solvable has the same text (see gem_solv.c). The solvables with the
+   first ones are only found until data is internalized, so reset t
+   before that */
+void gem_texts_set(GemTexts *t, Repodata *data, Id handle, Id key, const char *val);
+void gem_texts_reset(GemTexts *t);
+
+/* state of the callbacks that add each gem as a solvable of repo */
+typedef struct SolvContext {
+    Repo *repo;
+    Solvable *s;
+    Repodata *data;
+    int flags;
+    ParseContext *pctx;
+    GemDepCache deps;
+    /* the requirements of the current gem, entries of deps */
+    int *pending;
+    int npending;
+    GemRel *rels;
+    /* keys of summary and description, language tagged if set */
+    Id summary;
+    Id description;
+    GemTexts texts;
+} SolvContext;
+
+/* points the callbacks of pctx to ctx, adding the gems to repo/data */
+void gem_solv_context_setup(SolvContext *ctx, ParseContext *pctx, Repo *repo, Repodata *data);
+void gem_solv_context_free(SolvContext *ctx);
+/* store summary and description for language, e.g. "en", so that
+   tool_write with a basename moves them to $basename.$language.solv */
+void gem_solv_context_set_language(SolvContext *ctx, const char *language);
+
+#endif
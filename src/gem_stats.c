@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2012, Novell Inc.
+ *
+ * This program is licensed under the BSD license, read LICENSE.BSD
+ * for further information
+ *
+ * gem_stats: timing and counters of the parser stages.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "gem_stats.h"
+
+static const char *stage_names[GEM_STATS_NSTAGES] = {
+    "io", "checksum", "tar", "inflate", "yaml", "marshal", "callbacks", "internalize", "write"
+};
+
+double gem_stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void gem_stats_init(GemStats *st)
+{
+    memset(st, 0, sizeof(GemStats));
+}
+
+GemStats *gem_stats_create(int nslowest)
+{
+    GemStats *st = calloc(1, sizeof(GemStats));
+    st->start = gem_stats_now();
+    st->maxslowest = nslowest;
+    if (nslowest > 0)
+        st->slowest = calloc(nslowest, sizeof(GemSlowGem));
+    st->progress_interval = 1;
+    return st;
+}
+
+void gem_stats_free(GemStats *st)
+{
+    int i;
+    for (i = 0; i < st->nslowest; i++)
+        free(st->slowest[i].path);
+    free(st->slowest);
+    free(st);
+}
+
+void gem_stats_add(GemStats *st, int stage, double time, unsigned long long bytes)
+{
+    st->stages[stage].time += time;
+    st->stages[stage].bytes += bytes;
+    st->stages[stage].count++;
+}
+
+void gem_stats_error(GemStats *st, int stage)
+{
+    st->stages[stage].errors++;
+}
+
+void gem_stats_merge(GemStats *st, const GemStats *gem)
+{
+    int i;
+    for (i = 0; i < GEM_STATS_NSTAGES; i++) {
+        st->stages[i].time += gem->stages[i].time;
+        st->stages[i].bytes += gem->stages[i].bytes;
+        st->stages[i].count += gem->stages[i].count;
+        st->stages[i].errors += gem->stages[i].errors;
+    }
+    st->cache_hits += gem->cache_hits;
+}
+
+double gem_stats_time(const GemStats *st)
+{
+    double t = 0;
+    int i;
+    for (i = 0; i < GEM_STATS_NSTAGES; i++)
+        t += st->stages[i].time;
+    return t;
+}
+
+static void json_string(FILE *fp, const char *s)
+{
+    putc('"', fp);
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\')
+            fprintf(fp, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(fp, "\\u%04x", c);
+        else
+            putc(c, fp);
+    }
+    putc('"', fp);
+}
+
+static void progress_line(GemStats *st, const char *path, double now)
+{
+    double elapsed = now - st->start;
+
+    fprintf(st->progress, "{\"progress\":{\"gems\":%llu,\"errors\":%llu,\"elapsed\":%.3f,\"rate\":%.1f,\"current\":",
+            st->gems, st->errors, elapsed, elapsed > 0 ? st->gems / elapsed : 0);
+    json_string(st->progress, path ? path : "");
+    fprintf(st->progress, "}}\n");
+    fflush(st->progress);
+    st->last_progress = now;
+}
+
+void gem_stats_progress_flush(GemStats *st, const char *path)
+{
+    if (st->progress)
+        progress_line(st, path, gem_stats_now());
+}
+
+void gem_stats_gem_done(GemStats *st, const char *path, double time, int ret)
+{
+    int i;
+    double now;
+
+    st->gems++;
+    if (ret)
+        st->errors++;
+
+    if (st->maxslowest && path && (st->nslowest < st->maxslowest || time > st->slowest[st->nslowest - 1].time)) {
+        if (st->nslowest == st->maxslowest)
+            free(st->slowest[--st->nslowest].path);
+        for (i = st->nslowest; i > 0 && st->slowest[i - 1].time < time; i--)
+            st->slowest[i] = st->slowest[i - 1];
+        st->slowest[i].path = strdup(path);
+        st->slowest[i].time = time;
+        st->nslowest++;
+    }
+
+    if (st->progress) {
+        now = gem_stats_now();
+        if (now - st->last_progress >= st->progress_interval)
+            progress_line(st, path, now);
+    }
+}
+
+void gem_stats_print_json(const GemStats *st, FILE *fp)
+{
+    const GemStatsStage *s;
+    int i;
+
+    fprintf(fp, "{\n  \"gems\": %llu,\n  \"errors\": %llu,\n  \"cache_hits\": %llu,\n  \"elapsed\": %.6f,\n",
+            st->gems, st->errors, st->cache_hits, gem_stats_now() - st->start);
+    fprintf(fp, "  \"stages\": {\n");
+    for (i = 0; i < GEM_STATS_NSTAGES; i++) {
+        s = st->stages + i;
+        fprintf(fp, "    \"%s\": { \"time\": %.6f, \"bytes\": %llu, \"count\": %llu, \"errors\": %llu }%s\n",
+                stage_names[i], s->time, s->bytes, s->count, s->errors, i + 1 < GEM_STATS_NSTAGES ? "," : "");
+    }
+    fprintf(fp, "  },\n  \"slowest\": [");
+    for (i = 0; i < st->nslowest; i++) {
+        fprintf(fp, "%s\n    { \"path\": ", i ? "," : "");
+        json_string(fp, st->slowest[i].path);
+        fprintf(fp, ", \"time\": %.6f }", st->slowest[i].time);
+    }
+    fprintf(fp, "%s]\n}\n", st->nslowest ? "\n  " : "");
+}
+
+int gem_stats_write_json(const GemStats *st, const char *file)
+{
+    FILE *fp;
+
+    if (!*file || !strcmp(file, "-")) {
+        gem_stats_print_json(st, stderr);
+        return 0;
+    }
+    if (!(fp = fopen(file, "w"))) {
+        perror(file);
+        return -1;
+    }
+    gem_stats_print_json(st, fp);
+    if (fclose(fp)) {
+        perror(file);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,86 @@
+#ifndef GEM_STATS_H
+#define GEM_STATS_H
+
+#include <stdio.h>
+
+/*
+ * Instrumentation of the parser. When ParseContext.stats is set, the
+ * parser adds the time, bytes and errors of each stage of every gem,
+ * and keeps the slowest gems. All updates of the stats of the context
+ * happen on the thread running the callbacks; worker threads collect
+ * the stats of a gem on their own and hand them over with the record.
+ *
+ * Times are cumulative over all threads, so with -j they add up to
+ * more than the elapsed time.
+ */
+
+enum {
+    GEM_STAGE_IO,           /* reading the gem file */
+    GEM_STAGE_CHECKSUM,     /* sha256 of the gem file */
+    GEM_STAGE_TAR,          /* finding metadata.gz in the archive */
+    GEM_STAGE_INFLATE,      /* gunzip of metadata.gz */
+    GEM_STAGE_YAML,         /* parsing the metadata */
+    GEM_STAGE_MARSHAL,      /* reading a Marshal index, with its callbacks */
+    GEM_STAGE_CALLBACKS,    /* the callbacks of the tool */
+    GEM_STAGE_INTERNALIZE,  /* repodata_internalize */
+    GEM_STAGE_WRITE,        /* writing the output */
+    GEM_STATS_NSTAGES
+};
+
+typedef struct GemStatsStage
+{
+    double time;
+    unsigned long long bytes;
+    unsigned long long count;
+    unsigned long long errors;
+} GemStatsStage;
+
+typedef struct GemSlowGem
+{
+    char *path;
+    double time;
+} GemSlowGem;
+
+typedef struct GemStats
+{
+    GemStatsStage stages[GEM_STATS_NSTAGES];
+    unsigned long long gems;
+    unsigned long long errors;
+    unsigned long long cache_hits;
+    double start;
+
+    /* the slowest gems, slowest first */
+    GemSlowGem *slowest;
+    int nslowest;
+    int maxslowest;
+
+    /* progress lines, at most one per interval */
+    FILE *progress;
+    double progress_interval;
+    double last_progress;
+} GemStats;
+
+double gem_stats_now(void);
+
+/* stats of a run, keeping the nslowest slowest gems */
+GemStats *gem_stats_create(int nslowest);
+void gem_stats_free(GemStats *st);
+/* stats of a single gem, no slowest list */
+void gem_stats_init(GemStats *st);
+
+void gem_stats_add(GemStats *st, int stage, double time, unsigned long long bytes);
+void gem_stats_error(GemStats *st, int stage);
+/* adds the stages of a gem to st */
+void gem_stats_merge(GemStats *st, const GemStats *gem);
+/* sum of the stage times */
+double gem_stats_time(const GemStats *st);
+/* counts a finished gem, ret is the parse result */
+void gem_stats_gem_done(GemStats *st, const char *path, double time, int ret);
+/* prints a progress line now, not just when the interval is over */
+void gem_stats_progress_flush(GemStats *st, const char *path);
+
+void gem_stats_print_json(const GemStats *st, FILE *fp);
+/* prints to file, or to stderr if file is empty or "-" */
+int gem_stats_write_json(const GemStats *st, const char *file);
+
+#endif
@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2012, Novell Inc.
+ *
+ * This program is licensed under the BSD license, read LICENSE.BSD
+ * for further information
+ *
+ * gem_susetags: parser callbacks writing the gems as susetags.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "rubygems_parser.h"
+#include "gem_susetags.h"
+#include "gem_version.h"
+#include "tools_util.h"
+
+/* mkdir -p implementation */
+static void mkdir_p(const char *dir) {
+    char tmp[256];
+    char *p = NULL;
+    size_t len;
+    snprintf(tmp, sizeof(tmp),"%s",dir);
+    len = strlen(tmp);
+    if(tmp[len - 1] == '/')
+        tmp[len - 1] = 0;
+    for(p = tmp + 1; *p; p++)
+        if(*p == '/') {
+           *p = 0;
+            mkdir(tmp, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
+            *p = '/';
+        }
+    mkdir(tmp, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
+}
+
+static int parse_start_callback(void *user_data)
+{
+    TagsContext *ctx = (TagsContext *) user_data;
+    gem_writer_puts(ctx->packages, "=Ver: 2.0\n");
+    return 0;
+}
+
+static void parse_error_callback(void *user_data, const char *msg)
+{
+    TagsContext *ctx = (TagsContext *) user_data;
+}
+
+static int start_callback(void *user_data, const char *file)
+{
+    TagsContext *ctx = (TagsContext *) user_data;
+    /* nothing of a gem that did not end goes to the next one */
+    ctx->name = 0;
+    ctx->location = 0;
+    ctx->checksum[0] = 0;
+    ctx->size = ctx->installsize = 0;
+    return 0;
+}
+
+static int end_callback(void *user_data)
+{
+    TagsContext *ctx = (TagsContext *) user_data;
+    if (ctx->checksum[0])
+        gem_writer_printf(ctx->packages, "=Cks: SHA256 %s\n", ctx->checksum);
+    if (ctx->checksum[0] || ctx->installsize)
+        gem_writer_printf(ctx->packages, "=Siz: %llu %llu\n", ctx->size, ctx->installsize);
+    if (ctx->location)
+        gem_writer_printf(ctx->packages, "=Loc: 1 %s\n", ctx->location);
+    return 0;
+}
+
+static int location_callback(void *user_data, const char *location)
+{
+    TagsContext *ctx = (TagsContext *) user_data;
+    ctx->location = join2(&ctx->locationbuf, location, 0, 0);
+    return 0;
+}
+
+static int checksum_callback(void *user_data, const char *sha256, unsigned long long size)
+{
+    TagsContext *ctx = (TagsContext *) user_data;
+    snprintf(ctx->checksum, sizeof(ctx->checksum), "%s", sha256);
+    ctx->size = size;
+    return 0;
+}
+
+static int installsize_callback(void *user_data, unsigned long long size)
+{
+    TagsContext *ctx = (TagsContext *) user_data;
+    ctx->installsize = size;
+    return 0;
+}
+
+static int deps_start_callback(void *user_data)
+{
+    TagsContext *ctx = (TagsContext *) user_data;
+    gem_writer_puts(ctx->packages, "+Req:\n");
+    return 0;
+}
+
+static int dep_callback(void *user_data, const char *name, const char *op, const char *version)
+{
+    TagsContext *ctx = (TagsContext *) user_data;
+    const char *dep = join2(&ctx->pctx->jd, "rubygem", "-", name);
+    GemConstraint c[2];
+    char bump[GEM_VERSION_BUMP_SIZE];
+    int i, n;
+
+    n = gem_requirement_constraints(op, version, c, bump, sizeof(bump));
+    if (!n)
+        gem_writer_printf(ctx->packages, "%s\n", dep);
+    for (i = 0; i < n; i++)
+        gem_writer_printf(ctx->packages, "%s %s %s\n", dep, gem_constraint_op(c[i].flags), c[i].version);
+    return 0;
+}
+
+static int deps_end_callback(void *user_data)
+{
+    TagsContext *ctx = (TagsContext *) user_data;
+    gem_writer_puts(ctx->packages, "-Req:\n");
+    return 0;
+}
+
+static int attr_callback(void *user_data, const char *attr, const char *val)
+{
+    TagsContext *ctx = (TagsContext *) user_data;
+    if (!strcmp(attr, "name")) {
+        /* val is only valid during the callback */
+        ctx->name = join2(&ctx->namebuf, val, 0, 0);
+    }
+    else if (!strcmp(attr, "version")) {
+        gem_writer_puts(ctx->packages, "##----------------------------------------\n");
+        gem_writer_puts(ctx->packages, "=Pkg: ");
+        gem_writer_printf(ctx->packages, "%s %s %d %s\n", join2(&ctx->pctx->jd, "rubygem", "-", ctx->name), val, 0, "x86_64");
+        gem_writer_puts(ctx->packages_en, "##----------------------------------------\n");
+        gem_writer_puts(ctx->packages_en, "=Pkg: ");
+        gem_writer_printf(ctx->packages_en, "%s %s %d %s\n", join2(&ctx->pctx->jd, "rubygem", "-", ctx->name), val, 0, "x86_64");
+    }
+    else if (!strcmp(attr, "license")) {
+        gem_writer_puts(ctx->packages, "=Lic: ");
+        gem_writer_puts(ctx->packages, val);
+        gem_writer_puts(ctx->packages, "\n");
+    }
+    else if (!strcmp(attr, "summary")) {
+        gem_writer_puts(ctx->packages_en, "=Sum: ");
+        gem_writer_puts(ctx->packages_en, val);
+        gem_writer_puts(ctx->packages_en, "\n");
+    }
+    else if (!strcmp(attr, "description")) {
+        gem_writer_puts(ctx->packages_en, "+Des:\n");
+        gem_writer_puts(ctx->packages_en, val);
+        gem_writer_puts(ctx->packages_en, "\n-Des:\n");
+    }
+
+    return 0;
+}
+
+static int parse_end_callback(void *ctx)
+{
+    return 0;
+}
+
+int gem_susetags_context_setup(TagsContext *ctx, ParseContext *pctx, const char *dir, int format, int jobs)
+{
+    int error;
+
+    memset(ctx, 0, sizeof(TagsContext));
+    ctx->pctx = pctx;
+
+    mkdir_p(join2(&pctx->jd, dir, "/", "suse/setup/descr"));
+    ctx->packages = gem_writer_open(join2(&pctx->jd, dir, "/suse/setup/descr/packages", gem_writer_suffix(format)), format, jobs);
+    if (!ctx->packages)
+        return -1;
+    ctx->packages_en = gem_writer_open(join2(&pctx->jd, dir, "/suse/setup/descr/packages.en", gem_writer_suffix(format)), format, jobs);
+    if (!ctx->packages_en) {
+        error = errno;
+        gem_writer_close(ctx->packages);
+        errno = error;
+        return -1;
+    }
+
+    pctx->gem_parse_start_callback = parse_start_callback;
+    pctx->gem_start_callback = start_callback;
+    pctx->gem_parse_error_callback = parse_error_callback;
+    pctx->gem_attr_callback = attr_callback;
+    pctx->gem_deps_start_callback = deps_start_callback;
+    pctx->gem_dep_callback = dep_callback;
+    pctx->gem_deps_end_callback = deps_end_callback;
+    pctx->gem_location_callback = location_callback;
+    pctx->gem_checksum_callback = checksum_callback;
+    pctx->gem_installsize_callback = installsize_callback;
+    pctx->gem_end_callback = end_callback;
+    pctx->gem_parse_end_callback = parse_end_callback;
+    pctx->data = ctx;
+    return 0;
+}
+
+int gem_susetags_context_close(TagsContext *ctx)
+{
+    int ret = gem_writer_close(ctx->packages);
+    int error = errno;
+
+    if (gem_writer_close(ctx->packages_en))
+        ret = -1;
+    else if (ret)
+        errno = error;
+    join_freemem(&ctx->namebuf);
+    join_freemem(&ctx->locationbuf);
+    return ret;
+}
@@ -0,0 +1,32 @@
+#ifndef GEM_SUSETAGS_H
+#define GEM_SUSETAGS_H
+
+#include "rubygems_parser.h"
+#include "gem_writer.h"
+#include "tools_util.h"
+
+/* state of the callbacks that write each gem as susetags */
+typedef struct TagsContext {
+    ParseContext *pctx;
+    GemWriter *packages;
+    GemWriter *packages_en;
+    /* point into the buffers below, which are reused for every gem */
+    char *name;
+    char *location;
+    /* sha256 and size of the gem, checksum[0] is 0 if there is none */
+    char checksum[65];
+    unsigned long long size;
+    /* estimated installed size, 0 if unknown */
+    unsigned long long installsize;
+    struct joindata namebuf;
+    struct joindata locationbuf;
+} TagsContext;
+
+/* creates dir/suse/setup/descr/packages{,.en}.gz (or .xz) and points
+   the callbacks of pctx to ctx. Returns -1 with errno set if the files
+   can't be created. jobs is the number of compression threads */
+int gem_susetags_context_setup(TagsContext *ctx, ParseContext *pctx, const char *dir, int format, int jobs);
+/* finishes the files, returns -1 with errno set if writing failed */
+int gem_susetags_context_close(TagsContext *ctx);
+
+#endif
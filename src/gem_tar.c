@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2012, Novell Inc.
+ *
+ * This program is licensed under the BSD license, read LICENSE.BSD
+ * for further information
+ *
+ * gem_tar: finds a member of a ustar archive without reading the
+ * data of the other members.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "gem_tar.h"
+
+#define TAR_BLOCK 512
+#define TAR_NAME_MAX 4096
+
+static int tar_read(int fd, void *buf, size_t len, off_t offset)
+{
+    ssize_t r;
+
+    while (len > 0) {
+        r = pread(fd, buf, len, offset);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return -1;
+        buf = (char *) buf + r;
+        len -= r;
+        offset += r;
+    }
+    return 0;
+}
+
+/* numeric header field, octal or base-256 for large values */
+static long long tar_number(const unsigned char *p, int len)
+{
+    long long x = 0;
+    int i;
+
+    if (*p & 0x80) {
+        if (*p & 0x40)
+            return -1;
+        x = *p & 0x3f;
+        for (i = 1; i < len; i++) {
+            if (x > (1LL << 54))
+                return -1;
+            x = x << 8 | p[i];
+        }
+        return x;
+    }
+    for (i = 0; i < len && p[i] == ' '; i++)
+        ;
+    for (; i < len && p[i] >= '0' && p[i] <= '7'; i++)
+        x = x << 3 | (p[i] - '0');
+    if (i < len && p[i] && p[i] != ' ')
+        return -1;
+    return x;
+}
+
+static int tar_checksum_ok(const unsigned char *h)
+{
+    long long sum = tar_number(h + 148, 8);
+    long long s = 0;
+    int i;
+
+    for (i = 0; i < TAR_BLOCK; i++)
+        s += i >= 148 && i < 156 ? ' ' : h[i];
+    return sum == s;
+}
+
+/* the path record of a pax extended header */
+static void tar_pax_path(const char *p, const char *end, char *name)
+{
+    const char *kv, *next;
+    long l;
+
+    while (p < end) {
+        l = strtol(p, (char **) &kv, 10);
+        if (l <= 0 || *kv != ' ' || l > end - p)
+            return;
+        next = p + l;
+        kv++;
+        if (next - kv > 5 && !strncmp(kv, "path=", 5) && next - kv - 6 < TAR_NAME_MAX) {
+            memcpy(name, kv + 5, next - kv - 6);
+            name[next - kv - 6] = 0;
+        }
+        p = next;
+    }
+}
+
+int gem_tar_find_members(int fd, GemTarMember *members, int nmembers)
+{
+    unsigned char h[TAR_BLOCK];
+    char longname[TAR_NAME_MAX], path[TAR_NAME_MAX];
+    struct stat st;
+    off_t offset = 0;
+    long long size;
+    char *ext;
+    int i, type, found = 0;
+
+    for (i = 0; i < nmembers; i++)
+        members[i].offset = -1;
+    if (fstat(fd, &st))
+        return -1;
+    longname[0] = 0;
+    for (;;) {
+        if (offset + TAR_BLOCK > st.st_size)
+            return -1;
+        if (tar_read(fd, h, TAR_BLOCK, offset))
+            return -1;
+        if (!h[0]) {
+            /* end of archive marker */
+            return found;
+        }
+        if (memcmp(h + 257, "ustar", 5) || !tar_checksum_ok(h))
+            return -1;
+        size = tar_number(h + 124, 12);
+        if (size < 0 || offset + TAR_BLOCK + size > st.st_size)
+            return -1;
+        offset += TAR_BLOCK;
+        type = h[156];
+
+        if (type == 'L' || type == 'x') {
+            /* long name for the next member */
+            if (size >= TAR_NAME_MAX * 2)
+                return -1;
+            ext = malloc(size + 1);
+            if (tar_read(fd, ext, size, offset)) {
+                free(ext);
+                return -1;
+            }
+            ext[size] = 0;
+            if (type == 'L')
+                snprintf(longname, sizeof(longname), "%s", ext);
+            else
+                tar_pax_path(ext, ext + size, longname);
+            free(ext);
+        }
+        else {
+            if (longname[0])
+                strcpy(path, longname);
+            else if (h[345] && !memcmp(h + 257, "ustar\0", 6))
+                snprintf(path, sizeof(path), "%.155s/%.100s", (char *) h + 345, (char *) h);
+            else
+                snprintf(path, sizeof(path), "%.100s", (char *) h);
+            longname[0] = 0;
+            for (i = 0; i < nmembers && (type == '0' || type == 0); i++)
+                if (members[i].offset < 0 && !strcmp(path, members[i].name)) {
+                    members[i].offset = offset;
+                    members[i].size = size;
+                    if (++found == nmembers)
+                        return found;
+                }
+        }
+        offset += (size + TAR_BLOCK - 1) & ~(long long) (TAR_BLOCK - 1);
+    }
+}
+
+int gem_tar_find(int fd, const char *name, off_t *offsetp, off_t *sizep)
+{
+    GemTarMember m;
+    int r;
+
+    m.name = name;
+    if ((r = gem_tar_find_members(fd, &m, 1)) == 1) {
+        *offsetp = m.offset;
+        *sizep = m.size;
+    }
+    return r;
+}
@@ -0,0 +1,31 @@
+#ifndef GEM_TAR_H
+#define GEM_TAR_H
+
+#include <sys/types.h>
+
+/*
+ * A .gem is a plain ustar archive of metadata.gz, data.tar.gz and
+ * checksums.yaml.gz. gem_tar_find walks the 512 byte headers with
+ * pread and skips the member data, so only the headers up to the
+ * wanted member are read.
+ *
+ * Returns 1 and sets offset and size of the member data if name was
+ * found, 0 if the archive has no such member, and -1 if the file
+ * can't be read or is not a tar archive we understand, in which case
+ * the caller should fall back to libarchive.
+ */
+int gem_tar_find(int fd, const char *name, off_t *offset, off_t *size);
+
+typedef struct GemTarMember
+{
+    const char *name;
+    /* set by gem_tar_find_members, -1 if not found */
+    off_t offset;
+    off_t size;
+} GemTarMember;
+
+/* the same for several members in one walk over the headers, which
+   stops once all are found. Returns the number found, or -1 */
+int gem_tar_find_members(int fd, GemTarMember *members, int nmembers);
+
+#endif
@@ -0,0 +1,302 @@
+/*
+ * Copyright (c) 2012, Novell Inc.
+ *
+ * This program is licensed under the BSD license, read LICENSE.BSD
+ * for further information
+ *
+ * gem_version: Gem::Version and Gem::Requirement without allocations.
+ */
+
+#include <string.h>
+
+#include <solv/pool.h>
+
+#include "gem_version.h"
+
+static const GemVersionSegment zero_segment = { "0", 1, 1 };
+
+static const struct {
+    const char *op;
+    int flags;
+} requirement_ops[] = {
+    { "=", REL_EQ },
+    { "!=", REL_LT | REL_GT },
+    { ">", REL_GT },
+    { "<", REL_LT },
+    { ">=", REL_GT | REL_EQ },
+    { "<=", REL_LT | REL_EQ },
+    { "~>", REL_GT | REL_EQ },
+};
+
+#define NOPS ((int) (sizeof(requirement_ops) / sizeof(*requirement_ops)))
+
+static int is_space(int c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+static int is_digit(int c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static int is_alpha(int c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+/* a run of [0-9a-zA-Z] (and '-' with dash) from p, its end or 0 if empty */
+static const char *skip_alnum(const char *p, const char *end, int dash)
+{
+    const char *s = p;
+
+    while (p < end && (is_digit(*p) || is_alpha(*p) || (dash && *p == '-')))
+        p++;
+    return p == s ? 0 : p;
+}
+
+/* \A\s*([0-9]+(?>\.[0-9a-zA-Z]+)*(-[0-9A-Za-z-]+(\.[0-9A-Za-z-]+)*)?)?\s*\z
+   without the blanks, which are gone */
+static int version_valid(const char *p, const char *end)
+{
+    if (p == end || !is_digit(*p))
+        return 0;
+    while (p < end && is_digit(*p))
+        p++;
+    while (p < end && *p == '.')
+        if (!(p = skip_alnum(p + 1, end, 0)))
+            return 0;
+    if (p < end && *p == '-') {
+        if (!(p = skip_alnum(p + 1, end, 1)))
+            return 0;
+        while (p < end && *p == '.')
+            if (!(p = skip_alnum(p + 1, end, 1)))
+                return 0;
+    }
+    return p == end;
+}
+
+static int add_segment(GemVersion *v, const char *str, int len, int numeric)
+{
+    GemVersionSegment *seg;
+
+    if (v->nsegments == GEM_VERSION_MAX_SEGMENTS)
+        return -1;
+    if (numeric)
+        for (; len > 1 && *str == '0'; len--)
+            str++;
+    seg = v->segments + v->nsegments++;
+    seg->str = str;
+    seg->len = len;
+    seg->numeric = numeric;
+    if (!numeric && v->nrelease < 0)
+        v->nrelease = v->nsegments - 1;
+    return 0;
+}
+
+int gem_version_parse(GemVersion *v, const char *version)
+{
+    const char *p = version, *end, *s;
+
+    v->nsegments = 0;
+    /* no string segment yet */
+    v->nrelease = -1;
+    while (is_space(*p))
+        p++;
+    end = p + strlen(p);
+    while (end > p && is_space(end[-1]))
+        end--;
+    if (p == end) {
+        /* a blank version is "0" */
+        add_segment(v, "0", 1, 1);
+        v->nrelease = 1;
+        return 0;
+    }
+    if (!version_valid(p, end))
+        return -1;
+
+    /* the segments of version.gsub("-", ".pre.").scan(/[0-9]+|[a-z]+/i) */
+    while (p < end) {
+        s = p;
+        if (*p == '-') {
+            if (add_segment(v, "pre", 3, 0))
+                return -1;
+            p++;
+        }
+        else if (is_digit(*p)) {
+            while (p < end && is_digit(*p))
+                p++;
+            if (add_segment(v, s, p - s, 1))
+                return -1;
+        }
+        else if (is_alpha(*p)) {
+            while (p < end && is_alpha(*p))
+                p++;
+            if (add_segment(v, s, p - s, 0))
+                return -1;
+        }
+        else
+            p++;
+    }
+    if (v->nrelease < 0)
+        v->nrelease = v->nsegments;
+    return 0;
+}
+
+int gem_version_prerelease(const GemVersion *v)
+{
+    return v->nrelease < v->nsegments;
+}
+
+static int is_zero(const GemVersionSegment *seg)
+{
+    return seg->numeric && seg->len == 1 && seg->str[0] == '0';
+}
+
+/* numbers are greater than strings, strings compare like memcmp */
+static int segment_cmp(const GemVersionSegment *a, const GemVersionSegment *b)
+{
+    int r;
+
+    if (a->numeric != b->numeric)
+        return a->numeric ? 1 : -1;
+    if (a->numeric && a->len != b->len)
+        return a->len < b->len ? -1 : 1;
+    r = memcmp(a->str, b->str, a->len < b->len ? a->len : b->len);
+    if (r)
+        return r < 0 ? -1 : 1;
+    return a->len < b->len ? -1 : a->len > b->len ? 1 : 0;
+}
+
+/* the canonical segments: release and prerelease part each without
+   their trailing zeros */
+static int canonical_segments(const GemVersion *v, const GemVersionSegment **segs)
+{
+    int i, n = 0, nrelease = v->nrelease, nsegments = v->nsegments;
+
+    while (nrelease > 0 && is_zero(v->segments + nrelease - 1))
+        nrelease--;
+    while (nsegments > v->nrelease && is_zero(v->segments + nsegments - 1))
+        nsegments--;
+    for (i = 0; i < nrelease; i++)
+        segs[n++] = v->segments + i;
+    for (i = v->nrelease; i < nsegments; i++)
+        segs[n++] = v->segments + i;
+    return n;
+}
+
+int gem_version_cmp(const GemVersion *a, const GemVersion *b)
+{
+    const GemVersionSegment *sa[GEM_VERSION_MAX_SEGMENTS], *sb[GEM_VERSION_MAX_SEGMENTS];
+    int i, r, na, nb;
+
+    na = canonical_segments(a, sa);
+    nb = canonical_segments(b, sb);
+    /* missing segments are 0 */
+    for (i = 0; i < na || i < nb; i++)
+        if ((r = segment_cmp(i < na ? sa[i] : &zero_segment, i < nb ? sb[i] : &zero_segment)) != 0)
+            return r;
+    return 0;
+}
+
+int gem_version_bump(const GemVersion *v, char *buf, int size)
+{
+    int i, len = 0, n = v->nrelease;
+
+    /* the string segments go, then the last one, unless it is the only */
+    if (n > 1)
+        n--;
+    for (i = 0; i < n; i++)
+        len += v->segments[i].len + 1;
+    /* a carry may add a digit */
+    if (len + 1 > size)
+        return -1;
+    len = 0;
+    for (i = 0; i < n; i++) {
+        if (i)
+            buf[len++] = '.';
+        memcpy(buf + len, v->segments[i].str, v->segments[i].len);
+        len += v->segments[i].len;
+    }
+    /* and the last one gets succ */
+    for (i = len - 1; i >= 0 && buf[i] == '9'; i--)
+        buf[i] = '0';
+    if (i < 0 || buf[i] == '.') {
+        memmove(buf + i + 2, buf + i + 1, len - i - 1);
+        buf[i + 1] = '1';
+        len++;
+    }
+    else
+        buf[i]++;
+    buf[len] = 0;
+    return len;
+}
+
+int gem_requirement_match(const char *op, const GemVersion *r, const GemVersion *v)
+{
+    GemVersion release, bumped;
+    char bump[GEM_VERSION_BUMP_SIZE];
+    int c = gem_version_cmp(v, r);
+
+    if (!strcmp(op, "="))
+        return c == 0;
+    if (!strcmp(op, "!="))
+        return c != 0;
+    if (!strcmp(op, ">"))
+        return c > 0;
+    if (!strcmp(op, "<"))
+        return c < 0;
+    if (!strcmp(op, ">="))
+        return c >= 0;
+    if (!strcmp(op, "<="))
+        return c <= 0;
+    if (!strcmp(op, "~>")) {
+        if (c < 0)
+            return 0;
+        if (gem_version_bump(r, bump, sizeof(bump)) < 0 || gem_version_parse(&bumped, bump))
+            return -1;
+        /* the prerelease segments of v don't count for the upper bound */
+        release = *v;
+        release.nsegments = release.nrelease;
+        return gem_version_cmp(&release, &bumped) < 0;
+    }
+    return -1;
+}
+
+int gem_requirement_constraints(const char *op, const char *version, GemConstraint *c, char *bump, int size)
+{
+    GemVersion v;
+    int i;
+
+    for (i = 0; i < NOPS; i++)
+        if (!strcmp(op, requirement_ops[i].op))
+            break;
+    if (i == NOPS)
+        return 0;
+    c[0].flags = requirement_ops[i].flags;
+    c[0].version = version;
+    if (strcmp(op, "~>") || gem_version_parse(&v, version) || gem_version_bump(&v, bump, size) < 0)
+        return 1;
+    c[1].flags = REL_LT;
+    c[1].version = bump;
+    return 2;
+}
+
+int gem_requirement_deps(Pool *pool, Id name, const char *op, const char *version, Id *deps)
+{
+    GemConstraint c[2];
+    char bump[GEM_VERSION_BUMP_SIZE];
+    int i, n;
+
+    n = gem_requirement_constraints(op, version, c, bump, sizeof(bump));
+    for (i = 0; i < n; i++)
+        deps[i] = pool_rel2id(pool, name, pool_str2id(pool, c[i].version, 1), c[i].flags, 1);
+    return n;
+}
+
+const char *gem_constraint_op(int flags)
+{
+    /* the flagtab of repo_susetags */
+    static const char *ops[] = { "", ">", "=", ">=", "<", "!=", "<=", "" };
+    return ops[flags & 7];
+}
@@ -0,0 +1,74 @@
+#ifndef GEM_VERSION_H
+#define GEM_VERSION_H
+
+#include <solv/pool.h>
+
+/*
+ * Gem::Version and Gem::Requirement as RubyGems has them: a version is
+ * split into numeric and string segments ("1.0.0.rc1" is 1, 0, 0, "rc",
+ * 1, a "-" counts as ".pre."), versions compare by their canonical
+ * segments ("1.0" == "1.0.0"), and "~> v" means >= v and, for the
+ * release part of the version, < v.bump ("~> 1.2.3" is < 1.3, "~> 2"
+ * is < 3).
+ *
+ * The segments point into the version string and live in a fixed
+ * array, so nothing here allocates: this runs for every dependency
+ * of every gem.
+ */
+
+#define GEM_VERSION_MAX_SEGMENTS 32
+/* a bump buffer that fits the versions of real gems */
+#define GEM_VERSION_BUMP_SIZE 256
+
+typedef struct GemVersionSegment
+{
+    /* numeric segments without their leading zeros */
+    const char *str;
+    int len;
+    int numeric;
+} GemVersionSegment;
+
+typedef struct GemVersion
+{
+    GemVersionSegment segments[GEM_VERSION_MAX_SEGMENTS];
+    int nsegments;
+    /* the segments before the first string segment */
+    int nrelease;
+} GemVersion;
+
+/* splits version, which must stay around. Returns -1 if it is no
+   valid Gem::Version or has too many segments */
+int gem_version_parse(GemVersion *v, const char *version);
+/* Gem::Version#<=> */
+int gem_version_cmp(const GemVersion *a, const GemVersion *b);
+/* Gem::Version#prerelease? */
+int gem_version_prerelease(const GemVersion *v);
+/* Gem::Version#bump written to buf, the upper bound of ~>. Returns
+   its length, or -1 if it does not fit */
+int gem_version_bump(const GemVersion *v, char *buf, int size);
+
+/* Gem::Requirement#satisfied_by? of a single "op r", -1 for an op
+   RubyGems does not know */
+int gem_requirement_match(const char *op, const GemVersion *r, const GemVersion *v);
+
+/* one condition of a requirement on the rpm ordered evr of a gem */
+typedef struct GemConstraint
+{
+    /* REL_GT, REL_EQ and REL_LT of libsolv; != is REL_LT | REL_GT */
+    int flags;
+    const char *version;
+} GemConstraint;
+
+/*
+ * the conditions of "op version", all of which must hold: one, or
+ * two for ~> (the upper bound goes to bump, which has room for size
+ * bytes). Returns their number, 0 if op is unknown, so that any
+ * version of the gem will do.
+ */
+int gem_requirement_constraints(const char *op, const char *version, GemConstraint *c, char *bump, int size);
+/* the same as dependency Ids on name, deps has room for two */
+int gem_requirement_deps(Pool *pool, Id name, const char *op, const char *version, Id *deps);
+/* the op of a constraint as susetags has it: "<", ">=", "!=", ... */
+const char *gem_constraint_op(int flags);
+
+#endif
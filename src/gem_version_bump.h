@@ -1,7 +0,0 @@
-
-#ifndef GEM_VERSION_BUMP_H
-#define GEM_VERSION_BUMP_H
-
-char * gem_version_bump(const char *version);
-
-#endif
\ No newline at end of file
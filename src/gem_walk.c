@@ -0,0 +1,474 @@
+/*
+ * Copyright (c) 2012, Novell Inc.
+ *
+ * This program is licensed under the BSD license, read LICENSE.BSD
+ * for further information
+ *
+ * gem_walk: finds the gems of a directory tree on several threads.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <solv/pool.h>
+#include <solv/hash.h>
+
+#include "gem_walk.h"
+
+#define WALK_BUFSIZE 65536
+
+/* what getdents64 returns */
+struct walk_dirent
+{
+    unsigned long long d_ino;
+    long long d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+typedef struct WalkDir WalkDir;
+
+typedef struct WalkEntry
+{
+    int name;           /* offset in names of the directory */
+    WalkDir *sub;       /* set for directories */
+    dev_t dev;
+    ino_t ino;
+} WalkEntry;
+
+struct WalkDir
+{
+    char *path;
+    int listed;
+    int err;
+    WalkEntry *entries;
+    int nentries;
+    char *names;
+    int nnames;
+};
+
+typedef struct WalkInode
+{
+    dev_t dev;
+    ino_t ino;
+} WalkInode;
+
+typedef struct WalkFrame
+{
+    WalkDir *dir;
+    int pos;
+} WalkFrame;
+
+struct GemWalk
+{
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;
+    pthread_cond_t listed_cond;
+    pthread_t *threads;
+    int nthreads;
+    int stop;
+
+    /* every directory found, freed at the end */
+    WalkDir **dirs;
+    int ndirs;
+    /* directories to list, the last one first */
+    WalkDir **queue;
+    int nqueue;
+    int active;
+
+    /* the directories the paths come from, depth first */
+    WalkFrame *stack;
+    int nstack;
+    /* or the list the paths come from */
+    FILE *list;
+    int sep;
+    char *line;
+    size_t linesize;
+
+    /* the paths found, paths[0] is path number base */
+    char **paths;
+    int npaths;
+    int base;
+    int end;
+
+    /* the inodes of the gems found */
+    WalkInode *inodes;
+    int ninodes;
+    Id *ht;
+    Hashval htmask;
+
+    char **errors;
+    int nerrors;
+};
+
+static WalkDir *walk_newdir(char *path)
+{
+    WalkDir *d = solv_calloc(1, sizeof(WalkDir));
+    d->path = path;
+    return d;
+}
+
+static void walk_freedir(WalkDir *d)
+{
+    d->path = solv_free(d->path);
+    d->entries = solv_free(d->entries);
+    d->names = solv_free(d->names);
+}
+
+static int is_gem(const char *name)
+{
+    int l = strlen(name);
+    return l > 4 && !strcmp(name + l - 4, ".gem");
+}
+
+/* strcmp of the names, with a '/' after those of directories */
+static int cmp_entry(const void *a, const void *b, void *dp)
+{
+    const WalkEntry *ea = a, *eb = b;
+    const unsigned char *na = (const unsigned char *) dp + ea->name;
+    const unsigned char *nb = (const unsigned char *) dp + eb->name;
+    int ca, cb;
+
+    while (*na && *na == *nb)
+        na++, nb++;
+    ca = *na ? *na : ea->sub ? '/' : 0;
+    cb = *nb ? *nb : eb->sub ? '/' : 0;
+    return ca - cb;
+}
+
+static void walk_add_entry(WalkDir *d, const char *name, int isdir, dev_t dev, ino_t ino)
+{
+    WalkEntry *e;
+    int l = strlen(name) + 1;
+
+    d->entries = solv_extend(d->entries, d->nentries, 1, sizeof(WalkEntry), 63);
+    e = d->entries + d->nentries++;
+    d->names = solv_extend(d->names, d->nnames, l, 1, 4095);
+    memcpy(d->names + d->nnames, name, l);
+    e->name = d->nnames;
+    d->nnames += l;
+    /* a marker until the directory node is made */
+    e->sub = isdir ? (WalkDir *) d : 0;
+    e->dev = dev;
+    e->ino = ino;
+}
+
+/* reads the gems and subdirectories of d, without the lock */
+static void walk_list(WalkDir *d, char *buf)
+{
+    struct walk_dirent *de;
+    struct stat st;
+    long n, off;
+    int fd, type, islink;
+
+    if ((fd = open(d->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0 || fstat(fd, &st)) {
+        d->err = errno;
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+    while ((n = syscall(SYS_getdents64, fd, buf, WALK_BUFSIZE)) > 0) {
+        for (off = 0; off < n; off += de->d_reclen) {
+            dev_t dev = st.st_dev;
+            ino_t ino;
+            struct stat est;
+
+            de = (struct walk_dirent *) (buf + off);
+            if (de->d_name[0] == '.')
+                continue;
+            type = de->d_type;
+            ino = de->d_ino;
+            if (type == DT_REG && !is_gem(de->d_name))
+                continue;
+            if (type == DT_UNKNOWN || type == DT_LNK) {
+                if (fstatat(fd, de->d_name, &est, AT_SYMLINK_NOFOLLOW))
+                    continue;
+                islink = S_ISLNK(est.st_mode);
+                if (islink && fstatat(fd, de->d_name, &est, 0))
+                    continue;
+                if (S_ISDIR(est.st_mode) && !islink)
+                    type = DT_DIR;
+                else if (S_ISREG(est.st_mode) && is_gem(de->d_name))
+                    type = DT_REG;
+                else
+                    continue;
+                dev = est.st_dev;
+                ino = est.st_ino;
+            }
+            if (type == DT_REG || type == DT_DIR)
+                walk_add_entry(d, de->d_name, type == DT_DIR, dev, ino);
+        }
+    }
+    if (n < 0)
+        d->err = errno;
+    close(fd);
+    solv_sort(d->entries, d->nentries, sizeof(WalkEntry), cmp_entry, d->names);
+}
+
+static void *walk_worker(void *arg)
+{
+    GemWalk *w = (GemWalk *) arg;
+    char *buf = solv_malloc(WALK_BUFSIZE);
+    WalkDir *d;
+    int i;
+
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (!w->nqueue && w->active && !w->stop)
+            pthread_cond_wait(&w->work_cond, &w->lock);
+        if (w->stop || !w->nqueue)
+            break;
+        d = w->queue[--w->nqueue];
+        w->active++;
+        pthread_mutex_unlock(&w->lock);
+
+        walk_list(d, buf);
+        for (i = 0; i < d->nentries; i++)
+            if (d->entries[i].sub)
+                d->entries[i].sub = walk_newdir(solv_dupjoin(d->path, "/", d->names + d->entries[i].name));
+
+        pthread_mutex_lock(&w->lock);
+        /* the first subdirectory is needed first */
+        for (i = d->nentries - 1; i >= 0; i--) {
+            if (!d->entries[i].sub)
+                continue;
+            w->queue = solv_extend(w->queue, w->nqueue, 1, sizeof(WalkDir *), 63);
+            w->queue[w->nqueue++] = d->entries[i].sub;
+            w->dirs = solv_extend(w->dirs, w->ndirs, 1, sizeof(WalkDir *), 63);
+            w->dirs[w->ndirs++] = d->entries[i].sub;
+        }
+        d->listed = 1;
+        w->active--;
+        pthread_cond_broadcast(&w->listed_cond);
+        pthread_cond_broadcast(&w->work_cond);
+    }
+    pthread_cond_broadcast(&w->work_cond);
+    pthread_mutex_unlock(&w->lock);
+    solv_free(buf);
+    return 0;
+}
+
+/* returns 1 if the inode was not seen before */
+static int walk_inode_add(GemWalk *w, dev_t dev, ino_t ino)
+{
+    Hashval h, hh;
+    WalkInode *in;
+    int i;
+
+    if (w->ninodes * 2 >= w->htmask) {
+        solv_free(w->ht);
+        w->htmask = mkmask(w->ninodes + 4096);
+        w->ht = solv_calloc(w->htmask + 1, sizeof(Id));
+        for (i = 0; i < w->ninodes; i++) {
+            h = (w->inodes[i].ino * 31 + w->inodes[i].dev) & w->htmask;
+            hh = HASHCHAIN_START;
+            while (w->ht[h])
+                h = HASHCHAIN_NEXT(h, hh, w->htmask);
+            w->ht[h] = i + 1;
+        }
+    }
+    h = (ino * 31 + dev) & w->htmask;
+    hh = HASHCHAIN_START;
+    while (w->ht[h]) {
+        in = w->inodes + w->ht[h] - 1;
+        if (in->ino == ino && in->dev == dev)
+            return 0;
+        h = HASHCHAIN_NEXT(h, hh, w->htmask);
+    }
+    w->inodes = solv_extend(w->inodes, w->ninodes, 1, sizeof(WalkInode), 4095);
+    w->inodes[w->ninodes].dev = dev;
+    w->inodes[w->ninodes++].ino = ino;
+    w->ht[h] = w->ninodes;
+    return 1;
+}
+
+static void walk_add_path(GemWalk *w, char *path)
+{
+    w->paths = solv_extend(w->paths, w->npaths - w->base, 1, sizeof(char *), 1023);
+    w->paths[w->npaths++ - w->base] = path;
+}
+
+/* finds the next path, with the lock held */
+static void walk_next(GemWalk *w)
+{
+    WalkFrame *f;
+    WalkEntry *e;
+    WalkDir *d;
+    ssize_t l;
+
+    if (w->list) {
+        while ((l = getdelim(&w->line, &w->linesize, w->sep, w->list)) > 0) {
+            if (w->line[l - 1] == w->sep)
+                w->line[--l] = 0;
+            if (l) {
+                walk_add_path(w, solv_strdup(w->line));
+                return;
+            }
+        }
+        w->end = 1;
+        return;
+    }
+    while (w->nstack && !w->stop) {
+        f = w->stack + w->nstack - 1;
+        d = f->dir;
+        if (!d->listed) {
+            /* another caller may move on meanwhile, so look again */
+            pthread_cond_wait(&w->listed_cond, &w->lock);
+            continue;
+        }
+        if (f->pos == d->nentries) {
+            if (d->err) {
+                w->errors = solv_extend(w->errors, w->nerrors, 1, sizeof(char *), 15);
+                w->errors[w->nerrors++] = solv_dupjoin(d->path, ": ", strerror(d->err));
+            }
+            walk_freedir(d);
+            w->nstack--;
+            continue;
+        }
+        e = d->entries + f->pos++;
+        if (e->sub) {
+            w->stack = solv_extend(w->stack, w->nstack, 1, sizeof(WalkFrame), 15);
+            w->stack[w->nstack].dir = e->sub;
+            w->stack[w->nstack++].pos = 0;
+        }
+        else if (walk_inode_add(w, e->dev, e->ino)) {
+            walk_add_path(w, solv_dupjoin(d->path, "/", d->names + e->name));
+            return;
+        }
+    }
+    w->end = 1;
+}
+
+static const char *walk_path(void *data, int i)
+{
+    GemWalk *w = (GemWalk *) data;
+    const char *path;
+
+    pthread_mutex_lock(&w->lock);
+    while (i >= w->npaths && !w->end)
+        walk_next(w);
+    path = i < w->npaths ? w->paths[i - w->base] : 0;
+    pthread_mutex_unlock(&w->lock);
+    return path;
+}
+
+/* frees the paths up to i, they are done with in order */
+static void walk_done(void *data, int i)
+{
+    GemWalk *w = (GemWalk *) data;
+    int n;
+
+    pthread_mutex_lock(&w->lock);
+    w->paths[i - w->base] = solv_free(w->paths[i - w->base]);
+    n = i + 1 - w->base;
+    if (n >= 1024 && n * 2 >= w->npaths - w->base) {
+        memmove(w->paths, w->paths + n, (w->npaths - w->base - n) * sizeof(char *));
+        w->base += n;
+    }
+    pthread_mutex_unlock(&w->lock);
+}
+
+static GemWalk *walk_create(void)
+{
+    GemWalk *w = solv_calloc(1, sizeof(GemWalk));
+    pthread_mutex_init(&w->lock, 0);
+    pthread_cond_init(&w->work_cond, 0);
+    pthread_cond_init(&w->listed_cond, 0);
+    return w;
+}
+
+GemWalk *gem_walk_dir(const char *dir, int nthreads)
+{
+    GemWalk *w = walk_create();
+    WalkDir *root = walk_newdir(solv_strdup(dir));
+    int i;
+
+    w->dirs = solv_extend(w->dirs, 0, 1, sizeof(WalkDir *), 63);
+    w->dirs[w->ndirs++] = root;
+    w->queue = solv_extend(w->queue, 0, 1, sizeof(WalkDir *), 63);
+    w->queue[w->nqueue++] = root;
+    w->stack = solv_extend(w->stack, 0, 1, sizeof(WalkFrame), 15);
+    w->stack[w->nstack].dir = root;
+    w->stack[w->nstack++].pos = 0;
+
+    w->nthreads = nthreads > 0 ? nthreads : 1;
+    w->threads = solv_calloc(w->nthreads, sizeof(pthread_t));
+    for (i = 0; i < w->nthreads; i++)
+        pthread_create(w->threads + i, 0, walk_worker, w);
+    return w;
+}
+
+GemWalk *gem_walk_list(FILE *fp, int sep)
+{
+    GemWalk *w = walk_create();
+    w->list = fp;
+    w->sep = sep;
+    return w;
+}
+
+void gem_walk_source(GemWalk *w, GemPathSource *src)
+{
+    src->path = walk_path;
+    src->done = walk_done;
+    src->data = w;
+}
+
+int gem_walk_count(GemWalk *w)
+{
+    int n;
+
+    pthread_mutex_lock(&w->lock);
+    n = w->npaths;
+    pthread_mutex_unlock(&w->lock);
+    return n;
+}
+
+const char *gem_walk_error(GemWalk *w, int i)
+{
+    return i < w->nerrors ? w->errors[i] : 0;
+}
+
+void gem_walk_free(GemWalk *w)
+{
+    int i;
+
+    pthread_mutex_lock(&w->lock);
+    w->stop = 1;
+    pthread_cond_broadcast(&w->work_cond);
+    pthread_cond_broadcast(&w->listed_cond);
+    pthread_mutex_unlock(&w->lock);
+    for (i = 0; i < w->nthreads; i++)
+        pthread_join(w->threads[i], 0);
+    solv_free(w->threads);
+
+    for (i = 0; i < w->ndirs; i++) {
+        walk_freedir(w->dirs[i]);
+        solv_free(w->dirs[i]);
+    }
+    solv_free(w->dirs);
+    solv_free(w->queue);
+    solv_free(w->stack);
+    free(w->line);
+    for (i = 0; i < w->npaths - w->base; i++)
+        solv_free(w->paths[i]);
+    solv_free(w->paths);
+    solv_free(w->inodes);
+    solv_free(w->ht);
+    for (i = 0; i < w->nerrors; i++)
+        solv_free(w->errors[i]);
+    solv_free(w->errors);
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->work_cond);
+    pthread_cond_destroy(&w->listed_cond);
+    solv_free(w);
+}
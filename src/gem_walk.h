@@ -0,0 +1,32 @@
+#ifndef GEM_WALK_H
+#define GEM_WALK_H
+
+#include <stdio.h>
+#include "gem_parallel.h"
+
+/*
+ * Streams the paths of the gems in a directory tree, or in a list, to
+ * the parser while they are still being found.
+ *
+ * A directory is listed with getdents on several threads. Its gems
+ * come in the strcmp order of their paths (as sorted "find | sort"
+ * output, the order of the old glob for a flat directory), whatever
+ * the order the threads list the directories in. Hidden files and
+ * directories are skipped, symlinks are followed to gems but not to
+ * directories, and a gem hardlinked under several paths only comes
+ * once, under the first.
+ */
+typedef struct GemWalk GemWalk;
+
+/* walks dir with nthreads threads */
+GemWalk *gem_walk_dir(const char *dir, int nthreads);
+/* reads the paths from fp, separated by sep ('\n' or '\0') */
+GemWalk *gem_walk_list(FILE *fp, int sep);
+void gem_walk_source(GemWalk *w, GemPathSource *src);
+/* the number of paths so far */
+int gem_walk_count(GemWalk *w);
+/* the i-th directory that could not be read, as "path: error", or 0 */
+const char *gem_walk_error(GemWalk *w, int i);
+void gem_walk_free(GemWalk *w);
+
+#endif
@@ -0,0 +1,523 @@
+/*
+ * Copyright (c) 2012, Novell Inc.
+ *
+ * This program is licensed under the BSD license, read LICENSE.BSD
+ * for further information
+ *
+ * gem_watch: keeps the solv file of gem directories up to date.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include <solv/pool.h>
+#include <solv/repo.h>
+#include <solv/strpool.h>
+#include "common_write.h"
+
+#include "rubygems_parser.h"
+#include "gem_record.h"
+#include "gem_parallel.h"
+#include "gem_solv.h"
+#include "gem_stats.h"
+#include "gem_watch.h"
+#include "tools_util.h"
+
+/* quiet time after the last change before the solv file is written */
+#define WATCH_DELAY_MS 1000
+
+/* IN_CREATE only counts for directories */
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CREATE)
+
+typedef struct WatchGem
+{
+    GemRecord rec;
+    int present;
+    int changed;
+} WatchGem;
+
+typedef struct Watch
+{
+    ParseContext *pctx;
+    char **dirs;
+    int ndirs;
+    const char *outfile;
+
+    /* the inotify fd and the path of every watched directory by its
+       watch descriptor, spelled as the directory scan spells it */
+    int fd;
+    char **wdpaths;
+    int nwdpaths;
+
+    /* the gems by the Stringpool id of their path */
+    Stringpool paths;
+    WatchGem *gems;
+    int ngems;
+    /* ids of the paths changed since the last write */
+    Queue changed;
+    int rescan;
+
+    /* records the callbacks of the gem being parsed */
+    ParseContext rctx;
+    WatchGem *cur;
+    struct joindata jd;
+} Watch;
+
+static volatile sig_atomic_t watch_stop;
+
+static void watch_signal(int sig)
+{
+    watch_stop = 1;
+}
+
+static WatchGem *watch_gem(Watch *w, const char *path)
+{
+    Id id = stringpool_str2id(&w->paths, path, 1);
+
+    if (id >= w->ngems) {
+        w->gems = solv_zextend(w->gems, w->ngems, id + 1 - w->ngems, sizeof(WatchGem), 1023);
+        w->ngems = id + 1;
+    }
+    return w->gems + id;
+}
+
+/*
+ * The sink of the parser: every gem start switches to the record of
+ * that gem, everything else goes to the record.
+ */
+
+static int sink_start(void *user_data, const char *filename)
+{
+    Watch *w = (Watch *) user_data;
+
+    w->cur = watch_gem(w, filename);
+    w->cur->present = 1;
+    gem_record_reset(&w->cur->rec);
+    gem_record_context(&w->rctx, &w->cur->rec, w->pctx);
+    return w->rctx.gem_start_callback(w->rctx.data, filename);
+}
+
+static int sink_attr(void *user_data, const char *attr, const char *val)
+{
+    Watch *w = (Watch *) user_data;
+    return w->cur ? w->rctx.gem_attr_callback(w->rctx.data, attr, val) : 0;
+}
+
+static int sink_deps_start(void *user_data)
+{
+    Watch *w = (Watch *) user_data;
+    return w->cur ? w->rctx.gem_deps_start_callback(w->rctx.data) : 0;
+}
+
+static int sink_dep(void *user_data, const char *name, const char *op, const char *version)
+{
+    Watch *w = (Watch *) user_data;
+    return w->cur ? w->rctx.gem_dep_callback(w->rctx.data, name, op, version) : 0;
+}
+
+static int sink_deps_end(void *user_data)
+{
+    Watch *w = (Watch *) user_data;
+    return w->cur ? w->rctx.gem_deps_end_callback(w->rctx.data) : 0;
+}
+
+static int sink_location(void *user_data, const char *location)
+{
+    Watch *w = (Watch *) user_data;
+    return w->cur ? w->rctx.gem_location_callback(w->rctx.data, location) : 0;
+}
+
+static int sink_checksum(void *user_data, const char *sha256, unsigned long long size)
+{
+    Watch *w = (Watch *) user_data;
+    return w->cur ? w->rctx.gem_checksum_callback(w->rctx.data, sha256, size) : 0;
+}
+
+static int sink_installsize(void *user_data, unsigned long long size)
+{
+    Watch *w = (Watch *) user_data;
+    return w->cur ? w->rctx.gem_installsize_callback(w->rctx.data, size) : 0;
+}
+
+static int sink_end(void *user_data)
+{
+    Watch *w = (Watch *) user_data;
+    int ret = w->cur ? w->rctx.gem_end_callback(w->rctx.data) : 0;
+
+    w->cur = 0;
+    return ret;
+}
+
+static void sink_error(void *user_data, const char *msg)
+{
+    fprintf(stderr, "%s\n", msg);
+}
+
+static int is_gem(const char *name)
+{
+    int l = strlen(name);
+    return name[0] != '.' && l > 4 && !strcmp(name + l - 4, ".gem");
+}
+
+static void watch_changed(Watch *w, const char *path)
+{
+    WatchGem *g = watch_gem(w, path);
+
+    if (!g->changed) {
+        g->changed = 1;
+        queue_push(&w->changed, g - w->gems);
+    }
+}
+
+/*
+ * Watches dir and the directories below it that the scan walks into,
+ * i.e. not hidden and not through symlinks (see gem_walk.h). The watch
+ * comes before the listing, so nothing created in between is missed.
+ * With gems, the gems found are changed, for directories that showed
+ * up after the scan. Returns -1 if a directory can't be watched.
+ */
+static int watch_tree(Watch *w, const char *dir, int top, int gems)
+{
+    DIR *d;
+    struct dirent *de;
+    struct stat st;
+    char *path;
+    int wd, ret = 0;
+
+    if ((wd = inotify_add_watch(w->fd, dir, WATCH_EVENTS | IN_ONLYDIR | (top ? 0 : IN_DONT_FOLLOW))) < 0) {
+        /* gone again */
+        if (!top && errno == ENOENT)
+            return 0;
+        fprintf(stderr, "%s: %s\n", dir, strerror(errno));
+        return -1;
+    }
+    if (wd >= w->nwdpaths) {
+        w->wdpaths = solv_zextend(w->wdpaths, w->nwdpaths, wd + 1 - w->nwdpaths, sizeof(char *), 255);
+        w->nwdpaths = wd + 1;
+    }
+    /* a directory that moved has its old watch */
+    solv_free(w->wdpaths[wd]);
+    w->wdpaths[wd] = solv_strdup(dir);
+
+    if (!(d = opendir(dir))) {
+        if (!top && errno == ENOENT)
+            return 0;
+        fprintf(stderr, "%s: %s\n", dir, strerror(errno));
+        return -1;
+    }
+    while ((de = readdir(d)) != 0) {
+        if (de->d_name[0] == '.')
+            continue;
+        path = solv_dupjoin(dir, "/", de->d_name);
+        if (de->d_type == DT_DIR || (de->d_type == DT_UNKNOWN && !lstat(path, &st) && S_ISDIR(st.st_mode))) {
+            if (watch_tree(w, path, 0, gems))
+                ret = -1;
+        }
+        else if (gems && is_gem(de->d_name))
+            watch_changed(w, path);
+        solv_free(path);
+    }
+    closedir(d);
+    return ret;
+}
+
+/* dir went away: its watches go, its gems are changed */
+static void watch_forget(Watch *w, const char *dir)
+{
+    size_t l = strlen(dir);
+    const char *path;
+    int i;
+
+    for (i = 0; i < w->nwdpaths; i++)
+        if (w->wdpaths[i] && !strncmp(w->wdpaths[i], dir, l) && (!w->wdpaths[i][l] || w->wdpaths[i][l] == '/')) {
+            inotify_rm_watch(w->fd, i);
+            w->wdpaths[i] = solv_free(w->wdpaths[i]);
+        }
+    for (i = 1; i < w->ngems; i++) {
+        if (!w->gems[i].present)
+            continue;
+        path = stringpool_id2str(&w->paths, i);
+        if (!strncmp(path, dir, l) && path[l] == '/')
+            watch_changed(w, path);
+    }
+}
+
+static int cmp_path(const void *a, const void *b, void *dp)
+{
+    Stringpool *paths = (Stringpool *) dp;
+    return strcmp(stringpool_id2str(paths, *(const Id *) a), stringpool_id2str(paths, *(const Id *) b));
+}
+
+/* replays the gems in path order, as the directory scan reads them */
+static int watch_write(Watch *w)
+{
+    Pool *pool = pool_create();
+    Repo *repo = repo_create(pool, "rubygems");
+    Repodata *data = repo_add_repodata(repo, 0);
+    ParseContext sctx;
+    SolvContext ctx;
+    Queue q;
+    char *tmp;
+    FILE *fp;
+    mode_t mask;
+    int i, fd, ret = -1;
+
+    queue_init(&q);
+    for (i = 1; i < w->ngems; i++)
+        if (w->gems[i].present)
+            queue_push(&q, i);
+    solv_sort(q.elements, q.count, sizeof(Id), cmp_path, &w->paths);
+
+    gem_parse_context_initialize(&sctx);
+    gem_solv_context_setup(&ctx, &sctx, repo, data);
+    for (i = 0; i < q.count; i++)
+        gem_record_replay(&w->gems[q.elements[i]].rec, &sctx);
+    sctx.gem_parse_end_callback(sctx.data);
+    gem_solv_context_free(&ctx);
+    gem_parse_context_free(&sctx);
+    repodata_internalize(data);
+
+    tmp = solv_dupjoin(w->outfile, ".XXXXXX", 0);
+    if ((fd = mkstemp(tmp)) < 0) {
+        fprintf(stderr, "%s: %s\n", tmp, strerror(errno));
+        goto out;
+    }
+    /* mkstemp makes it 0600 */
+    mask = umask(0);
+    umask(mask);
+    fchmod(fd, 0666 & ~mask);
+    if (!(fp = fdopen(fd, "w"))) {
+        close(fd);
+        unlink(tmp);
+        goto out;
+    }
+    tool_write_fp(repo, 0, 0, fp);
+    if (fflush(fp) || ferror(fp) || fsync(fd)) {
+        fprintf(stderr, "%s: %s\n", tmp, strerror(errno));
+        fclose(fp);
+        unlink(tmp);
+        goto out;
+    }
+    fclose(fp);
+    if (rename(tmp, w->outfile)) {
+        fprintf(stderr, "%s: %s\n", w->outfile, strerror(errno));
+        unlink(tmp);
+        goto out;
+    }
+    ret = 0;
+out:
+    solv_free(tmp);
+    queue_free(&q);
+    pool_free(pool);
+    return ret;
+}
+
+/* parses paths, which are below dir if that is set, with the locations
+   the directory scan gives them */
+static void watch_parse(Watch *w, const char *dir, char **paths, int npaths)
+{
+    const char *base = w->pctx->location_base;
+    int i;
+
+    if (dir)
+        w->pctx->location_base = dir;
+    if (npaths > 1 && w->pctx->jobs > 1)
+        gem_parse_parallel(w->pctx, paths, npaths);
+    else
+        for (i = 0; i < npaths; i++)
+            gem_parse_add_rubygem(w->pctx, paths[i]);
+    w->pctx->location_base = base;
+}
+
+/* parses what changed since the last write and writes again */
+static void watch_update(Watch *w)
+{
+    struct stat st;
+    char **paths = 0;
+    double t = gem_stats_now();
+    int i, j, k, l, nparsed, npaths = 0, nremoved = 0, rescanned = w->rescan;
+    WatchGem *g;
+    char *p;
+
+    if (rescanned) {
+        /* inotify lost events, start over */
+        for (i = 1; i < w->ngems; i++) {
+            gem_record_free(&w->gems[i].rec);
+            w->gems[i].present = w->gems[i].changed = 0;
+        }
+        queue_empty(&w->changed);
+        w->rescan = 0;
+        /* directories may have come and gone unseen */
+        for (i = 0; i < w->ndirs; i++)
+            watch_tree(w, w->dirs[i], 1, 0);
+        gem_parse(w->pctx, w->ndirs, w->dirs);
+    }
+    for (i = 0; i < w->changed.count; i++) {
+        g = w->gems + w->changed.elements[i];
+        g->changed = 0;
+        if (!stat(stringpool_id2str(&w->paths, w->changed.elements[i]), &st) && S_ISREG(st.st_mode)) {
+            paths = solv_extend(paths, npaths, 1, sizeof(char *), 63);
+            paths[npaths++] = solv_strdup(stringpool_id2str(&w->paths, w->changed.elements[i]));
+        }
+        else if (g->present) {
+            gem_record_free(&g->rec);
+            g->present = 0;
+            nremoved++;
+        }
+    }
+    queue_empty(&w->changed);
+
+    /* the paths of every directory to the front in turn */
+    for (j = nparsed = 0; j < w->ndirs; j++) {
+        l = strlen(w->dirs[j]);
+        for (i = k = nparsed; i < npaths; i++)
+            if (!strncmp(paths[i], w->dirs[j], l) && paths[i][l] == '/') {
+                p = paths[k];
+                paths[k++] = paths[i];
+                paths[i] = p;
+            }
+        watch_parse(w, w->dirs[j], paths + nparsed, k - nparsed);
+        nparsed = k;
+    }
+    watch_parse(w, 0, paths + nparsed, npaths - nparsed);
+
+    if (!watch_write(w)) {
+        if (rescanned)
+            fprintf(stderr, "%s: rescanned, written in %.0f ms\n", w->outfile, (gem_stats_now() - t) * 1e3);
+        else
+            fprintf(stderr, "%s: %d gems parsed, %d removed, written in %.0f ms\n", w->outfile, npaths, nremoved, (gem_stats_now() - t) * 1e3);
+    }
+    for (i = 0; i < npaths; i++)
+        solv_free(paths[i]);
+    solv_free(paths);
+}
+
+static void watch_events(Watch *w)
+{
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *ev;
+    const char *path;
+    ssize_t len;
+    char *p;
+
+    len = read(w->fd, buf, sizeof(buf));
+    for (p = buf; len > 0 && p < buf + len; p += sizeof(struct inotify_event) + ev->len) {
+        ev = (const struct inotify_event *) p;
+        if (ev->mask & IN_Q_OVERFLOW) {
+            w->rescan = 1;
+            continue;
+        }
+        if (ev->wd < 0 || ev->wd >= w->nwdpaths || !w->wdpaths[ev->wd])
+            continue;
+        if (ev->mask & IN_IGNORED) {
+            w->wdpaths[ev->wd] = solv_free(w->wdpaths[ev->wd]);
+            continue;
+        }
+        if (!ev->len || ev->name[0] == '.')
+            continue;
+        /* the same path as the directory scan makes */
+        path = join2(&w->jd, w->wdpaths[ev->wd], "/", ev->name);
+        if (ev->mask & IN_ISDIR) {
+            if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+                path = solv_strdup(path);
+                watch_tree(w, path, 0, 1);
+                solv_free((char *) path);
+            }
+            else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+                watch_forget(w, path);
+        }
+        else if (!(ev->mask & IN_CREATE) && is_gem(ev->name))
+            watch_changed(w, path);
+    }
+}
+
+int gem_watch(ParseContext *pctx, char **dirs, int ndirs, const char *outfile, int checksums)
+{
+    struct sigaction sa;
+    struct pollfd pfd;
+    Watch w;
+    int i, r, ret = 0;
+
+    memset(&w, 0, sizeof(w));
+    w.pctx = pctx;
+    w.dirs = dirs;
+    w.ndirs = ndirs;
+    w.outfile = outfile;
+    stringpool_init_empty(&w.paths);
+    queue_init(&w.changed);
+
+    /* watch before the scan, so no change is lost in between */
+    if ((w.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+        perror("inotify_init");
+        return -1;
+    }
+    for (i = 0; i < ndirs; i++)
+        if (watch_tree(&w, dirs[i], 1, 0)) {
+            ret = -1;
+            goto out;
+        }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = watch_signal;
+    sigaction(SIGINT, &sa, 0);
+    sigaction(SIGTERM, &sa, 0);
+
+    pctx->gem_parse_start_callback = 0;
+    pctx->gem_start_callback = sink_start;
+    pctx->gem_yaml_metadata_callback = 0;
+    pctx->gem_attr_callback = sink_attr;
+    pctx->gem_deps_start_callback = sink_deps_start;
+    pctx->gem_dep_callback = sink_dep;
+    pctx->gem_deps_end_callback = sink_deps_end;
+    pctx->gem_location_callback = sink_location;
+    pctx->gem_checksum_callback = checksums ? sink_checksum : 0;
+    pctx->gem_installsize_callback = sink_installsize;
+    pctx->gem_end_callback = sink_end;
+    pctx->gem_parse_end_callback = 0;
+    pctx->gem_parse_error_callback = sink_error;
+    pctx->data = &w;
+
+    /* the first write is the full scan */
+    w.rescan = 1;
+    watch_update(&w);
+
+    pfd.fd = w.fd;
+    pfd.events = POLLIN;
+    while (!watch_stop) {
+        r = poll(&pfd, 1, w.changed.count || w.rescan ? WATCH_DELAY_MS : -1);
+        if (r < 0 && errno != EINTR) {
+            perror("poll");
+            ret = -1;
+            break;
+        }
+        if (r > 0)
+            watch_events(&w);
+        else if (r == 0)
+            watch_update(&w);
+    }
+    /* don't lose what came in during the delay */
+    if (!ret && w.changed.count)
+        watch_update(&w);
+
+out:
+    close(w.fd);
+    for (i = 1; i < w.ngems; i++)
+        gem_record_free(&w.gems[i].rec);
+    solv_free(w.gems);
+    for (i = 0; i < w.nwdpaths; i++)
+        solv_free(w.wdpaths[i]);
+    solv_free(w.wdpaths);
+    stringpool_free(&w.paths);
+    queue_free(&w.changed);
+    join_freemem(&w.jd);
+    return ret;
+}
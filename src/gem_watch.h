@@ -0,0 +1,26 @@
+#ifndef GEM_WATCH_H
+#define GEM_WATCH_H
+
+#include "rubygems_parser.h"
+
+/*
+ * rubygems2solv --watch: parses the gems of dirs once, then follows
+ * the directories with inotify, with a watch on every directory the
+ * scan walks into, also those that show up later. Added and replaced
+ * gems are parsed, removed ones (also with their directory) dropped, and once nothing changed for a moment the
+ * solv file is written to a temporary file that is renamed over
+ * outfile.
+ *
+ * The gems are kept as records of their callbacks (gem_record.h), so
+ * an update parses only the changed gems and replays all records into
+ * a new pool, which gives the same solv file as a run from scratch.
+ * pctx brings the number of jobs and the cache, its callbacks are
+ * replaced. With checksums the gems are read as a whole for their
+ * checksums and sizes.
+ *
+ * Runs until SIGINT or SIGTERM and returns 0 then, -1 if the
+ * directories can't be watched.
+ */
+int gem_watch(ParseContext *pctx, char **dirs, int ndirs, const char *outfile, int checksums);
+
+#endif
@@ -0,0 +1,508 @@
+/*
+ * Copyright (c) 2012, Novell Inc.
+ *
+ * This program is licensed under the BSD license, read LICENSE.BSD
+ * for further information
+ *
+ * gem_writer: compresses output on a pool of threads.
+ *
+ * The writing thread fills a ring of blocks. For gzip, worker threads
+ * deflate the blocks as raw deflate streams, using the previous 32k
+ * of input as dictionary and ending each one with a sync flush so the
+ * pieces concatenate to one deflate stream. The writer thread writes
+ * them in order and combines the crcs for the gzip trailer.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <zlib.h>
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+
+#include "gem_writer.h"
+
+#define GEM_WRITER_BLOCK (128 * 1024)
+#define GEM_WRITER_DICT (32 * 1024)
+/* the default of the xz presets is three times the dictionary, so
+   the packages files would mostly be compressed by one thread */
+#define GEM_WRITER_XZ_BLOCK (4 * 1024 * 1024)
+
+enum {
+    SLOT_FREE,
+    SLOT_FILLED,
+    SLOT_DONE
+};
+
+typedef struct GemWriterSlot
+{
+    unsigned char *in;
+    size_t inlen;
+    unsigned char dict[GEM_WRITER_DICT];
+    size_t dictlen;
+    unsigned char *out;
+    size_t outlen;
+    uLong crc;
+    int last;
+    int state;
+} GemWriterSlot;
+
+struct GemWriter
+{
+    int fd;
+    int format;
+    /* set by the writer thread, under the lock */
+    int error;
+    /* the caller's copy of error, taken when it hands over a block */
+    int seen_error;
+    /* the writer thread's copy, nothing more goes to the file then */
+    int writer_error;
+
+    GemWriterSlot *slots;
+    int nslots;
+    GemWriterSlot *cur;
+    /* the dictionary for the next block */
+    unsigned char dict[GEM_WRITER_DICT];
+    size_t dictlen;
+
+    /* sequence numbers of the blocks */
+    long filled;
+    long next_compress;
+    long next_write;
+    int finished;
+
+    pthread_t writer;
+    pthread_t *workers;
+    int nworkers;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+};
+
+static void gem_writer_fail(GemWriter *w, int error)
+{
+    pthread_mutex_lock(&w->lock);
+    if (!w->error)
+        w->error = error;
+    pthread_mutex_unlock(&w->lock);
+}
+
+/* only called on the writer thread */
+static void gem_writer_output(GemWriter *w, const void *buf, size_t len)
+{
+    const char *p = buf;
+    ssize_t r;
+
+    while (len && !w->writer_error) {
+        r = write(w->fd, p, len);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            w->writer_error = errno;
+            gem_writer_fail(w, errno);
+            break;
+        }
+        p += r;
+        len -= r;
+    }
+}
+
+/* returns 0 or an errno, the block must not be written then */
+static int gem_writer_deflate(z_stream *strm, GemWriterSlot *slot)
+{
+    size_t bound = deflateBound(strm, slot->inlen) + 16;
+    unsigned char *out;
+    int r;
+
+    slot->outlen = 0;
+    if (!(out = realloc(slot->out, bound)))
+        return ENOMEM;
+    slot->out = out;
+    if (deflateReset(strm) != Z_OK)
+        return EIO;
+    if (slot->dictlen && deflateSetDictionary(strm, slot->dict, slot->dictlen) != Z_OK)
+        return EIO;
+    strm->next_in = slot->in;
+    strm->avail_in = slot->inlen;
+    strm->next_out = slot->out;
+    strm->avail_out = bound;
+    /* the sync flush ends non-final blocks on a byte boundary */
+    r = deflate(strm, slot->last ? Z_FINISH : Z_SYNC_FLUSH);
+    /* the bound leaves room for all of it */
+    if (r != (slot->last ? Z_STREAM_END : Z_OK) || strm->avail_in)
+        return EIO;
+    slot->outlen = bound - strm->avail_out;
+    slot->crc = crc32(crc32(0, 0, 0), slot->in, slot->inlen);
+    return 0;
+}
+
+static void *gem_writer_worker(void *arg)
+{
+    GemWriter *w = (GemWriter *) arg;
+    GemWriterSlot *slot;
+    z_stream strm;
+    int error, init;
+
+    memset(&strm, 0, sizeof(strm));
+    init = deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    if (!init)
+        gem_writer_fail(w, ENOMEM);
+    for (;;) {
+        pthread_mutex_lock(&w->lock);
+        while (w->next_compress == w->filled && !w->finished)
+            pthread_cond_wait(&w->changed, &w->lock);
+        if (w->next_compress == w->filled) {
+            pthread_mutex_unlock(&w->lock);
+            break;
+        }
+        slot = w->slots + w->next_compress++ % w->nslots;
+        pthread_mutex_unlock(&w->lock);
+
+        /* a failed block is still done, so that the writer goes on to
+           the end, but error keeps it and the rest out of the file */
+        if (init && (error = gem_writer_deflate(&strm, slot)) != 0)
+            gem_writer_fail(w, error);
+
+        pthread_mutex_lock(&w->lock);
+        slot->state = SLOT_DONE;
+        pthread_cond_broadcast(&w->changed);
+        pthread_mutex_unlock(&w->lock);
+    }
+    if (init)
+        deflateEnd(&strm);
+    return 0;
+}
+
+static void gem_writer_put32(unsigned char *p, uLong x)
+{
+    p[0] = x;
+    p[1] = x >> 8;
+    p[2] = x >> 16;
+    p[3] = x >> 24;
+}
+
+#ifdef HAVE_LZMA
+static int gem_writer_xz_init(lzma_stream *strm, int jobs)
+{
+    lzma_mt mt;
+
+    memset(&mt, 0, sizeof(mt));
+    mt.threads = jobs;
+    mt.preset = LZMA_PRESET_DEFAULT;
+    mt.check = LZMA_CHECK_CRC64;
+    mt.block_size = GEM_WRITER_XZ_BLOCK;
+    return lzma_stream_encoder_mt(strm, &mt) == LZMA_OK ? 0 : -1;
+}
+
+static void gem_writer_xz(GemWriter *w, lzma_stream *strm, GemWriterSlot *slot)
+{
+    unsigned char buf[65536];
+    lzma_action action = slot->last ? LZMA_FINISH : LZMA_RUN;
+    lzma_ret ret;
+
+    strm->next_in = slot->in;
+    strm->avail_in = slot->inlen;
+    do {
+        strm->next_out = buf;
+        strm->avail_out = sizeof(buf);
+        ret = lzma_code(strm, action);
+        if (ret != LZMA_OK && ret != LZMA_STREAM_END) {
+            w->writer_error = EIO;
+            gem_writer_fail(w, EIO);
+            break;
+        }
+        gem_writer_output(w, buf, sizeof(buf) - strm->avail_out);
+    } while (strm->avail_in || strm->avail_out == 0 || (action == LZMA_FINISH && ret != LZMA_STREAM_END));
+}
+#endif
+
+/* writes the blocks in order */
+static void *gem_writer_writer(void *arg)
+{
+    GemWriter *w = (GemWriter *) arg;
+    GemWriterSlot *slot;
+    unsigned char buf[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+    uLong crc = crc32(0, 0, 0), isize = 0;
+    int last;
+#ifdef HAVE_LZMA
+    lzma_stream strm = LZMA_STREAM_INIT;
+
+    if (w->format == GEM_WRITER_XZ && gem_writer_xz_init(&strm, w->nworkers)) {
+        w->writer_error = ENOMEM;
+        gem_writer_fail(w, ENOMEM);
+    }
+#endif
+
+    if (w->format == GEM_WRITER_GZIP)
+        gem_writer_output(w, buf, 10);
+    do {
+        pthread_mutex_lock(&w->lock);
+        slot = w->slots + w->next_write % w->nslots;
+        while (w->next_write == w->filled || (w->format == GEM_WRITER_GZIP && slot->state != SLOT_DONE))
+            pthread_cond_wait(&w->changed, &w->lock);
+        /* a worker failed on this or an earlier block */
+        if (w->error && !w->writer_error)
+            w->writer_error = w->error;
+        pthread_mutex_unlock(&w->lock);
+
+        last = slot->last;
+        if (w->format == GEM_WRITER_GZIP) {
+            gem_writer_output(w, slot->out, slot->outlen);
+            crc = crc32_combine(crc, slot->crc, slot->inlen);
+            isize += slot->inlen;
+        }
+#ifdef HAVE_LZMA
+        else if (!w->writer_error)
+            gem_writer_xz(w, &strm, slot);
+#endif
+
+        pthread_mutex_lock(&w->lock);
+        slot->state = SLOT_FREE;
+        w->next_write++;
+        pthread_cond_broadcast(&w->changed);
+        pthread_mutex_unlock(&w->lock);
+    } while (!last);
+
+    if (w->format == GEM_WRITER_GZIP) {
+        gem_writer_put32(buf, crc);
+        gem_writer_put32(buf + 4, isize);
+        gem_writer_output(w, buf, 8);
+    }
+#ifdef HAVE_LZMA
+    lzma_end(&strm);
+#endif
+    return 0;
+}
+
+/* waits for the next slot to become free and makes it current */
+static void gem_writer_next_slot(GemWriter *w)
+{
+    GemWriterSlot *slot = w->slots + w->filled % w->nslots;
+
+    pthread_mutex_lock(&w->lock);
+    while (slot->state != SLOT_FREE)
+        pthread_cond_wait(&w->changed, &w->lock);
+    w->seen_error = w->error;
+    pthread_mutex_unlock(&w->lock);
+    slot->inlen = 0;
+    slot->last = 0;
+    w->cur = slot;
+}
+
+static void gem_writer_submit(GemWriter *w, int last)
+{
+    GemWriterSlot *slot = w->cur;
+    size_t n;
+
+    if (w->format == GEM_WRITER_GZIP) {
+        memcpy(slot->dict, w->dict, w->dictlen);
+        slot->dictlen = w->dictlen;
+        if (slot->inlen >= GEM_WRITER_DICT) {
+            memcpy(w->dict, slot->in + slot->inlen - GEM_WRITER_DICT, GEM_WRITER_DICT);
+            w->dictlen = GEM_WRITER_DICT;
+        }
+        else {
+            /* keep the tail of the old dictionary in front */
+            n = w->dictlen + slot->inlen > GEM_WRITER_DICT ? GEM_WRITER_DICT - slot->inlen : w->dictlen;
+            memmove(w->dict, w->dict + w->dictlen - n, n);
+            memcpy(w->dict + n, slot->in, slot->inlen);
+            w->dictlen = n + slot->inlen;
+        }
+    }
+    slot->last = last;
+
+    pthread_mutex_lock(&w->lock);
+    slot->state = SLOT_FILLED;
+    w->filled++;
+    if (last)
+        w->finished = 1;
+    pthread_cond_broadcast(&w->changed);
+    pthread_mutex_unlock(&w->lock);
+    w->cur = 0;
+}
+
+int gem_writer_format(const char *name)
+{
+    if (!strcmp(name, "gz") || !strcmp(name, "gzip"))
+        return GEM_WRITER_GZIP;
+#ifdef HAVE_LZMA
+    if (!strcmp(name, "xz"))
+        return GEM_WRITER_XZ;
+#endif
+    return -1;
+}
+
+const char *gem_writer_suffix(int format)
+{
+    return format == GEM_WRITER_XZ ? ".xz" : ".gz";
+}
+
+static void gem_writer_free(GemWriter *w)
+{
+    int i;
+
+    if (w->slots)
+        for (i = 0; i < w->nslots; i++) {
+            free(w->slots[i].in);
+            free(w->slots[i].out);
+        }
+    free(w->slots);
+    free(w->workers);
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->changed);
+    free(w);
+}
+
+/* stops the first n workers of a writer that never got a block */
+static void gem_writer_stop(GemWriter *w, int n)
+{
+    int i;
+
+    pthread_mutex_lock(&w->lock);
+    w->finished = 1;
+    pthread_cond_broadcast(&w->changed);
+    pthread_mutex_unlock(&w->lock);
+    for (i = 0; i < n; i++)
+        pthread_join(w->workers[i], 0);
+}
+
+GemWriter *gem_writer_open(const char *path, int format, int jobs)
+{
+    GemWriter *w;
+    int i, error;
+
+#ifndef HAVE_LZMA
+    if (format == GEM_WRITER_XZ) {
+        errno = ENOTSUP;
+        return 0;
+    }
+#endif
+    if (jobs < 1)
+        jobs = 1;
+
+    if (!(w = calloc(1, sizeof(*w)))) {
+        errno = ENOMEM;
+        return 0;
+    }
+    pthread_mutex_init(&w->lock, 0);
+    pthread_cond_init(&w->changed, 0);
+    w->format = format;
+    w->nslots = 2 * jobs + 2;
+    if (!(w->slots = calloc(w->nslots, sizeof(GemWriterSlot)))) {
+        gem_writer_free(w);
+        errno = ENOMEM;
+        return 0;
+    }
+    for (i = 0; i < w->nslots; i++)
+        if (!(w->slots[i].in = malloc(GEM_WRITER_BLOCK))) {
+            gem_writer_free(w);
+            errno = ENOMEM;
+            return 0;
+        }
+    /* xz does its own threading in the writer thread */
+    w->nworkers = jobs;
+    if (format == GEM_WRITER_GZIP && !(w->workers = calloc(jobs, sizeof(pthread_t)))) {
+        gem_writer_free(w);
+        errno = ENOMEM;
+        return 0;
+    }
+
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (w->fd < 0) {
+        error = errno;
+        gem_writer_free(w);
+        errno = error;
+        return 0;
+    }
+    error = 0;
+    if (format == GEM_WRITER_GZIP)
+        for (i = 0; i < jobs && !error; i++)
+            if ((error = pthread_create(w->workers + i, 0, gem_writer_worker, w)) != 0)
+                gem_writer_stop(w, i);
+    if (!error && (error = pthread_create(&w->writer, 0, gem_writer_writer, w)) != 0)
+        gem_writer_stop(w, format == GEM_WRITER_GZIP ? jobs : 0);
+    if (error) {
+        close(w->fd);
+        unlink(path);
+        gem_writer_free(w);
+        errno = error;
+        return 0;
+    }
+    gem_writer_next_slot(w);
+    return w;
+}
+
+int gem_writer_write(GemWriter *w, const void *buf, size_t len)
+{
+    const char *p = buf;
+    size_t n;
+
+    while (len) {
+        if (w->cur->inlen == GEM_WRITER_BLOCK) {
+            gem_writer_submit(w, 0);
+            gem_writer_next_slot(w);
+        }
+        n = GEM_WRITER_BLOCK - w->cur->inlen;
+        if (n > len)
+            n = len;
+        memcpy(w->cur->in + w->cur->inlen, p, n);
+        w->cur->inlen += n;
+        p += n;
+        len -= n;
+    }
+    return w->seen_error ? -1 : 0;
+}
+
+int gem_writer_puts(GemWriter *w, const char *s)
+{
+    return gem_writer_write(w, s, strlen(s));
+}
+
+int gem_writer_printf(GemWriter *w, const char *fmt, ...)
+{
+    char buf[1024], *p = buf;
+    va_list ap;
+    int len, ret;
+
+    va_start(ap, fmt);
+    len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (len < 0)
+        return -1;
+    if (len >= sizeof(buf)) {
+        p = malloc(len + 1);
+        va_start(ap, fmt);
+        vsnprintf(p, len + 1, fmt, ap);
+        va_end(ap);
+    }
+    ret = gem_writer_write(w, p, len);
+    if (p != buf)
+        free(p);
+    return ret;
+}
+
+int gem_writer_close(GemWriter *w)
+{
+    int i, error;
+
+    gem_writer_submit(w, 1);
+    pthread_join(w->writer, 0);
+    if (w->format == GEM_WRITER_GZIP)
+        for (i = 0; i < w->nworkers; i++)
+            pthread_join(w->workers[i], 0);
+    /* the threads are gone, error can be read without the lock */
+    if (close(w->fd) && !w->error)
+        w->error = errno;
+    error = w->error;
+    gem_writer_free(w);
+    if (error) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,40 @@
+#ifndef GEM_WRITER_H
+#define GEM_WRITER_H
+
+#include <stddef.h>
+
+/*
+ * Buffered compressed output for the susetags files.
+ *
+ * The caller's writes are collected into blocks which are handed to
+ * other threads, so compression overlaps with parsing. gzip blocks
+ * are compressed in parallel, each one primed with the last 32k of
+ * the previous block, and written in order as a single gzip member
+ * (like pigz). xz, if liblzma is available, runs the liblzma
+ * multithreaded encoder on the writer thread.
+ */
+
+enum {
+    GEM_WRITER_GZIP,
+    GEM_WRITER_XZ
+};
+
+typedef struct GemWriter GemWriter;
+
+/* Returns 0 with errno set if the file can't be created or the format
+ * is not supported. jobs is the number of compression threads. */
+GemWriter *gem_writer_open(const char *path, int format, int jobs);
+/* Flushes and frees the writer, returns -1 with errno set if any
+ * write failed. */
+int gem_writer_close(GemWriter *w);
+
+int gem_writer_write(GemWriter *w, const void *buf, size_t len);
+int gem_writer_puts(GemWriter *w, const char *s);
+int gem_writer_printf(GemWriter *w, const char *fmt, ...)
+    __attribute__ ((format (printf, 2, 3)));
+
+/* ".gz" or ".xz" */
+const char *gem_writer_suffix(int format);
+int gem_writer_format(const char *name);
+
+#endif
@@ -12,14 +12,25 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
 #include "rubygems_parser.h"
+#include "gem_stats.h"
+#include "gem_corpus.h"
 
 typedef struct DumpContext {
+    /* --capture: the metadata go there instead of the attributes to stdout */
+    GemCorpusWriter *corpus;
+    const char *location;
+    struct joindata locationbuf;
+    int error;
 } DumpContext;
 
 static int parse_start_callback(void *user_data)
 {
     printf("start!\n");
+    return 0;
 }
 
 static void parse_error_callback(void *user_data, const char *msg)
@@ -33,9 +44,25 @@ static int attr_callback(void *user_data, const char*attr, const char *val)
     return 0;
 }
 
+static int location_callback(void *user_data, const char *location)
+{
+    DumpContext *ctx = (DumpContext *) user_data;
+    ctx->location = join2(&ctx->locationbuf, location, 0, 0);
+    return 0;
+}
+
+static int yaml_metadata_callback(void *user_data, const char *buff, int len)
+{
+    DumpContext *ctx = (DumpContext *) user_data;
+    if (gem_corpus_writer_add(ctx->corpus, ctx->location ? ctx->location : "", buff, len))
+        ctx->error = errno;
+    return 0;
+}
+
 static int parse_end_callback(void *user_data)
 {
     printf("end!\n");
+    return 0;
 }
 
 static void usage(const char *prog)
@@ -44,11 +71,33 @@ static void usage(const char *prog)
   fprintf(stderr, "You can pass one or more gem files or directories with gems.\n");
   fprintf(stderr, "You can pass one or more gem files or directories with gems.\n");
   fprintf(stderr, "options: -b $file : output to $file instead of stdout.\n");
+  fprintf(stderr, "         -j N : parse with N threads (default: available cpus).\n");
+  fprintf(stderr, "         --capture=$file : write the metadata of the gems to the corpus $file,\n");
+  fprintf(stderr, "                           which the tools take instead of the gems.\n");
+  fprintf(stderr, "         --stats[=$file] : print timing and counters as JSON to stderr or $file.\n");
+  fprintf(stderr, "         --progress : print a JSON progress line to stderr every second.\n");
 }
 
+enum {
+    OPT_STATS = 256,
+    OPT_PROGRESS,
+    OPT_CAPTURE
+};
+
+static struct option long_options[] = {
+    { "stats", optional_argument, 0, OPT_STATS },
+    { "progress", no_argument, 0, OPT_PROGRESS },
+    { "capture", required_argument, 0, OPT_CAPTURE },
+    { 0, 0, 0, 0 }
+};
+
 int main(int argc, char **argv)
 {
-    int ret;
+    int ret = 0;
+    int c;
+    const char *statsfile = 0;
+    const char *capturefile = 0;
+    int progress = 0;
     DumpContext ctx;
     ParseContext pctx;
 
@@ -60,10 +109,67 @@ int main(int argc, char **argv)
     pctx.gem_attr_callback = attr_callback;
     pctx.gem_parse_end_callback = parse_end_callback;
     pctx.data = &ctx;
+    pctx.jobs = gem_parse_default_jobs();
 
-    gem_parse(&pctx, argc, argv);
+    while ((c = getopt_long(argc, argv, "hj:", long_options, 0)) >= 0)
+    {
+        switch (c)
+        {
+        case OPT_STATS:
+            statsfile = optarg ? optarg : "";
+            break;
+        case OPT_PROGRESS:
+            progress = 1;
+            break;
+        case OPT_CAPTURE:
+            capturefile = optarg;
+            break;
+        case 'j':
+            pctx.jobs = atoi(optarg);
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(0);
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
 
+    if (capturefile) {
+        if (!(ctx.corpus = gem_corpus_writer_new(capturefile))) {
+            perror(capturefile);
+            exit(1);
+        }
+        pctx.gem_attr_callback = 0;
+        pctx.gem_location_callback = location_callback;
+        pctx.gem_yaml_metadata_callback = yaml_metadata_callback;
+    }
+    if (statsfile || progress)
+        pctx.stats = gem_stats_create(statsfile ? 10 : 0);
+    if (progress)
+        pctx.stats->progress = stderr;
+
+    gem_parse(&pctx, argc - optind, argv + optind);
+
+    if (pctx.stats) {
+        fflush(stdout);
+        gem_stats_progress_flush(pctx.stats, 0);
+        if (statsfile)
+            gem_stats_write_json(pctx.stats, statsfile);
+        gem_stats_free(pctx.stats);
+    }
     gem_parse_context_free(&pctx);
 
+    if (ctx.corpus) {
+        if (gem_corpus_writer_close(ctx.corpus) && !ctx.error)
+            ctx.error = errno;
+        if (ctx.error) {
+            fprintf(stderr, "%s: %s\n", capturefile, strerror(ctx.error));
+            ret = 1;
+        }
+    }
+    join_freemem(&ctx.locationbuf);
+
     return ret;
 }
\ No newline at end of file
@@ -0,0 +1,842 @@
+/*
+ * Copyright (c) 2012, Novell Inc.
+ *
+ * This program is licensed under the BSD license, read LICENSE.BSD
+ * for further information
+ *
+ * repodir2solv: converts a repository directory to solv data.
+ *
+ * Does what repo2solv.sh does for rpmmd, susetags and rubygems
+ * repositories, and writes the same solv file, but in one process:
+ * the files are decompressed with solv_xfopen on worker threads instead
+ * of piping gzip/xz/bzip2 into the converters, and the rpmmd parts are
+ * converted in parallel, each into its own pool, before they are merged
+ * like mergesolv does.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <glob.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <solv/pool.h>
+#include <solv/repo.h>
+#include <solv/repo_solv.h>
+#include <solv/solv_xfopen.h>
+#include <solv/repo_content.h>
+#include <solv/repo_susetags.h>
+#include <solv/repo_rpmmd.h>
+#include <solv/repo_repomdxml.h>
+#include <solv/repo_updateinfoxml.h>
+#include <solv/repo_deltainfoxml.h>
+#include "common_write.h"
+
+#include "rubygems_parser.h"
+#include "gem_solv.h"
+
+/*
+ * A Stream reads a list of pieces, literal text or files, as one
+ * FILE. The reader decompresses the piece it is at itself, worker
+ * threads decompress the next few pieces after it into memory
+ * meanwhile. They stay at most ahead pieces in front of the reader,
+ * so only that many pieces are held in memory at a time.
+ */
+
+enum {
+    PIECE_QUEUED,
+    PIECE_WORKING,      /* a worker decompresses it */
+    PIECE_READING,      /* the reader decompresses it */
+    PIECE_DONE
+};
+
+typedef struct Piece
+{
+    char *file;
+    char *buf;
+    size_t len;
+    size_t off;
+    int state;
+    int error;
+} Piece;
+
+typedef struct Stream
+{
+    Piece *pieces;
+    int npieces;
+    int cur;
+    FILE *fp;           /* of the current piece if PIECE_READING */
+    int next;           /* next piece for the workers */
+    int ahead;          /* how far they may get in front of cur */
+    int stopped;
+    int error;
+
+    pthread_t *workers;
+    int nworkers;
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    pthread_cond_t advanced;    /* cur moved on, or stopped */
+} Stream;
+
+static void stream_init(Stream *st)
+{
+    memset(st, 0, sizeof(Stream));
+    pthread_mutex_init(&st->lock, 0);
+    pthread_cond_init(&st->done, 0);
+    pthread_cond_init(&st->advanced, 0);
+}
+
+static Piece *stream_add(Stream *st)
+{
+    Piece *p;
+
+    st->pieces = solv_extend(st->pieces, st->npieces, 1, sizeof(Piece), 15);
+    p = st->pieces + st->npieces++;
+    memset(p, 0, sizeof(Piece));
+    return p;
+}
+
+static void stream_add_text(Stream *st, const char *text)
+{
+    Piece *p = stream_add(st);
+    p->buf = solv_strdup(text);
+    p->len = strlen(text);
+    p->state = PIECE_DONE;
+}
+
+static void stream_add_file(Stream *st, const char *file)
+{
+    Piece *p = stream_add(st);
+    p->file = solv_strdup(file);
+    p->state = PIECE_QUEUED;
+}
+
+/* reads all of a file, decompressing it by its suffix */
+static int read_file(const char *file, char **bufp, size_t *lenp)
+{
+    FILE *fp = solv_xfopen(file, "r");
+    char *buf = 0;
+    size_t len = 0, n;
+
+    if (!fp) {
+        perror(file);
+        return -1;
+    }
+    for (;;) {
+        buf = solv_extend_realloc(buf, len + 65536, 1, 65535);
+        if (!(n = fread(buf + len, 1, 65536, fp)))
+            break;
+        len += n;
+    }
+    if (ferror(fp)) {
+        fprintf(stderr, "%s: read error\n", file);
+        fclose(fp);
+        solv_free(buf);
+        return -1;
+    }
+    fclose(fp);
+    *bufp = buf;
+    *lenp = len;
+    return 0;
+}
+
+static void *stream_worker(void *arg)
+{
+    Stream *st = (Stream *) arg;
+    Piece *p;
+
+    pthread_mutex_lock(&st->lock);
+    for (;;) {
+        while (st->next < st->npieces && st->pieces[st->next].state != PIECE_QUEUED)
+            st->next++;
+        if (st->stopped || st->next >= st->npieces) {
+            pthread_mutex_unlock(&st->lock);
+            break;
+        }
+        if (st->next > st->cur + st->ahead) {
+            pthread_cond_wait(&st->advanced, &st->lock);
+            continue;
+        }
+        p = st->pieces + st->next++;
+        p->state = PIECE_WORKING;
+        pthread_mutex_unlock(&st->lock);
+
+        p->error = read_file(p->file, &p->buf, &p->len);
+
+        pthread_mutex_lock(&st->lock);
+        p->state = PIECE_DONE;
+        pthread_cond_broadcast(&st->done);
+    }
+    return 0;
+}
+
+static ssize_t stream_read(void *cookie, char *buf, size_t size)
+{
+    Stream *st = (Stream *) cookie;
+    Piece *p;
+    size_t n;
+
+    while (st->cur < st->npieces) {
+        p = st->pieces + st->cur;
+        if (!st->fp) {
+            pthread_mutex_lock(&st->lock);
+            if (p->state == PIECE_QUEUED)
+                p->state = PIECE_READING;
+            while (p->state == PIECE_WORKING)
+                pthread_cond_wait(&st->done, &st->lock);
+            pthread_mutex_unlock(&st->lock);
+            if (p->state == PIECE_READING && !(st->fp = solv_xfopen(p->file, "r"))) {
+                perror(p->file);
+                p->error = 1;
+            }
+            if (p->error) {
+                st->error = 1;
+                return -1;
+            }
+        }
+        if (st->fp) {
+            if ((n = fread(buf, 1, size, st->fp)) > 0)
+                return n;
+            if (ferror(st->fp)) {
+                fprintf(stderr, "%s: read error\n", p->file);
+                st->error = 1;
+                return -1;
+            }
+            fclose(st->fp);
+            st->fp = 0;
+            p->state = PIECE_DONE;
+        }
+        else if (p->off < p->len) {
+            n = p->len - p->off < size ? p->len - p->off : size;
+            memcpy(buf, p->buf + p->off, n);
+            p->off += n;
+            return n;
+        }
+        p->buf = solv_free(p->buf);
+        /* makes room for the workers */
+        pthread_mutex_lock(&st->lock);
+        st->cur++;
+        pthread_cond_broadcast(&st->advanced);
+        pthread_mutex_unlock(&st->lock);
+    }
+    return 0;
+}
+
+/* starts the workers and returns the stream as FILE */
+static FILE *stream_open(Stream *st, int nworkers)
+{
+    cookie_io_functions_t io;
+    int i;
+
+    /* the reader starts with the first file itself */
+    for (i = 0; i < st->npieces && st->pieces[i].state != PIECE_QUEUED; i++)
+        ;
+    st->next = i + 1;
+    /* a piece for every worker besides the one being read */
+    st->ahead = nworkers;
+    memset(&io, 0, sizeof(io));
+    io.read = stream_read;
+    st->nworkers = nworkers;
+    st->workers = solv_calloc(nworkers, sizeof(pthread_t));
+    for (i = 0; i < nworkers; i++)
+        pthread_create(st->workers + i, 0, stream_worker, st);
+    return fopencookie(st, "r", io);
+}
+
+/* joins the workers, returns -1 if a piece could not be read */
+static int stream_free(Stream *st)
+{
+    int i;
+
+    /* the reader may have given up before the end */
+    pthread_mutex_lock(&st->lock);
+    st->stopped = 1;
+    pthread_cond_broadcast(&st->advanced);
+    pthread_mutex_unlock(&st->lock);
+    for (i = 0; i < st->nworkers; i++)
+        pthread_join(st->workers[i], 0);
+    if (st->fp)
+        fclose(st->fp);
+    for (i = 0; i < st->npieces; i++) {
+        if (st->pieces[i].error)
+            st->error = 1;
+        solv_free(st->pieces[i].file);
+        solv_free(st->pieces[i].buf);
+    }
+    solv_free(st->pieces);
+    solv_free(st->workers);
+    pthread_mutex_destroy(&st->lock);
+    pthread_cond_destroy(&st->done);
+    pthread_cond_destroy(&st->advanced);
+    return st->error ? -1 : 0;
+}
+
+/*
+ * The "grep -v '?xml' | sed '1i<?xml ...?>'" repo2solv.sh puts between
+ * the concatenated primary and susedata and rpmmd2solv.
+ */
+typedef struct XmlFilter
+{
+    FILE *in;
+    char *line;
+    size_t alloc;
+    char *pending;
+    size_t npending;
+} XmlFilter;
+
+static ssize_t xmlfilter_read(void *cookie, char *buf, size_t size)
+{
+    XmlFilter *xf = (XmlFilter *) cookie;
+    ssize_t l;
+    size_t n;
+
+    while (!xf->npending) {
+        if ((l = getline(&xf->line, &xf->alloc, xf->in)) <= 0)
+            return ferror(xf->in) ? -1 : 0;
+        if (strstr(xf->line, "?xml"))
+            continue;
+        /* grep terminates the last line */
+        if (xf->line[l - 1] != '\n') {
+            xf->line = solv_extend_realloc(xf->line, l + 2, 1, 255);
+            xf->line[l++] = '\n';
+            xf->line[l] = 0;
+        }
+        xf->pending = xf->line;
+        xf->npending = l;
+    }
+    n = xf->npending < size ? xf->npending : size;
+    memcpy(buf, xf->pending, n);
+    xf->pending += n;
+    xf->npending -= n;
+    return n;
+}
+
+static FILE *xmlfilter_open(XmlFilter *xf, FILE *in)
+{
+    static const char header[] = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+    cookie_io_functions_t io;
+
+    memset(xf, 0, sizeof(XmlFilter));
+    xf->in = in;
+    xf->line = solv_strdup(header);
+    xf->pending = xf->line;
+    xf->npending = strlen(header);
+    memset(&io, 0, sizeof(io));
+    io.read = xmlfilter_read;
+    return fopencookie(xf, "r", io);
+}
+
+/* test -s */
+static int nonempty(const char *file)
+{
+    struct stat st;
+    return file && stat(file, &st) == 0 && st.st_size > 0;
+}
+
+/* test -f */
+static int isfile(const char *file)
+{
+    struct stat st;
+    return file && stat(file, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+/* test -d */
+static int isdir(const char *file)
+{
+    struct stat st;
+    return stat(file, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/* the last of "repomdxml2solv -q type:location < repomd.xml" */
+static const char *repomd_location(Repo *repomd, const char *type)
+{
+    Pool *pool;
+    Dataiterator di;
+    const char *location = 0;
+
+    if (!repomd)
+        return 0;
+    pool = repomd->pool;
+    dataiterator_init(&di, pool, repomd, SOLVID_META, REPOSITORY_REPOMD_TYPE, type, SEARCH_STRING);
+    dataiterator_prepend_keyname(&di, REPOSITORY_REPOMD);
+    while (dataiterator_step(&di)) {
+        dataiterator_setpos_parent(&di);
+        location = pool_lookup_str(pool, SOLVID_POS, REPOSITORY_REPOMD_LOCATION);
+    }
+    dataiterator_free(&di);
+    return location;
+}
+
+/* repomd_findfile of repo2solv.sh, returns a static buffer */
+static const char *repomd_findfile(Repo *repomd, const char *type, const char *name)
+{
+    static char fn[4096];
+    static const char *suffixes[] = { ".bz2", ".gz", "", 0 };
+    const char *location, *base;
+    int i;
+
+    if (type && (location = repomd_location(repomd, type)) != 0) {
+        base = strrchr(location, '/');
+        base = base ? base + 1 : location;
+        if (*base && isfile(base)) {
+            snprintf(fn, sizeof(fn), "%s", base);
+            return fn;
+        }
+    }
+    for (i = 0; suffixes[i]; i++) {
+        snprintf(fn, sizeof(fn), "%s%s", name, suffixes[i]);
+        if (isfile(fn))
+            return fn;
+    }
+    return 0;
+}
+
+enum {
+    CONV_REPOMDXML,
+    CONV_RPMMD,
+    CONV_PRIMARY,       /* rpmmd of primary and susedata */
+    CONV_UPDATEINFO,
+    CONV_DELTAINFO
+};
+
+typedef struct Conversion
+{
+    int type;
+    char *file;
+    char *file2;
+    int nworkers;
+    /* the resulting solv file */
+    char *solv;
+    size_t solvlen;
+    int error;
+} Conversion;
+
+static const char *conversion_tools[] = {
+    "repomdxml2solv", "rpmmd2solv", "rpmmd2solv", "updateinfoxml2solv", "deltainfoxml2solv"
+};
+
+/* one of the converter tools, with the output in memory */
+static void convert(Conversion *cv)
+{
+    Pool *pool = pool_create();
+    Repo *repo = repo_create(pool, "<stdin>");
+    Stream st;
+    XmlFilter xf;
+    FILE *fp, *in = 0, *out;
+    int ret = -1;
+
+    stream_init(&st);
+    if (cv->type == CONV_PRIMARY) {
+        stream_add_text(&st, "<rpmmd>\n");
+        stream_add_file(&st, cv->file);
+        stream_add_text(&st, "\n");
+        if (cv->file2)
+            stream_add_file(&st, cv->file2);
+        stream_add_text(&st, "</rpmmd>\n");
+        in = stream_open(&st, cv->nworkers);
+        fp = xmlfilter_open(&xf, in);
+    }
+    else if (!(fp = solv_xfopen(cv->file, "r")))
+        perror(cv->file);
+
+    if (fp) {
+        switch (cv->type) {
+        case CONV_REPOMDXML:
+            ret = repo_add_repomdxml(repo, fp, 0);
+            break;
+        case CONV_RPMMD:
+        case CONV_PRIMARY:
+            ret = repo_add_rpmmd(repo, fp, 0, 0);
+            break;
+        case CONV_UPDATEINFO:
+            ret = repo_add_updateinfoxml(repo, fp, 0);
+            break;
+        case CONV_DELTAINFO:
+            ret = repo_add_deltainfoxml(repo, fp, 0);
+            break;
+        }
+        if (ret)
+            fprintf(stderr, "%s: %s\n", conversion_tools[cv->type], pool_errstr(pool));
+        fclose(fp);
+    }
+    if (in) {
+        fclose(in);
+        solv_free(xf.line);
+    }
+    if (stream_free(&st))
+        ret = -1;
+
+    if (!ret) {
+        out = open_memstream(&cv->solv, &cv->solvlen);
+        tool_write_fp(repo, 0, 0, out);
+        fclose(out);
+    }
+    cv->error = ret ? 1 : 0;
+    pool_free(pool);
+}
+
+typedef struct Conversions
+{
+    Conversion *cvs;
+    int ncvs;
+    int next;
+    pthread_mutex_t lock;
+} Conversions;
+
+static void *conversion_worker(void *arg)
+{
+    Conversions *c = (Conversions *) arg;
+    Conversion *cv;
+
+    for (;;) {
+        pthread_mutex_lock(&c->lock);
+        cv = c->next < c->ncvs ? c->cvs + c->next++ : 0;
+        pthread_mutex_unlock(&c->lock);
+        if (!cv)
+            break;
+        convert(cv);
+    }
+    return 0;
+}
+
+static Conversion *conversion_add(Conversions *c, int type, const char *file)
+{
+    Conversion *cv;
+
+    c->cvs = solv_extend(c->cvs, c->ncvs, 1, sizeof(Conversion), 7);
+    cv = c->cvs + c->ncvs++;
+    memset(cv, 0, sizeof(Conversion));
+    cv->type = type;
+    cv->file = solv_strdup(file);
+    return cv;
+}
+
+static int rpmmd2solv(int jobs)
+{
+    Pool *pool;
+    Repo *repo, *repomd = 0;
+    Conversions c;
+    Conversion *cv;
+    pthread_t *threads;
+    const char *f;
+    FILE *fp;
+    int i, nthreads, ret = 0;
+
+    if (isdir("repodata") && chdir("repodata")) {
+        perror("repodata");
+        return 2;
+    }
+    memset(&c, 0, sizeof(c));
+    pthread_mutex_init(&c.lock, 0);
+
+    /* for the locations in repomd_findfile */
+    pool = pool_create();
+    if (nonempty("repomd.xml") && (fp = solv_xfopen("repomd.xml", "r")) != 0) {
+        repomd = repo_create(pool, "repomd");
+        if (repo_add_repomdxml(repomd, fp, 0))
+            repomd = 0;
+        fclose(fp);
+    }
+
+    /* in the order mergesolv gets them */
+    if (nonempty(f = repomd_findfile(0, 0, "repomd.xml")))
+        conversion_add(&c, CONV_REPOMDXML, f);
+    if (nonempty(f = repomd_findfile(repomd, "suseinfo", "suseinfo.xml")))
+        conversion_add(&c, CONV_REPOMDXML, f);
+    if (nonempty(f = repomd_findfile(repomd, "primary", "primary.xml"))) {
+        cv = conversion_add(&c, CONV_PRIMARY, f);
+        if ((f = repomd_findfile(repomd, "susedata", "susedata.xml")) != 0)
+            cv->file2 = solv_strdup(f);
+    }
+    if (!(f = repomd_findfile(repomd, "products", "products.xml")))
+        f = repomd_findfile(repomd, "product", "product.xml");
+    if (nonempty(f))
+        conversion_add(&c, CONV_RPMMD, f);
+    if (nonempty(f = repomd_findfile(repomd, "patterns", "patterns.xml")))
+        conversion_add(&c, CONV_RPMMD, f);
+    if (nonempty(f = repomd_findfile(repomd, "updateinfo", "updateinfo.xml")))
+        conversion_add(&c, CONV_UPDATEINFO, f);
+    if (!(f = repomd_findfile(repomd, "deltainfo", "deltainfo.xml")))
+        f = repomd_findfile(repomd, "prestodelta", "prestodelta.xml");
+    if (nonempty(f))
+        conversion_add(&c, CONV_DELTAINFO, f);
+    pool_free(pool);
+
+    /* the threads left over decompress susedata next to primary */
+    nthreads = jobs < c.ncvs ? jobs : c.ncvs;
+    for (i = 0; i < c.ncvs; i++)
+        if (c.cvs[i].type == CONV_PRIMARY && c.cvs[i].file2 && jobs > c.ncvs)
+            c.cvs[i].nworkers = 1;
+    if (nthreads > 1) {
+        threads = solv_calloc(nthreads, sizeof(pthread_t));
+        for (i = 0; i < nthreads; i++)
+            pthread_create(threads + i, 0, conversion_worker, &c);
+        for (i = 0; i < nthreads; i++)
+            pthread_join(threads[i], 0);
+        solv_free(threads);
+    }
+    else
+        conversion_worker(&c);
+    pthread_mutex_destroy(&c.lock);
+
+    /* mergesolv */
+    pool = pool_create();
+    repo = repo_create(pool, "");
+    for (i = 0; i < c.ncvs; i++) {
+        cv = c.cvs + i;
+        if (cv->error) {
+            ret = 4;
+            continue;
+        }
+        fp = solv_fmemopen(cv->solv, cv->solvlen, "r");
+        if (!ret && repo_add_solv(repo, fp, 0)) {
+            fprintf(stderr, "mergesolv: %s\n", pool_errstr(pool));
+            ret = 4;
+        }
+        fclose(fp);
+    }
+    if (!ret)
+        tool_write(repo, 0, 0);
+    pool_free(pool);
+
+    for (i = 0; i < c.ncvs; i++) {
+        free(c.cvs[i].solv);
+        solv_free(c.cvs[i].file);
+        solv_free(c.cvs[i].file2);
+    }
+    solv_free(c.cvs);
+    return ret;
+}
+
+/* DESCRDIR of the content file, or suse/setup/descr */
+static char *susetags_descrdir(void)
+{
+    FILE *fp = fopen("content", "r");
+    char line[4096], *p, *e;
+
+    if (fp) {
+        while (fgets(line, sizeof(line), fp)) {
+            if (strncmp(line, "DESCRDIR", 8) || (line[8] != ' ' && line[8] != '\t'))
+                continue;
+            for (p = line + 8; *p == ' ' || *p == '\t'; p++)
+                ;
+            for (e = p + strlen(p); e > p && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\n'); e--)
+                ;
+            *e = 0;
+            if (*p) {
+                fclose(fp);
+                return solv_strdup(p);
+            }
+        }
+        fclose(fp);
+    }
+    return solv_strdup("suse/setup/descr");
+}
+
+/* susetags_findfile_cat of repo2solv.sh */
+static void susetags_findfile(Stream *st, const char *name)
+{
+    static const char *suffixes[] = { ".xz", ".lzma", ".bz2", ".gz", "", 0 };
+    char fn[4096];
+    int i;
+
+    for (i = 0; suffixes[i]; i++) {
+        snprintf(fn, sizeof(fn), "%s%s", name, suffixes[i]);
+        if (nonempty(fn)) {
+            stream_add_file(st, fn);
+            return;
+        }
+    }
+}
+
+static int susetags2solv(int jobs)
+{
+    Pool *pool = pool_create();
+    Repo *repo = repo_create(pool, "<susetags>");
+    Stream st;
+    glob_t g;
+    FILE *fp;
+    char *descrdir, *name, *suffix, word[4096], text[4096];
+    size_t k;
+    Id defvendor = 0;
+    int ret = 0;
+
+    repo_add_repodata(repo, 0);
+    if (!(fp = fopen("content", "r"))) {
+        perror("content");
+        return 4;
+    }
+    if (repo_add_content(repo, fp, REPO_REUSE_REPODATA)) {
+        fprintf(stderr, "susetags2solv: %s: %s\n", "content", pool_errstr(pool));
+        fclose(fp);
+        return 4;
+    }
+    defvendor = repo_lookup_id(repo, SOLVID_META, SUSETAGS_DEFAULTVENDOR);
+    fclose(fp);
+
+    descrdir = susetags_descrdir();
+    if (chdir(descrdir)) {
+        perror(descrdir);
+        solv_free(descrdir);
+        return 2;
+    }
+    solv_free(descrdir);
+
+    stream_init(&st);
+    susetags_findfile(&st, "packages");
+    susetags_findfile(&st, "packages.DU");
+    susetags_findfile(&st, "packages.en");
+    /* the patterns mentioned in the file 'patterns' */
+    if (isfile("patterns") && (fp = fopen("patterns", "r")) != 0) {
+        while (fscanf(fp, "%4095s", word) == 1)
+            if (nonempty(word))
+                stream_add_file(&st, word);
+        fclose(fp);
+    }
+    /* all other packages.{lang}, they switch the language for the rest */
+    if (glob("packages.*", 0, 0, &g) == 0) {
+        for (k = 0; k < g.gl_pathc; k++) {
+            name = solv_strdup(g.gl_pathv[k]);
+            if ((suffix = strrchr(name, '.')) != 0
+                && (!strcmp(suffix, ".gz") || !strcmp(suffix, ".bz2") || !strcmp(suffix, ".xz") || !strcmp(suffix, ".lzma")))
+                *suffix = 0;
+            suffix = name + strlen(name);
+            if (strcmp(name, "packages") && !(suffix - name >= 3 && !strcmp(suffix - 3, ".DU"))
+                && !(suffix - name >= 3 && !strcmp(suffix - 3, ".en")) && !(suffix - name >= 3 && !strcmp(suffix - 3, ".FL"))) {
+                snprintf(text, sizeof(text), "=Lan: %s\n", name + 9);
+                stream_add_text(&st, text);
+                stream_add_file(&st, g.gl_pathv[k]);
+            }
+            solv_free(name);
+        }
+        globfree(&g);
+    }
+
+    fp = stream_open(&st, jobs - 1);
+    if (repo_add_susetags(repo, fp, defvendor, 0, REPO_REUSE_REPODATA | REPO_NO_INTERNALIZE)) {
+        fprintf(stderr, "susetags2solv: %s\n", pool_errstr(pool));
+        ret = 4;
+    }
+    fclose(fp);
+    if (stream_free(&st))
+        ret = 4;
+    if (!ret) {
+        repo_internalize(repo);
+        tool_write(repo, 0, 0);
+    }
+    pool_free(pool);
+    return ret;
+}
+
+static int rubygems2solv(int jobs)
+{
+    Pool *pool = pool_create();
+    Repo *repo = repo_create(pool, "rubygems");
+    Repodata *data = repo_add_repodata(repo, 0);
+    SolvContext ctx;
+    ParseContext pctx;
+    char *index = "Marshal.4.8.Z";
+
+    gem_parse_context_initialize(&pctx);
+    pctx.jobs = jobs;
+    gem_solv_context_setup(&ctx, &pctx, repo, data);
+    gem_parse(&pctx, 1, &index);
+    gem_solv_context_free(&ctx);
+    gem_parse_context_free(&pctx);
+    repodata_internalize(data);
+    tool_write(repo, 0, 0);
+    pool_free(pool);
+    return 0;
+}
+
+/* the autodetection of repo2solv.sh, without plaindir */
+static const char *detect_type(void)
+{
+    char *descrdir;
+    int susetags;
+
+    if (isdir("repodata") || isfile("repomd.xml"))
+        return "rpmmd";
+    if (nonempty("content")) {
+        descrdir = susetags_descrdir();
+        susetags = isdir(descrdir);
+        solv_free(descrdir);
+        if (susetags)
+            return "susetags";
+    }
+    if (nonempty("Marshal.4.8.Z"))
+        return "rubygems";
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "Usage:\n%s [options] <dir>\n", prog);
+  fprintf(stderr, "Converts the rpmmd, susetags or rubygems repository in <dir> to solv data.\n");
+  fprintf(stderr, "options: -o $file : write to $file instead of stdout.\n");
+  fprintf(stderr, "         -t rpmmd|susetags|rubygems : type of the repository (default: detected).\n");
+  fprintf(stderr, "         -j N : use N threads (default: available cpus).\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *outfile = 0;
+    const char *type = 0;
+    int jobs = gem_parse_default_jobs();
+    int c;
+
+    while ((c = getopt(argc, argv, "ho:t:j:")) >= 0)
+    {
+        switch (c)
+        {
+        case 'o':
+            outfile = optarg;
+            break;
+        case 't':
+            type = optarg;
+            break;
+        case 'j':
+            jobs = atoi(optarg);
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(0);
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (optind + 1 != argc) {
+        usage(argv[0]);
+        exit(1);
+    }
+    if (jobs < 1)
+        jobs = 1;
+    if (outfile && !freopen(outfile, "w", stdout)) {
+        perror(outfile);
+        exit(1);
+    }
+    if (chdir(argv[optind])) {
+        perror(argv[optind]);
+        exit(1);
+    }
+    if (!type && !(type = detect_type())) {
+        fprintf(stderr, "%s: not a rpmmd, susetags or rubygems repository\n", argv[optind]);
+        exit(1);
+    }
+
+    if (!strcmp(type, "rpmmd"))
+        return rpmmd2solv(jobs);
+    if (!strcmp(type, "susetags"))
+        return susetags2solv(jobs);
+    if (!strcmp(type, "rubygems"))
+        return rubygems2solv(jobs);
+    fprintf(stderr, "unknown repository type '%s'\n", type);
+    return 1;
+}
@@ -12,159 +12,371 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
 
 #include <solv/pool.h>
 #include <solv/repo.h>
+#include <solv/repo_solv.h>
 #include "common_write.h"
 
 #include "rubygems_parser.h"
-#include "gem_version_bump.h"
+#include "gem_cache.h"
+#include "gem_solv.h"
+#include "gem_susetags.h"
+#include "gem_fanout.h"
+#include "gem_stats.h"
+#include "gem_watch.h"
+#include "gem_delta.h"
 #include "tools_util.h"
 
-typedef struct SolvContext {
-    Repo *repo;
-    Solvable *s;
-    Repodata *data;
-    int flags;
-    ParseContext *pctx;
-} SolvContext;
-
-static int parse_start_callback(void *user_data)
-{
-}
-
-static void parse_error_callback(void *user_data, const char *msg)
-{
-    SolvContext *ctx = (SolvContext *) user_data;
-    pool_error(ctx->repo->pool, -1, msg);
-}
-
-static int start_callback(void *user_data, const char *file)
-{
-    SolvContext *ctx = (SolvContext *) user_data;
-    ctx->s = pool_id2solvable(ctx->repo->pool, repo_add_solvable(ctx->repo));
-    repodata_set_poolstr(ctx->data, ctx->s - ctx->repo->pool->solvables, SOLVABLE_GROUP, "Devel/Languages/Ruby");
-    ctx->s->arch = pool_str2id(ctx->repo->pool, "x86_64", 1);
-    return 0;
-}
-
-static int end_callback(void *user_data)
-{
-    return 0;
-}
-
-static int dep_callback(void *user_data, const char *name, const char *op, const char *version)
+/* drops the solvables of a gem given as name-version, or as path of the .gem */
+static int remove_gem(Repo *repo, const char *gem)
 {
-    SolvContext *ctx = (SolvContext *) user_data;
-    int flags = 0;
+    Pool *pool = repo->pool;
+    Solvable *s;
+    Id p;
+    const char *name, *evr, *base;
+    int l, nl, el, count = 0;
 
-    if (*op == '~') {
-        ctx->s->requires = repo_addid_dep(ctx->s->repo, ctx->s->requires,
-        pool_rel2id(ctx->s->repo->pool,
-            pool_str2id(ctx->s->repo->pool, join2(&ctx->pctx->jd, "rubygem", "-", name), 1),
-            pool_str2id(ctx->s->repo->pool, version, 1),
-            REL_GT | REL_EQ, 1),
-        0);
-
-        char *bumped = gem_version_bump(version);
-        ctx->s->requires = repo_addid_dep(ctx->s->repo, ctx->s->requires,
-        pool_rel2id(ctx->s->repo->pool,
-            pool_str2id(ctx->s->repo->pool, join2(&ctx->pctx->jd, "rubygem", "-", name), 1),
-            pool_str2id(ctx->s->repo->pool, bumped, 1),
-            REL_LT, 1),
-        0);
-        free(bumped);
-        return 0;
-    }
+    base = strrchr(gem, '/');
+    base = base ? base + 1 : gem;
+    l = strlen(base);
+    if (l > 4 && !strcmp(base + l - 4, ".gem"))
+        l -= 4;
 
-    const char *fbp;
-    for (fbp = op;; fbp++)
+    FOR_REPO_SOLVABLES(repo, p, s)
     {
-        if (*fbp == '>')
-            flags |= REL_GT;
-        else if (*fbp == '=')
-            flags |= REL_EQ;
-        else if (*fbp == '<')
-            flags |= REL_LT;
-        else
-            break;
+        name = pool_id2str(pool, s->name);
+        if (strncmp(name, "rubygem-", 8))
+            continue;
+        name += 8;
+        evr = pool_id2str(pool, s->evr);
+        nl = strlen(name);
+        el = strlen(evr);
+        /* name-version or name-version-platform */
+        if (nl + 1 + el > l || strncmp(base, name, nl) || base[nl] != '-' || strncmp(base + nl + 1, evr, el))
+            continue;
+        if (nl + 1 + el < l && base[nl + 1 + el] != '-')
+            continue;
+        repo_free_solvable_block(repo, p, 1, 1);
+        count++;
     }
-
-    ctx->s->requires = repo_addid_dep(ctx->s->repo, ctx->s->requires,
-        pool_rel2id(ctx->s->repo->pool,
-            pool_str2id(ctx->s->repo->pool, join2(&ctx->pctx->jd, "rubygem", "-", name), 1),
-            pool_str2id(ctx->s->repo->pool, version, 1),
-            flags, 1),
-        0);
-}
-
-static int attr_callback(void *user_data, const char*attr, const char *val)
-{
-    SolvContext *ctx = (SolvContext *) user_data;
-    Id handle = ctx->s - ctx->s->repo->pool->solvables;
-    if (!strcmp(attr, "name"))
-        ctx->s->name = pool_str2id(ctx->s->repo->pool, join2(&ctx->pctx->jd, "rubygem", "-", val), 1);
-      //ctx->s->name = pool_str2id(ctx->s->repo->pool, val, 1);
-    else if (!strcmp(attr, "version"))
-        ctx->s->evr = pool_str2id(ctx->s->repo->pool, val, 1);
-    else if (!strcmp(attr, "homepage"))
-        repodata_set_str(ctx->data, handle, SOLVABLE_URL, val);
-    else if (!strcmp(attr, "summary"))
-       repodata_set_str(ctx->data, handle, SOLVABLE_SUMMARY, val);
-    else if (!strcmp(attr, "description"))
-      repodata_set_str(ctx->data, handle, SOLVABLE_DESCRIPTION, val);
-    return 0;
-}
-
-static int parse_end_callback(void *user_data)
-{
+    return count;
 }
 
 static void usage(const char *prog)
 {
   fprintf(stderr, "Usage:\n%s [options] arg1 arg2 arg3 ...\n", prog);
-  fprintf(stderr, "You can pass one or more gem files or directories with gems.\n");
-  fprintf(stderr, "You can pass one or more gem files or directories with gems.\n");
-  fprintf(stderr, "options: -b $file : output to $file instead of stdout.\n");
+  fprintf(stderr, "You can pass one or more gem files or directories with gems, which are\n");
+  fprintf(stderr, "searched recursively. - reads the paths of gems from stdin, one per line.\n");
+  fprintf(stderr, "A Marshal.4.8(.Z) or specs.4.8(.gz) index is read as the gems of a repository.\n");
+  fprintf(stderr, "options: -b $base : write $base.solv, with summaries and descriptions in $base.en.solv.\n");
+  fprintf(stderr, "         -o $file : write the solv data to $file instead of stdout.\n");
+  fprintf(stderr, "         -j N : parse with N threads and write the -b files with N processes (default: available cpus).\n");
+  fprintf(stderr, "         -0 : the paths read from stdin are separated by NULs (find -print0).\n");
+  fprintf(stderr, "         --prefetch=N : read N gems ahead of the parser, 0 for none (default: 64).\n");
+  fprintf(stderr, "         --no-checksums : only read the metadata of the gems, without their sha256 and size.\n");
+  fprintf(stderr, "         -c $file : cache parsed gems in $file, unchanged gems are not parsed again.\n");
+  fprintf(stderr, "         -K : also compare the sha256 of the content of cached gems.\n");
+  fprintf(stderr, "         -a $file : add the gems to the solv data read from $file.\n");
+  fprintf(stderr, "         -x $name-$version : remove that gem from the solv data read with -a.\n");
+  fprintf(stderr, "         --susetags-dir=$dir : also write the gems as susetags to $dir/suse/setup/descr.\n");
+  fprintf(stderr, "         --compress=gz|xz : compression of the susetags files (default: gz).\n");
+  fprintf(stderr, "         --stats[=$file] : print timing and counters as JSON to stderr or $file.\n");
+  fprintf(stderr, "         --progress : print a JSON progress line to stderr every second.\n");
+  fprintf(stderr, "         --watch : keep running and write the -o file again whenever gems in the\n");
+  fprintf(stderr, "                   directories are added, replaced or removed.\n");
+  fprintf(stderr, "         --delta-from=$old --delta=$file : also write to $file what changed since the\n");
+  fprintf(stderr, "                   solv file $old, for applysolvdelta. The output is that of a run without them.\n");
 }
 
+enum {
+    OPT_STATS = 256,
+    OPT_PROGRESS,
+    OPT_SUSETAGS_DIR,
+    OPT_COMPRESS,
+    OPT_WATCH,
+    OPT_DELTA_FROM,
+    OPT_DELTA,
+    OPT_PREFETCH,
+    OPT_NO_CHECKSUMS
+};
+
+static struct option long_options[] = {
+    { "stats", optional_argument, 0, OPT_STATS },
+    { "progress", no_argument, 0, OPT_PROGRESS },
+    { "susetags-dir", required_argument, 0, OPT_SUSETAGS_DIR },
+    { "compress", required_argument, 0, OPT_COMPRESS },
+    { "watch", no_argument, 0, OPT_WATCH },
+    { "delta-from", required_argument, 0, OPT_DELTA_FROM },
+    { "delta", required_argument, 0, OPT_DELTA },
+    { "prefetch", required_argument, 0, OPT_PREFETCH },
+    { "no-checksums", no_argument, 0, OPT_NO_CHECKSUMS },
+    { 0, 0, 0, 0 }
+};
+
 int main(int argc, char **argv)
 {
-    int ret;
+    int ret = 0;
+    int c, i;
     int flags = 0;
     Pool *pool = pool_create();
     Repo *repo = repo_create(pool, "rubygems");
-    Repodata *data = repo_add_repodata(repo, flags);
+    Repodata *data;
     char *basefile = 0;
+    const char *cachefile = 0;
+    const char *addfile = 0;
+    char **removals = 0;
+    int nremovals = 0;
+    int verify = 0;
+    const char *statsfile = 0;
+    int progress = 0;
+    const char *outfile = 0;
+    const char *tagsdir = 0;
+    int format = GEM_WRITER_GZIP;
+    int watch = 0;
+    int checksums = 1;
+    const char *deltafrom = 0;
+    const char *deltafile = 0;
+    unsigned char *deltabase = 0;
+    size_t deltabaselen = 0;
+    double t = 0;
+    FILE *fp;
 
     SolvContext ctx;
+    TagsContext tctx;
     ParseContext pctx;
+    /* the sinks when writing solv and susetags */
+    ParseContext solvsink, tagssink;
+    GemFanout fan;
 
     memset(&ctx, 0, sizeof(ctx));
     gem_parse_context_initialize(&pctx);
+    pctx.jobs = gem_parse_default_jobs();
+    pctx.prefetch = GEM_PARSE_PREFETCH;
 
-    ctx.repo = repo;
-    ctx.data = data;
-    ctx.pctx = &pctx;
+    while ((c = getopt_long(argc, argv, "hb:o:j:c:Ka:x:0", long_options, 0)) >= 0)
+    {
+        switch (c)
+        {
+        case OPT_STATS:
+            statsfile = optarg ? optarg : "";
+            break;
+        case OPT_PROGRESS:
+            progress = 1;
+            break;
+        case OPT_SUSETAGS_DIR:
+            tagsdir = optarg;
+            break;
+        case OPT_WATCH:
+            watch = 1;
+            break;
+        case OPT_DELTA_FROM:
+            deltafrom = optarg;
+            break;
+        case OPT_DELTA:
+            deltafile = optarg;
+            break;
+        case OPT_COMPRESS:
+            format = gem_writer_format(optarg);
+            if (format < 0)
+            {
+                fprintf(stderr, "unsupported compression: %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'b':
+            basefile = optarg;
+            break;
+        case 'o':
+            outfile = optarg;
+            break;
+        case 'j':
+            pctx.jobs = atoi(optarg);
+            break;
+        case OPT_PREFETCH:
+            pctx.prefetch = atoi(optarg);
+            break;
+        case OPT_NO_CHECKSUMS:
+            checksums = 0;
+            break;
+        case 'c':
+            cachefile = optarg;
+            break;
+        case 'K':
+            verify = 1;
+            break;
+        case '0':
+            pctx.list_nul = 1;
+            break;
+        case 'a':
+            addfile = optarg;
+            break;
+        case 'x':
+            removals = solv_extend(removals, nremovals, 1, sizeof(char *), 15);
+            removals[nremovals++] = optarg;
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(0);
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+
+    if (watch && (!outfile || basefile || addfile || nremovals || tagsdir || statsfile || progress))
+    {
+        fprintf(stderr, "--watch needs -o and takes none of -b, -a, -x, --susetags-dir, --stats, --progress\n");
+        exit(1);
+    }
+
+    if (!deltafrom != !deltafile || (deltafile && (basefile || addfile || nremovals || watch)))
+    {
+        fprintf(stderr, "--delta-from and --delta go together and take none of -b, -a, -x, --watch\n");
+        exit(1);
+    }
+
+    if (addfile)
+    {
+        if (!(fp = fopen(addfile, "r")))
+        {
+            perror(addfile);
+            exit(1);
+        }
+        if (repo_add_solv(repo, fp, 0))
+        {
+            fprintf(stderr, "%s: %s\n", addfile, pool_errstr(pool));
+            exit(1);
+        }
+        fclose(fp);
+    }
+    for (i = 0; i < nremovals; i++)
+    {
+        if (!remove_gem(repo, removals[i]))
+        {
+            fprintf(stderr, "%s: no such gem\n", removals[i]);
+            exit(1);
+        }
+    }
+    solv_free(removals);
+
+    /* the old file may also be the output */
+    if (deltafrom)
+    {
+        if (!(fp = fopen(deltafrom, "r")) || !(deltabase = gem_delta_read_file(fp, &deltabaselen)))
+        {
+            perror(deltafrom);
+            exit(1);
+        }
+        fclose(fp);
+    }
+
+    /* after -a, which may read the same file */
+    if (outfile && !watch && !freopen(outfile, "w", stdout))
+    {
+        perror(outfile);
+        exit(1);
+    }
+
+    if (cachefile && !(pctx.cache = gem_cache_open(cachefile, verify, checksums)))
+        exit(1);
 
-    pctx.gem_parse_start_callback = parse_start_callback;
-    pctx.gem_start_callback = start_callback;
-    pctx.gem_parse_error_callback = parse_error_callback;
-    pctx.gem_attr_callback = attr_callback;
-    pctx.gem_dep_callback = dep_callback;
-    pctx.gem_end_callback = end_callback;
-    pctx.gem_parse_end_callback = parse_end_callback;
-    pctx.data = &ctx;
+    if (statsfile || progress)
+        pctx.stats = gem_stats_create(statsfile ? 10 : 0);
+    if (progress)
+        pctx.stats->progress = stderr;
 
-    gem_parse(&pctx, argc -1, argv + 1);
+    if (watch)
+    {
+        ret = gem_watch(&pctx, argv + optind, argc - optind, outfile, checksums) ? 1 : 0;
+        if (pctx.cache)
+            gem_cache_close(pctx.cache);
+        gem_parse_context_free(&pctx);
+        pool_free(pool);
+        return ret;
+    }
 
+    data = repo_add_repodata(repo, flags);
+    if (tagsdir)
+    {
+        gem_parse_context_initialize(&solvsink);
+        gem_parse_context_initialize(&tagssink);
+        gem_solv_context_setup(&ctx, &solvsink, repo, data);
+        if (gem_susetags_context_setup(&tctx, &tagssink, tagsdir, format, pctx.jobs))
+        {
+            fprintf(stderr, "Can't create the packages files in %s: %s\n", tagsdir, strerror(errno));
+            exit(1);
+        }
+        gem_fanout_init(&fan);
+        gem_fanout_add(&fan, &solvsink);
+        gem_fanout_add(&fan, &tagssink);
+        gem_fanout_context(&pctx, &fan);
+    }
+    else
+        gem_solv_context_setup(&ctx, &pctx, repo, data);
+    if (!checksums)
+        pctx.gem_checksum_callback = 0;
+    /* so they end up in $base.en.solv */
+    if (basefile)
+        gem_solv_context_set_language(&ctx, "en");
+
+    gem_parse(&pctx, argc - optind, argv + optind);
+
+    if (pctx.cache)
+        gem_cache_close(pctx.cache);
+    gem_solv_context_free(&ctx);
+    if (tagsdir)
+    {
+        if (gem_susetags_context_close(&tctx))
+        {
+            fprintf(stderr, "Can't write the packages files in %s: %s\n", tagsdir, strerror(errno));
+            exit(1);
+        }
+        gem_fanout_free(&fan);
+        gem_parse_context_free(&solvsink);
+        gem_parse_context_free(&tagssink);
+    }
     gem_parse_context_free(&pctx);
 
+    if (pctx.stats)
+      t = gem_stats_now();
     if (!(flags & REPO_NO_INTERNALIZE))
       repodata_internalize(data);
+    if (pctx.stats)
+      {
+        gem_stats_add(pctx.stats, GEM_STAGE_INTERNALIZE, gem_stats_now() - t, 0);
+        t = gem_stats_now();
+      }
 
-    tool_write(repo, basefile, 0);
+    if (deltafile)
+    {
+        if (!(fp = fopen(deltafile, "w")))
+        {
+            perror(deltafile);
+            exit(1);
+        }
+        if (gem_delta_write(repo, deltabase, deltabaselen, fp, stdout) || fclose(fp))
+        {
+            fprintf(stderr, "%s: %s\n", deltafile, pool_errstr(pool));
+            exit(1);
+        }
+        solv_free(deltabase);
+    }
+    else
+        tool_write_jobs(repo, basefile, 0, pctx.jobs);
+    if (pctx.stats)
+      {
+        fflush(stdout);
+        gem_stats_add(pctx.stats, GEM_STAGE_WRITE, gem_stats_now() - t, 0);
+        gem_stats_progress_flush(pctx.stats, 0);
+        if (statsfile)
+          gem_stats_write_json(pctx.stats, statsfile);
+        gem_stats_free(pctx.stats);
+      }
     pool_free(pool);
 
     return ret;
-}
\ No newline at end of file
+}
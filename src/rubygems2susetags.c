@@ -13,174 +13,155 @@
 #include <string.h>
 #include <stdarg.h>
 #include <errno.h>
-#include <zlib.h>
-#include <sys/types.h>
-#include <sys/stat.h>
+#include <unistd.h>
+#include <getopt.h>
 
 #include <solv/pool.h>
 #include <solv/repo.h>
 #include "common_write.h"
 
 #include "rubygems_parser.h"
-#include "gem_version_bump.h"
+#include "gem_stats.h"
+#include "gem_susetags.h"
 #include "tools_util.h"
 
-typedef struct TagsContext {
-    ParseContext *pctx;
-    gzFile packages;
-    gzFile packages_en;
-    const char *name;
-    const char *basedir;
-} TagsContext;
-
-/* mkdir -p implementation */
-static void mkdir_p(const char *dir) {
-    char tmp[256];
-    char *p = NULL;
-    size_t len;
-    snprintf(tmp, sizeof(tmp),"%s",dir);
-    len = strlen(tmp);
-    if(tmp[len - 1] == '/')
-        tmp[len - 1] = 0;
-    for(p = tmp + 1; *p; p++)
-        if(*p == '/') {
-           *p = 0;
-            mkdir(tmp, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
-            *p = '/';
-        }
-    mkdir(tmp, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
-}
-
-static int parse_start_callback(void *user_data)
-{
-    TagsContext *ctx = (TagsContext *) user_data;
-    gzputs(ctx->packages, "=Ver: 2.0\n");
-}
-
-static void parse_error_callback(void *user_data, const char *msg)
-{
-    TagsContext *ctx = (TagsContext *) user_data;
-}
-
-static int start_callback(void *user_data, const char *file)
-{
-    TagsContext *ctx = (TagsContext *) user_data;
-    fprintf(stderr, "file: %s\n", file);
-    return 0;
-}
-
-static int end_callback(void *user_data)
-{
-    return 0;
-}
-
-static int deps_start_callback(void *user_data)
-{
-    TagsContext *ctx = (TagsContext *) user_data;
-    gzputs(ctx->packages, "+Req:\n");
-}
-
-static int dep_callback(void *user_data, const char *name, const char *op, const char *version)
-{
-    TagsContext *ctx = (TagsContext *) user_data;
-    if (*op == '~') {
-      char *bumped = gem_version_bump(version);
-      gzprintf(ctx->packages, "%s %s %s\n", join2(&ctx->pctx->jd, "rubygem", "-", name), ">=", version);
-      gzprintf(ctx->packages, "%s %s %s\n", join2(&ctx->pctx->jd, "rubygem", "-", name), "<", bumped);
-      free(bumped);
-      return 0;
-    }
-    gzprintf(ctx->packages, "%s %s %s\n", name, op, version);
-}
-
-static int deps_end_callback(void *user_data)
-{
-    TagsContext *ctx = (TagsContext *) user_data;
-    gzputs(ctx->packages, "-Req:\n");
-}
-
-static int attr_callback(void *user_data, const char *attr, const char *val)
-{
-    TagsContext *ctx = (TagsContext *) user_data;
-    if (!strcmp(attr, "name"))
-        ctx->name = val;
-    else if (!strcmp(attr, "version")) {
-        gzputs(ctx->packages, "##----------------------------------------\n");
-        gzputs(ctx->packages, "=Pkg: ");
-        gzprintf(ctx->packages, "%s %s %d %s\n", join2(&ctx->pctx->jd, "rubygem", "-", ctx->name), val, 0, "x86_64");
-        gzputs(ctx->packages_en, "##----------------------------------------\n");
-        gzputs(ctx->packages_en, "=Pkg: ");
-        gzprintf(ctx->packages_en, "%s %s %d %s\n", join2(&ctx->pctx->jd, "rubygem", "-", ctx->name), val, 0, "x86_64");
-    }
-    else if (!strcmp(attr, "summary")) {
-        gzputs(ctx->packages_en, "=Sum: ");
-        gzputs(ctx->packages_en, val);
-        gzputs(ctx->packages_en, "\n");
-    }
-    else if (!strcmp(attr, "description")) {
-        gzputs(ctx->packages_en, "+Des:\n");
-        gzputs(ctx->packages_en, val);
-        gzputs(ctx->packages_en, "\n-Des:\n");
-    }
-
-    return 0;
-}
-
-static int parse_end_callback(void *ctx)
-{
-}
-
 static void usage(const char *prog)
 {
-  fprintf(stderr, "Usage:\n%s <dir> ...\n", prog);
+  fprintf(stderr, "Usage:\n%s [options] <dir> ...\n", prog);
   fprintf(stderr, "<dir. is a directory with gems. The metadata will be generated there.\n");
+  fprintf(stderr, "options: -j N : parse and compress with N threads (default: available cpus).\n");
+  fprintf(stderr, "         --prefetch=N : read N gems ahead of the parser, 0 for none (default: 64).\n");
+  fprintf(stderr, "         --no-checksums : only read the metadata of the gems, without their sha256 and size.\n");
+  fprintf(stderr, "         --index=$file : read the Marshal.4.8(.Z) or specs.4.8(.gz) index $file instead of the gems.\n");
+  fprintf(stderr, "         --corpus=$file : read the metadata corpus $file (gemdump --capture) instead of the gems.\n");
+  fprintf(stderr, "         --compress=gz|xz : compression of the packages files (default: gz).\n");
+  fprintf(stderr, "         --stats[=$file] : print timing and counters as JSON to stderr or $file.\n");
+  fprintf(stderr, "         --progress : print a JSON progress line to stderr every second.\n");
 }
 
+enum {
+    OPT_STATS = 256,
+    OPT_PROGRESS,
+    OPT_COMPRESS,
+    OPT_PREFETCH,
+    OPT_NO_CHECKSUMS,
+    OPT_CORPUS,
+    OPT_INDEX
+};
+
+static struct option long_options[] = {
+    { "stats", optional_argument, 0, OPT_STATS },
+    { "progress", no_argument, 0, OPT_PROGRESS },
+    { "compress", required_argument, 0, OPT_COMPRESS },
+    { "prefetch", required_argument, 0, OPT_PREFETCH },
+    { "no-checksums", no_argument, 0, OPT_NO_CHECKSUMS },
+    { "corpus", required_argument, 0, OPT_CORPUS },
+    { "index", required_argument, 0, OPT_INDEX },
+    { 0, 0, 0, 0 }
+};
+
 int main(int argc, char **argv)
 {
-    int ret;
+    int ret = 0;
+    int c;
+    const char *dir;
+    char *index = 0;
+    char *corpus = 0;
+    const char *statsfile = 0;
+    int progress = 0;
+    int checksums = 1;
+    int format = GEM_WRITER_GZIP;
+    double t = 0;
     TagsContext ctx;
     ParseContext pctx;
 
-    if (argc < 2) {
+    gem_parse_context_initialize(&pctx);
+    pctx.jobs = gem_parse_default_jobs();
+    pctx.prefetch = GEM_PARSE_PREFETCH;
+
+    while ((c = getopt_long(argc, argv, "hj:", long_options, 0)) >= 0)
+    {
+        switch (c)
+        {
+        case OPT_STATS:
+            statsfile = optarg ? optarg : "";
+            break;
+        case OPT_PROGRESS:
+            progress = 1;
+            break;
+        case OPT_COMPRESS:
+            format = gem_writer_format(optarg);
+            if (format < 0) {
+                fprintf(stderr, "unsupported compression: %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'j':
+            pctx.jobs = atoi(optarg);
+            break;
+        case OPT_PREFETCH:
+            pctx.prefetch = atoi(optarg);
+            break;
+        case OPT_NO_CHECKSUMS:
+            checksums = 0;
+            break;
+        case OPT_CORPUS:
+            corpus = optarg;
+            break;
+        case OPT_INDEX:
+            index = optarg;
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(0);
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+
+    if (optind >= argc) {
         usage(argv[0]);
         return 1;
     }
-
-    memset(&ctx, 0, sizeof(ctx));
-    gem_parse_context_initialize(&pctx);
-    mkdir_p(join2(&pctx.jd, argv[1], "/", "suse/setup/descr"));
-
-    ctx.packages = gzopen(join2(&pctx.jd, argv[1], "/", "suse/setup/descr/packages.gz"), "w");
-    if (!ctx.packages) {
-        fprintf(stderr, "Can't open packages.gz file: %s\n", strerror(errno));
+    dir = argv[optind];
+    if (corpus && index) {
+        fprintf(stderr, "--corpus and --index can't be used together\n");
         return 1;
     }
 
-    ctx.packages_en = gzopen(join2(&pctx.jd, argv[1], "/", "suse/setup/descr/packages.en.gz"), "w");
-    if (!ctx.packages_en) {
-        fprintf(stderr, "Can't open packages.en.gz file: %s\n", strerror(errno));
+    if (gem_susetags_context_setup(&ctx, &pctx, dir, format, pctx.jobs)) {
+        fprintf(stderr, "Can't create the packages files in %s: %s\n", dir, strerror(errno));
         return 1;
     }
-
-
-    ctx.pctx = &pctx;
-
-    pctx.gem_parse_start_callback = parse_start_callback;
-    pctx.gem_start_callback = start_callback;
-    pctx.gem_parse_error_callback = parse_error_callback;
-    pctx.gem_attr_callback = attr_callback;
-    pctx.gem_deps_start_callback = deps_start_callback;
-    pctx.gem_dep_callback = dep_callback;
-    pctx.gem_deps_end_callback = deps_end_callback;
-    pctx.gem_end_callback = end_callback;
-    pctx.gem_parse_end_callback = parse_end_callback;
-    pctx.data = &ctx;
-
-    gem_parse(&pctx, 1, argv + 1);
-
-    gzclose(ctx.packages);
-    gzclose(ctx.packages_en);
+    if (!checksums)
+        pctx.gem_checksum_callback = 0;
+
+    if (statsfile || progress)
+        pctx.stats = gem_stats_create(statsfile ? 10 : 0);
+    if (progress)
+        pctx.stats->progress = stderr;
+
+    if (corpus)
+        gem_parse(&pctx, 1, &corpus);
+    else if (index)
+        gem_parse(&pctx, 1, &index);
+    else
+        gem_parse(&pctx, 1, argv + optind);
+
+    if (pctx.stats)
+        t = gem_stats_now();
+    if (gem_susetags_context_close(&ctx)) {
+        fprintf(stderr, "Can't write the packages files: %s\n", strerror(errno));
+        ret = 1;
+    }
+    if (pctx.stats) {
+        gem_stats_add(pctx.stats, GEM_STAGE_WRITE, gem_stats_now() - t, 0);
+        gem_stats_progress_flush(pctx.stats, 0);
+        if (statsfile)
+            gem_stats_write_json(pctx.stats, statsfile);
+        gem_stats_free(pctx.stats);
+    }
 
     gem_parse_context_free(&pctx);
 
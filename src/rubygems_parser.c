@@ -3,9 +3,11 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <zlib.h>
-#include <glob.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
 
 #include <yaml.h>
@@ -14,10 +16,24 @@
 #include <archive_entry.h>
 
 #include "rubygems_parser.h"
+#include "gem_parallel.h"
+#include "gem_record.h"
+#include "gem_cache.h"
+#include "gem_marshal.h"
+#include "gem_corpus.h"
+#include "gem_tar.h"
+#include "gem_stats.h"
+#include "gem_inflate.h"
+#include "gem_walk.h"
+#include "gem_prefetch.h"
+#include "gem_sha256.h"
 
 #define BLOCK_SIZE 16384
-#define ZLIB_BUFFER_SIZE 64000
-#define RUBYGEM_GZIP_HEADER_LEN 10
+#define METADATA_BUFFER_SIZE 16384
+/* don't trust a gzip trailer claiming more */
+#define METADATA_MAX_PRESIZE (64 << 20)
+/* reads of the whole file for its checksum */
+#define CHECKSUM_BLOCK_SIZE (256 << 10)
 
 static void gem_parse_error(ParseContext *ctx, const char *format, ...)
 {
@@ -31,124 +47,427 @@ static void gem_parse_error(ParseContext *ctx, const char *format, ...)
     }
 }
 
-static unsigned char *
-decompress(unsigned char *in, int inl, int *outlp)
-{
-  z_stream strm;
-  int outl, ret;
-  unsigned char *out;
-  memset(&strm, 0, sizeof(strm));
-  strm.next_in = in;
-  strm.avail_in = inl;
-  out = malloc(4096);
-  strm.next_out = out;
-  strm.avail_out = 4096;
-  outl = 0;
-  ret = inflateInit2(&strm, -MAX_WBITS);
-  if (ret != Z_OK)
-    {
-      inflateEnd(&strm);
-      free(out);
-      return 0;
-    }
-  for (;;)
-    {
-      if (strm.avail_out == 0)
-    {
-      outl += 4096;
-      out = realloc(out, outl + 4096);
-      strm.next_out = out + outl;
-      strm.avail_out = 4096;
-    }
-      ret = inflate(&strm, Z_NO_FLUSH);
-      if (ret == Z_STREAM_END)
-    break;
-      if (ret != Z_OK)
-    {
-      fprintf(stderr, "Error decompressing: %s\n", strm.msg);
-      inflateEnd(&strm);
-      free(out);
-      return 0;
-    }
-    }
-  outl += 4096 - strm.avail_out;
-  inflateEnd(&strm);
-  *outlp = outl;
-  return out;
-}
-
-/**
- * Reads the content of the metadata from the archive
- * returning an allocated buffer pointing to compressed gz data
- * and the size on outlp.
+typedef struct YamlStrBuf
+{
+    char *buf;
+    int len;
+    int alloc;
+} YamlStrBuf;
+
+/*
+ * What the parser needs for every gem, kept in the ParseContext from
+ * one gem to the next, so once the buffers have grown a gem costs no
+ * allocations of ours: the read buffer, the zlib stream (reset instead
+ * of set up and torn down), the buffer for the whole metadata, the
+ * dependency strings, the compressed member with its inflater, the
+ * buffer and hash of the checksum, the record of the recorded parse
+ * and the yaml parser. What remains are the allocations of libyaml
+ * for every scalar, tag and anchor, which its event API gives no way
+ * to avoid.
  */
-static unsigned char *
-read_archive(struct archive *archive, int *outlp)
+struct GemScratch
 {
-  int outl = 0;
-  unsigned char *out;
-  out = malloc(4096);
-  int ret;
+    unsigned char *inbuf;
+    z_stream strm;
+    int strm_ready;
+    unsigned char *metadata;
+    int metadata_alloc;
+    unsigned char *member;
+    int member_alloc;
+    GemInflater *inflater;
+    unsigned char *filebuf;
+    GemSha256 *sha256;
+    YamlStrBuf name;
+    YamlStrBuf requirement;
+    YamlStrBuf version_requirements;
+    GemRecord rec;
+    /* the parser and its state right after yaml_parser_initialize */
+    yaml_parser_t parser;
+    yaml_parser_t parser_init;
+    int parser_ready;
+};
 
-  while ((ret = archive_read_data(archive, out, 4096))) {
-    if (ret == -1) {
-        free(out);
-        return 0;
+static GemScratch *gem_scratch(ParseContext *ctx)
+{
+    if (!ctx->scratch) {
+        ctx->scratch = calloc(1, sizeof(GemScratch));
+        gem_record_init(&ctx->scratch->rec);
     }
-    outl += ret;
-    out = realloc(out, outl + 4096);
-  }
-  *outlp = outl;
-  return out;
+    return ctx->scratch;
 }
 
-static yaml_node_t* yaml_get_seq_node(yaml_document_t *doc, yaml_node_t *node, int index)
+void gem_scratch_free(GemScratch *sc)
 {
+    if (!sc)
+        return;
+    if (sc->strm_ready)
+        inflateEnd(&sc->strm);
+    free(sc->inbuf);
+    free(sc->metadata);
+    free(sc->member);
+    gem_inflater_free(sc->inflater);
+    free(sc->filebuf);
+    gem_sha256_free(sc->sha256);
+    free(sc->name.buf);
+    free(sc->requirement.buf);
+    free(sc->version_requirements.buf);
+    gem_record_free(&sc->rec);
+    if (sc->parser_ready)
+        yaml_parser_delete(&sc->parser);
+    free(sc);
+}
 
-    yaml_node_item_t *i;
-    for (i = node->data.sequence.items.start; i < node->data.sequence.items.top; ++i)
-    {
-        if ((i - node->data.sequence.items.start) == index) {
-          return yaml_document_get_node(doc, *i);
-        }
+/*
+ * Streams metadata.gz through zlib: the tar entry is inflated as the
+ * YAML reader asks for input, so the decompressed metadata is not
+ * copied into a buffer of its own. The compressed data comes either
+ * straight from the file (fd, offset and remaining size of the tar
+ * member) or from the data blocks of libarchive.
+ */
+typedef struct GemStream
+{
+    ParseContext *ctx;
+    struct archive *a;
+    int fd;
+    off_t offset;
+    off_t remaining;
+    unsigned char *inbuf;
+    z_stream *strm;
+    int input_eof;
+    int done;
+    int error;
+    /* for ctx->stats */
+    double io_time;
+    double inflate_time;
+    unsigned long long io_bytes;
+    int error_stage;
+} GemStream;
+
+static int gem_stream_init(GemStream *gs, ParseContext *ctx, struct archive *a, int fd, off_t offset, off_t size)
+{
+    GemScratch *sc = gem_scratch(ctx);
+
+    memset(gs, 0, sizeof(GemStream));
+    gs->ctx = ctx;
+    gs->a = a;
+    gs->fd = fd;
+    gs->offset = offset;
+    gs->remaining = size;
+    if (!a && !sc->inbuf)
+        sc->inbuf = malloc(BLOCK_SIZE);
+    gs->inbuf = sc->inbuf;
+    gs->strm = &sc->strm;
+    /* let zlib parse the gzip header and check the trailer */
+    if (sc->strm_ready) {
+        gs->strm->next_in = 0;
+        gs->strm->avail_in = 0;
+        if (inflateReset(gs->strm) == Z_OK)
+            return 0;
+        inflateEnd(gs->strm);
+        sc->strm_ready = 0;
+    }
+    memset(gs->strm, 0, sizeof(z_stream));
+    if (inflateInit2(gs->strm, 16 + MAX_WBITS) != Z_OK) {
+        gem_parse_error(ctx, "Error initializing zlib");
+        return -1;
     }
+    sc->strm_ready = 1;
     return 0;
 }
 
-static const char * yaml_get_seq_node_str(yaml_document_t *doc, yaml_node_t *node, int index)
+static void gem_stream_free(GemStream *gs)
+{
+    GemStats *st = gs->ctx->stats;
+
+    if (st) {
+        gem_stats_add(st, GEM_STAGE_IO, gs->io_time, gs->io_bytes);
+        gem_stats_add(st, GEM_STAGE_INFLATE, gs->inflate_time, gs->strm->total_out);
+        if (gs->error)
+            gem_stats_error(st, gs->error_stage);
+    }
+}
+
+/* gets the next chunk of compressed data into strm */
+static int gem_stream_fill(GemStream *gs)
 {
-    yaml_node_t *valNode = yaml_get_seq_node(doc, node, index);
-    if (valNode && valNode->type == YAML_SCALAR_NODE) {
-        return (const char *) valNode->data.scalar.value;
+    const void *block;
+    size_t block_len;
+    int64_t offset;
+    ssize_t l;
+    int ret;
+
+    if (!gs->a) {
+        if (gs->remaining == 0) {
+            gs->input_eof = 1;
+            return 0;
+        }
+        l = pread(gs->fd, gs->inbuf, gs->remaining < BLOCK_SIZE ? gs->remaining : BLOCK_SIZE, gs->offset);
+        if (l <= 0) {
+            gem_parse_error(gs->ctx, "Error reading gem file: %s", l ? strerror(errno) : "unexpected end of file");
+            return -1;
+        }
+        gs->offset += l;
+        gs->remaining -= l;
+        gs->io_bytes += l;
+        gs->strm->next_in = gs->inbuf;
+        gs->strm->avail_in = l;
+        return 0;
+    }
+    ret = archive_read_data_block(gs->a, &block, &block_len, &offset);
+    if (ret == ARCHIVE_EOF)
+        gs->input_eof = 1;
+    else if (ret != ARCHIVE_OK) {
+        gem_parse_error(gs->ctx, "Error reading gem archive: %s", archive_error_string(gs->a));
+        return -1;
+    }
+    else {
+        gs->strm->next_in = (unsigned char *) block;
+        gs->strm->avail_in = block_len;
+        gs->io_bytes += block_len;
     }
     return 0;
 }
 
-/* [] operator for a yaml mapping node */
-static yaml_node_t* yaml_get_map_node(yaml_document_t *doc, yaml_node_t *node, const char *key_str)
+/* inflates up to size bytes into buffer, returns the number of bytes or -1 */
+static int gem_stream_read(GemStream *gs, unsigned char *buffer, size_t size)
+{
+    int timed = gs->ctx->stats != 0;
+    double t = 0;
+    int ret;
+
+    if (gs->done || gs->error)
+        return gs->error ? -1 : 0;
+    gs->strm->next_out = buffer;
+    gs->strm->avail_out = size;
+    while (gs->strm->avail_out == size) {
+        if (gs->strm->avail_in == 0 && !gs->input_eof) {
+            if (timed)
+                t = gem_stats_now();
+            ret = gem_stream_fill(gs);
+            if (timed)
+                gs->io_time += gem_stats_now() - t;
+            if (ret) {
+                gs->error = 1;
+                gs->error_stage = GEM_STAGE_IO;
+                return -1;
+            }
+        }
+        if (timed)
+            t = gem_stats_now();
+        ret = inflate(gs->strm, Z_NO_FLUSH);
+        if (timed)
+            gs->inflate_time += gem_stats_now() - t;
+        if (ret == Z_STREAM_END) {
+            gs->done = 1;
+            break;
+        }
+        if (ret == Z_BUF_ERROR && gs->input_eof) {
+            gem_parse_error(gs->ctx, "Error decompressing: unexpected end of metadata.gz");
+            gs->error = 1;
+            gs->error_stage = GEM_STAGE_INFLATE;
+            return -1;
+        }
+        if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            gem_parse_error(gs->ctx, "Error decompressing: %s", gs->strm->msg ? gs->strm->msg : "corrupt data");
+            gs->error = 1;
+            gs->error_stage = GEM_STAGE_INFLATE;
+            return -1;
+        }
+    }
+    return size - gs->strm->avail_out;
+}
+
+/* libyaml read handler on top of gem_stream_read */
+static int gem_stream_yaml_read(void *data, unsigned char *buffer, size_t size, size_t *size_read)
 {
-    yaml_node_pair_t *i;
-    for (i = node->data.mapping.pairs.start; i < node->data.mapping.pairs.top; ++i)
-    {
-        yaml_node_t *key = yaml_document_get_node(doc, i->key);
-        yaml_node_t *value = yaml_document_get_node(doc, i->value);
+    int l = gem_stream_read((GemStream *) data, buffer, size);
+    if (l < 0)
+        return 0;
+    *size_read = l;
+    return 1;
+}
+
+/*
+ * The metadata is read with the libyaml event API instead of loading
+ * the whole document: only the parts of the Gem::Specification we
+ * report are looked at, everything else (files, test_files, ...)
+ * is skipped without building nodes for it.
+ *
+ * Without nodes there is nothing for an alias to point to, so the
+ * values of the anchors we come across are kept as far as we report
+ * them: scalars, Gem::Versions and requirements (as op/version pairs,
+ * whether a single pair, the requirements: list or the whole
+ * Gem::Requirement). An alias of anything else where a value is read
+ * is a parse error.
+ */
+
+enum {
+    ANCHOR_SCALAR,
+    ANCHOR_VERSION,
+    ANCHOR_PAIRS
+};
+
+typedef struct YamlAnchor
+{
+    int kind;
+    char *name;
+    /* a string with its NUL, or op/version pairs like YamlStrBuf */
+    char *value;
+    int len;
+} YamlAnchor;
+
+typedef struct YamlState
+{
+    yaml_parser_t *parser;
+    ParseContext *ctx;
+
+    /* the dependency being parsed */
+    YamlStrBuf name;
+    YamlStrBuf requirement;
+    YamlStrBuf version_requirements;
+
+    /* the anchors of the document, usually none */
+    YamlAnchor *anchors;
+    int nanchors;
+} YamlState;
 
-        if (!strcmp((const char *) key->data.scalar.value, key_str))
-          return value;
+static void strbuf_addn(YamlStrBuf *sb, const char *s, int l)
+{
+    if (sb->len + l > sb->alloc) {
+        sb->alloc = sb->len + l + 256;
+        sb->buf = realloc(sb->buf, sb->alloc);
     }
+    memcpy(sb->buf + sb->len, s, l);
+    sb->len += l;
+}
+
+static void strbuf_add(YamlStrBuf *sb, const char *s)
+{
+    strbuf_addn(sb, s, strlen(s) + 1);
+}
+
+static void anchor_add(YamlState *ys, const yaml_char_t *name, int kind, const char *value, int len)
+{
+    YamlAnchor *a;
+
+    if (!name)
+        return;
+    ys->anchors = realloc(ys->anchors, (ys->nanchors + 1) * sizeof(YamlAnchor));
+    a = ys->anchors + ys->nanchors++;
+    a->kind = kind;
+    a->name = strdup((const char *) name);
+    a->value = malloc(len);
+    memcpy(a->value, value, len);
+    a->len = len;
+}
+
+/* the anchor an alias points to, the last one of that name */
+static const YamlAnchor *anchor_find(YamlState *ys, const yaml_event_t *alias)
+{
+    int i;
+
+    for (i = ys->nanchors - 1; i >= 0; i--)
+        if (!strcmp(ys->anchors[i].name, (const char *) alias->data.alias.anchor))
+            return ys->anchors + i;
+    return 0;
+}
+
+/* the same where a value of kind is read, an error if it is none */
+static const YamlAnchor *anchor_get(YamlState *ys, const yaml_event_t *alias, int kind)
+{
+    const YamlAnchor *a = anchor_find(ys, alias);
+
+    if (a && a->kind == kind)
+        return a;
+    gem_parse_error(ys->ctx, "Error parsing YAML document: unsupported alias *%s", (const char *) alias->data.alias.anchor);
     return 0;
 }
 
-/* [] operator for a yaml mapping node with a string value*/
-static const char * yaml_get_map_node_str(yaml_document_t *doc, yaml_node_t *node, const char *key)
+static void anchor_scalar(YamlState *ys, const yaml_event_t *e)
+{
+    if (e->type == YAML_SCALAR_EVENT && e->data.scalar.anchor)
+        anchor_add(ys, e->data.scalar.anchor, ANCHOR_SCALAR, (const char *) e->data.scalar.value, e->data.scalar.length + 1);
+}
+
+static void anchors_free(YamlState *ys)
 {
-    yaml_node_t *valNode = yaml_get_map_node(doc, node, key);
-    if (valNode && valNode->type == YAML_SCALAR_NODE) {
-      return (const char *) valNode->data.scalar.value;
+    int i;
+
+    for (i = 0; i < ys->nanchors; i++) {
+        free(ys->anchors[i].name);
+        free(ys->anchors[i].value);
+    }
+    free(ys->anchors);
+}
+
+static int yaml_next(YamlState *ys, yaml_event_t *event)
+{
+    return yaml_parser_parse(ys->parser, event) ? 0 : -1;
+}
+
+/* consumes the rest of the node started by event */
+static int yaml_skip_node(YamlState *ys, yaml_event_t *event)
+{
+    yaml_event_t e;
+    int depth = 1;
+
+    /* a skipped scalar may still be aliased where we look */
+    anchor_scalar(ys, event);
+    if (event->type != YAML_SEQUENCE_START_EVENT && event->type != YAML_MAPPING_START_EVENT)
+        return 0;
+    while (depth) {
+        if (yaml_next(ys, &e))
+            return -1;
+        anchor_scalar(ys, &e);
+        if (e.type == YAML_SEQUENCE_START_EVENT || e.type == YAML_MAPPING_START_EVENT)
+            depth++;
+        else if (e.type == YAML_SEQUENCE_END_EVENT || e.type == YAML_MAPPING_END_EVENT)
+            depth--;
+        yaml_event_delete(&e);
     }
     return 0;
 }
 
+/*
+ * Reads the next pair of the current mapping. Returns 1 with key and
+ * value set, 0 at the end of the mapping and -1 on error. The caller
+ * has to consume the value node and delete both events.
+ */
+static int yaml_next_pair(YamlState *ys, yaml_event_t *key, yaml_event_t *value)
+{
+    for (;;) {
+        if (yaml_next(ys, key))
+            return -1;
+        if (key->type == YAML_MAPPING_END_EVENT) {
+            yaml_event_delete(key);
+            return 0;
+        }
+        if (key->type != YAML_SCALAR_EVENT) {
+            /* complex keys are not used in gemspecs */
+            if (yaml_skip_node(ys, key)) {
+                yaml_event_delete(key);
+                return -1;
+            }
+            yaml_event_delete(key);
+            if (yaml_next(ys, value))
+                return -1;
+            if (yaml_skip_node(ys, value)) {
+                yaml_event_delete(value);
+                return -1;
+            }
+            yaml_event_delete(value);
+            continue;
+        }
+        if (yaml_next(ys, value)) {
+            yaml_event_delete(key);
+            return -1;
+        }
+        return 1;
+    }
+}
+
+#define YAML_KEY(e) ((const char *) (e).data.scalar.value)
+
 static int parse_attribute(ParseContext *ctx, const char *attr, const char *val)
 {
     if (ctx->gem_attr_callback)
@@ -156,50 +475,181 @@ static int parse_attribute(ParseContext *ctx, const char *attr, const char *val)
     return 0;
 }
 
-static int parse_version(ParseContext *ctx, yaml_node_t *node)
+/*
+ * Reads the version: key of a Gem::Version mapping into sb, or
+ * reports it as attribute if sb is 0.
+ */
+static int parse_version(YamlState *ys, yaml_event_t *node, YamlStrBuf *sb)
 {
     /*
       version: 0.4.1
     */
-    const char *version = yaml_get_map_node_str(ctx->doc, node, "version");
+    yaml_event_t key, value;
+    const YamlAnchor *a;
+    const char *v;
+    int r, found = 0;
 
-    if (!version) {
-      gem_parse_error(ctx, "Error parsing version");
-      return -1;
+    if (node->type == YAML_ALIAS_EVENT) {
+        if (!(a = anchor_get(ys, node, ANCHOR_VERSION)))
+            return -1;
+        if (sb)
+            strbuf_add(sb, a->value);
+        else
+            parse_attribute(ys->ctx, "version", a->value);
+        return 1;
     }
-    parse_attribute(ctx, "version", version);
-    return 0;
+    if (node->type != YAML_MAPPING_START_EVENT) {
+        if (!sb)
+            gem_parse_error(ys->ctx, "Error parsing version");
+        return yaml_skip_node(ys, node);
+    }
+    while ((r = yaml_next_pair(ys, &key, &value)) > 0) {
+        v = 0;
+        if (!found && !strcmp(YAML_KEY(key), "version")) {
+            if (value.type == YAML_SCALAR_EVENT)
+                v = YAML_KEY(value);
+            else if (value.type == YAML_ALIAS_EVENT && (a = anchor_get(ys, &value, ANCHOR_SCALAR)) != 0)
+                v = a->value;
+            else if (value.type == YAML_ALIAS_EVENT)
+                r = -1;
+        }
+        if (v) {
+            found = 1;
+            anchor_add(ys, node->data.mapping_start.anchor, ANCHOR_VERSION, v, strlen(v) + 1);
+            if (sb)
+                strbuf_add(sb, v);
+            else
+                parse_attribute(ys->ctx, "version", v);
+        }
+        if (r >= 0)
+            r = yaml_skip_node(ys, &value);
+        yaml_event_delete(&key);
+        yaml_event_delete(&value);
+        if (r < 0)
+            return -1;
+    }
+    if (r == 0 && !found && !sb)
+        gem_parse_error(ys->ctx, "Error parsing version");
+    return r < 0 ? -1 : found;
 }
 
-static int parse_requirement(ParseContext *ctx, const char *name, yaml_node_t *node_req)
+static int parse_requirement(YamlState *ys, yaml_event_t *node, YamlStrBuf *sb)
 {
     /*
     - ">="
     - !ruby/object:Gem::Version
       version: 1.0.5
     */
-    if (node_req->type != YAML_SEQUENCE_NODE) {
-        gem_parse_error(ctx, "Error parsing requirement");
-        return -1;
-    }
-
-    const char *op = yaml_get_seq_node_str(ctx->doc, node_req, 0);
-    if (!op)
-      return -1;
-
-    yaml_node_t *version_node = yaml_get_seq_node(ctx->doc, node_req, 1);
-    if (!version_node)
-      return -1;
+    yaml_event_t e;
+    const YamlAnchor *a;
+    int saved = sb->len;
+    int i, r;
 
-    const char *version = yaml_get_map_node_str(ctx->doc, version_node, "version");
-    if (!version)
-      return -1;
+    if (node->type == YAML_ALIAS_EVENT) {
+        if (!(a = anchor_get(ys, node, ANCHOR_PAIRS)))
+            return -1;
+        strbuf_addn(sb, a->value, a->len);
+        return 0;
+    }
+    if (node->type != YAML_SEQUENCE_START_EVENT) {
+        gem_parse_error(ys->ctx, "Error parsing requirement");
+        return yaml_skip_node(ys, node);
+    }
+    for (i = 0; ; i++) {
+        if (yaml_next(ys, &e))
+            return -1;
+        if (e.type == YAML_SEQUENCE_END_EVENT) {
+            yaml_event_delete(&e);
+            break;
+        }
+        if (i == 0 && e.type == YAML_SCALAR_EVENT) {
+            anchor_scalar(ys, &e);
+            strbuf_add(sb, YAML_KEY(e));
+            r = 0;
+        }
+        else if (i == 0 && e.type == YAML_ALIAS_EVENT) {
+            if ((a = anchor_get(ys, &e, ANCHOR_SCALAR)) != 0)
+                strbuf_add(sb, a->value);
+            r = a ? 0 : -1;
+        }
+        else if (i == 1 && sb->len > saved)
+            r = parse_version(ys, &e, sb) < 0 ? -1 : 0;
+        else
+            r = yaml_skip_node(ys, &e);
+        yaml_event_delete(&e);
+        if (r < 0)
+            return -1;
+    }
+    /* only keep complete op/version pairs */
+    for (i = saved, r = 0; i < sb->len; i += strlen(sb->buf + i) + 1)
+        r++;
+    if (r != 2)
+        sb->len = saved;
+    else
+        anchor_add(ys, node->data.sequence_start.anchor, ANCHOR_PAIRS, sb->buf + saved, sb->len - saved);
+    return 0;
+}
 
-    if (ctx->gem_dep_callback)
-        ctx->gem_dep_callback(ctx->data, name, op, version);
+static int parse_requirements(YamlState *ys, yaml_event_t *node, YamlStrBuf *sb)
+{
+    /*
+    !ruby/object:Gem::Requirement
+      requirements:
+      - - ">="
+        - !ruby/object:Gem::Version
+          version: 1.0.5
+    */
+    yaml_event_t key, value, e;
+    const YamlAnchor *a;
+    int r, saved;
+
+    sb->len = 0;
+    if (node->type == YAML_ALIAS_EVENT) {
+        /* older gems point version_requirements: to requirement: */
+        if (!(a = anchor_get(ys, node, ANCHOR_PAIRS)))
+            return -1;
+        strbuf_addn(sb, a->value, a->len);
+        return 0;
+    }
+    if (node->type != YAML_MAPPING_START_EVENT)
+        return yaml_skip_node(ys, node);
+    while ((r = yaml_next_pair(ys, &key, &value)) > 0) {
+        if (value.type == YAML_ALIAS_EVENT && !strcmp(YAML_KEY(key), "requirements")) {
+            if ((a = anchor_get(ys, &value, ANCHOR_PAIRS)) != 0)
+                strbuf_addn(sb, a->value, a->len);
+            r = a ? 0 : -1;
+        }
+        else if (value.type == YAML_SEQUENCE_START_EVENT && !strcmp(YAML_KEY(key), "requirements")) {
+            saved = sb->len;
+            /* iterate over requirements, usually only one */
+            for (;;) {
+                if ((r = yaml_next(ys, &e)) < 0)
+                    break;
+                if (e.type == YAML_SEQUENCE_END_EVENT) {
+                    yaml_event_delete(&e);
+                    break;
+                }
+                r = parse_requirement(ys, &e, sb);
+                yaml_event_delete(&e);
+                if (r < 0)
+                    break;
+            }
+            if (r >= 0)
+                anchor_add(ys, value.data.sequence_start.anchor, ANCHOR_PAIRS, sb->buf + saved, sb->len - saved);
+        }
+        else
+            r = yaml_skip_node(ys, &value);
+        yaml_event_delete(&key);
+        yaml_event_delete(&value);
+        if (r < 0)
+            return -1;
+    }
+    if (r == 0)
+        anchor_add(ys, node->data.mapping_start.anchor, ANCHOR_PAIRS, sb->buf, sb->len);
+    return r;
 }
 
-static int parse_dependency(ParseContext *ctx, yaml_node_t *node)
+static int parse_dependency(YamlState *ys)
 {
     /*
       name: trollop
@@ -212,34 +662,61 @@ static int parse_dependency(ParseContext *ctx, yaml_node_t *node)
             version: 1.0.5
         version:
     */
-    if (node->type != YAML_MAPPING_NODE) {
-        gem_parse_error(ctx, "Error parsing dependency");
-        return -1;
+    yaml_event_t key, value;
+    YamlStrBuf *reqs = 0;
+    const YamlAnchor *a;
+    int have_name = 0;
+    int r, i;
+    const char *op;
+
+    ys->requirement.len = 0;
+    ys->version_requirements.len = 0;
+    while ((r = yaml_next_pair(ys, &key, &value)) > 0) {
+        const char *k = YAML_KEY(key);
+        r = 0;
+        if (!strcmp(k, "name") && value.type == YAML_SCALAR_EVENT) {
+            anchor_scalar(ys, &value);
+            ys->name.len = 0;
+            strbuf_add(&ys->name, YAML_KEY(value));
+            have_name = 1;
+        }
+        else if (!strcmp(k, "name") && value.type == YAML_ALIAS_EVENT) {
+            if ((a = anchor_get(ys, &value, ANCHOR_SCALAR)) != 0) {
+                ys->name.len = 0;
+                strbuf_add(&ys->name, a->value);
+                have_name = 1;
+            }
+            r = a ? 0 : -1;
+        }
+        else if (!strcmp(k, "version_requirements")) {
+            r = parse_requirements(ys, &value, &ys->version_requirements);
+            reqs = &ys->version_requirements;
+        }
+        else if (!strcmp(k, "requirement"))
+            r = parse_requirements(ys, &value, &ys->requirement);
+        else
+            r = yaml_skip_node(ys, &value);
+        yaml_event_delete(&key);
+        yaml_event_delete(&value);
+        if (r < 0)
+            return -1;
     }
-
-    const char *name = yaml_get_map_node_str(ctx->doc, node, "name");
-    if (!name)
-      return -1;
-
-    yaml_node_t *version_reqs = yaml_get_map_node(ctx->doc, node, "version_requirements");
-    if (!version_reqs)
-        return -1;
-
-    yaml_node_t *reqs = yaml_get_map_node(ctx->doc, version_reqs, "requirements");
-    if (!reqs)
+    if (r < 0)
         return -1;
+    if (!have_name || !reqs)
+        return 0;
 
-    /* iterate over requirements, usually only one */
-    yaml_node_item_t *i;
-    for (i = reqs->data.sequence.items.start; i < reqs->data.sequence.items.top; ++i)
-    {
-        yaml_node_t *item = yaml_document_get_node(ctx->doc, *i);
-        parse_requirement(ctx, name, item);
+    for (i = 0; i < reqs->len; ) {
+        op = reqs->buf + i;
+        i += strlen(op) + 1;
+        if (ys->ctx->gem_dep_callback)
+            ys->ctx->gem_dep_callback(ys->ctx->data, ys->name.buf, op, reqs->buf + i);
+        i += strlen(reqs->buf + i) + 1;
     }
     return 0;
 }
 
-static int parse_dependencies(ParseContext *ctx, yaml_node_t *node)
+static int parse_dependencies(YamlState *ys, yaml_event_t *node)
 {
     /*
       - !ruby/object:Gem::Dependency
@@ -251,131 +728,477 @@ static int parse_dependencies(ParseContext *ctx, yaml_node_t *node)
         type: :runtime
         ...
     */
-    if (node->type != YAML_SEQUENCE_NODE) {
-        gem_parse_error(ctx, "Error parsing deps");
-        return -1;
-    }
+    yaml_event_t e;
+    int r = 0;
 
-    if (ctx->gem_deps_start_callback)
-        ctx->gem_deps_start_callback(ctx->data);
+    if (node->type != YAML_SEQUENCE_START_EVENT) {
+        gem_parse_error(ys->ctx, "Error parsing deps");
+        return yaml_skip_node(ys, node);
+    }
 
-    yaml_node_item_t *i;
-    for (i = node->data.sequence.items.start; i < node->data.sequence.items.top; ++i)
-    {
-        yaml_node_t *item = yaml_document_get_node(ctx->doc, *i);
+    if (ys->ctx->gem_deps_start_callback)
+        ys->ctx->gem_deps_start_callback(ys->ctx->data);
 
-        parse_dependency(ctx, item);
+    for (;;) {
+        if (yaml_next(ys, &e))
+            return -1;
+        if (e.type == YAML_SEQUENCE_END_EVENT) {
+            yaml_event_delete(&e);
+            break;
+        }
+        if (e.type == YAML_MAPPING_START_EVENT)
+            r = parse_dependency(ys);
+        else if (e.type == YAML_ALIAS_EVENT) {
+            /* the pairs of a dependency are not kept */
+            gem_parse_error(ys->ctx, "Error parsing YAML document: unsupported alias *%s", (const char *) e.data.alias.anchor);
+            r = -1;
+        }
+        else {
+            gem_parse_error(ys->ctx, "Error parsing dependency");
+            r = yaml_skip_node(ys, &e);
+        }
+        yaml_event_delete(&e);
+        if (r < 0)
+            return -1;
     }
 
-    if (ctx->gem_deps_end_callback)
-        ctx->gem_deps_end_callback(ctx->data);
+    if (ys->ctx->gem_deps_end_callback)
+        ys->ctx->gem_deps_end_callback(ys->ctx->data);
 
     return 0;
 }
 
-static int parse_root_node(ParseContext *ctx, yaml_node_t *node)
+static int parse_root_node(YamlState *ys)
 {
-    yaml_node_pair_t *i;
-    for (i = node->data.mapping.pairs.start; i < node->data.mapping.pairs.top; ++i)
-    {
-        yaml_node_t *key = yaml_document_get_node(ctx->doc, i->key);
-        yaml_node_t *value = yaml_document_get_node(ctx->doc, i->value);
+    yaml_event_t e, key, value;
+    yaml_event_type_t type;
+    int r;
+
+    do {
+        if (yaml_next(ys, &e))
+            return -1;
+        type = e.type;
+        yaml_event_delete(&e);
+    } while (type == YAML_STREAM_START_EVENT || type == YAML_DOCUMENT_START_EVENT);
+
+    if (type != YAML_MAPPING_START_EVENT) {
+        gem_parse_error(ys->ctx, "Error getting YAML document root node");
+        return -1;
+    }
 
-        if (value->type == YAML_SCALAR_NODE) {
-            /*fprintf(stderr, "%s -> %s\n", key->data.scalar.value, value->data.scalar.value);*/
-            parse_attribute(ctx, (const char *) key->data.scalar.value, (const char *) value->data.scalar.value);
+    while ((r = yaml_next_pair(ys, &key, &value)) > 0) {
+        const char *k = YAML_KEY(key);
+        if (value.type == YAML_SCALAR_EVENT) {
+            /*fprintf(stderr, "%s -> %s\n", k, value.data.scalar.value);*/
+            anchor_scalar(ys, &value);
+            parse_attribute(ys->ctx, k, YAML_KEY(value));
+            r = 0;
         }
-        else
-        {
-            if (!strcmp((const char *) key->data.scalar.value, "dependencies"))
-                parse_dependencies(ctx, value);
-            else if (!strcmp((const char *) key->data.scalar.value, "version"))
-                parse_version(ctx, value);
+        else if (value.type == YAML_ALIAS_EVENT && strcmp(k, "version") && strcmp(k, "dependencies")) {
+            /* only scalars are reported of the other keys */
+            const YamlAnchor *a = anchor_find(ys, &value);
+            if (a && a->kind == ANCHOR_SCALAR)
+                parse_attribute(ys->ctx, k, a->value);
+            r = 0;
+        }
+        else if (!strcmp(k, "dependencies") && value.type == YAML_ALIAS_EVENT) {
+            gem_parse_error(ys->ctx, "Error parsing YAML document: unsupported alias *%s", (const char *) value.data.alias.anchor);
+            r = -1;
         }
+        else if (!strcmp(k, "dependencies"))
+            r = parse_dependencies(ys, &value);
+        else if (!strcmp(k, "version"))
+            r = parse_version(ys, &value, 0) < 0 ? -1 : 0;
+        else
+            r = yaml_skip_node(ys, &value);
+        yaml_event_delete(&key);
+        yaml_event_delete(&value);
+        if (r < 0)
+            return -1;
     }
-    return 0;
+    return r;
 }
 
-static int gem_parse_metadata_entry(ParseContext *ctx, struct archive *a, struct archive_entry *entry)
+/*
+ * libyaml can't reset a parser, and setting one up allocates its
+ * buffers, queue and stacks. A parser that got to the end of the
+ * stream without growing any of them differs from a new one only in
+ * their contents, so it is reused by copying back the state it was
+ * set up with.
+ */
+static yaml_parser_t *gem_scratch_parser(GemScratch *sc)
 {
-    yaml_parser_t parser;
-    yaml_document_t document;
-    int ret = 0;
+    if (!sc->parser_ready) {
+        if (!yaml_parser_initialize(&sc->parser))
+            return 0;
+        sc->parser_init = sc->parser;
+        sc->parser_ready = 1;
+    }
+    return &sc->parser;
+}
 
-    unsigned char *metadata_gz;
-    unsigned char *metadata;
+#define YAML_SAME_ALLOC(p, q, f) ((p)->f.start == (q)->f.start && (p)->f.end == (q)->f.end)
 
-    int metadata_gz_len = 0;
-    int metadata_len = 0;
+static void gem_scratch_parser_done(GemScratch *sc)
+{
+    yaml_parser_t *p = &sc->parser, *q = &sc->parser_init;
+    yaml_event_t e;
+    int end = 0;
+
+    /* the end of the document after the root node */
+    while (!end && !p->error && !p->stream_end_produced && yaml_parser_parse(p, &e)) {
+        end = e.type == YAML_STREAM_END_EVENT;
+        yaml_event_delete(&e);
+    }
+    if (end && p->tokens.head == p->tokens.tail && p->tag_directives.top == p->tag_directives.start
+        && YAML_SAME_ALLOC(p, q, raw_buffer) && YAML_SAME_ALLOC(p, q, buffer) && YAML_SAME_ALLOC(p, q, tokens)
+        && YAML_SAME_ALLOC(p, q, indents) && YAML_SAME_ALLOC(p, q, simple_keys) && YAML_SAME_ALLOC(p, q, states)
+        && YAML_SAME_ALLOC(p, q, marks) && YAML_SAME_ALLOC(p, q, tag_directives) && YAML_SAME_ALLOC(p, q, aliases)) {
+        *p = *q;
+        return;
+    }
+    yaml_parser_delete(p);
+    sc->parser_ready = 0;
+}
 
-    metadata_gz = read_archive(a, &metadata_gz_len);
-    if (!metadata_gz) {
-        gem_parse_error(ctx, "Error reading gem archive: %s", archive_error_string(a));
-        free(metadata_gz);
+static int gem_parse_yaml(ParseContext *ctx, const unsigned char *metadata, int metadata_len, GemStream *gs)
+{
+    GemScratch *sc = gem_scratch(ctx);
+    YamlState ys;
+    int ret;
+
+    memset(&ys, 0, sizeof(ys));
+    ys.ctx = ctx;
+    if (!(ys.parser = gem_scratch_parser(sc))) {
+        gem_parse_error(ctx, "Error parsing YAML document: out of memory");
         return -1;
     }
+    ys.name = sc->name;
+    ys.requirement = sc->requirement;
+    ys.version_requirements = sc->version_requirements;
+    if (gs)
+        yaml_parser_set_input(ys.parser, gem_stream_yaml_read, gs);
+    else
+        yaml_parser_set_input_string(ys.parser, metadata, metadata_len);
+
+    ret = parse_root_node(&ys);
+
+    gem_scratch_parser_done(sc);
+    anchors_free(&ys);
+    sc->name = ys.name;
+    sc->requirement = ys.requirement;
+    sc->version_requirements = ys.version_requirements;
+    return ret;
+}
 
-    metadata = decompress(metadata_gz + RUBYGEM_GZIP_HEADER_LEN, metadata_gz_len - RUBYGEM_GZIP_HEADER_LEN, &metadata_len);
-    free(metadata_gz);
-
-    if (!metadata) {
-        gem_parse_error(ctx, "Error decompressing (%d) -> (%d)", metadata_gz_len, metadata_len);
-        free(metadata);
+int gem_parse_add_metadata(ParseContext *ctx, const char *metadata, int len)
+{
+    if (gem_parse_yaml(ctx, (const unsigned char *) metadata, len, 0) != 0) {
+        gem_parse_error(ctx, "Error parsing YAML document");
         return -1;
     }
+    return 0;
+}
+
+/* the uncompressed size from the gzip trailer, modulo 2^32, or 0 */
+static unsigned int gem_stream_isize(GemStream *gs)
+{
+    unsigned char trailer[4];
+
+    if (gs->a || gs->remaining < 18 || pread(gs->fd, trailer, 4, gs->offset + gs->remaining - 4) != 4)
+        return 0;
+    return trailer[0] | trailer[1] << 8 | trailer[2] << 16 | (unsigned int) trailer[3] << 24;
+}
+
+static int gem_parse_metadata_entry(ParseContext *ctx, struct archive *a, int fd, off_t offset, off_t size)
+{
+    GemScratch *sc;
+    GemStream gs;
+    unsigned char *metadata = 0;
+    int metadata_len = 0;
+    unsigned int isize;
+    int l, ret;
+    double t = 0, streamed = 0;
+
+    if (gem_stream_init(&gs, ctx, a, fd, offset, size))
+        return -1;
+
     if (ctx->gem_yaml_metadata_callback) {
-        ctx->gem_yaml_metadata_callback(ctx->data, metadata, metadata_len);
+        /* the callback wants the whole document, so collect it first.
+           Sized from the trailer, one byte more to see the end */
+        sc = gem_scratch(ctx);
+        isize = gem_stream_isize(&gs);
+        if (isize < METADATA_MAX_PRESIZE && isize >= sc->metadata_alloc) {
+            sc->metadata_alloc = isize + 1;
+            sc->metadata = realloc(sc->metadata, sc->metadata_alloc);
+        }
+        do {
+            if (metadata_len == sc->metadata_alloc) {
+                sc->metadata_alloc = sc->metadata_alloc * 2 + METADATA_BUFFER_SIZE;
+                sc->metadata = realloc(sc->metadata, sc->metadata_alloc);
+            }
+            l = gem_stream_read(&gs, sc->metadata + metadata_len, sc->metadata_alloc - metadata_len);
+            if (l > 0)
+                metadata_len += l;
+        } while (l > 0);
+        if (l < 0) {
+            gem_stream_free(&gs);
+            return -1;
+        }
+        metadata = sc->metadata;
+        ctx->gem_yaml_metadata_callback(ctx->data, (const char *) metadata, metadata_len);
     }
 
-    yaml_parser_initialize(&parser);
-    yaml_parser_set_input_string(&parser, metadata, metadata_len);
+    if (ctx->stats) {
+        t = gem_stats_now();
+        streamed = gs.io_time + gs.inflate_time;
+    }
+    if (metadata)
+        ret = gem_parse_yaml(ctx, metadata, metadata_len, 0);
+    else
+        ret = gem_parse_yaml(ctx, 0, 0, &gs);
+    if (ctx->stats) {
+        /* reading and inflating happen inside the yaml parser, they have their own stages */
+        t = gem_stats_now() - t - (gs.io_time + gs.inflate_time - streamed);
+        gem_stats_add(ctx->stats, GEM_STAGE_YAML, t, gs.strm->total_out);
+        if (ret != 0 && !gs.error)
+            gem_stats_error(ctx->stats, GEM_STAGE_YAML);
+    }
+
+    l = gs.error;
+    gem_stream_free(&gs);
 
-    ret = !yaml_parser_load(&parser, &document);
     if (ret != 0) {
-        gem_parse_error(ctx, "Error parsing YAML document");
-        free(metadata);
-        yaml_parser_delete(&parser);
-        yaml_document_delete(&document);
+        if (!l)
+            gem_parse_error(ctx, "Error parsing YAML document");
         return -1;
     }
+    // start new gem callback
+    if (ctx->gem_end_callback)
+        ctx->gem_end_callback(ctx->data);
 
-    yaml_node_t *root = yaml_document_get_root_node(&document);
-    yaml_parser_delete(&parser);
-    if (!root) {
-        gem_parse_error(ctx, "Error getting YAML document root node");
-        yaml_document_delete(&document);
-        return -1;
-    }
+    return ret;
+}
 
-    ctx->doc = &document;
-    memset(&ctx->jd, 0, sizeof(ctx->jd));
+/*
+ * metadata.gz of a plain tar archive: read as a whole, inflated in one
+ * go into a buffer sized from the trailer and parsed from there. Gzip
+ * members this does not take (too large, broken) go to the streaming
+ * path, which tells what is wrong with them. That path counts its own
+ * reading and inflating, so these are only counted here once the
+ * member is inflated.
+ */
+static int gem_parse_metadata_member(ParseContext *ctx, int fd, off_t offset, off_t size)
+{
+    GemScratch *sc = gem_scratch(ctx);
+    GemStats *st = ctx->stats;
+    const char *error;
+    long isize, len;
+    double t = 0, io = 0;
+    int ret;
 
-    ret = parse_root_node(ctx, root);
-    yaml_document_delete(&document);
+    if (size > METADATA_MAX_PRESIZE)
+        return gem_parse_metadata_entry(ctx, 0, fd, offset, size);
+    if (!sc->inflater && !(sc->inflater = gem_inflater_new()))
+        return gem_parse_metadata_entry(ctx, 0, fd, offset, size);
 
-    free(metadata);
+    if (st)
+        t = gem_stats_now();
+    if (size > sc->member_alloc) {
+        sc->member_alloc = size + BLOCK_SIZE;
+        sc->member = solv_realloc(sc->member, sc->member_alloc);
+    }
+    if (pread(fd, sc->member, size, offset) != size)
+        return gem_parse_metadata_entry(ctx, 0, fd, offset, size);
+    if (st)
+        io = gem_stats_now() - t;
+
+    isize = gem_gzip_isize(sc->member, size);
+    if (isize < 0 || isize >= METADATA_MAX_PRESIZE)
+        return gem_parse_metadata_entry(ctx, 0, fd, offset, size);
+    if (isize >= sc->metadata_alloc) {
+        sc->metadata_alloc = isize + 1;
+        sc->metadata = solv_realloc(sc->metadata, sc->metadata_alloc);
+    }
+    if (st)
+        t = gem_stats_now();
+    len = gem_inflater_gunzip(sc->inflater, sc->member, size, sc->metadata, isize, &error);
+    if (len < 0)
+        return gem_parse_metadata_entry(ctx, 0, fd, offset, size);
+    if (st) {
+        gem_stats_add(st, GEM_STAGE_INFLATE, gem_stats_now() - t, len);
+        gem_stats_add(st, GEM_STAGE_IO, io, size);
+    }
 
+    if (ctx->gem_yaml_metadata_callback)
+        ctx->gem_yaml_metadata_callback(ctx->data, (const char *) sc->metadata, len);
+    if (st)
+        t = gem_stats_now();
+    ret = gem_parse_yaml(ctx, sc->metadata, len, 0);
+    if (st) {
+        gem_stats_add(st, GEM_STAGE_YAML, gem_stats_now() - t, len);
+        if (ret != 0)
+            gem_stats_error(st, GEM_STAGE_YAML);
+    }
     if (ret != 0) {
         gem_parse_error(ctx, "Error parsing YAML document");
+        return -1;
     }
-    // start new gem callback
     if (ctx->gem_end_callback)
         ctx->gem_end_callback(ctx->data);
+    return 0;
+}
 
-    return ret;
+/* where the gem is in the repository, see ParseContext.location_base */
+const char *gem_parse_location(ParseContext *ctx, const char *rubygem)
+{
+    const char *base = ctx->location_base;
+    const char *p;
+    size_t l;
+
+    if (base && (l = strlen(base)) != 0 && !strncmp(rubygem, base, l) && (base[l - 1] == '/' || rubygem[l] == '/')) {
+        for (p = rubygem + l; *p == '/'; p++)
+            ;
+        if (*p)
+            return p;
+    }
+    p = strrchr(rubygem, '/');
+    return p ? p + 1 : rubygem;
 }
 
+/*
+ * sha256 and size of the whole gem, in one sequential read. This comes
+ * before the tar headers and metadata.gz are read, which then are in
+ * the page cache, so the disk reads every byte of the gem only once.
+ */
+static int gem_parse_checksum(ParseContext *ctx, int fd, const char *rubygem)
+{
+    GemScratch *sc = gem_scratch(ctx);
+    unsigned char sum[GEM_SHA256_LEN];
+    char hex[2 * GEM_SHA256_LEN + 1];
+    unsigned long long size = 0;
+    double t = 0, t2, io = 0, hash = 0;
+    ssize_t r;
+
+    if (!sc->filebuf)
+        sc->filebuf = malloc(CHECKSUM_BLOCK_SIZE);
+    if (!sc->sha256)
+        sc->sha256 = gem_sha256_new();
+    if (!sc->filebuf || !sc->sha256 || gem_sha256_init(sc->sha256)) {
+        gem_parse_error(ctx, "Error reading gem file %s: can't set up the checksum", rubygem);
+        return -1;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    for (;;) {
+        if (ctx->stats)
+            t = gem_stats_now();
+        r = pread(fd, sc->filebuf, CHECKSUM_BLOCK_SIZE, size);
+        if (ctx->stats) {
+            t2 = gem_stats_now();
+            io += t2 - t;
+            t = t2;
+        }
+        if (r <= 0)
+            break;
+        gem_sha256_update(sc->sha256, sc->filebuf, r);
+        size += r;
+        if (ctx->stats)
+            hash += gem_stats_now() - t;
+    }
+    if (r < 0) {
+        gem_parse_error(ctx, "Error reading gem file %s: %s", rubygem, strerror(errno));
+        if (ctx->stats)
+            gem_stats_error(ctx->stats, GEM_STAGE_IO);
+        return -1;
+    }
+    gem_sha256_final(sc->sha256, sum);
+    if (ctx->stats) {
+        gem_stats_add(ctx->stats, GEM_STAGE_IO, io, size);
+        gem_stats_add(ctx->stats, GEM_STAGE_CHECKSUM, hash, size);
+    }
+    solv_bin2hex(sum, GEM_SHA256_LEN, hex);
+    ctx->gem_checksum_callback(ctx->data, hex, size);
+    return 0;
+}
 
-int gem_parse_add_rubygem(ParseContext *ctx, const char *rubygem)
+/*
+ * The installed size, estimated as the uncompressed size of
+ * data.tar.gz: the files plus their tar headers. It is in the gzip
+ * trailer (modulo 2^32), so it takes a read of a few bytes instead of
+ * inflating the payload.
+ */
+static void gem_parse_installsize(ParseContext *ctx, int fd, off_t offset, off_t size)
+{
+    unsigned char magic[2], trailer[4];
+
+    if (size < 18 || pread(fd, magic, 2, offset) != 2 || magic[0] != 0x1f || magic[1] != 0x8b)
+        return;
+    if (pread(fd, trailer, 4, offset + size - 4) != 4)
+        return;
+    ctx->gem_installsize_callback(ctx->data, trailer[0] | trailer[1] << 8 | trailer[2] << 16 | (unsigned int) trailer[3] << 24);
+}
+
+int gem_parse_rubygem(ParseContext *ctx, const char *rubygem)
 {
     struct archive *a;
     struct archive_entry *entry;
-    int ret;
+    GemTarMember members[2];
+    int fd, ret, found = 0;
+    double t = 0;
 
     // start new gem callback
     if (ctx->gem_start_callback)
         ctx->gem_start_callback(ctx->data, rubygem);
-
+    if (ctx->gem_location_callback)
+        ctx->gem_location_callback(ctx->data, gem_parse_location(ctx, rubygem));
+
+    if (ctx->stats)
+        t = gem_stats_now();
+    /* the usual .gem is a plain ustar archive, go straight to metadata.gz */
+    if ((fd = open(rubygem, O_RDONLY)) < 0) {
+        gem_parse_error(ctx, "Error reading gem file %s: %s", rubygem, strerror(errno));
+        if (ctx->stats)
+            gem_stats_error(ctx->stats, GEM_STAGE_IO);
+        return -1;
+    }
+    if (ctx->gem_checksum_callback) {
+        if (gem_parse_checksum(ctx, fd, rubygem)) {
+            close(fd);
+            return -1;
+        }
+        if (ctx->stats)
+            t = gem_stats_now();
+    }
+    /* data.tar.gz only for its size, its header usually is the next */
+    members[0].name = "metadata.gz";
+    members[1].name = "data.tar.gz";
+    ret = gem_tar_find_members(fd, members, ctx->gem_installsize_callback ? 2 : 1);
+    if (members[0].offset >= 0)
+        ret = 1;
+    else if (ret > 0)
+        ret = 0;
+    if (ctx->stats) {
+        gem_stats_add(ctx->stats, GEM_STAGE_TAR, gem_stats_now() - t, ret == 1 ? members[0].offset : 0);
+        if (ret == 0)
+            gem_stats_error(ctx->stats, GEM_STAGE_TAR);
+    }
+    if (ret == 1 && ctx->gem_installsize_callback && members[1].offset >= 0)
+        gem_parse_installsize(ctx, fd, members[1].offset, members[1].size);
+    if (ret == 1)
+        ret = gem_parse_metadata_member(ctx, fd, members[0].offset, members[0].size);
+    else if (ret == 0) {
+        gem_parse_error(ctx, "Error reading gem file %s: no metadata.gz", rubygem);
+        ret = -1;
+    }
+    else
+        ret = 1;
+    close(fd);
+    if (ret != 1)
+        return ret;
+
+    /* anything else (compressed, other tar dialects) goes to libarchive */
+    if (ctx->stats)
+        t = gem_stats_now();
     a = archive_read_new();
     archive_read_support_compression_gzip(a);
     archive_read_support_format_tar(a);
@@ -385,12 +1208,20 @@ int gem_parse_add_rubygem(ParseContext *ctx, const char *rubygem)
 
     ret = -1;
     while (archive_read_next_header(a, &entry) == ARCHIVE_OK) {
-        if (!strcmp(archive_entry_pathname(entry), "metadata.gz"))
-            ret = gem_parse_metadata_entry(ctx, a, entry);
-        else
-          archive_read_data_skip(a);
+        if (!strcmp(archive_entry_pathname(entry), "metadata.gz")) {
+            found = 1;
+            if (ctx->stats)
+                gem_stats_add(ctx->stats, GEM_STAGE_TAR, gem_stats_now() - t, 0);
+            ret = gem_parse_metadata_entry(ctx, a, -1, 0, 0);
+            break;
+        }
+        archive_read_data_skip(a);
     }
 out:
+    if (ctx->stats && !found) {
+        gem_stats_add(ctx->stats, GEM_STAGE_TAR, gem_stats_now() - t, 0);
+        gem_stats_error(ctx->stats, GEM_STAGE_TAR);
+    }
     if (ret != 0) {
       gem_parse_error(ctx, "Error reading gem file %s: %s", rubygem, archive_error_string(a));
     }
@@ -401,41 +1232,185 @@ out:
     return ret;
 }
 
-int gem_parse_add_rubygem_dir(ParseContext *ctx, const char *dir)
+/*
+ * parses a gem into a record and replays that: through the cache,
+ * replaying the cached record if the gem is unchanged, and with stats,
+ * to tell the time of the parser from that of the callbacks.
+ */
+static int gem_parse_rubygem_recorded(ParseContext *ctx, const char *rubygem)
+{
+    ParseContext rctx;
+    GemRecord *rec = &gem_scratch(ctx)->rec;
+    GemCacheKey key;
+    GemStats gem;
+    int ret, cacheable, hit = 0;
+    double t = 0;
+
+    /* the cache does not keep the raw metadata */
+    cacheable = ctx->cache && !ctx->gem_yaml_metadata_callback && !gem_cache_key(ctx->cache, rubygem, &key);
+
+    gem_record_reset(rec);
+    gem_stats_init(&gem);
+    if (cacheable)
+        hit = gem_cache_fetch(ctx->cache, rubygem, gem_parse_location(ctx, rubygem), &key, rec);
+    if (!hit) {
+        gem_record_context(&rctx, rec, ctx);
+        if (ctx->stats)
+            rctx.stats = &gem;
+        /* lend our scratch, the record is not part of what it uses */
+        rctx.scratch = ctx->scratch;
+        rec->ret = gem_parse_rubygem(&rctx, rubygem);
+        ctx->scratch = rctx.scratch;
+        rctx.scratch = 0;
+        gem_parse_context_free(&rctx);
+    }
+    else
+        gem.cache_hits = 1;
+
+    if (ctx->stats)
+        t = gem_stats_now();
+    ret = gem_record_replay(rec, ctx);
+    if (ctx->stats) {
+        gem_stats_add(&gem, GEM_STAGE_CALLBACKS, gem_stats_now() - t, 0);
+        gem_stats_merge(ctx->stats, &gem);
+        gem_stats_gem_done(ctx->stats, rubygem, gem_stats_time(&gem), ret);
+    }
+    if (ret == 0 && cacheable)
+        gem_cache_store(ctx->cache, rubygem, gem_parse_location(ctx, rubygem), &key, rec);
+    return ret;
+}
+
+int gem_parse_add_rubygem(ParseContext *ctx, const char *rubygem)
 {
-    glob_t data;
-    struct joindata jd;
-    memset(&jd, 0, sizeof(jd));
-    int ret = 0;
+    if (ctx->cache || ctx->stats)
+        return gem_parse_rubygem_recorded(ctx, rubygem);
+    return gem_parse_rubygem(ctx, rubygem);
+}
 
-    switch( glob(join2(&jd, dir, "/", "*.gem"), 0, NULL, &data))
-    {
-        case 0:
-            break;
-        case GLOB_NOSPACE:
-            gem_parse_error(ctx, "out of memory");
-            return -1;
-        case GLOB_ABORTED:
-            gem_parse_error(ctx, "reading error");
-            return -1;
-        case GLOB_NOMATCH:
-            gem_parse_error(ctx, "no files found");
-            return -1;
-        default:
-            break;
+/* parses the paths of a walk while it goes on */
+static int gem_parse_walk(ParseContext *ctx, GemWalk *walk, int needgems)
+{
+    GemPathSource src, ahead;
+    GemPrefetch *pf = 0;
+    const char *msg;
+    int i, ret;
+
+    gem_walk_source(walk, &src);
+    /* cached gems are not read at all */
+    if (ctx->prefetch > 0 && !ctx->cache)
+        pf = gem_prefetch_new(&src, ctx->prefetch, ctx->gem_checksum_callback != 0, &ahead);
+    ret = gem_parse_source(ctx, pf ? &ahead : &src);
+    if (pf)
+        gem_prefetch_free(pf);
+    for (i = 0; (msg = gem_walk_error(walk, i)) != 0; i++) {
+        gem_parse_error(ctx, "%s", msg);
+        ret = -1;
+    }
+    if (needgems && !gem_walk_count(walk)) {
+        gem_parse_error(ctx, "no files found");
+        ret = -1;
     }
+    gem_walk_free(walk);
+    return ret;
+}
 
-    int i;
-    for(i=0; i<data.gl_pathc; i++)
-    {
-        if (gem_parse_add_rubygem(ctx, data.gl_pathv[i]) != 0)
-          ret = -1;
+int gem_parse_add_rubygem_dir(ParseContext *ctx, const char *dir)
+{
+    const char *base = ctx->location_base;
+    int ret;
+
+    ctx->location_base = dir;
+    ret = gem_parse_walk(ctx, gem_walk_dir(dir, ctx->jobs), 1);
+    ctx->location_base = base;
+    return ret;
+}
+
+int gem_parse_add_rubygem_list(ParseContext *ctx, FILE *fp)
+{
+    return gem_parse_walk(ctx, gem_walk_list(fp, ctx->list_nul ? 0 : '\n'), 0);
+}
+
+/* a gem of a corpus: what gem_parse_rubygem does once it has the
+   metadata inflated */
+static int gem_parse_corpus_entry(ParseContext *ctx, const char *location, const char *metadata, int len)
+{
+    double t = 0;
+    int ret;
+
+    if (ctx->gem_start_callback)
+        ctx->gem_start_callback(ctx->data, location);
+    if (ctx->gem_location_callback)
+        ctx->gem_location_callback(ctx->data, location);
+    if (ctx->gem_yaml_metadata_callback)
+        ctx->gem_yaml_metadata_callback(ctx->data, metadata, len);
+    if (ctx->stats)
+        t = gem_stats_now();
+    ret = gem_parse_yaml(ctx, (const unsigned char *) metadata, len, 0);
+    if (ctx->stats) {
+        gem_stats_add(ctx->stats, GEM_STAGE_YAML, gem_stats_now() - t, len);
+        if (ret != 0)
+            gem_stats_error(ctx->stats, GEM_STAGE_YAML);
     }
+    if (ret != 0) {
+        gem_parse_error(ctx, "Error parsing YAML document of %s", location);
+        return -1;
+    }
+    if (ctx->gem_end_callback)
+        ctx->gem_end_callback(ctx->data);
+    return 0;
+}
 
-    globfree( &data );
+/* with stats the gem is recorded first, so that the YAML parser and
+   the callbacks of the tool are timed apart */
+static int gem_parse_corpus_entry_recorded(ParseContext *ctx, const char *location, const char *metadata, int len)
+{
+    ParseContext rctx;
+    GemRecord *rec = &gem_scratch(ctx)->rec;
+    GemStats gem;
+    int ret;
+    double t;
+
+    gem_record_reset(rec);
+    gem_stats_init(&gem);
+    gem_record_context(&rctx, rec, ctx);
+    rctx.stats = &gem;
+    rctx.scratch = ctx->scratch;
+    rec->ret = gem_parse_corpus_entry(&rctx, location, metadata, len);
+    ctx->scratch = rctx.scratch;
+    rctx.scratch = 0;
+    gem_parse_context_free(&rctx);
+
+    t = gem_stats_now();
+    ret = gem_record_replay(rec, ctx);
+    gem_stats_add(&gem, GEM_STAGE_CALLBACKS, gem_stats_now() - t, 0);
+    gem_stats_merge(ctx->stats, &gem);
+    gem_stats_gem_done(ctx->stats, location, gem_stats_time(&gem), ret);
     return ret;
 }
 
+int gem_parse_add_corpus(ParseContext *ctx, const char *filename)
+{
+    GemCorpus *corpus;
+    const char *location, *metadata;
+    int i, len, ret = 0;
+
+    if (!(corpus = gem_corpus_open(filename))) {
+        gem_parse_error(ctx, "Error reading %s: %s", filename, errno == EINVAL ? "not a metadata corpus" : strerror(errno));
+        return -1;
+    }
+    /* always on the calling thread and in corpus order: a replay is
+       there to profile the YAML parser and the callbacks */
+    for (i = 0; i < gem_corpus_count(corpus); i++) {
+        location = gem_corpus_entry(corpus, i, &metadata, &len);
+        if (ctx->stats)
+            ret |= gem_parse_corpus_entry_recorded(ctx, location, metadata, len);
+        else
+            ret |= gem_parse_corpus_entry(ctx, location, metadata, len);
+    }
+    gem_corpus_close(corpus);
+    return ret ? -1 : 0;
+}
+
 void gem_parse_context_initialize(ParseContext *ctx)
 {
     memset(ctx, 0, sizeof(ParseContext));
@@ -444,6 +1419,8 @@ void gem_parse_context_initialize(ParseContext *ctx)
 void gem_parse_context_free(ParseContext *ctx)
 {
     join_freemem(&ctx->jd);
+    gem_scratch_free(ctx->scratch);
+    ctx->scratch = 0;
 }
 
 int gem_parse(ParseContext *ctx, int argc, char **locations)
@@ -457,11 +1434,30 @@ int gem_parse(ParseContext *ctx, int argc, char **locations)
 
     int i;
     for (i = 0; i < argc; ++i) {
+        if (!strcmp(locations[i], "-")) {
+          ret = gem_parse_add_rubygem_list(ctx, stdin);
+          if (ret != 0) {
+            gem_parse_error(ctx, "Error parsing the gems listed on stdin");
+          }
+          continue;
+        }
         status = stat (locations[i], &st_buf);
         if (status != 0) {
             printf ("Error, errno = %d\n", errno);
             return 1;
         }
+        else if (S_ISREG (st_buf.st_mode) && gem_is_corpus(locations[i])) {
+          ret = gem_parse_add_corpus(ctx, locations[i]);
+          if (ret != 0) {
+            gem_parse_error(ctx, "Error parsing %s", locations[i]);
+          }
+        }
+        else if (S_ISREG (st_buf.st_mode) && gem_is_marshal_index(locations[i])) {
+          ret = gem_parse_add_marshal_index(ctx, locations[i]);
+          if (ret != 0) {
+            gem_parse_error(ctx, "Error parsing %s", locations[i]);
+          }
+        }
         else if (S_ISREG (st_buf.st_mode)) {
           ret = gem_parse_add_rubygem(ctx, locations[i]);
           if (ret != 0) {
@@ -476,7 +1472,7 @@ int gem_parse(ParseContext *ctx, int argc, char **locations)
         }
     }
 
-    if (ctx->gem_end_callback)
+    if (ctx->gem_parse_end_callback)
         ctx->gem_parse_end_callback(ctx->data);
 
     return 0;
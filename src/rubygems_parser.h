@@ -10,10 +10,34 @@
 #include <stdlib.h>
 #include "tools_util.h"
 
+typedef struct GemCache GemCache;
+typedef struct GemStats GemStats;
+typedef struct GemScratch GemScratch;
+
 typedef struct
 {
-    yaml_document_t *doc;
+    /* scratch buffer for the callbacks, the parser does not touch it */
     struct joindata jd;
+    /* number of parser threads, <= 1 parses on the calling thread */
+    int jobs;
+    /* cache of already parsed gems, optional */
+    GemCache *cache;
+    /* timing and counters of the parser stages, optional (gem_stats.h) */
+    GemStats *stats;
+    /* buffers and streams the parser reuses from gem to gem, set up on
+       first use and freed with the context */
+    GemScratch *scratch;
+    /* number of gems read ahead of the parser from directories and
+       lists, on a cold cache that overlaps reading and parsing; 0 for
+       none */
+    int prefetch;
+    /* the gem paths read from stdin for "-" are separated by NULs,
+       not newlines */
+    int list_nul;
+    /* the locations of the gems are their paths relative to this
+       directory, gems outside of it are located by their file name.
+       Set while a directory is parsed */
+    const char *location_base;
 
     /* start of all parsing */
     int (*gem_parse_start_callback)(void *user_data);
@@ -26,6 +50,15 @@ typedef struct
     int (*gem_deps_start_callback)(void *user_data);
     int (*gem_dep_callback)(void *user_data, const char *name, const char *op, const char *version);
     int (*gem_deps_end_callback)(void *user_data);
+    /* location of the gem relative to the repository */
+    int (*gem_location_callback)(void *user_data, const char *location);
+    /* sha256 (in hex) and size of the .gem file. Only if set the whole
+       file is read, not just up to metadata.gz, and never for gems
+       from indexes */
+    int (*gem_checksum_callback)(void *user_data, const char *sha256, unsigned long long size);
+    /* estimated installed size: the uncompressed size of data.tar.gz,
+       from its gzip trailer. Only for gems that are plain tar archives */
+    int (*gem_installsize_callback)(void *user_data, unsigned long long size);
     int (*gem_end_callback)(void *user_data);
     int (*gem_parse_end_callback)(void *user_data);
     void (*gem_parse_error_callback)(void *user_data, const char *msg);
@@ -34,7 +67,25 @@ typedef struct
 } ParseContext;
 
 void gem_parse_context_initialize(ParseContext *ctx);
+void gem_parse_context_free(ParseContext *ctx);
 int gem_parse(ParseContext *ctx, int argc, char **locations);
+int gem_parse_add_rubygem(ParseContext *ctx, const char *rubygem);
+/* all gems below dir, see gem_walk.h */
+int gem_parse_add_rubygem_dir(ParseContext *ctx, const char *dir);
+/* the gems whose paths are read from fp */
+int gem_parse_add_rubygem_list(ParseContext *ctx, FILE *fp);
+/* reports the attributes and dependencies of an inflated metadata
+   document, without the start and end callbacks of a gem */
+int gem_parse_add_metadata(ParseContext *ctx, const char *metadata, int len);
+/* replays a metadata corpus (gem_corpus.h): the metadata of every gem
+   in it goes through the YAML parser and the callbacks, on the calling
+   thread, without any gem being read */
+int gem_parse_add_corpus(ParseContext *ctx, const char *filename);
+int gem_parse_default_jobs(void);
+/* the prefetch the tools use unless told otherwise */
+#define GEM_PARSE_PREFETCH 64
+/* for contexts that pass their scratch on, see gem_parse_context_free */
+void gem_scratch_free(GemScratch *scratch);
 
 
 #endif
@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) 2012, Novell Inc.
+ *
+ * This program is licensed under the BSD license, read LICENSE.BSD
+ * for further information
+ *
+ * test_gem_version: checks gem_version against RubyGems.
+ *
+ * The tables below are what RubyGems 3.5.3 says about a set of versions
+ * (Gem::Version.correct?, #prerelease?, #bump, #<=>) and requirements
+ * (Gem::Requirement#satisfied_by? of every op); any difference is
+ * printed and makes the test fail.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "gem_version.h"
+
+/* Gem::Version.correct?, #prerelease? and #bump */
+typedef struct VersionCase
+{
+    const char *version;
+    int valid;
+    int prerelease;
+    const char *bump;
+} VersionCase;
+
+/* Gem::Requirement.new("op version").satisfied_by? of each of rs */
+typedef struct MatchCase
+{
+    const char *op;
+    const char *version;
+    const char *match;
+} MatchCase;
+
+/* the versions compared and used in requirements, cmp[i][j] is
+   rs[i] <=> rs[j] as "<", "=" or ">" */
+static const char *rs[] = {
+    "0", "1", "1.0", "1.0.0", "1.0.1", "1.1", "1.9.9", "1.10", "2", "2.0.0.rc1",
+    "1.0.0.rc1", "1.0.0-rc2", "1.0.0.a", "1.0.a", "1.1.a", "1.0.0.0.1", "01.1",
+};
+
+#define NRS ((int) (sizeof(rs) / sizeof(*rs)))
+
+static const VersionCase versions[] = {
+    { "0", 1, 0, "1" },
+    { "", 1, 0, "1" },
+    { " 1.0 ", 1, 0, "2" },
+    { "1", 1, 0, "2" },
+    { "2", 1, 0, "3" },
+    { "1.0", 1, 0, "2" },
+    { "1.0.0", 1, 0, "1.1" },
+    { "1.00", 1, 0, "2" },
+    { "1.01.5", 1, 0, "1.2" },
+    { "1.2.3", 1, 0, "1.3" },
+    { "1.9.9", 1, 0, "1.10" },
+    { "9", 1, 0, "10" },
+    { "99.9", 1, 0, "100" },
+    { "1.0.0.rc1", 1, 1, "1.1" },
+    { "1.0.0.RC1", 1, 1, "1.1" },
+    { "1.0.0.pre", 1, 1, "1.1" },
+    { "1.0.0.a.0", 1, 1, "1.1" },
+    { "1.0.0-rc1", 1, 1, "1.1" },
+    { "1.0.0-beta.2", 1, 1, "1.1" },
+    { "1.0.a.0.b", 1, 1, "2" },
+    { "1.0.a10", 1, 1, "2" },
+    { "2.0.0.alpha", 1, 1, "2.1" },
+    { "3.2.22.5", 1, 0, "3.2.23" },
+    { "0.0.1", 1, 0, "0.1" },
+    { "1.10", 1, 0, "2" },
+    { "007", 1, 0, "8" },
+    { "1.0a", 1, 1, "2" },
+    { "1.0--x", 1, 1, "2" },
+    { "1..0", 0, 0, 0 },
+    { "1.0-", 0, 0, 0 },
+    { "a1", 0, 0, 0 },
+    { "-1", 0, 0, 0 },
+    { "1.0 2", 0, 0, 0 },
+    { "1_0", 0, 0, 0 },
+};
+static const char *cmp[] = {
+    "=<<<<<<<<<<<<<<<<",
+    ">===<<<<<<>>>><<<",
+    ">===<<<<<<>>>><<<",
+    ">===<<<<<<>>>><<<",
+    ">>>>=<<<<<>>>><><",
+    ">>>>>=<<<<>>>>>>=",
+    ">>>>>>=<<<>>>>>>>",
+    ">>>>>>>=<<>>>>>>>",
+    ">>>>>>>>=>>>>>>>>",
+    ">>>>>>>><=>>>>>>>",
+    "><<<<<<<<<=>>><<<",
+    "><<<<<<<<<<=>><<<",
+    "><<<<<<<<<<<==<<<",
+    "><<<<<<<<<<<==<<<",
+    ">>>>><<<<<>>>>=><",
+    ">>>><<<<<<>>>><=<",
+    ">>>>>=<<<<>>>>>>=",
+};
+static const MatchCase matches[] = {
+    { "=", "0", "10000000000000000" },
+    { "=", "1", "01110000000000000" },
+    { "=", "1.0", "01110000000000000" },
+    { "=", "1.0.0", "01110000000000000" },
+    { "=", "1.0.1", "00001000000000000" },
+    { "=", "1.1", "00000100000000001" },
+    { "=", "1.9.9", "00000010000000000" },
+    { "=", "1.10", "00000001000000000" },
+    { "=", "2", "00000000100000000" },
+    { "=", "2.0.0.rc1", "00000000010000000" },
+    { "=", "1.0.0.rc1", "00000000001000000" },
+    { "=", "1.0.0-rc2", "00000000000100000" },
+    { "=", "1.0.0.a", "00000000000011000" },
+    { "=", "1.0.a", "00000000000011000" },
+    { "=", "1.1.a", "00000000000000100" },
+    { "=", "1.0.0.0.1", "00000000000000010" },
+    { "=", "01.1", "00000100000000001" },
+    { "!=", "0", "01111111111111111" },
+    { "!=", "1", "10001111111111111" },
+    { "!=", "1.0", "10001111111111111" },
+    { "!=", "1.0.0", "10001111111111111" },
+    { "!=", "1.0.1", "11110111111111111" },
+    { "!=", "1.1", "11111011111111110" },
+    { "!=", "1.9.9", "11111101111111111" },
+    { "!=", "1.10", "11111110111111111" },
+    { "!=", "2", "11111111011111111" },
+    { "!=", "2.0.0.rc1", "11111111101111111" },
+    { "!=", "1.0.0.rc1", "11111111110111111" },
+    { "!=", "1.0.0-rc2", "11111111111011111" },
+    { "!=", "1.0.0.a", "11111111111100111" },
+    { "!=", "1.0.a", "11111111111100111" },
+    { "!=", "1.1.a", "11111111111111011" },
+    { "!=", "1.0.0.0.1", "11111111111111101" },
+    { "!=", "01.1", "11111011111111110" },
+    { ">", "0", "01111111111111111" },
+    { ">", "1", "00001111110000111" },
+    { ">", "1.0", "00001111110000111" },
+    { ">", "1.0.0", "00001111110000111" },
+    { ">", "1.0.1", "00000111110000101" },
+    { ">", "1.1", "00000011110000000" },
+    { ">", "1.9.9", "00000001110000000" },
+    { ">", "1.10", "00000000110000000" },
+    { ">", "2", "00000000000000000" },
+    { ">", "2.0.0.rc1", "00000000100000000" },
+    { ">", "1.0.0.rc1", "01111111110000111" },
+    { ">", "1.0.0-rc2", "01111111111000111" },
+    { ">", "1.0.0.a", "01111111111100111" },
+    { ">", "1.0.a", "01111111111100111" },
+    { ">", "1.1.a", "00000111110000001" },
+    { ">", "1.0.0.0.1", "00001111110000101" },
+    { ">", "01.1", "00000011110000000" },
+    { "<", "0", "00000000000000000" },
+    { "<", "1", "10000000001111000" },
+    { "<", "1.0", "10000000001111000" },
+    { "<", "1.0.0", "10000000001111000" },
+    { "<", "1.0.1", "11110000001111010" },
+    { "<", "1.1", "11111000001111110" },
+    { "<", "1.9.9", "11111100001111111" },
+    { "<", "1.10", "11111110001111111" },
+    { "<", "2", "11111111011111111" },
+    { "<", "2.0.0.rc1", "11111111001111111" },
+    { "<", "1.0.0.rc1", "10000000000111000" },
+    { "<", "1.0.0-rc2", "10000000000011000" },
+    { "<", "1.0.0.a", "10000000000000000" },
+    { "<", "1.0.a", "10000000000000000" },
+    { "<", "1.1.a", "11111000001111010" },
+    { "<", "1.0.0.0.1", "11110000001111000" },
+    { "<", "01.1", "11111000001111110" },
+    { ">=", "0", "11111111111111111" },
+    { ">=", "1", "01111111110000111" },
+    { ">=", "1.0", "01111111110000111" },
+    { ">=", "1.0.0", "01111111110000111" },
+    { ">=", "1.0.1", "00001111110000101" },
+    { ">=", "1.1", "00000111110000001" },
+    { ">=", "1.9.9", "00000011110000000" },
+    { ">=", "1.10", "00000001110000000" },
+    { ">=", "2", "00000000100000000" },
+    { ">=", "2.0.0.rc1", "00000000110000000" },
+    { ">=", "1.0.0.rc1", "01111111111000111" },
+    { ">=", "1.0.0-rc2", "01111111111100111" },
+    { ">=", "1.0.0.a", "01111111111111111" },
+    { ">=", "1.0.a", "01111111111111111" },
+    { ">=", "1.1.a", "00000111110000101" },
+    { ">=", "1.0.0.0.1", "00001111110000111" },
+    { ">=", "01.1", "00000111110000001" },
+    { "<=", "0", "10000000000000000" },
+    { "<=", "1", "11110000001111000" },
+    { "<=", "1.0", "11110000001111000" },
+    { "<=", "1.0.0", "11110000001111000" },
+    { "<=", "1.0.1", "11111000001111010" },
+    { "<=", "1.1", "11111100001111111" },
+    { "<=", "1.9.9", "11111110001111111" },
+    { "<=", "1.10", "11111111001111111" },
+    { "<=", "2", "11111111111111111" },
+    { "<=", "2.0.0.rc1", "11111111011111111" },
+    { "<=", "1.0.0.rc1", "10000000001111000" },
+    { "<=", "1.0.0-rc2", "10000000000111000" },
+    { "<=", "1.0.0.a", "10000000000011000" },
+    { "<=", "1.0.a", "10000000000011000" },
+    { "<=", "1.1.a", "11111000001111110" },
+    { "<=", "1.0.0.0.1", "11110000001111010" },
+    { "<=", "01.1", "11111100001111111" },
+    { "~>", "0", "10000000000000000" },
+    { "~>", "1", "01111111000000111" },
+    { "~>", "1.0", "01111111000000111" },
+    { "~>", "1.0.0", "01111000000000010" },
+    { "~>", "1.0.1", "00001000000000000" },
+    { "~>", "1.1", "00000111000000001" },
+    { "~>", "1.9.9", "00000010000000000" },
+    { "~>", "1.10", "00000001000000000" },
+    { "~>", "2", "00000000100000000" },
+    { "~>", "2.0.0.rc1", "00000000110000000" },
+    { "~>", "1.0.0.rc1", "01111000001000010" },
+    { "~>", "1.0.0-rc2", "01111000001100010" },
+    { "~>", "1.0.0.a", "01111000001111010" },
+    { "~>", "1.0.a", "01111111001111111" },
+    { "~>", "1.1.a", "00000111000000101" },
+    { "~>", "1.0.0.0.1", "00000000000000010" },
+    { "~>", "01.1", "00000111000000001" },
+};
+
+#define NVERSIONS ((int) (sizeof(versions) / sizeof(*versions)))
+#define NMATCHES ((int) (sizeof(matches) / sizeof(*matches)))
+
+static int check_versions(void)
+{
+    GemVersion v;
+    char bump[GEM_VERSION_BUMP_SIZE];
+    int i, bad = 0;
+
+    for (i = 0; i < NVERSIONS; i++) {
+        const VersionCase *vc = versions + i;
+        int valid = !gem_version_parse(&v, vc->version);
+
+        if (valid != vc->valid) {
+            printf("\"%s\": valid %d, RubyGems %d\n", vc->version, valid, vc->valid);
+            bad++;
+            continue;
+        }
+        if (!valid)
+            continue;
+        if (gem_version_prerelease(&v) != vc->prerelease) {
+            printf("\"%s\": prerelease %d, RubyGems %d\n", vc->version, !vc->prerelease, vc->prerelease);
+            bad++;
+        }
+        if (gem_version_bump(&v, bump, sizeof(bump)) < 0 || strcmp(bump, vc->bump)) {
+            printf("\"%s\": bump %s, RubyGems %s\n", vc->version, bump, vc->bump);
+            bad++;
+        }
+    }
+    return bad;
+}
+
+static int check_requirements(void)
+{
+    GemVersion a, b;
+    int i, j, c, m, bad = 0;
+
+    for (i = 0; i < NRS; i++) {
+        gem_version_parse(&a, rs[i]);
+        for (j = 0; j < NRS; j++) {
+            gem_version_parse(&b, rs[j]);
+            c = gem_version_cmp(&a, &b);
+            if ("<=>"[c + 1] != cmp[i][j]) {
+                printf("%s <=> %s: %d, RubyGems %d\n", rs[i], rs[j], c, cmp[i][j] == '<' ? -1 : cmp[i][j] == '>');
+                bad++;
+            }
+        }
+    }
+    for (i = 0; i < NMATCHES; i++) {
+        gem_version_parse(&a, matches[i].version);
+        for (j = 0; j < NRS; j++) {
+            gem_version_parse(&b, rs[j]);
+            m = gem_requirement_match(matches[i].op, &a, &b);
+            if (m != matches[i].match[j] - '0') {
+                printf("%s %s for %s: %d, RubyGems %c\n", matches[i].op, matches[i].version, rs[j], m, matches[i].match[j]);
+                bad++;
+            }
+        }
+    }
+    return bad;
+}
+
+int main(void)
+{
+    int bad;
+
+    bad = check_versions() + check_requirements();
+    printf("%d versions, %d comparisons, %d requirements checked against RubyGems: %d differences\n",
+           NVERSIONS, NRS * NRS, NMATCHES * NRS, bad);
+    return bad ? 1 : 0;
+}